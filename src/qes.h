@@ -28,5 +28,22 @@
 #include <qes_str.h>
 #include <qes_util.h>
 #include <qes_file.h>
+#include <qes_hash.h>
+#include <qes_seqindex.h>
+#include <qes_arena.h>
+#include <qes_seqpool.h>
+#include <qes_seqbatch.h>
+#include <qes_pairedfile.h>
+#include <qes_seqstats.h>
+#include <qes_trim.h>
+#include <qes_demux.h>
+#include <qes_dedup.h>
+#include <qes_sort.h>
+#include <qes_sample.h>
+#include <qes_nameset.h>
+#include <qes_illumina.h>
+#include <qes_qual.h>
+#include <qes_binseq.h>
+#include <qes_merge.h>
 
 #endif /* LIBQES_H */
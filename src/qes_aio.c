@@ -0,0 +1,516 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_aio.c
+ *
+ *    Description:  Read-ahead and write-behind file IO, with io_uring
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 19:02:17
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_aio.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef IO_URING_FOUND
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+/*
+ * The io_uring, through raw syscalls so we don't need liburing. We only ever
+ * have ``depth`` requests in flight, so the rings can't overflow.
+ */
+
+#ifdef IO_URING_FOUND
+static int
+aio_ring_setup (struct qes_aio *aio)
+{
+    struct io_uring_params params;
+    unsigned char *sq = NULL;
+    unsigned char *cq = NULL;
+    int fd = -1;
+
+    memset(&params, 0, sizeof(params));
+    fd = syscall(__NR_io_uring_setup, aio->depth, &params);
+    if (fd < 0) {
+        /* No io_uring (old kernel, or forbidden by seccomp) */
+        return 1;
+    }
+    aio->sq_ring_len = params.sq_off.array +
+                       params.sq_entries * sizeof(unsigned);
+    aio->cq_ring_len = params.cq_off.cqes +
+                       params.cq_entries * sizeof(struct io_uring_cqe);
+    aio->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sq_ring = mmap(NULL, aio->sq_ring_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    aio->cq_ring = mmap(NULL, aio->cq_ring_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    aio->sqes = mmap(NULL, aio->sqes_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    aio->iovs = qes_calloc_errnil(aio->depth, sizeof(struct iovec));
+    if (aio->sq_ring == MAP_FAILED || aio->cq_ring == MAP_FAILED ||
+            aio->sqes == MAP_FAILED || aio->iovs == NULL) {
+        if (aio->sq_ring != MAP_FAILED) munmap(aio->sq_ring, aio->sq_ring_len);
+        if (aio->cq_ring != MAP_FAILED) munmap(aio->cq_ring, aio->cq_ring_len);
+        if (aio->sqes != MAP_FAILED) munmap(aio->sqes, aio->sqes_len);
+        qes_free(aio->iovs);
+        close(fd);
+        return 1;
+    }
+    sq = aio->sq_ring;
+    cq = aio->cq_ring;
+    aio->sq_head = (unsigned *)(sq + params.sq_off.head);
+    aio->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    aio->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    aio->sq_array = (unsigned *)(sq + params.sq_off.array);
+    aio->cq_head = (unsigned *)(cq + params.cq_off.head);
+    aio->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    aio->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    aio->cqes = cq + params.cq_off.cqes;
+    aio->ring_fd = fd;
+    return 0;
+}
+
+static void
+aio_ring_free (struct qes_aio *aio)
+{
+    munmap(aio->sq_ring, aio->sq_ring_len);
+    munmap(aio->cq_ring, aio->cq_ring_len);
+    munmap(aio->sqes, aio->sqes_len);
+    qes_free(aio->iovs);
+    close(aio->ring_fd);
+    aio->ring_fd = -1;
+}
+
+/* Send the rest of slot ``idx``'s request to the kernel. Returns 0 on
+ * success, or 1 on error, with errno set. */
+static int
+aio_ring_submit (struct qes_aio *aio, unsigned idx)
+{
+    struct qes_aio_slot *slot = &aio->slots[idx];
+    struct iovec *iov = (struct iovec *)aio->iovs + idx;
+    struct io_uring_sqe *sqe = NULL;
+    unsigned tail = *aio->sq_tail;
+    unsigned sqidx = tail & *aio->sq_mask;
+    int res = 0;
+
+    iov->iov_base = slot->buf + slot->done;
+    iov->iov_len = slot->len - slot->done;
+    sqe = (struct io_uring_sqe *)aio->sqes + sqidx;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = aio->writing ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = aio->fd;
+    sqe->off = slot->offset + slot->done;
+    sqe->addr = (uintptr_t)iov;
+    sqe->len = 1;
+    sqe->user_data = idx;
+    aio->sq_array[sqidx] = sqidx;
+    /* The kernel only looks at the tail in io_uring_enter, so it must be
+     * published first, and taken back if the entry wasn't consumed */
+    __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    do {
+        res = syscall(__NR_io_uring_enter, aio->ring_fd, 1, 0, 0, NULL, 0);
+    } while (res < 0 && errno == EINTR);
+    if (res < 1) {
+        __atomic_store_n(aio->sq_tail, tail, __ATOMIC_RELEASE);
+        slot->err = res < 0 ? errno : EAGAIN;
+        errno = slot->err;
+        return 1;
+    }
+    slot->busy = 1;
+    aio->inflight++;
+    return 0;
+}
+
+/* Handle one completion, waiting for it if need be. Returns 0 on success, or
+ * 1 on error, with errno set. */
+static int
+aio_ring_reap (struct qes_aio *aio)
+{
+    struct io_uring_cqe *cqe = NULL;
+    struct qes_aio_slot *slot = NULL;
+    unsigned head = *aio->cq_head;
+    int res = 0;
+
+    while (head == __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE)) {
+        res = syscall(__NR_io_uring_enter, aio->ring_fd, 0, 1,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+        if (res < 0 && errno != EINTR) return 1;
+    }
+    cqe = (struct io_uring_cqe *)aio->cqes + (head & *aio->cq_mask);
+    slot = &aio->slots[cqe->user_data];
+    res = cqe->res;
+    __atomic_store_n(aio->cq_head, head + 1, __ATOMIC_RELEASE);
+    slot->busy = 0;
+    aio->inflight--;
+    if (res == -EINTR || res == -EAGAIN) {
+        return aio_ring_submit(aio, slot - aio->slots);
+    } else if (res < 0) {
+        slot->err = -res;
+    } else if (res == 0) {
+        if (aio->writing) {
+            slot->err = EIO;
+        } else {
+            slot->eof = 1;
+        }
+    } else {
+        slot->done += res;
+        /* Short reads and writes are finished off */
+        if (slot->done < slot->len) {
+            return aio_ring_submit(aio, slot - aio->slots);
+        }
+    }
+    return 0;
+}
+#endif
+
+/* Do slot ``idx``'s request now, with plain read or write */
+static void
+aio_sync (struct qes_aio *aio, unsigned idx)
+{
+    struct qes_aio_slot *slot = &aio->slots[idx];
+    ssize_t res = 0;
+
+    while (slot->done < slot->len) {
+        if (aio->writing) {
+            res = write(aio->fd, slot->buf + slot->done,
+                        slot->len - slot->done);
+        } else {
+            res = read(aio->fd, slot->buf + slot->done,
+                       slot->len - slot->done);
+        }
+        if (res < 0 && errno == EINTR) {
+            continue;
+        } else if (res < 0) {
+            slot->err = errno;
+            return;
+        } else if (res == 0) {
+            if (aio->writing) {
+                slot->err = EIO;
+            } else {
+                slot->eof = 1;
+            }
+            return;
+        }
+        slot->done += res;
+        /* A short read, e.g. from a pipe, is fine; we'll get the rest next
+         * time. Writes must be finished. */
+        if (!aio->writing) return;
+    }
+}
+
+/* Ask for slot ``idx`` to be read or written, at the next offset */
+static int
+aio_request (struct qes_aio *aio, unsigned idx, size_t len)
+{
+    struct qes_aio_slot *slot = &aio->slots[idx];
+
+    slot->offset = aio->offset;
+    slot->len = len;
+    slot->done = 0;
+    slot->eof = 0;
+    slot->err = 0;
+    aio->offset += len;
+#ifdef IO_URING_FOUND
+    if (aio->ring_fd >= 0) {
+        return aio_ring_submit(aio, idx);
+    }
+#endif
+    aio_sync(aio, idx);
+    if (!aio->writing) {
+        /* We don't know how much we'll get until we've got it */
+        aio->offset = slot->offset + slot->done;
+    }
+    return slot->err != 0;
+}
+
+/* Wait until slot ``idx`` is ours. Returns 0 on success, or 1 on error. */
+static int
+aio_wait (struct qes_aio *aio, unsigned idx)
+{
+#ifdef IO_URING_FOUND
+    while (aio->slots[idx].busy) {
+        if (aio_ring_reap(aio) != 0) return 1;
+    }
+#else
+    (void) aio;
+    (void) idx;
+#endif
+    return 0;
+}
+
+/* Wait for every request in flight */
+static int
+aio_drain (struct qes_aio *aio)
+{
+#ifdef IO_URING_FOUND
+    while (aio->inflight > 0) {
+        if (aio_ring_reap(aio) != 0) return 1;
+    }
+#else
+    (void) aio;
+#endif
+    return 0;
+}
+
+/* Is ``fd`` something we can do IO on at arbitrary offsets */
+static int
+aio_fd_async (int fd, int writing)
+{
+    struct stat st;
+    int flags = fcntl(fd, F_GETFL);
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || flags < 0) return 0;
+    /* Appends ignore the offset, so can't be done out of order */
+    return !(writing && (flags & O_APPEND));
+}
+
+struct qes_aio *
+qes_aio_open (int fd, int writing, unsigned depth, size_t bufsize)
+{
+    struct qes_aio *aio = NULL;
+    unsigned iii = 0;
+    int err = ENOMEM;
+
+    if (fd < 0 || bufsize == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    aio = qes_calloc_errnil(1, sizeof(*aio));
+    if (aio == NULL) return NULL;
+    aio->fd = fd;
+    aio->writing = writing;
+    aio->bufsize = bufsize;
+    aio->ring_fd = -1;
+    aio->depth = 1;
+    aio->offset = lseek(fd, 0, SEEK_CUR);
+    if (aio->offset < 0) {
+        /* Pipes etc. We count from 0 instead */
+        aio->offset = 0;
+    }
+#ifdef IO_URING_FOUND
+    if (depth > 1 && aio_fd_async(fd, writing)) {
+        aio->depth = depth;
+        if (aio_ring_setup(aio) != 0) {
+            aio->depth = 1;
+        }
+    }
+#else
+    (void) depth;
+    (void) aio_fd_async;
+#endif
+    aio->slots = qes_calloc_errnil(aio->depth, sizeof(*aio->slots));
+    if (aio->slots == NULL) goto error;
+    for (iii = 0; iii < aio->depth; iii++) {
+        aio->slots[iii].buf = qes_malloc_errnil(bufsize);
+        if (aio->slots[iii].buf == NULL) goto error;
+        aio->slots[iii].offset = aio->offset;
+    }
+    if (!writing && aio->ring_fd >= 0) {
+        /* Start reading ahead straight away */
+        for (iii = 0; iii < aio->depth; iii++) {
+            if (aio_request(aio, iii, bufsize) != 0) {
+                err = aio->slots[iii].err;
+                goto error;
+            }
+        }
+    }
+    return aio;
+error:
+    /* Closing may clobber errno, so set it after */
+    qes_aio_close(aio);
+    errno = err;
+    return NULL;
+}
+
+ssize_t
+qes_aio_read (struct qes_aio *aio, void *buf, size_t len)
+{
+    struct qes_aio_slot *slot = NULL;
+    unsigned char *out = buf;
+    size_t got = 0;
+    size_t tocpy = 0;
+
+    if (aio == NULL || aio->writing || buf == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    while (got < len) {
+        slot = &aio->slots[aio->cur];
+        if (aio_wait(aio, aio->cur) != 0) return -1;
+        if (slot->err != 0) {
+            errno = slot->err;
+            return -1;
+        }
+        if (slot->pos < slot->done) {
+            tocpy = slot->done - slot->pos;
+            if (tocpy > len - got) tocpy = len - got;
+            memcpy(out + got, slot->buf + slot->pos, tocpy);
+            slot->pos += tocpy;
+            got += tocpy;
+            continue;
+        }
+        if (slot->eof) break;
+        /* Spent. Send it off for the chunk after the last one in flight. */
+        slot->pos = 0;
+        if (aio_request(aio, aio->cur, aio->bufsize) != 0 &&
+                aio->ring_fd >= 0) {
+            errno = slot->err;
+            return -1;
+        }
+        aio->cur = (aio->cur + 1) % aio->depth;
+    }
+    return got;
+}
+
+int
+qes_aio_seek (struct qes_aio *aio, off_t offset)
+{
+    struct qes_aio_slot *slot = NULL;
+    unsigned iii = 0;
+
+    if (aio == NULL || aio->writing || offset < 0) return 1;
+    slot = &aio->slots[aio->cur];
+    if (!slot->busy && slot->err == 0 && offset >= slot->offset &&
+            offset <= slot->offset + (off_t)slot->done) {
+        slot->pos = offset - slot->offset;
+        return 0;
+    }
+    if (aio_drain(aio) != 0) return 1;
+    if (aio->ring_fd < 0 && lseek(aio->fd, offset, SEEK_SET) != offset) {
+        return 1;
+    }
+    aio->offset = offset;
+    aio->cur = 0;
+    for (iii = 0; iii < aio->depth; iii++) {
+        slot = &aio->slots[iii];
+        slot->offset = offset;
+        slot->len = slot->done = slot->pos = 0;
+        slot->eof = slot->err = 0;
+    }
+    if (aio->ring_fd >= 0) {
+        for (iii = 0; iii < aio->depth; iii++) {
+            if (aio_request(aio, iii, aio->bufsize) != 0) return 1;
+        }
+    }
+    return 0;
+}
+
+off_t
+qes_aio_tell (const struct qes_aio *aio)
+{
+    const struct qes_aio_slot *slot = NULL;
+
+    if (aio == NULL) return -1;
+    slot = &aio->slots[aio->cur];
+    if (aio->writing) {
+        /* The current slot is either being filled, or in flight */
+        return aio->offset + (slot->len > 0 ? 0 : slot->pos);
+    }
+    return slot->offset + slot->pos;
+}
+
+ssize_t
+qes_aio_write (struct qes_aio *aio, const void *buf, size_t len)
+{
+    struct qes_aio_slot *slot = NULL;
+    const unsigned char *in = buf;
+    size_t put = 0;
+    size_t tocpy = 0;
+
+    if (aio == NULL || !aio->writing || buf == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    while (put < len) {
+        slot = &aio->slots[aio->cur];
+        if (aio_wait(aio, aio->cur) != 0) return -1;
+        if (slot->err != 0) {
+            errno = slot->err;
+            return -1;
+        }
+        if (slot->len > 0) {
+            /* Written, so free to refill */
+            slot->len = slot->pos = 0;
+        }
+        tocpy = aio->bufsize - slot->pos;
+        if (tocpy > len - put) tocpy = len - put;
+        memcpy(slot->buf + slot->pos, in + put, tocpy);
+        slot->pos += tocpy;
+        put += tocpy;
+        if (slot->pos == aio->bufsize) {
+            if (aio_request(aio, aio->cur, slot->pos) != 0) {
+                errno = slot->err;
+                return -1;
+            }
+            aio->cur = (aio->cur + 1) % aio->depth;
+        }
+    }
+    return len;
+}
+
+int
+qes_aio_flush (struct qes_aio *aio)
+{
+    struct qes_aio_slot *slot = NULL;
+    unsigned iii = 0;
+
+    if (aio == NULL || !aio->writing) return 1;
+    slot = &aio->slots[aio->cur];
+    if (aio_wait(aio, aio->cur) != 0) return 1;
+    if (slot->len > 0) {
+        slot->len = slot->pos = 0;
+    }
+    if (slot->pos > 0) {
+        aio_request(aio, aio->cur, slot->pos);
+        aio->cur = (aio->cur + 1) % aio->depth;
+    }
+    if (aio_drain(aio) != 0) return 1;
+    for (iii = 0; iii < aio->depth; iii++) {
+        if (aio->slots[iii].err != 0) {
+            errno = aio->slots[iii].err;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int
+qes_aio_close (struct qes_aio *aio)
+{
+    int ret = 0;
+    unsigned iii = 0;
+
+    if (aio == NULL) return 0;
+    if (aio->slots != NULL) {
+        if (aio->writing) {
+            ret = qes_aio_flush(aio);
+        }
+        /* The kernel may still be using our buffers */
+        aio_drain(aio);
+        /* Leave fd where a synchronous reader or writer would have */
+        lseek(aio->fd, qes_aio_tell(aio), SEEK_SET);
+        for (iii = 0; iii < aio->depth; iii++) {
+            qes_free(aio->slots[iii].buf);
+        }
+        qes_free(aio->slots);
+    }
+#ifdef IO_URING_FOUND
+    if (aio->ring_fd >= 0) {
+        aio_ring_free(aio);
+    }
+#endif
+    qes_free(aio);
+    return ret;
+}
@@ -0,0 +1,166 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_aio.h
+ *
+ *    Description:  Read-ahead and write-behind file IO, with io_uring
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 19:02:17
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_AIO_H
+#define QES_AIO_H
+
+#include <qes_util.h>
+
+/* A chunk of the file, being read into or written from */
+struct qes_aio_slot {
+    unsigned char *buf;
+    /* File offset of buf[0] */
+    off_t offset;
+    /* Bytes requested from the kernel */
+    size_t len;
+    /* Bytes the kernel has read or written so far */
+    size_t done;
+    /* Bytes handed to the caller (reads) or filled by it (writes) */
+    size_t pos;
+    /* In the kernel's hands */
+    int busy;
+    /* A read hit the end of the file */
+    int eof;
+    /* errno of a failed request, or 0 */
+    int err;
+};
+
+/* A file descriptor read sequentially with ``depth`` reads in flight, or
+ * written with ``depth`` writes in flight. Without io_uring, or for pipes and
+ * the like, IO is synchronous and ``depth`` is 1. */
+struct qes_aio {
+    int fd;
+    int writing;
+    size_t bufsize;
+    unsigned depth;
+    struct qes_aio_slot *slots;
+    /* Slot being read from or written to by the caller */
+    unsigned cur;
+    /* File offset of the next request */
+    off_t offset;
+    /* Requests in the kernel's hands */
+    unsigned inflight;
+    /* The io_uring, if ``ring_fd`` >= 0 */
+    int ring_fd;
+    /* One struct iovec per slot */
+    void *iovs;
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    void *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    void *cqes;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_aio_open
+Paramters:      int fd: File descriptor to read or write, from its current
+                    offset. It is not owned by the returned struct.
+                int writing: Write to ``fd`` rather than read it.
+                unsigned depth: Number of requests to keep in flight.
+                size_t bufsize: Size of each request.
+Description:    Set up asynchronous IO on ``fd``. Reads are sent ahead of the
+                caller, and writes are queued behind it, so that neither waits
+                on storage as long as ``depth`` requests cover the latency.
+                Only regular files opened without O_APPEND are handled
+                asynchronously, and only if the kernel supports io_uring;
+                otherwise (or if ``depth`` is 0) IO is done synchronously with
+                ``bufsize`` bytes of buffer.
+Returns:        struct qes_aio *: The new struct, or NULL on error.
+ *===========================================================================*/
+struct qes_aio *qes_aio_open (int fd, int writing, unsigned depth,
+                              size_t bufsize);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_aio_read
+Paramters:      struct qes_aio *aio: File to read.
+                void *buf: Destination buffer.
+                size_t len: Bytes to read.
+Description:    Read the next ``len`` bytes of ``aio``.
+Returns:        ssize_t: Bytes read, which is less than ``len`` only at EOF, or
+                -1 on error, setting errno.
+ *===========================================================================*/
+ssize_t qes_aio_read (struct qes_aio *aio, void *buf, size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_aio_seek
+Paramters:      struct qes_aio *aio: File to seek, opened for reading.
+                off_t offset: File offset to read from next.
+Description:    Move the read position of ``aio``. Seeks within the chunk
+                being read are free; otherwise the requests in flight are
+                waited for and discarded.
+Returns:        int: 0 on success, 1 on error.
+ *===========================================================================*/
+int qes_aio_seek (struct qes_aio *aio, off_t offset);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_aio_tell
+Paramters:      const struct qes_aio *aio: File to query.
+Description:    Get the file offset of the next byte to be read or written.
+                For files that can't seek, this counts from where ``aio``
+                started.
+Returns:        off_t: The offset.
+ *===========================================================================*/
+off_t qes_aio_tell (const struct qes_aio *aio);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_aio_write
+Paramters:      struct qes_aio *aio: File to write, opened for writing.
+                const void *buf: Bytes to write.
+                size_t len: Number of bytes.
+Description:    Queue ``len`` bytes to be written. They are copied, so ``buf``
+                may be reused straight away.
+Returns:        ssize_t: ``len``, or -1 on error, setting errno.
+ *===========================================================================*/
+ssize_t qes_aio_write (struct qes_aio *aio, const void *buf, size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_aio_flush
+Paramters:      struct qes_aio *aio: File to flush.
+Description:    Write everything queued, and wait until it's written.
+Returns:        int: 0 on success, 1 on error, setting errno.
+ *===========================================================================*/
+int qes_aio_flush (struct qes_aio *aio);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_aio_close
+Paramters:      struct qes_aio *aio: File to close.
+Description:    Flush any writes, wait for requests in flight, and free
+                ``aio``. The file descriptor's offset is set to
+                qes_aio_tell(aio), but it is not closed.
+Returns:        int: 0 on success, 1 if flushing failed.
+ *===========================================================================*/
+int qes_aio_close (struct qes_aio *aio);
+
+/* Is IO on ``aio`` asynchronous */
+static inline int
+qes_aio_async (const struct qes_aio *aio)
+{
+    return aio != NULL && aio->ring_fd >= 0;
+}
+
+#endif /* QES_AIO_H */
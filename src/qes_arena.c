@@ -0,0 +1,111 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_arena.c
+ *
+ *    Description:  Bump allocator with whole-arena reset
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 13:05:51
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_arena.h"
+
+static struct qes_arena_block *
+arena_block_create (size_t size)
+{
+    /* Over-allocate so that ``size`` bytes fit after aligning the start */
+    struct qes_arena_block *blk = qes_malloc(sizeof(*blk) + size +
+                                             QES_ARENA_ALIGN);
+
+    if (blk == NULL) return NULL;
+    blk->next = NULL;
+    blk->size = size + QES_ARENA_ALIGN;
+    blk->used = 0;
+    return blk;
+}
+
+struct qes_arena *
+qes_arena_create (size_t block_size)
+{
+    struct qes_arena *arena = qes_calloc(1, sizeof(*arena));
+
+    if (arena == NULL) return NULL;
+    arena->block_size = block_size > 0 ? block_size : QES_ARENA_BLOCK_LEN;
+    arena->head = arena_block_create(arena->block_size);
+    if (arena->head == NULL) {
+        qes_free(arena);
+        return NULL;
+    }
+    arena->current = arena->head;
+    arena->last = NULL;
+    return arena;
+}
+
+void *
+qes_arena_alloc_block_ (struct qes_arena *arena, size_t size)
+{
+    struct qes_arena_block *blk = NULL;
+
+    if (arena == NULL) return NULL;
+    /* After a reset, the following blocks are empty and can be reused */
+    blk = arena->current->next;
+    if (blk == NULL || blk->size < size + QES_ARENA_ALIGN) {
+        blk = arena_block_create(size > arena->block_size ?
+                                 size : arena->block_size);
+        if (blk == NULL) return NULL;
+        blk->next = arena->current->next;
+        arena->current->next = blk;
+    }
+    blk->used = 0;
+    arena->current = blk;
+    return qes_arena_alloc(arena, size);
+}
+
+void
+qes_arena_reset (struct qes_arena *arena)
+{
+    struct qes_arena_block *blk = NULL;
+
+    if (arena == NULL) return;
+    for (blk = arena->head; blk != NULL; blk = blk->next) {
+        blk->used = 0;
+    }
+    arena->current = arena->head;
+    arena->last = NULL;
+}
+
+size_t
+qes_arena_size (const struct qes_arena *arena)
+{
+    const struct qes_arena_block *blk = NULL;
+    size_t size = 0;
+
+    if (arena == NULL) return 0;
+    for (blk = arena->head; blk != NULL; blk = blk->next) {
+        size += blk->size;
+    }
+    return size;
+}
+
+void
+qes_arena_destroy_ (struct qes_arena *arena)
+{
+    struct qes_arena_block *blk = NULL;
+    struct qes_arena_block *next = NULL;
+
+    if (arena != NULL) {
+        for (blk = arena->head; blk != NULL; blk = next) {
+            next = blk->next;
+            qes_free(blk);
+        }
+        qes_free(arena);
+    }
+}
@@ -0,0 +1,177 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_arena.h
+ *
+ *    Description:  Bump allocator with whole-arena reset
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 13:05:51
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_ARENA_H
+#define QES_ARENA_H
+
+#include <qes_util.h>
+
+/* Default size of each block of an arena */
+#define QES_ARENA_BLOCK_LEN (1<<20)
+/* All allocations are aligned to this many bytes */
+#define QES_ARENA_ALIGN (16)
+
+struct qes_arena_block {
+    struct qes_arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+/* An arena hands out memory from large blocks by bumping a pointer. Memory is
+ * never freed individually; qes_arena_reset makes all of it available again
+ * at once, keeping the blocks for reuse. An arena is not thread-safe: use one
+ * per thread. */
+struct qes_arena {
+    struct qes_arena_block *head;
+    struct qes_arena_block *current;
+    size_t block_size;
+    /* The most recent allocation, which can be grown in place */
+    char *last;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_arena_create
+Paramters:      size_t block_size: Size of each block, or 0 for the default
+                    QES_ARENA_BLOCK_LEN.
+Description:    Create a ``struct qes_arena`` with one empty block.
+Returns:        struct qes_arena *: A new arena, or NULL on error.
+ *===========================================================================*/
+struct qes_arena *qes_arena_create (size_t block_size);
+
+/* Allocates from a new block. Use qes_arena_alloc instead. */
+void *qes_arena_alloc_block_ (struct qes_arena *arena, size_t size);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_arena_alloc
+Paramters:      struct qes_arena *arena: Arena to allocate from.
+                size_t size: Number of bytes to allocate.
+Description:    Allocate ``size`` bytes, aligned to QES_ARENA_ALIGN, from
+                ``arena``. The memory is not zeroed, and is valid until the
+                next qes_arena_reset or qes_arena_destroy.
+Returns:        void *: The memory, or NULL on error.
+ *===========================================================================*/
+static inline void *
+qes_arena_alloc (struct qes_arena *arena, size_t size)
+{
+    struct qes_arena_block *blk = NULL;
+    size_t start = 0;
+
+    if (arena == NULL) return NULL;
+    blk = arena->current;
+    start = blk->used + (-(uintptr_t)(blk->data + blk->used) &
+                         (QES_ARENA_ALIGN - 1));
+    if (start > blk->size || size > blk->size - start) {
+        return qes_arena_alloc_block_(arena, size);
+    }
+    blk->used = start + size;
+    arena->last = blk->data + start;
+    return arena->last;
+}
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_arena_realloc
+Paramters:      struct qes_arena *arena: Arena ``ptr`` was allocated from.
+                void *ptr: Memory to resize, or NULL.
+                size_t oldsize: Current size of ``ptr``.
+                size_t newsize: Size required.
+Description:    Resize memory allocated from ``arena``. If ``ptr`` was the most
+                recent allocation and there is room, it is grown in place.
+                Otherwise new memory is allocated and the first ``oldsize``
+                bytes copied to it; the old memory is not reused until the
+                arena is reset.
+Returns:        void *: The resized memory, or NULL on error (in which case
+                ``ptr`` is untouched).
+ *===========================================================================*/
+static inline void *
+qes_arena_realloc (struct qes_arena *arena, void *ptr, size_t oldsize,
+                   size_t newsize)
+{
+    struct qes_arena_block *blk = NULL;
+    void *ret = NULL;
+
+    if (arena == NULL) return NULL;
+    if (ptr == NULL) return qes_arena_alloc(arena, newsize);
+    if (newsize <= oldsize) return ptr;
+    blk = arena->current;
+    if ((char *)ptr == arena->last &&
+            newsize <= blk->size - (size_t)(arena->last - blk->data)) {
+        blk->used = (arena->last - blk->data) + newsize;
+        return ptr;
+    }
+    ret = qes_arena_alloc(arena, newsize);
+    if (ret != NULL) {
+        memcpy(ret, ptr, oldsize);
+    }
+    return ret;
+}
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_arena_strndup
+Paramters:      struct qes_arena *arena: Arena to allocate from.
+                const char *str, size_t len: String to copy.
+Description:    Copy ``len`` bytes of ``str`` into ``arena``, null-terminated.
+Returns:        char *: The copy, or NULL on error.
+ *===========================================================================*/
+static inline char *
+qes_arena_strndup (struct qes_arena *arena, const char *str, size_t len)
+{
+    char *ret = NULL;
+
+    if (str == NULL) return NULL;
+    ret = qes_arena_alloc(arena, len + 1);
+    if (ret != NULL) {
+        memcpy(ret, str, len);
+        ret[len] = '\0';
+    }
+    return ret;
+}
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_arena_reset
+Paramters:      struct qes_arena *arena: Arena to reset.
+Description:    Make all memory in ``arena`` available for allocation again.
+                Everything previously allocated from ``arena`` becomes
+                invalid. No memory is returned to the system.
+Returns:        void
+ *===========================================================================*/
+void qes_arena_reset (struct qes_arena *arena);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_arena_size
+Paramters:      const struct qes_arena *arena: Arena to measure.
+Description:    Count the bytes ``arena`` holds from the system.
+Returns:        size_t: Total size of all blocks.
+ *===========================================================================*/
+size_t qes_arena_size (const struct qes_arena *arena);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_arena_destroy
+Paramters:      struct qes_arena *: arena to destroy.
+Description:    Free all blocks of ``arena``, and ``arena`` itself, and set
+                ``arena`` to NULL.
+Returns:        void.
+ *===========================================================================*/
+void qes_arena_destroy_ (struct qes_arena *arena);
+#define qes_arena_destroy(arena) do {                                       \
+            qes_arena_destroy_(arena);                                      \
+            arena = NULL;                                                   \
+        } while(0)
+
+#endif /* QES_ARENA_H */
@@ -0,0 +1,893 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_binseq.c
+ *
+ *    Description:  Compact binary format of sequence records
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 05:03:17
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_binseq.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+/* Bytes of a block's header, of each record in QES_BINSEQ_LENS, and of each
+ * run in QES_BINSEQ_EXCEPTIONS */
+#define BINSEQ_BLOCK_HEADER_LEN (16 + 8 * QES_BINSEQ_N_STREAMS)
+#define BINSEQ_LENS_LEN 20
+#define BINSEQ_EXCEPTION_LEN 9
+/* Bytes of the index before its entries, and of each entry */
+#define BINSEQ_INDEX_HEADER_LEN 24
+#define BINSEQ_INDEX_ENTRY_LEN 16
+
+/* 2-bit code of each base, plus one. 0 is an exception. */
+static const uint8_t binseq_codes[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+};
+static const char binseq_bases[4] = {'A', 'C', 'G', 'T'};
+
+
+static inline void
+binseq_put32 (uint8_t *buf, uint32_t val)
+{
+    buf[0] = val;
+    buf[1] = val >> 8;
+    buf[2] = val >> 16;
+    buf[3] = val >> 24;
+}
+
+static inline void
+binseq_put64 (uint8_t *buf, uint64_t val)
+{
+    binseq_put32(buf, val);
+    binseq_put32(buf + 4, val >> 32);
+}
+
+static inline uint32_t
+binseq_get32 (const uint8_t *buf)
+{
+    return (uint32_t)buf[0] | (uint32_t)buf[1] << 8 |
+           (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+static inline uint64_t
+binseq_get64 (const uint8_t *buf)
+{
+    return binseq_get32(buf) | (uint64_t)binseq_get32(buf + 4) << 32;
+}
+
+/* Grow ``*buf`` to hold at least ``needed`` bytes. Returns 0, or 1 on
+ * error. */
+static int
+binseq_reserve (uint8_t **buf, size_t *capacity, size_t needed)
+{
+    size_t newcap = *capacity > 0 ? *capacity : 64;
+    uint8_t *newbuf = NULL;
+
+    if (needed <= *capacity) return 0;
+    while (newcap < needed) newcap <<= 1;
+    newbuf = qes_realloc_errnil(*buf, newcap);
+    if (newbuf == NULL) return 1;
+    *buf = newbuf;
+    *capacity = newcap;
+    return 0;
+}
+
+/* Make room for ``len`` more bytes of ``stream``, returning where they go,
+ * or NULL on error */
+static inline uint8_t *
+binseq_extend (struct qes_binseq_block *block, enum qes_binseq_stream stream,
+               size_t len)
+{
+    uint8_t *ret = NULL;
+
+    if (binseq_reserve(&block->streams[stream], &block->capacities[stream],
+                       block->lens[stream] + len) != 0) {
+        return NULL;
+    }
+    ret = block->streams[stream] + block->lens[stream];
+    block->lens[stream] += len;
+    return ret;
+}
+
+/* Fill ``block->qual_lens`` from its lengths stream, and create its
+ * coder. Returns 0, or 1 on error. */
+static int
+binseq_qual_lens (struct qes_binseq_block *block, int order)
+{
+    size_t *lens = NULL;
+    size_t iii = 0;
+
+    if (block->codec == NULL) {
+        block->codec = qes_qual_codec_create(order);
+        if (block->codec == NULL) return 1;
+    }
+    if (block->n_records > block->qual_lens_capacity) {
+        lens = qes_realloc_errnil(block->qual_lens,
+                                  block->n_records * sizeof(*lens));
+        if (lens == NULL) return 1;
+        block->qual_lens = lens;
+        block->qual_lens_capacity = block->n_records;
+    }
+    for (iii = 0; iii < block->n_records; iii++) {
+        block->qual_lens[iii] = binseq_get32(block->streams[QES_BINSEQ_LENS] +
+                                             iii * BINSEQ_LENS_LEN + 4);
+    }
+    return 0;
+}
+
+/* The state of ``seqfile``, created on first use */
+static struct qes_binseq *
+binseq_state (struct qes_seqfile *seqfile)
+{
+    struct qes_binseq *bs = seqfile->binseq;
+
+    if (bs != NULL) return bs;
+    bs = qes_calloc_errnil(1, sizeof(*bs));
+    if (bs == NULL) return NULL;
+    bs->opts.block_size = QES_BINSEQ_BLOCK_SIZE;
+    bs->opts.level = QES_BINSEQ_LEVEL;
+    qes_qual_bins_illumina(&bs->bins);
+    bs->writing = seqfile->qf->mode != QES_READ_MODE_READ;
+    seqfile->binseq = bs;
+    return bs;
+}
+
+int
+qes_binseq_set_opts (struct qes_seqfile *seqfile,
+                     const struct qes_binseq_opts *opts)
+{
+    struct qes_binseq *bs = NULL;
+
+    if (!qes_seqfile_ok(seqfile) || !qes_file_writable(seqfile->qf)) {
+        return 1;
+    }
+    if (opts != NULL && (opts->level < -1 || opts->level > 9 ||
+                         opts->qual_order < 0 || opts->qual_order > 2)) {
+        return 1;
+    }
+    bs = binseq_state(seqfile);
+    if (bs == NULL || bs->started) return 1;
+    if (opts != NULL) bs->opts = *opts;
+    if (bs->opts.block_size == 0) bs->opts.block_size = QES_BINSEQ_BLOCK_SIZE;
+    if (bs->opts.level == 0) bs->opts.level = QES_BINSEQ_LEVEL;
+    seqfile->format = BINSEQ_FMT;
+    return 0;
+}
+
+/*                                 Writing                                  */
+
+static int
+binseq_write_all (struct qes_seqfile *seqfile, const void *buf, size_t len)
+{
+    if (qes_file_write(seqfile->qf, buf, len) != (ssize_t)len) return 1;
+    seqfile->binseq->offset += len;
+    return 0;
+}
+
+static int
+binseq_write_header (struct qes_seqfile *seqfile)
+{
+    struct qes_binseq *bs = seqfile->binseq;
+    uint8_t header[QES_BINSEQ_HEADER_LEN];
+
+    bs->flags = bs->opts.bin_quals ? QES_BINSEQ_BINNED : 0;
+    memcpy(header, QES_BINSEQ_MAGIC, 4);
+    binseq_put32(header + 4, QES_BINSEQ_VERSION);
+    binseq_put32(header + 8, bs->flags);
+    binseq_put32(header + 12, 0);
+    bs->started = 1;
+    return binseq_write_all(seqfile, header, sizeof(header));
+}
+
+/* Compress and write the records of the current block */
+static int
+binseq_write_block (struct qes_seqfile *seqfile)
+{
+    struct qes_binseq *bs = seqfile->binseq;
+    struct qes_binseq_block *block = &bs->block;
+    uint8_t *header = NULL;
+    uint64_t *index = NULL;
+    size_t len = BINSEQ_BLOCK_HEADER_LEN;
+    size_t pad = 0;
+    size_t iii = 0;
+    uLongf stored = 0;
+    ssize_t coded = 0;
+    int stored_raw = bs->opts.level < 0;
+    int qual_coded = bs->opts.qual_order > 0;
+
+    if (block->next == 0) return 0;
+    for (iii = 0; iii < QES_BINSEQ_N_STREAMS; iii++) {
+        len += stored_raw ? block->lens[iii] : compressBound(block->lens[iii]);
+    }
+    len += qes_qual_encode_bound(block->lens[QES_BINSEQ_QUALS]);
+    if (binseq_reserve(&bs->buf, &bs->buf_capacity, len + 8) != 0) return 1;
+    header = bs->buf;
+    memcpy(header, QES_BINSEQ_BLOCK_MAGIC, 4);
+    binseq_put32(header + 4, block->next);
+    binseq_put32(header + 8, (stored_raw ? QES_BINSEQ_STORED : 0) |
+                             (qual_coded ? QES_BINSEQ_QUAL_CODED : 0));
+    binseq_put32(header + 12, 0);
+    len = BINSEQ_BLOCK_HEADER_LEN;
+    block->n_records = block->next;
+    for (iii = 0; iii < QES_BINSEQ_N_STREAMS; iii++) {
+        stored = block->lens[iii];
+        if (iii == QES_BINSEQ_QUALS && qual_coded && stored > 0) {
+            if (binseq_qual_lens(block, bs->opts.qual_order) != 0) return 1;
+            coded = qes_qual_encode(block->codec,
+                                    (char *)block->streams[iii], stored,
+                                    block->qual_lens, block->n_records,
+                                    bs->buf + len, bs->buf_capacity - len);
+            if (coded < 0) return 1;
+            stored = coded;
+        } else if (stored_raw || block->lens[iii] == 0) {
+            if (stored > 0) memcpy(bs->buf + len, block->streams[iii], stored);
+        } else {
+            stored = bs->buf_capacity - len;
+            if (compress2(bs->buf + len, &stored, block->streams[iii],
+                          block->lens[iii], bs->opts.level) != Z_OK) {
+                return 1;
+            }
+        }
+        binseq_put32(header + 16 + 8 * iii, block->lens[iii]);
+        binseq_put32(header + 20 + 8 * iii, stored);
+        len += stored;
+    }
+    /* Align the next block */
+    pad = -len & 7;
+    memset(bs->buf + len, 0, pad);
+    len += pad;
+    if (bs->n_blocks * 2 == bs->index_capacity) {
+        iii = bs->index_capacity > 0 ? bs->index_capacity << 1 : 64;
+        index = qes_realloc_errnil(bs->index, iii * sizeof(*index));
+        if (index == NULL) return 1;
+        bs->index = index;
+        bs->index_capacity = iii;
+    }
+    bs->index[bs->n_blocks * 2] = bs->offset;
+    bs->index[bs->n_blocks * 2 + 1] = block->first_record;
+    if (binseq_write_all(seqfile, bs->buf, len) != 0) return 1;
+    bs->n_blocks++;
+    for (iii = 0; iii < QES_BINSEQ_N_STREAMS; iii++) block->lens[iii] = 0;
+    block->first_record = bs->n_records;
+    block->next = 0;
+    return 0;
+}
+
+int
+qes_binseq_flush (struct qes_seqfile *seqfile)
+{
+    if (!qes_seqfile_ok(seqfile) || seqfile->binseq == NULL) return 1;
+    if (!seqfile->binseq->writing || seqfile->binseq->finished) return 1;
+    if (!seqfile->binseq->started && binseq_write_header(seqfile) != 0) {
+        return 1;
+    }
+    return binseq_write_block(seqfile);
+}
+
+/* Pack the bases of ``seq`` into ``block``. Returns the number of runs of
+ * exceptions, or -1 on error. */
+static inline ssize_t
+binseq_pack (struct qes_binseq_block *block, const struct qes_str *seq)
+{
+    uint8_t *packed = binseq_extend(block, QES_BINSEQ_BASES,
+                                    (seq->len + 3) / 4);
+    uint8_t *run = NULL;
+    size_t run_offset = 0;
+    size_t run_end = 0;
+    size_t n_runs = 0;
+    size_t iii = 0;
+    uint8_t code = 0;
+    char base = 0;
+
+    if (packed == NULL) return -1;
+    memset(packed, 0, (seq->len + 3) / 4);
+    for (iii = 0; iii < seq->len; iii++) {
+        base = seq->str[iii];
+        code = binseq_codes[(uint8_t)base];
+        if (code > 0) {
+            packed[iii >> 2] |= (code - 1) << ((iii & 3) * 2);
+            continue;
+        }
+        /* Extend the current run, or start a new one. ``packed`` may move
+         * when the exceptions grow, but they're separate streams. */
+        if (n_runs > 0 && run_end == iii &&
+                block->streams[QES_BINSEQ_EXCEPTIONS][run_offset + 8] ==
+                (uint8_t)base) {
+            run = block->streams[QES_BINSEQ_EXCEPTIONS] + run_offset;
+            binseq_put32(run + 4, binseq_get32(run + 4) + 1);
+        } else {
+            run_offset = block->lens[QES_BINSEQ_EXCEPTIONS];
+            run = binseq_extend(block, QES_BINSEQ_EXCEPTIONS,
+                                BINSEQ_EXCEPTION_LEN);
+            if (run == NULL) return -1;
+            binseq_put32(run, iii);
+            binseq_put32(run + 4, 1);
+            run[8] = base;
+            n_runs++;
+        }
+        run_end = iii + 1;
+    }
+    return n_runs;
+}
+
+ssize_t
+qes_binseq_write_ (struct qes_seqfile *seqfile, const struct qes_seq *seq)
+{
+    struct qes_binseq *bs = NULL;
+    struct qes_binseq_block *block = NULL;
+    struct qes_str name;
+    struct qes_str comment;
+    uint8_t *lens = NULL;
+    uint8_t *dest = NULL;
+    size_t qual_len = 0;
+    size_t before = 0;
+    size_t after = 0;
+    size_t iii = 0;
+    ssize_t n_runs = 0;
+
+    if (!qes_seqfile_ok(seqfile) || !qes_seq_ok(seq)) return -2;
+    bs = binseq_state(seqfile);
+    if (bs == NULL || !bs->writing || bs->finished) return -2;
+    if (!bs->started && binseq_write_header(seqfile) != 0) return -2;
+    block = &bs->block;
+    qes_seq_peek_header(seq, &name, &comment);
+    qual_len = seq->qual.str != NULL ? seq->qual.len : 0;
+    if ((qual_len > 0 && qual_len != seq->seq.len) ||
+            seq->seq.len > UINT32_MAX || name.len > UINT32_MAX ||
+            comment.len > UINT32_MAX || block->next == UINT32_MAX) {
+        return -2;
+    }
+    for (iii = 0; iii < QES_BINSEQ_N_STREAMS; iii++) {
+        before += block->lens[iii];
+    }
+    /* The lengths go first, but the number of exceptions is known last */
+    lens = binseq_extend(block, QES_BINSEQ_LENS, BINSEQ_LENS_LEN);
+    if (lens == NULL) return -2;
+    iii = block->lens[QES_BINSEQ_LENS] - BINSEQ_LENS_LEN;
+    n_runs = binseq_pack(block, &seq->seq);
+    if (n_runs < 0 || n_runs > UINT32_MAX) return -2;
+    lens = block->streams[QES_BINSEQ_LENS] + iii;
+    binseq_put32(lens, seq->seq.len);
+    binseq_put32(lens + 4, qual_len);
+    binseq_put32(lens + 8, name.len);
+    binseq_put32(lens + 12, comment.len);
+    binseq_put32(lens + 16, n_runs);
+    dest = binseq_extend(block, QES_BINSEQ_QUALS, qual_len);
+    if (dest == NULL && qual_len > 0) return -2;
+    if (qual_len > 0) {
+        memcpy(dest, seq->qual.str, qual_len);
+        if (bs->opts.bin_quals) {
+            qes_qual_bin(&bs->bins, (char *)dest, qual_len);
+        }
+    }
+    dest = binseq_extend(block, QES_BINSEQ_NAMES, name.len + comment.len);
+    if (dest == NULL && name.len + comment.len > 0) return -2;
+    if (name.len > 0) memcpy(dest, name.str, name.len);
+    if (comment.len > 0) memcpy(dest + name.len, comment.str, comment.len);
+    block->next++;
+    bs->n_records++;
+    for (iii = 0; iii < QES_BINSEQ_N_STREAMS; iii++) {
+        after += block->lens[iii];
+    }
+    if (after >= bs->opts.block_size && binseq_write_block(seqfile) != 0) {
+        return -2;
+    }
+    return after - before;
+}
+
+/* Finish writing: the last block, the index and the trailer */
+static int
+binseq_write_index (struct qes_seqfile *seqfile)
+{
+    struct qes_binseq *bs = seqfile->binseq;
+    uint8_t buf[BINSEQ_INDEX_HEADER_LEN];
+    uint64_t index_offset = 0;
+    size_t iii = 0;
+
+    if (!bs->started && binseq_write_header(seqfile) != 0) return 1;
+    if (binseq_write_block(seqfile) != 0) return 1;
+    index_offset = bs->offset;
+    memcpy(buf, QES_BINSEQ_INDEX_MAGIC, 4);
+    binseq_put32(buf + 4, 0);
+    binseq_put64(buf + 8, bs->n_blocks);
+    binseq_put64(buf + 16, bs->n_records);
+    if (binseq_write_all(seqfile, buf, BINSEQ_INDEX_HEADER_LEN) != 0) {
+        return 1;
+    }
+    for (iii = 0; iii < bs->n_blocks; iii++) {
+        binseq_put64(buf, bs->index[iii * 2]);
+        binseq_put64(buf + 8, bs->index[iii * 2 + 1]);
+        if (binseq_write_all(seqfile, buf, BINSEQ_INDEX_ENTRY_LEN) != 0) {
+            return 1;
+        }
+    }
+    binseq_put64(buf, index_offset);
+    memcpy(buf + 8, QES_BINSEQ_END_MAGIC, 4);
+    binseq_put32(buf + 12, QES_BINSEQ_VERSION);
+    return binseq_write_all(seqfile, buf, QES_BINSEQ_TRAILER_LEN);
+}
+
+int
+qes_binseq_finish (struct qes_seqfile *seqfile)
+{
+    struct qes_binseq *bs = NULL;
+    struct qes_file *qf = NULL;
+
+    if (!qes_seqfile_ok(seqfile) || seqfile->format != BINSEQ_FMT) return 1;
+    qf = seqfile->qf;
+    if (!qes_file_writable(qf)) return 1;
+    bs = binseq_state(seqfile);
+    if (bs == NULL || !bs->writing || bs->finished) return 1;
+    /* Even if this fails, a retry would only append a second index */
+    bs->finished = 1;
+    if (binseq_write_index(seqfile) != 0) return 1;
+    /* The writes above may only have reached the backend's buffer */
+    return qf->backend->flush(qf->handle);
+}
+
+/*                                 Reading                                  */
+
+/* Decode a block from its header and stored streams. ``len`` is the number
+ * of bytes at ``data`` after the header. Returns 0, or 1 on error. */
+static int
+binseq_decode (struct qes_binseq_block *block, const uint8_t *header,
+               const uint8_t *data, size_t len)
+{
+    uint32_t flags = binseq_get32(header + 8);
+    uint64_t offsets[4] = {0, 0, 0, 0};
+    const uint8_t *lens = NULL;
+    size_t raw_len = 0;
+    size_t stored = 0;
+    size_t iii = 0;
+    uLongf out_len = 0;
+
+    if (memcmp(header, QES_BINSEQ_BLOCK_MAGIC, 4) != 0) return 1;
+    block->n_records = binseq_get32(header + 4);
+    block->next = 0;
+    for (iii = 0; iii < QES_BINSEQ_N_STREAMS; iii++) {
+        raw_len = binseq_get32(header + 16 + 8 * iii);
+        stored = binseq_get32(header + 20 + 8 * iii);
+        if (stored > len) return 1;
+        /* Leave room for a null, so empty streams are allocated too */
+        if (binseq_reserve(&block->streams[iii], &block->capacities[iii],
+                           raw_len + 1) != 0) {
+            return 1;
+        }
+        if (iii == QES_BINSEQ_QUALS && (flags & QES_BINSEQ_QUAL_CODED) &&
+                raw_len > 0) {
+            /* The lengths stream has been decoded already */
+            if (block->lens[QES_BINSEQ_LENS] !=
+                    (size_t)block->n_records * BINSEQ_LENS_LEN ||
+                    binseq_qual_lens(block, 2) != 0 ||
+                    qes_qual_decode(block->codec, data, stored,
+                                    (char *)block->streams[iii], raw_len,
+                                    block->qual_lens, block->n_records)) {
+                return 1;
+            }
+        } else if ((flags & QES_BINSEQ_STORED) || raw_len == 0) {
+            if (stored != raw_len) return 1;
+            if (raw_len > 0) memcpy(block->streams[iii], data, raw_len);
+        } else {
+            out_len = raw_len;
+            if (uncompress(block->streams[iii], &out_len, data, stored) !=
+                    Z_OK || out_len != raw_len) {
+                return 1;
+            }
+        }
+        block->lens[iii] = raw_len;
+        data += stored;
+        len -= stored;
+    }
+    if (block->lens[QES_BINSEQ_LENS] !=
+            (size_t)block->n_records * BINSEQ_LENS_LEN) {
+        return 1;
+    }
+    if (binseq_reserve((uint8_t **)&block->offsets, &block->offsets_capacity,
+                       (block->n_records + 1) * 4 * sizeof(uint64_t)) != 0) {
+        return 1;
+    }
+    /* Find each record in the streams, checking they hold them all */
+    for (iii = 0; iii < block->n_records; iii++) {
+        lens = block->streams[QES_BINSEQ_LENS] + iii * BINSEQ_LENS_LEN;
+        memcpy(block->offsets + iii * 4, offsets, sizeof(offsets));
+        offsets[0] += ((uint64_t)binseq_get32(lens) + 3) / 4;
+        offsets[1] += (uint64_t)binseq_get32(lens + 16) *
+                      BINSEQ_EXCEPTION_LEN;
+        offsets[2] += binseq_get32(lens + 4);
+        offsets[3] += (uint64_t)binseq_get32(lens + 8) +
+                      binseq_get32(lens + 12);
+    }
+    if (offsets[0] != block->lens[QES_BINSEQ_BASES] ||
+            offsets[1] != block->lens[QES_BINSEQ_EXCEPTIONS] ||
+            offsets[2] != block->lens[QES_BINSEQ_QUALS] ||
+            offsets[3] != block->lens[QES_BINSEQ_NAMES]) {
+        return 1;
+    }
+    return 0;
+}
+
+static inline int
+binseq_fill_str (struct qes_str *str, const uint8_t *data, size_t len)
+{
+    if (qes_str_reserve(str, len + 1) != 0) return 1;
+    if (len > 0) memcpy(str->str, data, len);
+    str->str[len] = '\0';
+    str->len = len;
+    return 0;
+}
+
+/* Unpack record ``idx`` of ``block``, and its name if ``names`` */
+static ssize_t
+binseq_get (const struct qes_binseq_block *block, size_t idx,
+            struct qes_seq *seq, int names)
+{
+    const uint8_t *lens = block->streams[QES_BINSEQ_LENS] +
+                          idx * BINSEQ_LENS_LEN;
+    const uint64_t *offsets = block->offsets + idx * 4;
+    const uint8_t *packed = block->streams[QES_BINSEQ_BASES] + offsets[0];
+    const uint8_t *run = block->streams[QES_BINSEQ_EXCEPTIONS] + offsets[1];
+    const uint8_t *names_at = block->streams[QES_BINSEQ_NAMES] + offsets[3];
+    size_t seq_len = binseq_get32(lens);
+    size_t qual_len = binseq_get32(lens + 4);
+    size_t name_len = binseq_get32(lens + 8);
+    size_t n_runs = binseq_get32(lens + 16);
+    size_t pos = 0;
+    size_t run_len = 0;
+    size_t iii = 0;
+    char *bases = NULL;
+
+    if (qes_str_reserve(&seq->seq, seq_len + 1) != 0) return -2;
+    bases = seq->seq.str;
+    for (iii = 0; iii < seq_len; iii++) {
+        bases[iii] = binseq_bases[(packed[iii >> 2] >> ((iii & 3) * 2)) & 3];
+    }
+    for (iii = 0; iii < n_runs; iii++, run += BINSEQ_EXCEPTION_LEN) {
+        pos = binseq_get32(run);
+        run_len = binseq_get32(run + 4);
+        if (pos > seq_len || run_len > seq_len - pos) return -2;
+        memset(bases + pos, run[8], run_len);
+    }
+    bases[seq_len] = '\0';
+    seq->seq.len = seq_len;
+    if (binseq_fill_str(&seq->qual,
+                        block->streams[QES_BINSEQ_QUALS] + offsets[2],
+                        qual_len) != 0) {
+        return -2;
+    }
+    if (names) {
+        if (binseq_fill_str(&seq->name, names_at, name_len) != 0 ||
+                binseq_fill_str(&seq->comment, names_at + name_len,
+                                binseq_get32(lens + 12)) != 0) {
+            return -2;
+        }
+    } else {
+        qes_str_nullify(&seq->name);
+        qes_str_nullify(&seq->comment);
+    }
+    seq->raw_header = 0;
+    return seq_len;
+}
+
+ssize_t
+qes_binseq_block_get (const struct qes_binseq_block *block, size_t idx,
+                      struct qes_seq *seq)
+{
+    if (block == NULL || idx >= block->n_records || !qes_seq_ok(seq)) {
+        return -2;
+    }
+    return binseq_get(block, idx, seq, 1);
+}
+
+static int
+binseq_read_header (struct qes_seqfile *seqfile)
+{
+    struct qes_binseq *bs = seqfile->binseq;
+    uint8_t header[QES_BINSEQ_HEADER_LEN];
+
+    if (qes_file_read(seqfile->qf, header, sizeof(header)) !=
+            sizeof(header) ||
+            memcmp(header, QES_BINSEQ_MAGIC, 4) != 0 ||
+            binseq_get32(header + 4) != QES_BINSEQ_VERSION) {
+        return 1;
+    }
+    bs->flags = binseq_get32(header + 8);
+    bs->started = 1;
+    return 0;
+}
+
+/* Read the header of the next block into ``bs->buf``. Returns the number of
+ * bytes stored after it, including padding, 0 at the index, or -1 on
+ * error. */
+static ssize_t
+binseq_next_block (struct qes_seqfile *seqfile)
+{
+    struct qes_binseq *bs = seqfile->binseq;
+    size_t len = BINSEQ_BLOCK_HEADER_LEN;
+    size_t iii = 0;
+    ssize_t res = 0;
+
+    if (!bs->started && binseq_read_header(seqfile) != 0) return -1;
+    if (bs->done) return 0;
+    if (binseq_reserve(&bs->buf, &bs->buf_capacity, len) != 0) return -1;
+    /* Without the index, the file was truncated */
+    res = qes_file_read(seqfile->qf, bs->buf, 4);
+    if (res != 4) return -1;
+    if (memcmp(bs->buf, QES_BINSEQ_INDEX_MAGIC, 4) == 0) {
+        bs->done = 1;
+        return 0;
+    }
+    res = qes_file_read(seqfile->qf, bs->buf + 4, len - 4);
+    if (res != (ssize_t)(len - 4) ||
+            memcmp(bs->buf, QES_BINSEQ_BLOCK_MAGIC, 4) != 0) {
+        return -1;
+    }
+    for (iii = 0; iii < QES_BINSEQ_N_STREAMS; iii++) {
+        len += binseq_get32(bs->buf + 20 + 8 * iii);
+    }
+    return len + (-len & 7) - BINSEQ_BLOCK_HEADER_LEN;
+}
+
+/* Read and decode the next block. Returns 1, 0 at the index, or -1 on
+ * error. */
+static int
+binseq_read_block (struct qes_seqfile *seqfile)
+{
+    struct qes_binseq *bs = seqfile->binseq;
+    ssize_t len = binseq_next_block(seqfile);
+
+    if (len <= 0) return len;
+    if (binseq_reserve(&bs->buf, &bs->buf_capacity,
+                       BINSEQ_BLOCK_HEADER_LEN + len) != 0 ||
+            qes_file_read(seqfile->qf, bs->buf + BINSEQ_BLOCK_HEADER_LEN,
+                          len) != len) {
+        return -1;
+    }
+    bs->block.first_record = seqfile->n_records;
+    if (binseq_decode(&bs->block, bs->buf,
+                      bs->buf + BINSEQ_BLOCK_HEADER_LEN, len) != 0) {
+        return -1;
+    }
+    return 1;
+}
+
+ssize_t
+qes_binseq_read_ (struct qes_seqfile *seqfile, struct qes_seq *seq)
+{
+    struct qes_binseq *bs = NULL;
+    struct qes_binseq_block *block = NULL;
+    ssize_t res = 0;
+
+    if (!qes_seqfile_ok(seqfile) || !qes_seq_ok(seq)) return -2;
+    bs = binseq_state(seqfile);
+    if (bs == NULL || bs->writing) return -2;
+    block = &bs->block;
+    while (block->next >= block->n_records) {
+        res = binseq_read_block(seqfile);
+        if (res < 0) return -2;
+        if (res == 0) return EOF;
+    }
+    res = binseq_get(block, block->next++, seq,
+                     seqfile->header != QES_HEADER_SKIP);
+    if (res >= 0) seqfile->n_records++;
+    return res;
+}
+
+ssize_t
+qes_binseq_skip_ (struct qes_seqfile *seqfile, size_t n)
+{
+    struct qes_binseq *bs = NULL;
+    struct qes_binseq_block *block = NULL;
+    size_t n_skipped = 0;
+    size_t avail = 0;
+    ssize_t len = 0;
+    uint32_t n_records = 0;
+
+    if (!qes_seqfile_ok(seqfile)) return -2;
+    bs = binseq_state(seqfile);
+    if (bs == NULL || bs->writing) return -2;
+    block = &bs->block;
+    while (n_skipped < n) {
+        avail = block->n_records - block->next;
+        if (avail > 0) {
+            if (avail > n - n_skipped) avail = n - n_skipped;
+            block->next += avail;
+            n_skipped += avail;
+            continue;
+        }
+        len = binseq_next_block(seqfile);
+        if (len < 0) return -2;
+        if (len == 0) break;
+        /* Whole blocks are skipped without decompressing them */
+        n_records = binseq_get32(bs->buf + 4);
+        if (n_records <= n - n_skipped) {
+            if (qes_file_read(seqfile->qf, NULL, len) != len) return -2;
+            n_skipped += n_records;
+            continue;
+        }
+        if (binseq_reserve(&bs->buf, &bs->buf_capacity,
+                           BINSEQ_BLOCK_HEADER_LEN + len) != 0 ||
+                qes_file_read(seqfile->qf, bs->buf + BINSEQ_BLOCK_HEADER_LEN,
+                              len) != len ||
+                binseq_decode(block, bs->buf,
+                              bs->buf + BINSEQ_BLOCK_HEADER_LEN, len) != 0) {
+            return -2;
+        }
+        block->first_record = seqfile->n_records + n_skipped;
+    }
+    seqfile->n_records += n_skipped;
+    return n_skipped;
+}
+
+int
+qes_binseq_close_ (struct qes_seqfile *seqfile)
+{
+    struct qes_binseq *bs = NULL;
+    size_t iii = 0;
+    int ret = 0;
+
+    if (seqfile == NULL || seqfile->binseq == NULL) return 1;
+    bs = seqfile->binseq;
+    if (bs->writing && !bs->finished) ret = binseq_write_index(seqfile);
+    for (iii = 0; iii < QES_BINSEQ_N_STREAMS; iii++) {
+        qes_free(bs->block.streams[iii]);
+    }
+    qes_free(bs->block.offsets);
+    qes_free(bs->block.qual_lens);
+    qes_qual_codec_destroy(bs->block.codec);
+    qes_free(bs->buf);
+    qes_free(bs->index);
+    qes_free(bs);
+    seqfile->binseq = NULL;
+    return ret;
+}
+
+/*                                 Mapping                                  */
+
+struct qes_binseq_map *
+qes_binseq_map_open (const char *path)
+{
+    struct qes_binseq_map *map = NULL;
+    struct stat st;
+    const uint8_t *trailer = NULL;
+    uint64_t index_offset = 0;
+    void *data = MAP_FAILED;
+    int fd = -1;
+
+    if (path == NULL) return NULL;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < QES_BINSEQ_HEADER_LEN +
+            BINSEQ_INDEX_HEADER_LEN + QES_BINSEQ_TRAILER_LEN) {
+        goto error;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) goto error;
+    close(fd);
+    fd = -1;
+    map = qes_calloc_errnil(1, sizeof(*map));
+    if (map == NULL) goto error;
+    map->data = data;
+    map->len = st.st_size;
+    trailer = map->data + map->len - QES_BINSEQ_TRAILER_LEN;
+    index_offset = binseq_get64(trailer);
+    if (memcmp(map->data, QES_BINSEQ_MAGIC, 4) != 0 ||
+            binseq_get32(map->data + 4) != QES_BINSEQ_VERSION ||
+            memcmp(trailer + 8, QES_BINSEQ_END_MAGIC, 4) != 0 ||
+            index_offset < QES_BINSEQ_HEADER_LEN ||
+            index_offset > map->len - QES_BINSEQ_TRAILER_LEN -
+                           BINSEQ_INDEX_HEADER_LEN ||
+            memcmp(map->data + index_offset, QES_BINSEQ_INDEX_MAGIC, 4)) {
+        goto error;
+    }
+    map->flags = binseq_get32(map->data + 8);
+    map->n_blocks = binseq_get64(map->data + index_offset + 8);
+    map->n_records = binseq_get64(map->data + index_offset + 16);
+    map->index = map->data + index_offset + BINSEQ_INDEX_HEADER_LEN;
+    if (map->n_blocks > (size_t)(trailer - map->index) /
+            BINSEQ_INDEX_ENTRY_LEN) {
+        goto error;
+    }
+    return map;
+error:
+    if (fd >= 0) close(fd);
+    if (map != NULL) {
+        qes_binseq_map_close(map);
+    } else if (data != MAP_FAILED) {
+        munmap(data, st.st_size);
+    }
+    return NULL;
+}
+
+int64_t
+qes_binseq_map_find (const struct qes_binseq_map *map, uint64_t record)
+{
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    uint64_t mid = 0;
+
+    if (map == NULL || record >= map->n_records || map->n_blocks == 0) {
+        return -1;
+    }
+    /* The last block starting at or before ``record`` */
+    hi = map->n_blocks;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (binseq_get64(map->index + mid * BINSEQ_INDEX_ENTRY_LEN + 8) <=
+                record) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int
+qes_binseq_map_block (const struct qes_binseq_map *map, uint64_t blk,
+                      struct qes_binseq_block *block)
+{
+    const uint8_t *entry = NULL;
+    uint64_t offset = 0;
+    uint64_t end = 0;
+
+    if (map == NULL || block == NULL || blk >= map->n_blocks) return 1;
+    entry = map->index + blk * BINSEQ_INDEX_ENTRY_LEN;
+    offset = binseq_get64(entry);
+    /* Blocks end where the index starts */
+    end = map->index - BINSEQ_INDEX_HEADER_LEN - map->data;
+    if (offset < QES_BINSEQ_HEADER_LEN ||
+            offset > end - BINSEQ_BLOCK_HEADER_LEN) {
+        return 1;
+    }
+    if (binseq_decode(block, map->data + offset,
+                      map->data + offset + BINSEQ_BLOCK_HEADER_LEN,
+                      end - offset - BINSEQ_BLOCK_HEADER_LEN) != 0) {
+        return 1;
+    }
+    block->first_record = binseq_get64(entry + 8);
+    return 0;
+}
+
+void
+qes_binseq_map_close_ (struct qes_binseq_map *map)
+{
+    if (map != NULL) {
+        munmap((void *)map->data, map->len);
+        qes_free(map);
+    }
+}
+
+struct qes_binseq_block *
+qes_binseq_block_create (void)
+{
+    return qes_calloc_errnil(1, sizeof(struct qes_binseq_block));
+}
+
+void
+qes_binseq_block_destroy_ (struct qes_binseq_block *block)
+{
+    size_t iii = 0;
+
+    if (block != NULL) {
+        for (iii = 0; iii < QES_BINSEQ_N_STREAMS; iii++) {
+            qes_free(block->streams[iii]);
+        }
+        qes_free(block->offsets);
+        qes_free(block->qual_lens);
+        qes_qual_codec_destroy(block->codec);
+        qes_free(block);
+    }
+}
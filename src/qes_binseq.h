@@ -0,0 +1,280 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_binseq.h
+ *
+ *    Description:  Compact binary format of sequence records
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 05:03:17
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_BINSEQ_H
+#define QES_BINSEQ_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+#include <qes_seqfile.h>
+#include <qes_qual.h>
+
+/*---------------------------------------------------------------------------
+  | qes_binseq module -- a binary record format for intermediate files      |
+  ---------------------------------------------------------------------------*/
+
+/* A file is a header, blocks of records, an index of the blocks, and a
+ * trailer. All integers are little-endian.
+ *
+ *  header:  "QESB", u32 version, u32 flags, u32 reserved
+ *  block:   "QBLK", u32 n_records, u32 flags, u32 reserved, then per stream
+ *           u32 uncompressed length and u32 stored length, then each stream
+ *           as stored, then zeros to align the next block to 8 bytes
+ *  index:   "QIDX", u32 reserved, u64 n_blocks, u64 n_records, then per
+ *           block u64 offset and u64 number of its first record
+ *  trailer: u64 offset of the index, "QEND", u32 version
+ *
+ * Each stream of a block is compressed on its own with zlib, unless the
+ * block's flags say it's stored as is, or that its qualities are coded with
+ * qes_qual_encode. Blocks are found from the index, so a mapped file can be
+ * read from any block without reading those before. */
+
+#define QES_BINSEQ_MAGIC "QESB"
+#define QES_BINSEQ_BLOCK_MAGIC "QBLK"
+#define QES_BINSEQ_INDEX_MAGIC "QIDX"
+#define QES_BINSEQ_END_MAGIC "QEND"
+#define QES_BINSEQ_VERSION 1
+#define QES_BINSEQ_HEADER_LEN 16
+#define QES_BINSEQ_TRAILER_LEN 16
+/* Flags of the header */
+#define QES_BINSEQ_BINNED 0x1
+/* Flags of a block */
+#define QES_BINSEQ_STORED 0x1
+#define QES_BINSEQ_QUAL_CODED 0x2
+
+/* Defaults of struct qes_binseq_opts */
+#define QES_BINSEQ_BLOCK_SIZE (4<<20)
+#define QES_BINSEQ_LEVEL 1
+
+/* Streams of each block */
+enum qes_binseq_stream {
+    /* Per record, the lengths of the sequence, quality, name and comment,
+     * and the number of exceptions, as u32s */
+    QES_BINSEQ_LENS = 0,
+    /* Bases packed 4 per byte, A, C, G and T as 0 to 3, from the low bits
+     * up. Each record starts on a new byte. */
+    QES_BINSEQ_BASES = 1,
+    /* Runs of bases other than ACGT, e.g. N or lower case, which are packed
+     * as A. Each is a u32 position in the record, u32 length and the base. */
+    QES_BINSEQ_EXCEPTIONS = 2,
+    /* Quality scores, as in FASTQ */
+    QES_BINSEQ_QUALS = 3,
+    /* Each record's name, then comment */
+    QES_BINSEQ_NAMES = 4,
+};
+#define QES_BINSEQ_N_STREAMS 5
+
+/* Options for qes_binseq_set_opts. A zeroed struct gives the defaults. */
+struct qes_binseq_opts {
+    /* Bytes of records in each block, before compression. 0 means
+     * QES_BINSEQ_BLOCK_SIZE. */
+    size_t block_size;
+    /* zlib compression level of each stream, 1-9, or -1 to store them
+     * uncompressed. 0 means QES_BINSEQ_LEVEL. */
+    int level;
+    /* If true, quality scores are binned to Illumina's eight levels, which
+     * compress much better, but can't be recovered. */
+    int bin_quals;
+    /* If 1 or 2, quality scores are coded by qes_qual_encode with that
+     * order, rather than compressed with zlib. This is both smaller and
+     * faster. 0 means zlib. */
+    int qual_order;
+};
+
+/* A block of records, decompressed */
+struct qes_binseq_block {
+    uint64_t first_record;
+    uint32_t n_records;
+    uint8_t *streams[QES_BINSEQ_N_STREAMS];
+    size_t lens[QES_BINSEQ_N_STREAMS];
+    size_t capacities[QES_BINSEQ_N_STREAMS];
+    /* Per record, offsets of its bases, exceptions, qualities and name
+     * within their streams */
+    uint64_t *offsets;
+    size_t offsets_capacity;
+    /* Next record to read, or records written */
+    uint32_t next;
+    /* Coder of quality scores, and each record's number of them */
+    struct qes_qual_codec *codec;
+    size_t *qual_lens;
+    size_t qual_lens_capacity;
+};
+
+/* State of a qes_seqfile in BINSEQ_FMT. Private to qes_binseq.c. */
+struct qes_binseq {
+    struct qes_binseq_opts opts;
+    struct qes_qual_bins bins;
+    /* Flags of the file's header, once read or written */
+    uint32_t flags;
+    int started;
+    int writing;
+    /* The index and trailer have been written */
+    int finished;
+    /* Records read have passed the last block */
+    int done;
+    struct qes_binseq_block block;
+    /* Bytes of the block as stored */
+    uint8_t *buf;
+    size_t buf_capacity;
+    /* Writing: bytes written, records written, and the index of blocks */
+    uint64_t offset;
+    uint64_t n_records;
+    uint64_t *index;
+    size_t n_blocks;
+    size_t index_capacity;
+};
+
+/* A file in BINSEQ_FMT, mapped into memory */
+struct qes_binseq_map {
+    const uint8_t *data;
+    size_t len;
+    uint32_t flags;
+    uint64_t n_records;
+    uint64_t n_blocks;
+    /* Points into ``data`` */
+    const uint8_t *index;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_set_opts
+Paramters:      struct qes_seqfile *seqfile: File opened for writing, which
+                    should be uncompressed (e.g. mode "wT"), as its blocks
+                    are compressed already.
+                const struct qes_binseq_opts *opts: Options, or NULL for the
+                    defaults.
+Description:    Set ``seqfile`` to be written in BINSEQ_FMT, with ``opts``.
+                Setting the format with qes_seqfile_set_format gives the
+                defaults. Records written by qes_seqfile_write are packed
+                into blocks in memory, which are written once full or when
+                flushed. Call qes_binseq_finish once all records are written.
+Returns:        int: 0 on success, 1 on error, e.g. if records have already
+                been written.
+ *===========================================================================*/
+int qes_binseq_set_opts (struct qes_seqfile *seqfile,
+                         const struct qes_binseq_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_flush
+Paramters:      struct qes_seqfile *seqfile: File in BINSEQ_FMT.
+Description:    Write the records of ``seqfile``'s partly full block. The
+                file can't be mapped or read until qes_binseq_finish has
+                also written its index.
+Returns:        int: 0 on success, 1 on error.
+ *===========================================================================*/
+int qes_binseq_flush (struct qes_seqfile *seqfile);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_finish
+Paramters:      struct qes_seqfile *seqfile: File in BINSEQ_FMT.
+Description:    Write the last block, the index and the trailer of
+                ``seqfile``, and flush them to disk. No more records may be
+                written afterwards. Callers must check that this succeeded
+                before destroying ``seqfile``: qes_seqfile_destroy finishes
+                files that weren't, but then a failed write (e.g. a full
+                disk) leaves a truncated file without an error.
+Returns:        int: 0 on success, 1 on error, or if ``seqfile`` was already
+                finished.
+ *===========================================================================*/
+int qes_binseq_finish (struct qes_seqfile *seqfile);
+
+/* Read, skip, write and close files in BINSEQ_FMT. Use qes_seqfile_read,
+ * qes_seqfile_skip, qes_seqfile_write and qes_seqfile_destroy instead. */
+ssize_t qes_binseq_read_ (struct qes_seqfile *seqfile, struct qes_seq *seq);
+ssize_t qes_binseq_skip_ (struct qes_seqfile *seqfile, size_t n);
+ssize_t qes_binseq_write_ (struct qes_seqfile *seqfile,
+                           const struct qes_seq *seq);
+int qes_binseq_close_ (struct qes_seqfile *seqfile);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_map_open
+Paramters:      const char *path: File in BINSEQ_FMT.
+Description:    Map ``path`` into memory, and check its header, trailer and
+                index. Blocks are then decoded straight from the mapping.
+Returns:        struct qes_binseq_map *: The mapped file, or NULL on error.
+ *===========================================================================*/
+struct qes_binseq_map *qes_binseq_map_open (const char *path);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_map_find
+Paramters:      const struct qes_binseq_map *map: Mapped file.
+                uint64_t record: Number of a record, from 0.
+Description:    Find the block holding record number ``record``, by binary
+                search of the index.
+Returns:        int64_t: The number of the block, or -1 if there's no such
+                record.
+ *===========================================================================*/
+int64_t qes_binseq_map_find (const struct qes_binseq_map *map,
+                             uint64_t record);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_map_block
+Paramters:      const struct qes_binseq_map *map: Mapped file.
+                uint64_t blk: Number of the block to decode, from 0.
+                struct qes_binseq_block *block: Filled with the block.
+Description:    Decompress block ``blk`` of ``map`` into ``block``, whose
+                buffers are reused.
+Returns:        int: 0 on success, 1 on error.
+ *===========================================================================*/
+int qes_binseq_map_block (const struct qes_binseq_map *map, uint64_t blk,
+                          struct qes_binseq_block *block);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_map_close
+Paramters:      struct qes_binseq_map *: Mapped file to close.
+Description:    Unmap, deallocate and set to NULL a struct qes_binseq_map.
+Returns:        void.
+ *===========================================================================*/
+void qes_binseq_map_close_ (struct qes_binseq_map *map);
+#define qes_binseq_map_close(map) do {                                      \
+            qes_binseq_map_close_(map);                                     \
+            map = NULL;                                                     \
+        } while(0)
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_block_create
+Paramters:      void
+Description:    Create an empty block, to decode blocks into.
+Returns:        struct qes_binseq_block *: The block, or NULL on error.
+ *===========================================================================*/
+struct qes_binseq_block *qes_binseq_block_create (void);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_block_get
+Paramters:      const struct qes_binseq_block *block: Decoded block.
+                size_t idx: Index of the record within ``block``.
+                struct qes_seq *seq: Filled with the record.
+Description:    Unpack record ``idx`` of ``block`` into ``seq``.
+Returns:        ssize_t: The length of the record's sequence, or -2 on error.
+ *===========================================================================*/
+ssize_t qes_binseq_block_get (const struct qes_binseq_block *block,
+                              size_t idx, struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_binseq_block_destroy
+Paramters:      struct qes_binseq_block *: Block to destroy.
+Description:    Deallocate and set to NULL a struct qes_binseq_block.
+Returns:        void.
+ *===========================================================================*/
+void qes_binseq_block_destroy_ (struct qes_binseq_block *block);
+#define qes_binseq_block_destroy(block) do {                                \
+            qes_binseq_block_destroy_(block);                               \
+            block = NULL;                                                   \
+        } while(0)
+
+#endif /* QES_BINSEQ_H */
@@ -0,0 +1,1309 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_compress.c
+ *
+ *    Description:  Pluggable decompression backends for qes_file
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 16:12:40
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+/* For tee */
+#define _GNU_SOURCE
+#include "qes_compress.h"
+#include "qes_aio.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#ifdef BZIP2_FOUND
+#include <bzlib.h>
+#endif
+#ifdef LIBLZMA_FOUND
+#include <lzma.h>
+#endif
+#ifdef ZSTD_FOUND
+#include <zstd.h>
+#endif
+#ifdef LIBDEFLATE_FOUND
+#include <libdeflate.h>
+#endif
+
+
+static inline uint32_t
+compress_le16 (const unsigned char *buf)
+{
+    return (uint32_t)buf[0] | (uint32_t)buf[1] << 8;
+}
+
+static inline uint32_t
+compress_le32 (const unsigned char *buf)
+{
+    return compress_le16(buf) | compress_le16(buf + 2) << 16;
+}
+
+/*
+ * gzip, and uncompressed files, through zlib
+ */
+
+static void *
+gzip_dopen (int fd, const char *mode, size_t bufsize, unsigned depth)
+{
+    QES_ZTYPE fp = QES_ZDOPEN(fd, mode);
+
+    /* zlib does its own IO */
+    (void) depth;
+    if (fp != NULL && bufsize > 0) {
+        QES_ZBUFFER(fp, bufsize);
+    }
+    return fp;
+}
+
+static ssize_t
+gzip_read (void *handle, void *buf, size_t len)
+{
+    /* gzread takes an unsigned and returns an int */
+    if (len > INT_MAX) len = INT_MAX;
+    return QES_ZREAD((QES_ZTYPE)handle, buf, len);
+}
+
+static int
+gzip_seek (void *handle, off_t offset)
+{
+    return QES_ZSEEK((QES_ZTYPE)handle, offset, SEEK_SET) == offset ? 0 : 1;
+}
+
+static off_t
+gzip_offset (void *handle)
+{
+    return QES_ZOFFSET((QES_ZTYPE)handle);
+}
+
+static const char *
+gzip_error (void *handle)
+{
+    int error = 0;
+    const char *errstr = gzerror((QES_ZTYPE)handle, &error);
+
+    if (error == Z_ERRNO) {
+        return strerror(errno);
+    }
+    return errstr;
+}
+
+static void
+gzip_close (void *handle)
+{
+    QES_ZCLOSE((QES_ZTYPE)handle);
+}
+
+static ssize_t
+gzip_write (void *handle, const void *buf, size_t len)
+{
+    const char *from = buf;
+    size_t left = len;
+    int chunk = 0;
+
+    while (left > 0) {
+        /* gzwrite takes an unsigned and returns an int */
+        chunk = left > (1U<<30) ? (1<<30) : (int)left;
+        if (QES_ZWRITE((QES_ZTYPE)handle, from, chunk) != chunk) return -1;
+        from += chunk;
+        left -= chunk;
+    }
+    return len;
+}
+
+static int
+gzip_flush (void *handle)
+{
+    return QES_ZFLUSH((QES_ZTYPE)handle, Z_SYNC_FLUSH) == Z_OK ? 0 : 1;
+}
+
+static int
+gzip_direct (void *handle)
+{
+    return gzdirect((QES_ZTYPE)handle);
+}
+
+static const struct qes_compress_backend backend_gzip = {
+    .name = "gzip",
+    .type = QES_COMPRESSION_GZIP,
+    .dopen = gzip_dopen,
+    .read = gzip_read,
+    .seek = gzip_seek,
+    .offset = gzip_offset,
+    .error = gzip_error,
+    .close = gzip_close,
+    .write = gzip_write,
+    .flush = gzip_flush,
+    .direct = gzip_direct,
+};
+
+/*
+ * Compressed input or output on a file descriptor of our own, through
+ * qes_aio, shared by the other backends
+ */
+
+struct zstream {
+    int fd;
+    struct qes_aio *aio;
+    unsigned char *inbuf;
+    size_t insize;
+    int feof;
+    const char *errstr;
+};
+
+static int
+zstream_dopen (struct zstream *zs, int fd, const char *mode, size_t bufsize,
+               unsigned depth, int can_write)
+{
+    int writing = mode != NULL && (mode[0] == 'w' || mode[0] == 'a');
+
+    if (mode == NULL || (mode[0] != 'r' && !(can_write && writing))) {
+        /* Only gzip can write */
+        errno = EINVAL;
+        return 1;
+    }
+    zs->insize = bufsize > 0 ? bufsize : QES_FILEBUFFER_LEN;
+    zs->inbuf = qes_malloc_errnil(zs->insize);
+    if (zs->inbuf == NULL) {
+        errno = ENOMEM;
+        return 1;
+    }
+    /* Each fill is one request, so the requests are as big as inbuf */
+    zs->aio = qes_aio_open(fd, writing, depth, zs->insize);
+    if (zs->aio == NULL) {
+        qes_free(zs->inbuf);
+        return 1;
+    }
+    zs->fd = fd;
+    zs->feof = 0;
+    zs->errstr = "";
+    return 0;
+}
+
+/* Read ``len`` bytes, or fewer at EOF. Returns the number of bytes read, or
+ * -1 on error. */
+static ssize_t
+zstream_read (struct zstream *zs, void *buf, size_t len)
+{
+    ssize_t got = qes_aio_read(zs->aio, buf, len);
+
+    if (got < 0) {
+        zs->errstr = strerror(errno);
+    }
+    return got;
+}
+
+/* Read the next chunk of compressed input into ``zs->inbuf``. Returns the
+ * number of bytes read, 0 at EOF, or -1 on error. */
+static ssize_t
+zstream_fill (struct zstream *zs)
+{
+    ssize_t len = 0;
+
+    if (zs->feof) return 0;
+    len = zstream_read(zs, zs->inbuf, zs->insize);
+    if (len >= 0 && (size_t)len < zs->insize) {
+        zs->feof = 1;
+    }
+    return len;
+}
+
+/* Queue ``len`` bytes to be written. Returns 0 on success, 1 on error. */
+static int
+zstream_write (struct zstream *zs, const void *buf, size_t len)
+{
+    if (qes_aio_write(zs->aio, buf, len) < 0) {
+        zs->errstr = strerror(errno);
+        return 1;
+    }
+    return 0;
+}
+
+/* Compressed bytes consumed, given ``unused`` bytes are left in inbuf */
+static off_t
+zstream_offset (const struct zstream *zs, size_t unused)
+{
+    return qes_aio_tell(zs->aio) - unused;
+}
+
+static void
+zstream_close (struct zstream *zs)
+{
+    qes_aio_close(zs->aio);
+    close(zs->fd);
+    qes_free(zs->inbuf);
+}
+
+/*
+ * gzip through zlib's inflate and deflate. Unlike the gz* functions, this
+ * leaves the IO to qes_aio, so it can read ahead of and write behind us.
+ */
+
+struct zlib_handle {
+    /* inbuf holds compressed input when reading, and uncompressed input to
+     * deflate when writing */
+    struct zstream zs;
+    z_stream strm;
+    int writing;
+    /* Input isn't gzip, so is read as is (like gzread), or output is written
+     * uncompressed (mode has 'T', like gzwrite) */
+    int direct;
+    /* Reading: between inflateReset and the end of a gzip member */
+    int in_member;
+    /* Reading: the first chunk has been read, so ``direct`` is known */
+    int started;
+    /* Reading: hit something other than a gzip member, which we ignore */
+    int done;
+    /* Writing: bytes waiting in inbuf to be deflated, and deflate's output */
+    size_t pending;
+    unsigned char *outbuf;
+    /* File offset of the start of the stream */
+    off_t start;
+};
+
+static void *
+zlib_dopen (int fd, const char *mode, size_t bufsize, unsigned depth)
+{
+    struct zlib_handle *zh = qes_calloc(1, sizeof(*zh));
+    const char *iter = mode;
+    int level = Z_DEFAULT_COMPRESSION;
+    int ret = Z_OK;
+
+    if (zh == NULL) return NULL;
+    zh->writing = mode != NULL && mode[0] != 'r';
+    if (zh->writing) {
+        for (; *iter != '\0'; iter++) {
+            if (*iter >= '0' && *iter <= '9') level = *iter - '0';
+            if (*iter == 'T') zh->direct = 1;
+        }
+        ret = deflateInit2(&zh->strm, level, Z_DEFLATED, 15 + 16, 8,
+                           Z_DEFAULT_STRATEGY);
+    } else {
+        /* 15 + 16 is a gzip wrapper, with the largest window */
+        ret = inflateInit2(&zh->strm, 15 + 16);
+    }
+    if (ret != Z_OK) {
+        qes_free(zh);
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* Last, so that we never close fd on failure */
+    if (zstream_dopen(&zh->zs, fd, mode, bufsize, depth, 1) != 0 ||
+            (zh->writing &&
+             (zh->outbuf = qes_malloc_errnil(zh->zs.insize)) == NULL)) {
+        if (zh->zs.aio != NULL) {
+            qes_aio_close(zh->zs.aio);
+            qes_free(zh->zs.inbuf);
+            errno = ENOMEM;
+        }
+        if (zh->writing) {
+            deflateEnd(&zh->strm);
+        } else {
+            inflateEnd(&zh->strm);
+        }
+        qes_free(zh);
+        return NULL;
+    }
+    zh->start = qes_aio_tell(zh->zs.aio);
+    return zh;
+}
+
+/* Read uncompressed input: what's left in inbuf, then straight from the
+ * file into ``buf`` */
+static ssize_t
+zlib_read_direct (struct zlib_handle *zh, unsigned char *buf, size_t len)
+{
+    size_t got = zh->strm.avail_in < len ? zh->strm.avail_in : len;
+    ssize_t res = 0;
+
+    memcpy(buf, zh->strm.next_in, got);
+    zh->strm.next_in += got;
+    zh->strm.avail_in -= got;
+    if (got < len && !zh->zs.feof) {
+        res = zstream_read(&zh->zs, buf + got, len - got);
+        if (res < 0) return -1;
+        if ((size_t)res < len - got) zh->zs.feof = 1;
+        got += res;
+    }
+    return got;
+}
+
+static ssize_t
+zlib_read (void *handle, void *buf, size_t len)
+{
+    struct zlib_handle *zh = handle;
+    ssize_t got = 0;
+    int ret = Z_OK;
+
+    if (!zh->started) {
+        got = zstream_fill(&zh->zs);
+        if (got < 0) return -1;
+        zh->strm.next_in = zh->zs.inbuf;
+        zh->strm.avail_in = got;
+        zh->started = 1;
+        /* As with gzread, anything without the gzip magic is read as is */
+        zh->direct = got < 2 || zh->zs.inbuf[0] != 0x1f ||
+                     zh->zs.inbuf[1] != 0x8b;
+    }
+    if (zh->direct) {
+        return zlib_read_direct(zh, buf, len);
+    }
+    if (zh->done) return 0;
+    if (len > UINT_MAX) len = UINT_MAX;
+    zh->strm.next_out = buf;
+    zh->strm.avail_out = len;
+    while (zh->strm.avail_out > 0) {
+        if (zh->strm.avail_in == 0) {
+            got = zstream_fill(&zh->zs);
+            if (got < 0) return -1;
+            if (got == 0) {
+                if (zh->in_member) {
+                    zh->zs.errstr = "Truncated gzip stream";
+                    return -1;
+                }
+                break;
+            }
+            zh->strm.next_in = zh->zs.inbuf;
+            zh->strm.avail_in = got;
+        }
+        if (!zh->in_member) {
+            /* Another member, or trailing garbage, which gzread ignores */
+            if (zh->strm.next_in[0] != 0x1f) {
+                zh->done = 1;
+                break;
+            }
+            inflateReset(&zh->strm);
+            zh->in_member = 1;
+        }
+        ret = inflate(&zh->strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            zh->in_member = 0;
+        } else if (ret != Z_OK) {
+            zh->zs.errstr = zh->strm.msg != NULL ? zh->strm.msg :
+                                                   "Corrupt gzip stream";
+            return -1;
+        }
+    }
+    return len - zh->strm.avail_out;
+}
+
+static int
+zlib_seek (void *handle, off_t offset)
+{
+    struct zlib_handle *zh = handle;
+
+    if (zh->writing || !zh->started || !zh->direct) return -1;
+    if (qes_aio_seek(zh->zs.aio, zh->start + offset) != 0) return 1;
+    zh->strm.avail_in = 0;
+    zh->zs.feof = 0;
+    return 0;
+}
+
+static off_t
+zlib_offset (void *handle)
+{
+    struct zlib_handle *zh = handle;
+
+    return zstream_offset(&zh->zs, zh->writing ? 0 : zh->strm.avail_in);
+}
+
+static const char *
+zlib_error (void *handle)
+{
+    return ((struct zlib_handle *)handle)->zs.errstr;
+}
+
+/* Deflate ``len`` bytes of ``buf`` with ``flush``, and queue the output to be
+ * written. Returns 0 on success, 1 on error. */
+static int
+zlib_deflate (struct zlib_handle *zh, const void *buf, size_t len, int flush)
+{
+    size_t have = 0;
+
+    zh->strm.next_in = (unsigned char *)buf;
+    zh->strm.avail_in = len;
+    do {
+        zh->strm.next_out = zh->outbuf;
+        zh->strm.avail_out = zh->zs.insize;
+        if (deflate(&zh->strm, flush) == Z_STREAM_ERROR) {
+            zh->zs.errstr = "Couldn't compress with zlib";
+            return 1;
+        }
+        have = zh->zs.insize - zh->strm.avail_out;
+        if (have > 0 && zstream_write(&zh->zs, zh->outbuf, have) != 0) {
+            return 1;
+        }
+    } while (zh->strm.avail_out == 0);
+    return 0;
+}
+
+static ssize_t
+zlib_write (void *handle, const void *buf, size_t len)
+{
+    struct zlib_handle *zh = handle;
+    const unsigned char *from = buf;
+    size_t left = len;
+    size_t chunk = 0;
+
+    if (zh->direct) {
+        return zstream_write(&zh->zs, buf, len) == 0 ? (ssize_t)len : -1;
+    }
+    /* Small writes are gathered in inbuf, as deflate works best on big
+     * blocks */
+    if (zh->pending + len < zh->zs.insize) {
+        memcpy(zh->zs.inbuf + zh->pending, buf, len);
+        zh->pending += len;
+        return len;
+    }
+    if (zh->pending > 0) {
+        if (zlib_deflate(zh, zh->zs.inbuf, zh->pending, Z_NO_FLUSH) != 0) {
+            return -1;
+        }
+        zh->pending = 0;
+    }
+    while (left > 0) {
+        chunk = left > (1U<<30) ? (1U<<30) : left;
+        if (zlib_deflate(zh, from, chunk, Z_NO_FLUSH) != 0) return -1;
+        from += chunk;
+        left -= chunk;
+    }
+    return len;
+}
+
+static int
+zlib_flush (void *handle)
+{
+    struct zlib_handle *zh = handle;
+
+    if (!zh->direct) {
+        if (zlib_deflate(zh, zh->zs.inbuf, zh->pending, Z_SYNC_FLUSH) != 0) {
+            return 1;
+        }
+        zh->pending = 0;
+    }
+    if (qes_aio_flush(zh->zs.aio) != 0) {
+        zh->zs.errstr = strerror(errno);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+zlib_direct (void *handle)
+{
+    return ((struct zlib_handle *)handle)->direct;
+}
+
+static void
+zlib_close (void *handle)
+{
+    struct zlib_handle *zh = handle;
+
+    if (zh->writing) {
+        if (!zh->direct) {
+            zlib_deflate(zh, zh->zs.inbuf, zh->pending, Z_FINISH);
+        }
+        deflateEnd(&zh->strm);
+    } else {
+        inflateEnd(&zh->strm);
+    }
+    zstream_close(&zh->zs);
+    qes_free(zh->outbuf);
+    qes_free(zh);
+}
+
+static const struct qes_compress_backend backend_zlib = {
+    .name = "zlib",
+    .type = QES_COMPRESSION_GZIP,
+    .dopen = zlib_dopen,
+    .read = zlib_read,
+    .seek = zlib_seek,
+    .offset = zlib_offset,
+    .error = zlib_error,
+    .close = zlib_close,
+    .write = zlib_write,
+    .flush = zlib_flush,
+    .direct = zlib_direct,
+};
+
+/*
+ * bzip2, including the concatenated streams written by pbzip2
+ */
+
+#ifdef BZIP2_FOUND
+struct bzip2_handle {
+    struct zstream zs;
+    bz_stream strm;
+    /* Between BZ2_bzDecompressInit and BZ2_bzDecompressEnd */
+    int in_stream;
+};
+
+static void *
+bzip2_dopen (int fd, const char *mode, size_t bufsize, unsigned depth)
+{
+    struct bzip2_handle *bz = qes_calloc(1, sizeof(*bz));
+
+    if (bz == NULL) return NULL;
+    if (zstream_dopen(&bz->zs, fd, mode, bufsize, depth, 0) != 0) {
+        qes_free(bz);
+        return NULL;
+    }
+    return bz;
+}
+
+static ssize_t
+bzip2_read (void *handle, void *buf, size_t len)
+{
+    struct bzip2_handle *bz = handle;
+    ssize_t got = 0;
+    int ret = 0;
+
+    if (len > UINT_MAX) len = UINT_MAX;
+    bz->strm.next_out = buf;
+    bz->strm.avail_out = len;
+    while (bz->strm.avail_out > 0) {
+        if (bz->strm.avail_in == 0) {
+            got = zstream_fill(&bz->zs);
+            if (got < 0) return -1;
+            if (got == 0) {
+                if (bz->in_stream) {
+                    bz->zs.errstr = "Truncated bzip2 stream";
+                    return -1;
+                }
+                break;
+            }
+            bz->strm.next_in = (char *)bz->zs.inbuf;
+            bz->strm.avail_in = got;
+        }
+        if (!bz->in_stream) {
+            if (BZ2_bzDecompressInit(&bz->strm, 0, 0) != BZ_OK) {
+                bz->zs.errstr = "Couldn't initialise bzip2 decompression";
+                return -1;
+            }
+            bz->in_stream = 1;
+        }
+        ret = BZ2_bzDecompress(&bz->strm);
+        if (ret == BZ_STREAM_END) {
+            /* Any remaining input is the next stream */
+            BZ2_bzDecompressEnd(&bz->strm);
+            bz->in_stream = 0;
+        } else if (ret != BZ_OK) {
+            bz->zs.errstr = "Corrupt bzip2 stream";
+            return -1;
+        }
+    }
+    return len - bz->strm.avail_out;
+}
+
+static off_t
+bzip2_offset (void *handle)
+{
+    struct bzip2_handle *bz = handle;
+
+    return zstream_offset(&bz->zs, bz->strm.avail_in);
+}
+
+static const char *
+bzip2_error (void *handle)
+{
+    return ((struct bzip2_handle *)handle)->zs.errstr;
+}
+
+static void
+bzip2_close (void *handle)
+{
+    struct bzip2_handle *bz = handle;
+
+    if (bz->in_stream) BZ2_bzDecompressEnd(&bz->strm);
+    zstream_close(&bz->zs);
+    qes_free(bz);
+}
+
+static const struct qes_compress_backend backend_bzip2 = {
+    .name = "bzip2",
+    .type = QES_COMPRESSION_BZIP2,
+    .dopen = bzip2_dopen,
+    .read = bzip2_read,
+    .seek = NULL,
+    .offset = bzip2_offset,
+    .error = bzip2_error,
+    .close = bzip2_close,
+};
+#endif
+
+/*
+ * xz, through liblzma
+ */
+
+#ifdef LIBLZMA_FOUND
+struct xz_handle {
+    struct zstream zs;
+    lzma_stream strm;
+    /* lzma_code has returned LZMA_STREAM_END */
+    int done;
+};
+
+static void *
+xz_dopen (int fd, const char *mode, size_t bufsize, unsigned depth)
+{
+    struct xz_handle *xz = qes_calloc(1, sizeof(*xz));
+    lzma_stream init = LZMA_STREAM_INIT;
+
+    if (xz == NULL) return NULL;
+    xz->strm = init;
+    if (lzma_stream_decoder(&xz->strm, UINT64_MAX, LZMA_CONCATENATED) !=
+            LZMA_OK) {
+        qes_free(xz);
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* Last, so that we never close fd on failure */
+    if (zstream_dopen(&xz->zs, fd, mode, bufsize, depth, 0) != 0) {
+        lzma_end(&xz->strm);
+        qes_free(xz);
+        return NULL;
+    }
+    return xz;
+}
+
+static ssize_t
+xz_read (void *handle, void *buf, size_t len)
+{
+    struct xz_handle *xz = handle;
+    ssize_t got = 0;
+    lzma_ret ret = LZMA_OK;
+
+    if (xz->done) return 0;
+    xz->strm.next_out = buf;
+    xz->strm.avail_out = len;
+    while (xz->strm.avail_out > 0) {
+        if (xz->strm.avail_in == 0 && !xz->zs.feof) {
+            got = zstream_fill(&xz->zs);
+            if (got < 0) return -1;
+            xz->strm.next_in = xz->zs.inbuf;
+            xz->strm.avail_in = got;
+        }
+        ret = lzma_code(&xz->strm, xz->zs.feof ? LZMA_FINISH : LZMA_RUN);
+        if (ret == LZMA_STREAM_END) {
+            xz->done = 1;
+            break;
+        } else if (ret != LZMA_OK) {
+            xz->zs.errstr = ret == LZMA_BUF_ERROR ? "Truncated xz stream" :
+                                                    "Corrupt xz stream";
+            return -1;
+        }
+    }
+    return len - xz->strm.avail_out;
+}
+
+static off_t
+xz_offset (void *handle)
+{
+    struct xz_handle *xz = handle;
+
+    return zstream_offset(&xz->zs, xz->strm.avail_in);
+}
+
+static const char *
+xz_error (void *handle)
+{
+    return ((struct xz_handle *)handle)->zs.errstr;
+}
+
+static void
+xz_close (void *handle)
+{
+    struct xz_handle *xz = handle;
+
+    lzma_end(&xz->strm);
+    zstream_close(&xz->zs);
+    qes_free(xz);
+}
+
+static const struct qes_compress_backend backend_xz = {
+    .name = "xz",
+    .type = QES_COMPRESSION_XZ,
+    .dopen = xz_dopen,
+    .read = xz_read,
+    .seek = NULL,
+    .offset = xz_offset,
+    .error = xz_error,
+    .close = xz_close,
+};
+#endif
+
+/*
+ * zstd. Files in the seekable format (independent frames, with a seek table
+ * in a trailing skippable frame) get real random access.
+ */
+
+#ifdef ZSTD_FOUND
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1U
+#define ZSTD_SEEKTABLE_MAGIC 0x184D2A5EU
+#define ZSTD_SEEKTABLE_FOOTER_LEN 9
+
+struct zstd_handle {
+    struct zstream zs;
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer in;
+    /* Return of the last ZSTD_decompressStream call that did anything. 0
+     * iff at the end of a frame */
+    size_t last;
+    /* From the seek table, if any: frame ``i`` starts at compressed offset
+     * ``coffsets[i]`` and decompressed offset ``doffsets[i]``. Both have
+     * ``n_frames + 1`` entries, the last being the totals. */
+    uint64_t *coffsets;
+    uint64_t *doffsets;
+    size_t n_frames;
+    /* Offset of the zstd data in the file */
+    off_t start;
+};
+
+/* Read ``len`` bytes at ``offset`` bytes before the end of the file */
+static int
+zstd_pread_end (int fd, off_t end, void *buf, size_t len, off_t offset)
+{
+    if (offset > end) return 1;
+    return pread(fd, buf, len, end - offset) != (ssize_t)len;
+}
+
+/* Load the seek table, if this is a seekable zstd file */
+static void
+zstd_load_seektable (struct zstd_handle *zh)
+{
+    int fd = zh->zs.fd;
+    unsigned char footer[ZSTD_SEEKTABLE_FOOTER_LEN];
+    unsigned char header[8];
+    unsigned char *table = NULL;
+    struct stat st;
+    size_t n_frames = 0;
+    size_t entry_len = 0;
+    size_t table_len = 0;
+    size_t iii = 0;
+
+    /* Not being able to seek (e.g. in a pipe) is fine; we just can't use a
+     * seek table. The table is read with pread, leaving the read ahead
+     * alone. */
+    zh->start = lseek(fd, 0, SEEK_CUR);
+    if (zh->start < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        zh->start = -1;
+        return;
+    }
+    if (zstd_pread_end(fd, st.st_size, footer, sizeof(footer),
+                       ZSTD_SEEKTABLE_FOOTER_LEN) != 0 ||
+            compress_le32(footer + 5) != ZSTD_SEEKABLE_MAGIC ||
+            (footer[4] & 0x7c) != 0) {
+        return;
+    }
+    n_frames = compress_le32(footer);
+    /* Bit 7 of the descriptor says entries have a checksum */
+    entry_len = footer[4] & 0x80 ? 12 : 8;
+    table_len = n_frames * entry_len;
+    if (zstd_pread_end(fd, st.st_size, header, sizeof(header),
+                       table_len + sizeof(footer) + sizeof(header)) != 0 ||
+            compress_le32(header) != ZSTD_SEEKTABLE_MAGIC ||
+            compress_le32(header + 4) != table_len + sizeof(footer)) {
+        return;
+    }
+    table = qes_malloc_errnil(table_len + 1);
+    zh->coffsets = qes_calloc_errnil(n_frames + 1, sizeof(*zh->coffsets));
+    zh->doffsets = qes_calloc_errnil(n_frames + 1, sizeof(*zh->doffsets));
+    if (table == NULL || zh->coffsets == NULL || zh->doffsets == NULL ||
+            zstd_pread_end(fd, st.st_size, table, table_len,
+                           table_len + sizeof(footer)) != 0) {
+        qes_free(zh->coffsets);
+        qes_free(zh->doffsets);
+        qes_free(table);
+        return;
+    }
+    for (iii = 0; iii < n_frames; iii++) {
+        zh->coffsets[iii + 1] = zh->coffsets[iii] +
+                                compress_le32(table + iii * entry_len);
+        zh->doffsets[iii + 1] = zh->doffsets[iii] +
+                                compress_le32(table + iii * entry_len + 4);
+    }
+    zh->n_frames = n_frames;
+    qes_free(table);
+}
+
+static void *
+zstd_dopen (int fd, const char *mode, size_t bufsize, unsigned depth)
+{
+    struct zstd_handle *zh = qes_calloc(1, sizeof(*zh));
+
+    if (zh == NULL) return NULL;
+    zh->dctx = ZSTD_createDCtx();
+    if (zh->dctx == NULL) {
+        qes_free(zh);
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* Last, so that we never close fd on failure */
+    if (zstream_dopen(&zh->zs, fd, mode,
+                      bufsize > 0 ? bufsize : ZSTD_DStreamInSize(), depth,
+                      0) != 0) {
+        ZSTD_freeDCtx(zh->dctx);
+        qes_free(zh);
+        return NULL;
+    }
+    zh->in.src = zh->zs.inbuf;
+    zstd_load_seektable(zh);
+    return zh;
+}
+
+static ssize_t
+zstd_read (void *handle, void *buf, size_t len)
+{
+    struct zstd_handle *zh = handle;
+    ZSTD_outBuffer out = {buf, len, 0};
+    ssize_t got = 0;
+    size_t inpos = 0;
+    size_t outpos = 0;
+    size_t ret = 0;
+
+    while (out.pos < out.size) {
+        if (zh->in.pos == zh->in.size && !zh->zs.feof) {
+            got = zstream_fill(&zh->zs);
+            if (got < 0) return -1;
+            zh->in.size = got;
+            zh->in.pos = 0;
+        }
+        inpos = zh->in.pos;
+        outpos = out.pos;
+        ret = ZSTD_decompressStream(zh->dctx, &out, &zh->in);
+        if (ZSTD_isError(ret)) {
+            zh->zs.errstr = ZSTD_getErrorName(ret);
+            return -1;
+        }
+        if (zh->in.pos == inpos && out.pos == outpos) {
+            /* Out of input, and nothing buffered in the decoder */
+            if (zh->last != 0) {
+                zh->zs.errstr = "Truncated zstd stream";
+                return -1;
+            }
+            break;
+        }
+        zh->last = ret;
+    }
+    return out.pos;
+}
+
+static int
+zstd_seek (void *handle, off_t offset)
+{
+    struct zstd_handle *zh = handle;
+    char discard[4096];
+    uint64_t skip = 0;
+    size_t left = 0;
+    size_t right = 0;
+    size_t mid = 0;
+    ssize_t got = 0;
+
+    if (zh->doffsets == NULL) return -1;
+    if ((uint64_t)offset > zh->doffsets[zh->n_frames]) return 1;
+    /* Find the last frame starting at or before offset */
+    right = zh->n_frames;
+    while (left < right) {
+        mid = left + (right - left + 1) / 2;
+        if (zh->doffsets[mid] <= (uint64_t)offset) {
+            left = mid;
+        } else {
+            right = mid - 1;
+        }
+    }
+    if (qes_aio_seek(zh->zs.aio, zh->start + zh->coffsets[left]) != 0) {
+        return 1;
+    }
+    ZSTD_DCtx_reset(zh->dctx, ZSTD_reset_session_only);
+    zh->in.pos = zh->in.size = 0;
+    zh->zs.feof = 0;
+    zh->last = 0;
+    /* Frames are independent, so we need only decompress this one */
+    skip = offset - zh->doffsets[left];
+    while (skip > 0) {
+        got = zstd_read(zh, discard, skip < sizeof(discard) ? skip :
+                                                              sizeof(discard));
+        if (got <= 0) return 1;
+        skip -= got;
+    }
+    return 0;
+}
+
+static off_t
+zstd_offset (void *handle)
+{
+    struct zstd_handle *zh = handle;
+
+    return zstream_offset(&zh->zs, zh->in.size - zh->in.pos);
+}
+
+static const char *
+zstd_error (void *handle)
+{
+    return ((struct zstd_handle *)handle)->zs.errstr;
+}
+
+static void
+zstd_close (void *handle)
+{
+    struct zstd_handle *zh = handle;
+
+    ZSTD_freeDCtx(zh->dctx);
+    zstream_close(&zh->zs);
+    qes_free(zh->coffsets);
+    qes_free(zh->doffsets);
+    qes_free(zh);
+}
+
+static const struct qes_compress_backend backend_zstd = {
+    .name = "zstd",
+    .type = QES_COMPRESSION_ZSTD,
+    .dopen = zstd_dopen,
+    .read = zstd_read,
+    .seek = zstd_seek,
+    .offset = zstd_offset,
+    .error = zstd_error,
+    .close = zstd_close,
+};
+#endif
+
+/*
+ * BGZF through libdeflate, which inflates a whole block per call rather than
+ * streaming. Blocks are inflated straight into the caller's buffer where they
+ * fit.
+ */
+
+#ifdef LIBDEFLATE_FOUND
+/* Largest compressed or uncompressed BGZF block */
+#define BGZF_MAX_BLOCK_LEN (1<<16)
+/* Fixed part of the gzip header, up to and including XLEN */
+#define BGZF_HEADER_LEN 12
+
+struct bgzf_handle {
+    /* inbuf holds one compressed block */
+    struct zstream zs;
+    struct libdeflate_decompressor *dec;
+    /* A decompressed block that didn't fit in the caller's buffer */
+    unsigned char *block;
+    size_t blocklen;
+    size_t blockpos;
+    /* Compressed bytes consumed */
+    off_t coffset;
+};
+
+static void *
+bgzf_dopen (int fd, const char *mode, size_t bufsize, unsigned depth)
+{
+    struct bgzf_handle *bg = qes_calloc(1, sizeof(*bg));
+
+    if (bg == NULL) return NULL;
+    bg->dec = libdeflate_alloc_decompressor();
+    bg->block = qes_malloc_errnil(BGZF_MAX_BLOCK_LEN);
+    /* zstream_dopen last, so that we never close fd on failure */
+    if (bg->dec == NULL || bg->block == NULL ||
+            zstream_dopen(&bg->zs, fd, mode,
+                          bufsize > BGZF_MAX_BLOCK_LEN ? bufsize :
+                                                         BGZF_MAX_BLOCK_LEN,
+                          depth, 0) != 0) {
+        if (bg->dec != NULL) libdeflate_free_decompressor(bg->dec);
+        qes_free(bg->block);
+        qes_free(bg);
+        if (errno == 0) errno = ENOMEM;
+        return NULL;
+    }
+    return bg;
+}
+
+/* Read the next compressed block into inbuf. Returns 1 on success, setting
+ * ``*cdata`` & ``*clen`` to its deflate data and ``*crc`` & ``*isize`` from
+ * its trailer; 0 at EOF; or -1 on error. */
+static int
+bgzf_read_block (struct bgzf_handle *bg, const unsigned char **cdata,
+                 size_t *clen, uint32_t *crc, size_t *isize)
+{
+    unsigned char *hdr = bg->zs.inbuf;
+    ssize_t got = 0;
+    size_t xlen = 0;
+    size_t bsize = 0;
+    size_t slen = 0;
+    size_t iii = BGZF_HEADER_LEN;
+
+    got = zstream_read(&bg->zs, hdr, BGZF_HEADER_LEN);
+    if (got <= 0) return got;
+    if (got < BGZF_HEADER_LEN) goto truncated;
+    if (hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[2] != 8 || !(hdr[3] & 4)) {
+        goto notbgzf;
+    }
+    xlen = compress_le16(hdr + 10);
+    /* A block, extra field and trailer included, must fit in inbuf. Check
+     * before reading the extra field, which XLEN alone could overrun. */
+    if (BGZF_HEADER_LEN + xlen + 8 > BGZF_MAX_BLOCK_LEN) goto notbgzf;
+    got = zstream_read(&bg->zs, hdr + BGZF_HEADER_LEN, xlen);
+    if (got < 0) return -1;
+    if ((size_t)got != xlen) goto truncated;
+    /* Find the BC subfield, which holds the block size */
+    while (iii + 4 <= BGZF_HEADER_LEN + xlen) {
+        slen = compress_le16(hdr + iii + 2);
+        if (hdr[iii] == 'B' && hdr[iii + 1] == 'C' && slen == 2 &&
+                iii + 6 <= BGZF_HEADER_LEN + xlen) {
+            bsize = compress_le16(hdr + iii + 4) + 1;
+            break;
+        }
+        iii += 4 + slen;
+    }
+    if (bsize < BGZF_HEADER_LEN + xlen + 8) goto notbgzf;
+    slen = bsize - BGZF_HEADER_LEN - xlen;
+    got = zstream_read(&bg->zs, hdr + BGZF_HEADER_LEN + xlen, slen);
+    if (got < 0) return -1;
+    if ((size_t)got != slen) goto truncated;
+    bg->coffset += bsize;
+    *cdata = hdr + BGZF_HEADER_LEN + xlen;
+    *clen = slen - 8;
+    *crc = compress_le32(hdr + bsize - 8);
+    *isize = compress_le32(hdr + bsize - 4);
+    if (*isize > BGZF_MAX_BLOCK_LEN) goto notbgzf;
+    return 1;
+truncated:
+    bg->zs.errstr = "Truncated BGZF block";
+    return -1;
+notbgzf:
+    bg->zs.errstr = "Not a BGZF block";
+    return -1;
+}
+
+static ssize_t
+bgzf_read (void *handle, void *buf, size_t len)
+{
+    struct bgzf_handle *bg = handle;
+    unsigned char *out = buf;
+    const unsigned char *cdata = NULL;
+    unsigned char *dest = NULL;
+    size_t got = 0;
+    size_t clen = 0;
+    size_t isize = 0;
+    size_t actual = 0;
+    size_t tocpy = 0;
+    uint32_t crc = 0;
+    int ret = 0;
+
+    while (got < len) {
+        if (bg->blockpos < bg->blocklen) {
+            tocpy = bg->blocklen - bg->blockpos;
+            if (tocpy > len - got) tocpy = len - got;
+            memcpy(out + got, bg->block + bg->blockpos, tocpy);
+            bg->blockpos += tocpy;
+            got += tocpy;
+            continue;
+        }
+        ret = bgzf_read_block(bg, &cdata, &clen, &crc, &isize);
+        if (ret < 0) return -1;
+        if (ret == 0) break;
+        /* Inflate in place if the whole block fits, saving a copy */
+        dest = isize <= len - got ? out + got : bg->block;
+        if (libdeflate_deflate_decompress(bg->dec, cdata, clen, dest, isize,
+                                          &actual) != LIBDEFLATE_SUCCESS ||
+                actual != isize || libdeflate_crc32(0, dest, isize) != crc) {
+            bg->zs.errstr = "Corrupt BGZF block";
+            return -1;
+        }
+        if (dest == bg->block) {
+            bg->blocklen = isize;
+            bg->blockpos = 0;
+        } else {
+            got += isize;
+        }
+    }
+    return got;
+}
+
+static off_t
+bgzf_offset (void *handle)
+{
+    return ((struct bgzf_handle *)handle)->coffset;
+}
+
+static const char *
+bgzf_error (void *handle)
+{
+    return ((struct bgzf_handle *)handle)->zs.errstr;
+}
+
+static void
+bgzf_close (void *handle)
+{
+    struct bgzf_handle *bg = handle;
+
+    libdeflate_free_decompressor(bg->dec);
+    qes_free(bg->block);
+    zstream_close(&bg->zs);
+    qes_free(bg);
+}
+
+static const struct qes_compress_backend backend_bgzf = {
+    .name = "bgzf",
+    .type = QES_COMPRESSION_BGZF,
+    .dopen = bgzf_dopen,
+    .read = bgzf_read,
+    .seek = NULL,
+    .offset = bgzf_offset,
+    .error = bgzf_error,
+    .close = bgzf_close,
+};
+#endif
+
+
+const struct qes_compress_backend *
+qes_compress_backend (enum qes_compression type)
+{
+    switch (type) {
+        case QES_COMPRESSION_GZIP:
+            return &backend_gzip;
+        case QES_COMPRESSION_BGZF:
+#ifdef LIBDEFLATE_FOUND
+            return &backend_bgzf;
+#else
+            return &backend_gzip;
+#endif
+        case QES_COMPRESSION_BZIP2:
+#ifdef BZIP2_FOUND
+            return &backend_bzip2;
+#else
+            return NULL;
+#endif
+        case QES_COMPRESSION_XZ:
+#ifdef LIBLZMA_FOUND
+            return &backend_xz;
+#else
+            return NULL;
+#endif
+        case QES_COMPRESSION_ZSTD:
+#ifdef ZSTD_FOUND
+            return &backend_zstd;
+#else
+            return NULL;
+#endif
+        case QES_COMPRESSION_AUTO:
+        default:
+            return NULL;
+    }
+}
+
+const struct qes_compress_backend *
+qes_compress_backend_aio (enum qes_compression type)
+{
+    const struct qes_compress_backend *backend = qes_compress_backend(type);
+
+    /* BGZF falls back to gzip, too */
+    if (backend == &backend_gzip) {
+        return &backend_zlib;
+    }
+    return backend;
+}
+
+enum qes_compression
+qes_compress_detect (const unsigned char *magic, size_t len)
+{
+    if (magic == NULL) return QES_COMPRESSION_GZIP;
+    if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        /* BGZF is gzip with a BC extra subfield (first, in practice) */
+        if (len >= 16 && (magic[3] & 4) && compress_le16(magic + 10) >= 6 &&
+                magic[12] == 'B' && magic[13] == 'C' &&
+                compress_le16(magic + 14) == 2) {
+            return QES_COMPRESSION_BGZF;
+        }
+        return QES_COMPRESSION_GZIP;
+    }
+    if (len >= 4 && memcmp(magic, "BZh", 3) == 0 && magic[3] >= '1' &&
+            magic[3] <= '9') {
+        return QES_COMPRESSION_BZIP2;
+    }
+    if (len >= 6 && memcmp(magic, "\xfd" "7zXZ\0", 6) == 0) {
+        return QES_COMPRESSION_XZ;
+    }
+    /* A zstd frame, or a skippable frame */
+    if (len >= 4 && ((magic[0] == 0x28 && magic[1] == 0xb5 &&
+                      magic[2] == 0x2f && magic[3] == 0xfd) ||
+                     ((magic[0] & 0xf0) == 0x50 && magic[1] == 0x2a &&
+                      magic[2] == 0x4d && magic[3] == 0x18))) {
+        return QES_COMPRESSION_ZSTD;
+    }
+    return QES_COMPRESSION_GZIP;
+}
+
+#ifdef SPLICE_FOUND
+/* Copy the first bytes in pipe ``fd`` to ``magic`` without consuming them, by
+ * tee-ing them into a pipe of our own and reading that. Returns the number of
+ * bytes peeked at, which may be fewer than ``len`` if the writer hasn't
+ * written that many yet, or -1 on error. */
+static ssize_t
+compress_peek_pipe (int fd, unsigned char *magic, size_t len)
+{
+    int pfd[2];
+    ssize_t res = 0;
+
+    if (pipe(pfd) != 0) return -1;
+    do {
+        res = tee(fd, pfd[1], len, 0);
+    } while (res < 0 && errno == EINTR);
+    if (res > 0) {
+        res = read(pfd[0], magic, res);
+    }
+    close(pfd[0]);
+    close(pfd[1]);
+    return res;
+}
+#endif
+
+enum qes_compression
+qes_compress_detect_fd (int fd)
+{
+    unsigned char magic[QES_COMPRESS_MAGIC_LEN];
+    struct stat st;
+    off_t pos = 0;
+    ssize_t len = -1;
+
+    if (fd < 0 || fstat(fd, &st) != 0) return QES_COMPRESSION_GZIP;
+    if (S_ISREG(st.st_mode)) {
+        pos = lseek(fd, 0, SEEK_CUR);
+        if (pos >= 0) {
+            len = pread(fd, magic, sizeof(magic), pos);
+        }
+#ifdef SPLICE_FOUND
+    } else if (S_ISFIFO(st.st_mode)) {
+        len = compress_peek_pipe(fd, magic, sizeof(magic));
+#endif
+    }
+    if (len < 0) return QES_COMPRESSION_GZIP;
+    return qes_compress_detect(magic, len);
+}
+
+enum qes_compression
+qes_compress_detect_path (const char *path)
+{
+    struct stat st;
+    enum qes_compression type = QES_COMPRESSION_GZIP;
+    int fd = -1;
+
+    /* Opening a FIFO blocks until there's a writer, and it's probably not
+     * ours to read from, so only regular files are inspected. */
+    if (path == NULL || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return QES_COMPRESSION_GZIP;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return QES_COMPRESSION_GZIP;
+    type = qes_compress_detect_fd(fd);
+    close(fd);
+    return type;
+}
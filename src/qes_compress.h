@@ -0,0 +1,136 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_compress.h
+ *
+ *    Description:  Pluggable decompression backends for qes_file
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 16:12:40
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_COMPRESS_H
+#define QES_COMPRESS_H
+
+#include <qes_util.h>
+
+/* Bytes needed by qes_compress_detect to recognise every format */
+#define QES_COMPRESS_MAGIC_LEN 16
+
+enum qes_compression {
+    /* Detect from the file's magic bytes */
+    QES_COMPRESSION_AUTO = 0,
+    /* zlib's gz* functions, which also read and write uncompressed files */
+    QES_COMPRESSION_GZIP,
+    /* Blocked gzip, as from bgzip. Read with libdeflate if available,
+     * otherwise as QES_COMPRESSION_GZIP */
+    QES_COMPRESSION_BGZF,
+    QES_COMPRESSION_BZIP2,
+    QES_COMPRESSION_XZ,
+    QES_COMPRESSION_ZSTD,
+};
+
+/* The operations qes_file needs of a compression library. ``handle`` is
+ * whatever ``dopen`` returned. Only the gzip and zlib backends can write; the
+ * others only accept modes starting with 'r'. */
+struct qes_compress_backend {
+    const char *name;
+    enum qes_compression type;
+    /* Open file descriptor ``fd``, using ``bufsize`` bytes of input buffer
+     * if not 0, and keeping up to ``depth`` reads or writes in flight (see
+     * qes_aio.h) if the backend does its own IO and ``depth`` isn't 0.
+     * ``close`` closes ``fd``. Returns NULL and sets errno on error, leaving
+     * ``fd`` open. */
+    void *(*dopen) (int fd, const char *mode, size_t bufsize, unsigned depth);
+    /* Read up to ``len`` decompressed bytes. Returns the number read, 0 at
+     * EOF or -1 on error. */
+    ssize_t (*read) (void *handle, void *buf, size_t len);
+    /* Move to decompressed byte ``offset``. Returns 0 on success, 1 on error,
+     * or -1 if this backend or file can't seek, in which case qes_file seeks
+     * by reading. May be NULL, which is the same as always returning -1. */
+    int (*seek) (void *handle, off_t offset);
+    /* Compressed bytes consumed so far */
+    off_t (*offset) (void *handle);
+    /* Description of the last error. Never NULL. */
+    const char *(*error) (void *handle);
+    void (*close) (void *handle);
+    /* Compress and write ``len`` bytes. Returns ``len``, or -1 on error. NULL
+     * for backends that can't write. */
+    ssize_t (*write) (void *handle, const void *buf, size_t len);
+    /* Write out everything compressed so far, such that a reader can
+     * decompress it. Returns 0 on success, 1 on error. */
+    int (*flush) (void *handle);
+    /* Is the file being read or written uncompressed. Only meaningful for
+     * readers once they have read something. May be NULL, meaning never. */
+    int (*direct) (void *handle);
+};
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_compress_backend
+Paramters:      enum qes_compression type: Compression format.
+Description:    Get the backend that reads ``type``, if libqes was built with
+                the library it needs. BGZF falls back to the gzip backend.
+Returns:        const struct qes_compress_backend *: The backend, or NULL if
+                it isn't available (or ``type`` is QES_COMPRESSION_AUTO).
+ *===========================================================================*/
+const struct qes_compress_backend *
+qes_compress_backend (enum qes_compression type);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_compress_backend_aio
+Paramters:      enum qes_compression type: Compression format.
+Description:    As per qes_compress_backend, but for reading or writing with
+                reads or writes in flight. zlib's gz* functions do their own
+                IO, so gzip (and BGZF, without libdeflate) is handled by the
+                "zlib" backend, which inflates and deflates itself.
+Returns:        const struct qes_compress_backend *: The backend, or NULL if
+                it isn't available.
+ *===========================================================================*/
+const struct qes_compress_backend *
+qes_compress_backend_aio (enum qes_compression type);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_compress_detect
+Paramters:      const unsigned char *magic: The first bytes of a file.
+                size_t len: Number of bytes in ``magic``. Should be
+                    QES_COMPRESS_MAGIC_LEN unless the file is shorter.
+Description:    Guess the compression format of a file from its magic bytes.
+                Anything unrecognised, including uncompressed text, is
+                QES_COMPRESSION_GZIP, as zlib reads it transparently.
+Returns:        enum qes_compression: The format.
+ *===========================================================================*/
+enum qes_compression qes_compress_detect (const unsigned char *magic,
+                                          size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_compress_detect_path
+Paramters:      const char *path: File to inspect.
+Description:    As per qes_compress_detect, reading the magic bytes from
+                ``path``. Only regular files are read, as the bytes read
+                from a pipe or device would be lost; anything else is
+                QES_COMPRESSION_GZIP.
+Returns:        enum qes_compression: The format.
+ *===========================================================================*/
+enum qes_compression qes_compress_detect_path (const char *path);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_compress_detect_fd
+Paramters:      int fd: Open file descriptor to inspect.
+Description:    As per qes_compress_detect, peeking at the magic bytes of
+                ``fd`` without consuming them. Regular files are read with
+                pread. Pipes are peeked at by tee-ing them into another pipe,
+                where the system supports it; this blocks until the writer
+                has written something. Anything else is
+                QES_COMPRESSION_GZIP.
+Returns:        enum qes_compression: The format.
+ *===========================================================================*/
+enum qes_compression qes_compress_detect_fd (int fd);
+
+#endif /* QES_COMPRESS_H */
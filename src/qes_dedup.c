@@ -0,0 +1,530 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_dedup.c
+ *
+ *    Description:  Streaming detection of duplicate and near-duplicate
+ *                  reads
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 23:36:05
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_dedup.h"
+
+#ifdef OPENMP_FOUND
+#define DEDUP_OMP(x) _Pragma(STRINGIFY(omp x))
+#else
+#define DEDUP_OMP(x)
+#endif
+
+/* Mates are hashed with different seeds, so swapping them changes the hash */
+#define DEDUP_SEED1 0x5eedd0d0c0ffee11ULL
+#define DEDUP_SEED2 0x5eedd0d0c0ffee22ULL
+#define DEDUP_INIT_SLOTS 1024
+#define DEDUP_INIT_READS 1024
+
+
+struct qes_dedup *
+qes_dedup_create (const struct qes_dedup_opts *opts)
+{
+    struct qes_dedup *dedup = qes_calloc(1, sizeof(*dedup));
+
+    if (dedup == NULL) return NULL;
+    if (opts != NULL) dedup->opts = *opts;
+    if (dedup->opts.n_hashes == 0) dedup->opts.n_hashes = QES_DEDUP_N_HASHES;
+    if (dedup->opts.n_threads == 0) dedup->opts.n_threads = 1;
+    if (dedup->opts.mode == QES_DEDUP_BLOOM) {
+        if (dedup->opts.max_mem == 0) {
+            dedup->opts.max_mem = QES_DEDUP_BLOOM_MEM;
+        }
+        dedup->n_counters = dedup->opts.max_mem;
+        dedup->counters = qes_calloc_errnil(dedup->n_counters, 1);
+        if (dedup->counters == NULL) goto error;
+    } else if (dedup->opts.mode == QES_DEDUP_EXACT) {
+        dedup->n_slots = DEDUP_INIT_SLOTS;
+        dedup->keys = qes_calloc(dedup->n_slots * 2, sizeof(*dedup->keys));
+        dedup->counts = qes_calloc(dedup->n_slots, sizeof(*dedup->counts));
+        if (dedup->keys == NULL || dedup->counts == NULL) goto error;
+    } else if (dedup->opts.mode == QES_DEDUP_NEAR) {
+        if (dedup->opts.max_mismatches == 0) {
+            dedup->opts.max_mismatches = QES_DEDUP_MAX_MISMATCHES;
+        }
+        if (dedup->opts.max_mismatches > QES_DEDUP_MISMATCHES_LIMIT) {
+            goto error;
+        }
+        dedup->reads_capacity = DEDUP_INIT_READS;
+        dedup->reads = qes_calloc(dedup->reads_capacity,
+                                  sizeof(*dedup->reads));
+        dedup->n_seg_slots = DEDUP_INIT_SLOTS;
+        dedup->seg_keys = qes_calloc(dedup->n_seg_slots,
+                                     sizeof(*dedup->seg_keys));
+        dedup->seg_reads = qes_calloc(dedup->n_seg_slots,
+                                      sizeof(*dedup->seg_reads));
+        /* Smaller blocks under a small budget, so one isn't all of it */
+        dedup->arena = qes_arena_create(
+                dedup->opts.max_mem / 16 < QES_ARENA_BLOCK_LEN ?
+                dedup->opts.max_mem / 16 : 0);
+        if (dedup->reads == NULL || dedup->seg_keys == NULL ||
+                dedup->seg_reads == NULL || dedup->arena == NULL) {
+            goto error;
+        }
+        dedup->arena_mem = qes_arena_size(dedup->arena);
+    } else {
+        goto error;
+    }
+    return dedup;
+error:
+    qes_dedup_destroy(dedup);
+    return NULL;
+}
+
+static inline void
+dedup_hash (const char *seq1, size_t len1, const char *seq2, size_t len2,
+            uint64_t *hash)
+{
+    uint64_t mate[2];
+
+    qes_hash128(seq1, len1, DEDUP_SEED1, hash);
+    if (seq2 != NULL) {
+        qes_hash128(seq2, len2, DEDUP_SEED2, mate);
+        hash[0] ^= mate[0];
+        hash[1] ^= mate[1];
+    }
+}
+
+/* Find the slot of ``hash``, or the empty slot where it belongs */
+static inline size_t
+dedup_find (const struct qes_dedup *dedup, const uint64_t *hash)
+{
+    size_t mask = dedup->n_slots - 1;
+    size_t slot = hash[0] & mask;
+    const uint64_t *key = NULL;
+
+    while (1) {
+        key = &dedup->keys[slot * 2];
+        if ((key[0] == hash[0] && key[1] == hash[1]) ||
+                (key[0] == 0 && key[1] == 0)) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+/* Double the hash set. Returns 0, or 1 on error. */
+static int
+dedup_grow (struct qes_dedup *dedup)
+{
+    struct qes_dedup old = *dedup;
+    size_t slot = 0;
+    size_t iii = 0;
+
+    dedup->n_slots = old.n_slots << 1;
+    if (dedup->opts.max_mem > 0 && dedup->n_slots *
+            (2 * sizeof(*dedup->keys) + sizeof(*dedup->counts)) >
+            dedup->opts.max_mem) {
+        dedup->n_slots = old.n_slots;
+        return 1;
+    }
+    dedup->keys = qes_calloc_errnil(dedup->n_slots * 2, sizeof(*dedup->keys));
+    dedup->counts = qes_calloc_errnil(dedup->n_slots,
+                                      sizeof(*dedup->counts));
+    if (dedup->keys == NULL || dedup->counts == NULL) {
+        qes_free(dedup->keys);
+        qes_free(dedup->counts);
+        *dedup = old;
+        return 1;
+    }
+    for (iii = 0; iii < old.n_slots; iii++) {
+        if (old.keys[iii * 2] == 0 && old.keys[iii * 2 + 1] == 0) continue;
+        slot = dedup_find(dedup, &old.keys[iii * 2]);
+        dedup->keys[slot * 2] = old.keys[iii * 2];
+        dedup->keys[slot * 2 + 1] = old.keys[iii * 2 + 1];
+        dedup->counts[slot] = old.counts[iii];
+    }
+    qes_free(old.keys);
+    qes_free(old.counts);
+    return 0;
+}
+
+static int64_t
+dedup_add_exact (struct qes_dedup *dedup, const uint64_t *hash)
+{
+    uint64_t key[2];
+    size_t slot = 0;
+    uint32_t count = 0;
+
+    key[0] = hash[0];
+    /* All zeros marks an empty slot */
+    key[1] = hash[0] == 0 && hash[1] == 0 ? 1 : hash[1];
+    /* Keep the load at most a half, so probes stay short */
+    if ((dedup->n_keys + 1) * 2 > dedup->n_slots && dedup_grow(dedup) != 0) {
+        return -1;
+    }
+    slot = dedup_find(dedup, key);
+    count = dedup->counts[slot];
+    if (count == 0) {
+        dedup->keys[slot * 2] = key[0];
+        dedup->keys[slot * 2 + 1] = key[1];
+        dedup->n_keys++;
+    }
+    if (count < UINT32_MAX) dedup->counts[slot]++;
+    return count;
+}
+
+static int64_t
+dedup_add_bloom (struct qes_dedup *dedup, const uint64_t *hash)
+{
+    uint64_t step = hash[1] | 1;
+    uint8_t min = UINT8_MAX;
+    size_t idx = 0;
+    unsigned iii = 0;
+
+    /* Counters are hash[0] + i * hash[1], as per Kirsch and Mitzenmacher */
+    for (iii = 0; iii < dedup->opts.n_hashes; iii++) {
+        idx = (hash[0] + iii * step) % dedup->n_counters;
+        if (dedup->counters[idx] < min) min = dedup->counters[idx];
+    }
+    if (min == UINT8_MAX) return min;
+    /* Conservative update: only the smallest counters count this read, which
+     * keeps the others from overestimating */
+    for (iii = 0; iii < dedup->opts.n_hashes; iii++) {
+        idx = (hash[0] + iii * step) % dedup->n_counters;
+        if (dedup->counters[idx] == min) dedup->counters[idx] = min + 1;
+    }
+    return min;
+}
+
+/* Hash of segment ``seg`` of a read. The mates' lengths are in the seed, as
+ * only reads of the same lengths can be near-duplicates. */
+static inline uint64_t
+dedup_seg_key (const struct qes_dedup *dedup, const char *seq, size_t len1,
+               size_t len2, unsigned seg)
+{
+    const size_t n_segs = dedup->opts.max_mismatches + 1;
+    const size_t len = len1 + len2;
+    const size_t start = seg * len / n_segs;
+    const size_t end = (seg + 1) * len / n_segs;
+    uint64_t seed = qes_hash_fmix64(DEDUP_SEED1 ^ len1) ^
+                    qes_hash_fmix64(DEDUP_SEED2 ^ len2) ^ seg;
+    uint64_t key = qes_hash64(seq + start, end - start, seed);
+
+    /* 0 marks an empty slot */
+    return key != 0 ? key : 1;
+}
+
+/* Bytes held by the near-duplicate set, besides the arena */
+static inline size_t
+dedup_near_mem (size_t reads_capacity, size_t n_seg_slots)
+{
+    return reads_capacity * sizeof(struct qes_dedup_read) +
+           n_seg_slots * (sizeof(uint64_t) + sizeof(uint32_t));
+}
+
+/* Double the segment multimap. Returns 0, or 1 on error. */
+static int
+dedup_near_grow (struct qes_dedup *dedup)
+{
+    const size_t n_slots = dedup->n_seg_slots << 1;
+    const size_t mask = n_slots - 1;
+    uint64_t *keys = NULL;
+    uint32_t *reads = NULL;
+    size_t slot = 0;
+    size_t iii = 0;
+
+    if (dedup->opts.max_mem > 0 && dedup->arena_mem +
+            dedup_near_mem(dedup->reads_capacity, n_slots) >
+            dedup->opts.max_mem) {
+        return 1;
+    }
+    keys = qes_calloc_errnil(n_slots, sizeof(*keys));
+    reads = qes_calloc_errnil(n_slots, sizeof(*reads));
+    if (keys == NULL || reads == NULL) {
+        qes_free(keys);
+        qes_free(reads);
+        return 1;
+    }
+    for (iii = 0; iii < dedup->n_seg_slots; iii++) {
+        if (dedup->seg_keys[iii] == 0) continue;
+        slot = dedup->seg_keys[iii] & mask;
+        while (keys[slot] != 0) slot = (slot + 1) & mask;
+        keys[slot] = dedup->seg_keys[iii];
+        reads[slot] = dedup->seg_reads[iii];
+    }
+    qes_free(dedup->seg_keys);
+    qes_free(dedup->seg_reads);
+    dedup->seg_keys = keys;
+    dedup->seg_reads = reads;
+    dedup->n_seg_slots = n_slots;
+    return 0;
+}
+
+/* Keep a read as distinct, indexing each of its segments. Returns 0, or 1
+ * on error. */
+static int
+dedup_near_keep (struct qes_dedup *dedup, const char *seq, size_t len1,
+                 size_t len2, const uint64_t *seg_keys)
+{
+    const size_t n_segs = dedup->opts.max_mismatches + 1;
+    const size_t len = len1 + len2;
+    struct qes_dedup_read *read = NULL;
+    struct qes_arena_block *blk = NULL;
+    size_t arena_grow = 0;
+    size_t mask = 0;
+    size_t slot = 0;
+    size_t newcap = 0;
+    size_t iii = 0;
+
+    if (dedup->n_distinct >= UINT32_MAX) return 1;
+    /* Keep the load at most a half, so probes stay short */
+    while ((dedup->n_segs + n_segs) * 2 > dedup->n_seg_slots) {
+        if (dedup_near_grow(dedup) != 0) return 1;
+    }
+    if (dedup->n_distinct >= dedup->reads_capacity) {
+        newcap = dedup->reads_capacity << 1;
+        if (dedup->opts.max_mem > 0 && dedup->arena_mem +
+                dedup_near_mem(newcap, dedup->n_seg_slots) >
+                dedup->opts.max_mem) {
+            return 1;
+        }
+        read = qes_realloc_errnil(dedup->reads, newcap * sizeof(*read));
+        if (read == NULL) return 1;
+        dedup->reads = read;
+        dedup->reads_capacity = newcap;
+    }
+    /* The read needs a new block of the arena if it might not fit in this
+     * one, which the arena makes at least block_size */
+    blk = dedup->arena->current;
+    if (len + 1 + QES_ARENA_ALIGN > blk->size - blk->used) {
+        arena_grow = len + 1 > dedup->arena->block_size ?
+                     len + 1 : dedup->arena->block_size;
+        arena_grow += QES_ARENA_ALIGN;
+    }
+    if (dedup->opts.max_mem > 0 && dedup->arena_mem + arena_grow +
+            dedup_near_mem(dedup->reads_capacity, dedup->n_seg_slots) >
+            dedup->opts.max_mem) {
+        return 1;
+    }
+    read = &dedup->reads[dedup->n_distinct];
+    read->seq = qes_arena_strndup(dedup->arena, seq, len);
+    if (read->seq == NULL) return 1;
+    if (dedup->arena->current != blk) {
+        dedup->arena_mem += dedup->arena->current->size;
+    }
+    read->len1 = len1;
+    read->len2 = len2;
+    read->count = 1;
+    read->seen = dedup->epoch;
+    mask = dedup->n_seg_slots - 1;
+    for (iii = 0; iii < n_segs; iii++) {
+        slot = seg_keys[iii] & mask;
+        while (dedup->seg_keys[slot] != 0) slot = (slot + 1) & mask;
+        dedup->seg_keys[slot] = seg_keys[iii];
+        dedup->seg_reads[slot] = dedup->n_distinct;
+    }
+    dedup->n_segs += n_segs;
+    dedup->n_distinct++;
+    return 0;
+}
+
+static int64_t
+dedup_add_near (struct qes_dedup *dedup, const char *seq, size_t len1,
+                size_t len2)
+{
+    const size_t n_segs = dedup->opts.max_mismatches + 1;
+    const size_t len = len1 + len2;
+    const size_t mask = dedup->n_seg_slots - 1;
+    const int_fast32_t max = dedup->opts.max_mismatches;
+    struct qes_dedup_read *read = NULL;
+    uint64_t seg_keys[QES_DEDUP_MISMATCHES_LIMIT + 1];
+    int_fast32_t dist = 0;
+    uint32_t count = 0;
+    size_t slot = 0;
+    size_t iii = 0;
+
+    if (++dedup->epoch == 0) {
+        /* Wrapped, so forget when every read was seen */
+        for (iii = 0; iii < dedup->n_distinct; iii++) {
+            dedup->reads[iii].seen = 0;
+        }
+        dedup->epoch = 1;
+    }
+    /* By the pigeonhole principle, a read within max_mismatches of another
+     * matches it exactly in at least one of max_mismatches + 1 segments */
+    for (iii = 0; iii < n_segs; iii++) {
+        seg_keys[iii] = dedup_seg_key(dedup, seq, len1, len2, iii);
+        for (slot = seg_keys[iii] & mask; dedup->seg_keys[slot] != 0;
+                slot = (slot + 1) & mask) {
+            if (dedup->seg_keys[slot] != seg_keys[iii]) continue;
+            read = &dedup->reads[dedup->seg_reads[slot]];
+            if (read->seen == dedup->epoch) continue;
+            read->seen = dedup->epoch;
+            if (read->len1 != len1 || read->len2 != len2) continue;
+            /* qes_match_hamming_max takes a length of 0 to mean strlen */
+            dist = len > 0 ? qes_match_hamming_max(read->seq, seq, len, max)
+                           : 0;
+            if (dist >= 0 && dist <= max) {
+                count = read->count;
+                if (count < UINT32_MAX) read->count++;
+                return count;
+            }
+        }
+    }
+    if (dedup_near_keep(dedup, seq, len1, len2, seg_keys) != 0) return -1;
+    return 0;
+}
+
+/* Count a read checked, whose count was ``count`` */
+static inline int64_t
+dedup_tally (struct qes_dedup *dedup, int64_t count)
+{
+    if (count < 0) return count;
+    dedup->n_reads++;
+    if (count > 0) dedup->n_dups++;
+    return count;
+}
+
+static inline int64_t
+dedup_add (struct qes_dedup *dedup, const uint64_t *hash)
+{
+    if (dedup->opts.mode == QES_DEDUP_BLOOM) {
+        return dedup_tally(dedup, dedup_add_bloom(dedup, hash));
+    }
+    return dedup_tally(dedup, dedup_add_exact(dedup, hash));
+}
+
+/* As per dedup_add, for QES_DEDUP_NEAR */
+static int64_t
+dedup_check_near (struct qes_dedup *dedup, const char *seq1, size_t len1,
+                  const char *seq2, size_t len2)
+{
+    char *buf = NULL;
+
+    if (seq2 == NULL) {
+        return dedup_tally(dedup, dedup_add_near(dedup, seq1, len1, 0));
+    }
+    if (len1 + len2 > dedup->pair_buf_len) {
+        buf = qes_realloc(dedup->pair_buf, len1 + len2);
+        if (buf == NULL) return -1;
+        dedup->pair_buf = buf;
+        dedup->pair_buf_len = len1 + len2;
+    }
+    /* Both empty would leave pair_buf NULL, which memcpy mustn't get */
+    if (len1 > 0) memcpy(dedup->pair_buf, seq1, len1);
+    if (len2 > 0) memcpy(dedup->pair_buf + len1, seq2, len2);
+    return dedup_tally(dedup, dedup_add_near(dedup, dedup->pair_buf, len1,
+                                             len2));
+}
+
+int64_t
+qes_dedup_check (struct qes_dedup *dedup, const struct qes_seq *seq)
+{
+    uint64_t hash[2];
+
+    if (dedup == NULL || seq == NULL || !qes_str_ok(&seq->seq)) return -1;
+    if (dedup->opts.mode == QES_DEDUP_NEAR) {
+        return dedup_check_near(dedup, seq->seq.str, seq->seq.len, NULL, 0);
+    }
+    dedup_hash(seq->seq.str, seq->seq.len, NULL, 0, hash);
+    return dedup_add(dedup, hash);
+}
+
+int64_t
+qes_dedup_check_pair (struct qes_dedup *dedup, const struct qes_seq *seq1,
+                      const struct qes_seq *seq2)
+{
+    uint64_t hash[2];
+
+    if (dedup == NULL || seq1 == NULL || !qes_str_ok(&seq1->seq) ||
+            seq2 == NULL || !qes_str_ok(&seq2->seq)) {
+        return -1;
+    }
+    if (dedup->opts.mode == QES_DEDUP_NEAR) {
+        return dedup_check_near(dedup, seq1->seq.str, seq1->seq.len,
+                                seq2->seq.str, seq2->seq.len);
+    }
+    dedup_hash(seq1->seq.str, seq1->seq.len, seq2->seq.str, seq2->seq.len,
+               hash);
+    return dedup_add(dedup, hash);
+}
+
+ssize_t
+qes_dedup_check_batch (struct qes_dedup *dedup,
+                       const struct qes_seqbatch *batch1,
+                       const struct qes_seqbatch *batch2, int64_t *counts)
+{
+    uint64_t *hashes = NULL;
+    size_t n_seqs = 0;
+    size_t n_dups = 0;
+    size_t iii = 0;
+    int64_t count = 0;
+
+    if (dedup == NULL || batch1 == NULL ||
+            (batch2 != NULL && batch2->n_seqs != batch1->n_seqs)) {
+        return -1;
+    }
+    n_seqs = batch1->n_seqs;
+    if (dedup->opts.mode == QES_DEDUP_NEAR) {
+        for (iii = 0; iii < n_seqs; iii++) {
+            count = dedup_check_near(
+                    dedup, qes_seqbatch_str(batch1, seq, iii),
+                    qes_seqbatch_len(batch1, seq, iii),
+                    batch2 == NULL ? NULL : qes_seqbatch_str(batch2, seq, iii),
+                    batch2 == NULL ? 0 : qes_seqbatch_len(batch2, seq, iii));
+            if (count < 0) return -1;
+            if (counts != NULL) counts[iii] = count;
+            n_dups += count > 0;
+        }
+        return n_dups;
+    }
+    if (n_seqs > dedup->batch_capacity) {
+        hashes = qes_realloc(dedup->batch_hashes,
+                             n_seqs * 2 * sizeof(*hashes));
+        if (hashes == NULL) return -1;
+        dedup->batch_hashes = hashes;
+        dedup->batch_capacity = n_seqs;
+    }
+    hashes = dedup->batch_hashes;
+    /* Hashing is the expensive part, and can be done in any order */
+    DEDUP_OMP(parallel for num_threads(dedup->opts.n_threads) \
+              schedule(static))
+    for (iii = 0; iii < n_seqs; iii++) {
+        dedup_hash(qes_seqbatch_str(batch1, seq, iii),
+                   qes_seqbatch_len(batch1, seq, iii),
+                   batch2 == NULL ? NULL : qes_seqbatch_str(batch2, seq, iii),
+                   batch2 == NULL ? 0 : qes_seqbatch_len(batch2, seq, iii),
+                   &hashes[iii * 2]);
+    }
+    /* But reads are added in order, so the first copy is the original */
+    for (iii = 0; iii < n_seqs; iii++) {
+        count = dedup_add(dedup, &hashes[iii * 2]);
+        if (count < 0) return -1;
+        if (counts != NULL) counts[iii] = count;
+        n_dups += count > 0;
+    }
+    return n_dups;
+}
+
+void
+qes_dedup_destroy_ (struct qes_dedup *dedup)
+{
+    if (dedup != NULL) {
+        qes_free(dedup->keys);
+        qes_free(dedup->counts);
+        qes_free(dedup->counters);
+        qes_free(dedup->batch_hashes);
+        qes_free(dedup->reads);
+        qes_free(dedup->seg_keys);
+        qes_free(dedup->seg_reads);
+        qes_free(dedup->pair_buf);
+        qes_arena_destroy(dedup->arena);
+        qes_free(dedup);
+    }
+}
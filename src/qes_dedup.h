@@ -0,0 +1,196 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_dedup.h
+ *
+ *    Description:  Streaming detection of duplicate and near-duplicate
+ *                  reads
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 23:36:05
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_DEDUP_H
+#define QES_DEDUP_H
+
+#include <qes_util.h>
+#include <qes_hash.h>
+#include <qes_arena.h>
+#include <qes_match.h>
+#include <qes_seq.h>
+#include <qes_seqbatch.h>
+
+/* Defaults of struct qes_dedup_opts */
+#define QES_DEDUP_BLOOM_MEM (64<<20)
+#define QES_DEDUP_N_HASHES 4
+#define QES_DEDUP_MAX_MISMATCHES 2
+/* Most max_mismatches allowed, as each needs a segment per read */
+#define QES_DEDUP_MISMATCHES_LIMIT 63
+
+enum qes_dedup_mode {
+    /* A hash set of each distinct read's 128-bit hash. Memory grows with
+     * the number of distinct reads, by 20 bytes each at worst. */
+    QES_DEDUP_EXACT = 0,
+    /* A counting Bloom filter of fixed size. A read may be wrongly called
+     * a duplicate, more often as the filter fills. */
+    QES_DEDUP_BLOOM = 1,
+    /* Each distinct read, so that reads of the same length within
+     * ``max_mismatches`` of one are duplicates of it too, e.g. PCR
+     * duplicates with a sequencing error. Reads are split into
+     * ``max_mismatches + 1`` segments, one of which must match exactly, so
+     * only reads sharing a segment are compared. Memory grows with the
+     * number and length of distinct reads. */
+    QES_DEDUP_NEAR = 2,
+};
+
+/* A distinct read of QES_DEDUP_NEAR */
+struct qes_dedup_read {
+    /* The read, or both mates back to back */
+    char *seq;
+    size_t len1;
+    size_t len2;
+    uint32_t count;
+    /* When it was last compared, so each read is compared once per check */
+    uint32_t seen;
+};
+
+/* Options for qes_dedup_create. A zeroed struct gives the defaults. */
+struct qes_dedup_opts {
+    enum qes_dedup_mode mode;
+    /* Most bytes of memory to use. For QES_DEDUP_EXACT and QES_DEDUP_NEAR,
+     * 0 is unbounded, and it's an error to need more. For QES_DEDUP_BLOOM,
+     * this is the size of the filter, and 0 means QES_DEDUP_BLOOM_MEM. */
+    size_t max_mem;
+    /* Counters set per read by QES_DEDUP_BLOOM. 0 means QES_DEDUP_N_HASHES. */
+    unsigned n_hashes;
+    /* Most mismatches between near-duplicates, for QES_DEDUP_NEAR, up to
+     * QES_DEDUP_MISMATCHES_LIMIT. 0 means QES_DEDUP_MAX_MISMATCHES; use
+     * QES_DEDUP_EXACT for none. */
+    unsigned max_mismatches;
+    /* Threads hashing reads in qes_dedup_check_batch, if libqes was built
+     * with OpenMP. 0 means 1. */
+    unsigned n_threads;
+};
+
+struct qes_dedup {
+    struct qes_dedup_opts opts;
+    /* QES_DEDUP_EXACT: ``n_slots`` open-addressed pairs of hash words, and
+     * how many times each was seen */
+    uint64_t *keys;
+    uint32_t *counts;
+    size_t n_slots;
+    size_t n_keys;
+    /* QES_DEDUP_BLOOM: saturating counters */
+    uint8_t *counters;
+    size_t n_counters;
+    /* QES_DEDUP_NEAR: the distinct reads, their sequences, and an
+     * open-addressed multimap from the hash of each of their segments to
+     * their index */
+    struct qes_dedup_read *reads;
+    size_t n_distinct;
+    size_t reads_capacity;
+    struct qes_arena *arena;
+    size_t arena_mem;
+    uint64_t *seg_keys;
+    uint32_t *seg_reads;
+    size_t n_seg_slots;
+    size_t n_segs;
+    uint32_t epoch;
+    /* Mates of a pair, back to back */
+    char *pair_buf;
+    size_t pair_buf_len;
+    /* Reads checked, and of those, duplicates */
+    uint64_t n_reads;
+    uint64_t n_dups;
+    /* Hashes of a batch */
+    uint64_t *batch_hashes;
+    size_t batch_capacity;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_dedup_create
+Paramters:      const struct qes_dedup_opts *opts: Options, or NULL for the
+                    defaults.
+Description:    Create an empty set of reads, to find duplicates in a single
+                pass, e.g. during the read loop. For QES_DEDUP_EXACT and
+                QES_DEDUP_BLOOM, reads are identified by a 128-bit hash of
+                their sequence (qes_hash128), so distinct reads colliding is
+                vanishingly unlikely. For QES_DEDUP_NEAR, reads are compared
+                base by base, and Ns are just another base.
+Returns:        struct qes_dedup *: The set, or NULL on error.
+ *===========================================================================*/
+struct qes_dedup *qes_dedup_create (const struct qes_dedup_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_dedup_check
+Paramters:      struct qes_dedup *dedup: Set to check against.
+                const struct qes_seq *seq: Read to check and add.
+Description:    Add ``seq`` to ``dedup``, and say how many times it was seen
+                before. A read with a count above 0 is a duplicate, which can
+                be flagged or dropped. For QES_DEDUP_NEAR, a near-duplicate
+                counts towards the first read it is found to be within
+                ``max_mismatches`` of, and isn't kept itself, so it can't be
+                matched by later reads.
+Returns:        int64_t: The number of times ``seq`` was added before (an
+                estimate for QES_DEDUP_BLOOM, which saturates at 255), or
+                -1 on error, including running out of ``max_mem``.
+ *===========================================================================*/
+int64_t qes_dedup_check (struct qes_dedup *dedup, const struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_dedup_check_pair
+Paramters:      struct qes_dedup *dedup: Set to check against.
+                const struct qes_seq *seq1, *seq2: Mates to check and add.
+Description:    As per qes_dedup_check, but the mates are hashed together, so
+                a pair is only a duplicate if both mates are. For
+                QES_DEDUP_NEAR, ``max_mismatches`` applies to the pair as a
+                whole. Don't mix single and paired reads in one set.
+Returns:        int64_t: As per qes_dedup_check.
+ *===========================================================================*/
+int64_t qes_dedup_check_pair (struct qes_dedup *dedup,
+                              const struct qes_seq *seq1,
+                              const struct qes_seq *seq2);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_dedup_check_batch
+Paramters:      struct qes_dedup *dedup: Set to check against.
+                const struct qes_seqbatch *batch1: Reads to check and add.
+                const struct qes_seqbatch *batch2: Mates of ``batch1``, or
+                    NULL if unpaired.
+                int64_t *counts: Filled with the result of qes_dedup_check
+                    for each read (or pair), or NULL.
+Description:    As per qes_dedup_check, for every read of a batch. Reads are
+                hashed in parallel, then added in order, so the first copy of
+                each read is the one with a count of 0, as when checking
+                reads one at a time. QES_DEDUP_NEAR checks reads in order,
+                without threads, as whether a read is kept depends on the
+                reads before it.
+Returns:        ssize_t: The number of duplicates in the batch, or -1 on
+                error.
+ *===========================================================================*/
+ssize_t qes_dedup_check_batch (struct qes_dedup *dedup,
+                               const struct qes_seqbatch *batch1,
+                               const struct qes_seqbatch *batch2,
+                               int64_t *counts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_dedup_destroy
+Paramters:      struct qes_dedup *: Set to destroy.
+Description:    Deallocate and set to NULL a struct qes_dedup on the heap.
+Returns:        void.
+ *===========================================================================*/
+void qes_dedup_destroy_ (struct qes_dedup *dedup);
+#define qes_dedup_destroy(dedup) do {                                       \
+            qes_dedup_destroy_(dedup);                                      \
+            dedup = NULL;                                                   \
+        } while(0)
+
+#endif /* QES_DEDUP_H */
@@ -0,0 +1,390 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_demux.c
+ *
+ *    Description:  Writing records to many output files at once
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 22:47:19
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_demux.h"
+
+#include <fcntl.h>
+#include <zlib.h>
+
+#ifdef OPENMP_FOUND
+#define DEMUX_OMP(x) _Pragma(STRINGIFY(omp x))
+#else
+#define DEMUX_OMP(x)
+#endif
+
+struct qes_demux_block {
+    struct qes_demux_dest *dest;
+    /* The block is ``len`` bytes at ``offset`` of dest's buffer */
+    size_t offset;
+    size_t len;
+    /* Compressed block, as a gzip member */
+    unsigned char *out;
+    size_t out_len;
+    size_t out_capacity;
+    int error;
+};
+
+
+struct qes_demux_writer *
+qes_demux_writer_create (const struct qes_demux_opts *opts)
+{
+    struct qes_demux_writer *writer = NULL;
+
+    writer = qes_calloc_errnil(1, sizeof(*writer));
+    if (writer == NULL) return NULL;
+    if (opts != NULL) writer->opts = *opts;
+    if (writer->opts.format == UNKNOWN_FMT) writer->opts.format = FASTQ_FMT;
+    if (writer->opts.level == 0) writer->opts.level = Z_DEFAULT_COMPRESSION;
+    if (writer->opts.mem_budget == 0) {
+        writer->opts.mem_budget = QES_DEMUX_MEM_BUDGET;
+    }
+    if (writer->opts.block_len == 0) {
+        writer->opts.block_len = QES_DEMUX_BLOCK_LEN;
+    }
+    if (writer->opts.max_open == 0) writer->opts.max_open = QES_DEMUX_MAX_OPEN;
+    if (writer->opts.n_threads == 0) writer->opts.n_threads = 1;
+    return writer;
+}
+
+/* Open the file of ``dest``, closing the least recently used if too many are
+ * open. Returns 0, or 1 on error. */
+static int
+demux_open (struct qes_demux_writer *writer, struct qes_demux_dest *dest,
+            int truncate)
+{
+    struct qes_demux_dest *lru = NULL;
+    size_t iii = 0;
+
+    dest->last_used = writer->clock++;
+    if (dest->fd >= 0) return 0;
+    if (writer->n_open >= writer->opts.max_open) {
+        for (iii = 0; iii < writer->n_dests; iii++) {
+            if (writer->dests[iii].fd >= 0 && (lru == NULL ||
+                    writer->dests[iii].last_used < lru->last_used)) {
+                lru = &writer->dests[iii];
+            }
+        }
+        close(lru->fd);
+        lru->fd = -1;
+        writer->n_open--;
+    }
+    /* Blocks are appended, so files are only truncated when added */
+    dest->fd = open(dest->path, O_WRONLY | O_CREAT | O_APPEND |
+                    (truncate ? O_TRUNC : 0), 0666);
+    if (dest->fd < 0) {
+        snprintf(writer->errstr, sizeof(writer->errstr),
+                 "Couldn't open %s: %s", dest->path, strerror(errno));
+        return 1;
+    }
+    writer->n_open++;
+    return 0;
+}
+
+ssize_t
+qes_demux_writer_add (struct qes_demux_writer *writer, const char *path)
+{
+    struct qes_demux_dest *dests = NULL;
+    struct qes_demux_dest *dest = NULL;
+    size_t capacity = 0;
+
+    if (writer == NULL || path == NULL) return -1;
+    if (writer->n_dests == writer->dests_capacity) {
+        capacity = writer->dests_capacity > 0 ?
+                   writer->dests_capacity << 1 : 64;
+        dests = qes_realloc_errnil(writer->dests,
+                                   capacity * sizeof(*dests));
+        if (dests == NULL) return -1;
+        /* Blocks point into dests, but they're only used while flushing */
+        writer->dests = dests;
+        writer->dests_capacity = capacity;
+    }
+    dest = &writer->dests[writer->n_dests];
+    memset(dest, 0, sizeof(*dest));
+    dest->fd = -1;
+    dest->path = strdup(path);
+    if (dest->path == NULL) return -1;
+    writer->n_dests++;
+    if (demux_open(writer, dest, 1) != 0) {
+        writer->n_dests--;
+        qes_free(dest->path);
+        return -1;
+    }
+    return writer->n_dests - 1;
+}
+
+/* Compress each block into a gzip member, in parallel */
+static void
+demux_compress (struct qes_demux_writer *writer, size_t n_blocks)
+{
+    size_t iii = 0;
+
+    DEMUX_OMP(parallel num_threads(writer->opts.n_threads))
+    {
+        z_stream strm;
+        int ok = 0;
+
+        /* One stream per thread, reset for each block */
+        memset(&strm, 0, sizeof(strm));
+        ok = deflateInit2(&strm, writer->opts.level, Z_DEFLATED, 15 + 16, 8,
+                          Z_DEFAULT_STRATEGY) == Z_OK;
+        DEMUX_OMP(for schedule(dynamic, 1))
+        for (iii = 0; iii < n_blocks; iii++) {
+            struct qes_demux_block *block = &writer->blocks[iii];
+            size_t bound = 0;
+
+            block->error = 1;
+            if (!ok || deflateReset(&strm) != Z_OK) continue;
+            bound = deflateBound(&strm, block->len);
+            if (bound > block->out_capacity) {
+                qes_free(block->out);
+                block->out_capacity = 0;
+                block->out = qes_malloc_errnil(bound);
+                if (block->out == NULL) continue;
+                block->out_capacity = bound;
+            }
+            strm.next_in = (unsigned char *)block->dest->buf + block->offset;
+            strm.avail_in = block->len;
+            strm.next_out = block->out;
+            strm.avail_out = block->out_capacity;
+            if (deflate(&strm, Z_FINISH) != Z_STREAM_END) continue;
+            block->out_len = block->out_capacity - strm.avail_out;
+            block->error = 0;
+        }
+        if (ok) deflateEnd(&strm);
+    }
+}
+
+/* Write all of ``len`` bytes of ``buf`` to the file of ``dest``. Returns 0,
+ * or 1 on error, with the bytes that were written in ``done``. */
+static int
+demux_write_all (struct qes_demux_writer *writer,
+                 struct qes_demux_dest *dest, const void *buf, size_t len,
+                 size_t *done)
+{
+    const char *iter = buf;
+    ssize_t res = 0;
+
+    *done = 0;
+    if (demux_open(writer, dest, 0) != 0) return 1;
+    while (len > 0) {
+        res = write(dest->fd, iter, len);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) {
+            snprintf(writer->errstr, sizeof(writer->errstr),
+                     "Couldn't write to %s: %s", dest->path,
+                     strerror(errno));
+            return 1;
+        }
+        iter += res;
+        len -= res;
+        *done += res;
+    }
+    return 0;
+}
+
+/* Drop the first ``len`` bytes of ``dest``'s buffer, once written */
+static void
+demux_trim (struct qes_demux_writer *writer, struct qes_demux_dest *dest,
+            size_t len)
+{
+    if (len == 0) return;
+    memmove(dest->buf, dest->buf + len, dest->len - len);
+    dest->len -= len;
+    writer->buffered -= len;
+}
+
+/* Compress and write the full blocks of each output, or with ``all``, all of
+ * each output. Returns 0, or 1 on error. */
+static int
+demux_flush (struct qes_demux_writer *writer, int all)
+{
+    struct qes_demux_block *blocks = NULL;
+    struct qes_demux_block *block = NULL;
+    struct qes_demux_dest *dest = NULL;
+    size_t block_len = writer->opts.block_len;
+    size_t n_blocks = 0;
+    size_t capacity = 0;
+    size_t offset = 0;
+    size_t full = 0;
+    size_t done = 0;
+    size_t iii = 0;
+    int ret = 0;
+
+    for (iii = 0; iii < writer->n_dests; iii++) {
+        dest = &writer->dests[iii];
+        full = all ? dest->len : dest->len - dest->len % block_len;
+        for (offset = 0; offset < full; offset += block_len) {
+            if (n_blocks == writer->blocks_capacity) {
+                capacity = writer->blocks_capacity > 0 ?
+                           writer->blocks_capacity << 1 : 64;
+                blocks = qes_realloc_errnil(writer->blocks,
+                                            capacity * sizeof(*blocks));
+                if (blocks == NULL) return 1;
+                memset(blocks + writer->blocks_capacity, 0,
+                       (capacity - writer->blocks_capacity) *
+                       sizeof(*blocks));
+                writer->blocks = blocks;
+                writer->blocks_capacity = capacity;
+            }
+            block = &writer->blocks[n_blocks++];
+            block->dest = dest;
+            block->offset = offset;
+            block->len = full - offset < block_len ? full - offset : block_len;
+        }
+    }
+    if (!writer->opts.uncompressed) {
+        demux_compress(writer, n_blocks);
+    }
+    /* Blocks of each output are in order, and contiguous. ``full`` counts
+     * the bytes of the current output written so far, which are dropped
+     * from its buffer even if a later write fails, so that they aren't
+     * written again by the next flush. */
+    full = 0;
+    for (iii = 0; iii < n_blocks && ret == 0; iii++) {
+        block = &writer->blocks[iii];
+        if (writer->opts.uncompressed) {
+            ret = demux_write_all(writer, block->dest,
+                                  block->dest->buf + block->offset,
+                                  block->len, &done);
+            full += done;
+        } else if (block->error) {
+            snprintf(writer->errstr, sizeof(writer->errstr),
+                     "Couldn't compress block of %s", block->dest->path);
+            ret = 1;
+        } else {
+            /* Part of a gzip member is no use, so retry it whole */
+            ret = demux_write_all(writer, block->dest, block->out,
+                                  block->out_len, &done);
+            if (ret == 0) full += block->len;
+        }
+        if (ret != 0 || iii + 1 == n_blocks ||
+                writer->blocks[iii + 1].dest != block->dest) {
+            demux_trim(writer, block->dest, full);
+            full = 0;
+        }
+    }
+    return ret;
+}
+
+ssize_t
+qes_demux_writer_write (struct qes_demux_writer *writer, size_t dest_idx,
+                        const struct qes_seq *seq)
+{
+    struct qes_demux_dest *dest = NULL;
+    size_t len = 0;
+    size_t capacity = 0;
+    char *buf = NULL;
+    char *iter = NULL;
+    int fastq = 0;
+
+    if (writer == NULL || dest_idx >= writer->n_dests || !qes_seq_ok(seq)) {
+        return -2;
+    }
+    dest = &writer->dests[dest_idx];
+    /* By the format alone, so an empty read, e.g. after trimming, still gets
+     * a FASTQ record in a FASTQ file */
+    fastq = writer->opts.format == FASTQ_FMT;
+    if (fastq && seq->qual.len != seq->seq.len) {
+        snprintf(writer->errstr, sizeof(writer->errstr),
+                 "Record %.64s has no qualities", seq->name.str);
+        return -2;
+    }
+    len = 1 + seq->name.len + 1 + seq->seq.len + 1;
+    if (seq->comment.len > 0) len += 1 + seq->comment.len;
+    if (fastq) len += 2 + seq->qual.len + 1;
+    if (dest->len + len > dest->capacity) {
+        capacity = dest->capacity > 0 ? dest->capacity : 1024;
+        while (capacity < dest->len + len) capacity <<= 1;
+        buf = qes_realloc_errnil(dest->buf, capacity);
+        if (buf == NULL) {
+            snprintf(writer->errstr, sizeof(writer->errstr),
+                     "Couldn't allocate buffer for %s", dest->path);
+            return -2;
+        }
+        dest->buf = buf;
+        dest->capacity = capacity;
+    }
+    iter = dest->buf + dest->len;
+    *iter++ = fastq ? FASTQ_DELIM : FASTA_DELIM;
+    memcpy(iter, seq->name.str, seq->name.len);
+    iter += seq->name.len;
+    if (seq->comment.len > 0) {
+        *iter++ = ' ';
+        memcpy(iter, seq->comment.str, seq->comment.len);
+        iter += seq->comment.len;
+    }
+    *iter++ = '\n';
+    memcpy(iter, seq->seq.str, seq->seq.len);
+    iter += seq->seq.len;
+    *iter++ = '\n';
+    if (fastq) {
+        *iter++ = FASTQ_QUAL_DELIM;
+        *iter++ = '\n';
+        memcpy(iter, seq->qual.str, seq->qual.len);
+        iter += seq->qual.len;
+        *iter++ = '\n';
+    }
+    dest->len += len;
+    writer->buffered += len;
+    if (writer->buffered >= writer->opts.mem_budget) {
+        if (demux_flush(writer, 0) != 0) return -2;
+        /* Partial blocks of many outputs can fill the budget alone */
+        if (writer->buffered >= writer->opts.mem_budget &&
+                demux_flush(writer, 1) != 0) {
+            return -2;
+        }
+    }
+    return len;
+}
+
+int
+qes_demux_writer_flush (struct qes_demux_writer *writer)
+{
+    if (writer == NULL) return 1;
+    return demux_flush(writer, 1);
+}
+
+const char *
+qes_demux_writer_error (const struct qes_demux_writer *writer)
+{
+    if (writer == NULL) {
+        return "BAD FILE";
+    }
+    return writer->errstr;
+}
+
+void
+qes_demux_writer_destroy_ (struct qes_demux_writer *writer)
+{
+    size_t iii = 0;
+
+    if (writer != NULL) {
+        demux_flush(writer, 1);
+        for (iii = 0; iii < writer->n_dests; iii++) {
+            if (writer->dests[iii].fd >= 0) close(writer->dests[iii].fd);
+            qes_free(writer->dests[iii].path);
+            qes_free(writer->dests[iii].buf);
+        }
+        for (iii = 0; iii < writer->blocks_capacity; iii++) {
+            qes_free(writer->blocks[iii].out);
+        }
+        qes_free(writer->dests);
+        qes_free(writer->blocks);
+        qes_free(writer);
+    }
+}
@@ -0,0 +1,162 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_demux.h
+ *
+ *    Description:  Writing records to many output files at once
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 22:47:19
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_DEMUX_H
+#define QES_DEMUX_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+#include <qes_seqfile.h>
+
+/* Defaults of struct qes_demux_opts */
+#define QES_DEMUX_MEM_BUDGET (64<<20)
+#define QES_DEMUX_BLOCK_LEN (256<<10)
+#define QES_DEMUX_MAX_OPEN 64
+
+/* Options for qes_demux_writer_create. A zeroed struct gives the defaults. */
+struct qes_demux_opts {
+    /* Format of records written. UNKNOWN_FMT (0) means FASTQ_FMT. */
+    enum qes_seqfile_format format;
+    /* Write plain text, rather than gzip */
+    int uncompressed;
+    /* gzip compression level, 1-9. 0 means zlib's default. */
+    int level;
+    /* Bytes of records buffered across all outputs before they're written.
+     * 0 means QES_DEMUX_MEM_BUDGET. */
+    size_t mem_budget;
+    /* Each output is compressed in blocks of this many bytes, each its own
+     * gzip member. 0 means QES_DEMUX_BLOCK_LEN. */
+    size_t block_len;
+    /* Most files kept open at once. 0 means QES_DEMUX_MAX_OPEN. */
+    unsigned max_open;
+    /* Threads compressing blocks, if libqes was built with OpenMP. 0 means
+     * 1. */
+    unsigned n_threads;
+};
+
+/* An output file, and the records buffered for it */
+struct qes_demux_dest {
+    char *path;
+    /* Open file, or -1 if closed to make room for others */
+    int fd;
+    /* When the file was last written, for closing the least recently used */
+    uint64_t last_used;
+    char *buf;
+    size_t len;
+    size_t capacity;
+};
+
+/* A block of an output, compressed for writing. Private to qes_demux.c. */
+struct qes_demux_block;
+
+struct qes_demux_writer {
+    struct qes_demux_opts opts;
+    struct qes_demux_dest *dests;
+    size_t n_dests;
+    size_t dests_capacity;
+    /* Bytes buffered, across all outputs */
+    size_t buffered;
+    /* Files open, and a clock for last_used */
+    unsigned n_open;
+    uint64_t clock;
+    struct qes_demux_block *blocks;
+    size_t blocks_capacity;
+    /* Description of the last error */
+    char errstr[128];
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_demux_writer_create
+Paramters:      const struct qes_demux_opts *opts: Options, or NULL for the
+                    defaults.
+Description:    Create a writer of records to many files, e.g. to split a
+                run into samples. Rather than a qes_seqfile (and gzip
+                stream) per output, records are buffered per output in a
+                shared memory budget. When that fills, full blocks of each
+                output are compressed in parallel, each into a separate gzip
+                member, and appended to their files. Only the most recently
+                used ``max_open`` files are kept open. The outputs are valid
+                gzip files, as gzip readers (including qes_file) read
+                concatenated members as one stream.
+Returns:        struct qes_demux_writer *: A writer with no outputs, or NULL
+                on error.
+ *===========================================================================*/
+struct qes_demux_writer *qes_demux_writer_create (
+        const struct qes_demux_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_demux_writer_add
+Paramters:      struct qes_demux_writer *writer: Writer to add to.
+                const char *path: Path of the output, which is created or
+                    truncated now.
+Description:    Add an output file to ``writer``.
+Returns:        ssize_t: The index of the new output, to pass to
+                qes_demux_writer_write, or -1 on error.
+ *===========================================================================*/
+ssize_t qes_demux_writer_add (struct qes_demux_writer *writer,
+                              const char *path);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_demux_writer_write
+Paramters:      struct qes_demux_writer *writer: Writer to write to.
+                size_t dest: Index of the output, from qes_demux_writer_add.
+                const struct qes_seq *seq: Record to write.
+Description:    Buffer ``seq`` for writing to output ``dest``, as a record of
+                the writer's format, even if ``seq`` is empty. If the
+                buffers are over their budget, blocks are compressed and
+                written.
+Returns:        ssize_t: The length of the record written, or -2 on error,
+                e.g. if writing FASTQ and ``seq`` doesn't have a quality
+                score per base. See qes_demux_writer_error.
+ *===========================================================================*/
+ssize_t qes_demux_writer_write (struct qes_demux_writer *writer, size_t dest,
+                                const struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_demux_writer_flush
+Paramters:      struct qes_demux_writer *writer: Writer to flush.
+Description:    Write everything buffered to the outputs.
+Returns:        int: 0 on success, 1 on error. See qes_demux_writer_error.
+ *===========================================================================*/
+int qes_demux_writer_flush (struct qes_demux_writer *writer);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_demux_writer_error
+Paramters:      const struct qes_demux_writer *writer: Writer to query.
+Description:    Describe why the last write or flush failed.
+Returns:        const char *: The description. Never NULL.
+ *===========================================================================*/
+const char *qes_demux_writer_error (const struct qes_demux_writer *writer);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_demux_writer_destroy
+Paramters:      struct qes_demux_writer *: Writer to destroy.
+Description:    Flush and close all outputs, and deallocate and set to NULL a
+                struct qes_demux_writer on the heap. Call
+                qes_demux_writer_flush first to check the last records were
+                written.
+Returns:        void.
+ *===========================================================================*/
+void qes_demux_writer_destroy_ (struct qes_demux_writer *writer);
+#define qes_demux_writer_destroy(writer) do {                               \
+            qes_demux_writer_destroy_(writer);                              \
+            writer = NULL;                                                  \
+        } while(0)
+
+#endif /* QES_DEMUX_H */
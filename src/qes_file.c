@@ -16,72 +16,250 @@
  * ============================================================================
  */
 
+/* For splice */
+#define _GNU_SOURCE
 #include "qes_file.h"
 
+#include <fcntl.h>
+
+/* Each splice into a pipe takes a whole pipe buffer, however few bytes it
+ * moves, so below this it's better to copy */
+#define FILE_SPLICE_MIN_LEN (1<<14)
+
+/* Allocate a read buffer, page-aligned where we can */
+static char *
+file_buffer_alloc (size_t size)
+{
+#if defined(MEMALIGN_FOUND) && defined(GETPAGESIZE_FOUND)
+    size_t pagesize = getpagesize();
+
+    /* aligned_alloc needs a multiple of the alignment */
+    return aligned_alloc(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+#else
+    return qes_malloc_errnil(size * sizeof(char));
+#endif
+}
+
 struct qes_file *
 qes_file_open_ (const char *path, const char *mode, qes_errhandler_func onerr,
         const char *file, int line)
+{
+    return qes_file_open_opts_(path, mode, NULL, onerr, file, line);
+}
+
+/* Open flags for an fopen-style mode, as used by gzopen */
+static int
+file_open_flags (const char *mode)
+{
+    int flags = 0;
+
+    switch (mode[0]) {
+        case 'r':
+            flags = O_RDONLY;
+            break;
+        case 'w':
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        case 'a':
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+            break;
+        default:
+            return -1;
+    }
+    if (strchr(mode, 'x') != NULL) flags |= O_EXCL;
+#ifdef O_CLOEXEC
+    if (strchr(mode, 'e') != NULL) flags |= O_CLOEXEC;
+#endif
+    return flags;
+}
+
+/* Check ``opts`` before we open anything */
+static int
+file_opts_ok (const struct qes_file_opts *opts, qes_errhandler_func onerr,
+              const char *file, int line)
+{
+    if (opts != NULL && opts->bufsize == 1) {
+        /* We need a byte for the terminating '\0' */
+        (*onerr)("Buffer size must be at least 2", file, line);
+        return 0;
+    }
+    return 1;
+}
+
+/* The guts of qes_file_open_opts_ and qes_file_dopen_. ``fd`` is always
+ * consumed: it belongs to the returned file, or is closed on error. ``path``
+ * is only used for messages. */
+static struct qes_file *
+file_dopen (int fd, const char *path, const char *mode,
+            const struct qes_file_opts *opts, qes_errhandler_func onerr,
+            const char *file, int line)
 {
     struct qes_file *qf = NULL;
+    const struct qes_compress_backend *backend = NULL;
+    enum qes_compression compression = QES_COMPRESSION_AUTO;
+    enum qes_read_mode rwmode = QES_READ_MODE_UNKNOWN;
+    size_t bufsize = QES_FILEBUFFER_LEN;
+    size_t zbufsize = 0;
+    unsigned io_depth = 0;
+    struct stat st;
 
-    /* Error out with NULL */
-    if (path == NULL || mode == NULL || onerr == NULL || file == NULL) {
-        return NULL;
+    if (opts != NULL) {
+        if (opts->bufsize > 0) bufsize = opts->bufsize;
+        zbufsize = opts->zbufsize;
+        compression = opts->compression;
+        io_depth = opts->io_depth;
+    }
+    if (zbufsize == 0) {
+        /* Use a larger than default IO buffer, speeds things up.
+         * Using 2x our buffer len for no particular reason. */
+        zbufsize = bufsize << 1;
+    }
+
+    rwmode = qes_file_guess_mode(mode);
+    if (rwmode == QES_READ_MODE_UNKNOWN || fstat(fd, &st) != 0) {
+        goto error;
+    }
+    /* Pick a backend. We only write with zlib. */
+    if (rwmode != QES_READ_MODE_READ) {
+        compression = QES_COMPRESSION_GZIP;
+    } else if (compression == QES_COMPRESSION_AUTO) {
+        compression = qes_compress_detect_fd(fd);
+    }
+    if (io_depth > 0) {
+        backend = qes_compress_backend_aio(compression);
+    } else {
+        backend = qes_compress_backend(compression);
+    }
+    if (backend == NULL) {
+        (*onerr)("Opening file %s failed:\n%s\n", file, line, path,
+                 "libqes was built without support for its compression");
+        goto error;
     }
 
     /* create file struct */
     qf = qes_calloc(1, sizeof(*qf));
+    qf->fd = fd;
+    qf->fdmode = st.st_mode;
+    /* Fails for pipes, which can't be seeked */
+    qf->fd_start = lseek(fd, 0, SEEK_CUR);
     /* Open file, handling any errors */
-    qf->fp = QES_ZOPEN(path, mode);
-    if (qf->fp == NULL) {
+    qf->handle = backend->dopen(fd, mode, zbufsize, io_depth);
+    if (qf->handle == NULL) {
         (*onerr)("Opening file %s failed:\n%s\n", file, line,
                 path, strerror(errno));
         qes_free(qf);
-        return(NULL);
+        goto error;
     }
-    qf->mode = qes_file_guess_mode(mode);
-    if (qf->mode == QES_READ_MODE_UNKNOWN) {
-        QES_ZCLOSE(qf->fp);
-        qes_free(qf);
-        return NULL;
+    qf->backend = backend;
+    qf->zbufsize = zbufsize;
+    qf->io_depth = io_depth;
+    if (backend == qes_compress_backend(QES_COMPRESSION_GZIP)) {
+        qf->fp = qf->handle;
     }
-    /* Use a larger than default IO buffer, speeds things up.
-     * Using 2x our buffer len for no particular reason. */
-    QES_ZBUFFER(qf->fp, (QES_FILEBUFFER_LEN) << 1);
+    qf->mode = rwmode;
     if (qf->mode == QES_READ_MODE_READ) {
-#if defined(MEMALIGN_FOUND) && defined(GETPAGESIZE_FOUND)
-        qf->buffer = aligned_alloc(getpagesize(),
-                                   (QES_FILEBUFFER_LEN * sizeof(*qf->buffer)));
-        if (qf->buffer == NULL) {
-            QES_ZCLOSE(qf->fp);
-            qes_free(qf);
-            (*onerr)("Coudn't allocate aligned memory", file, line);
-            return NULL;
+        qf->bufsize = bufsize;
+        if (opts != NULL && opts->adaptive) {
+            qf->max_bufsize = opts->max_bufsize > 0 ? opts->max_bufsize :
+                                                      QES_FILEBUFFER_MAX_LEN;
         }
-#else
-        qf->buffer = qes_malloc_((QES_FILEBUFFER_LEN * sizeof(*qf->buffer)),
-                onerr, file, line);
+        qf->buffer = file_buffer_alloc(bufsize);
         if (qf->buffer == NULL) {
-            QES_ZCLOSE(qf->fp);
+            backend->close(qf->handle);
             qes_free(qf);
             (*onerr)("Coudn't allocate buffer memory", file, line);
             return NULL;
         }
-#endif
         qf->bufiter = qf->buffer;
         qf->buffer[0] = '\0';
         qf->bufend = qf->buffer;
         if (__qes_file_fill_buffer(qf) == 0) {
+            (*onerr)("Reading file %s failed:\n%s\n", file, line, path,
+                     backend->error(qf->handle));
+            backend->close(qf->handle);
             qes_free(qf->buffer);
             qes_free(qf);
             return NULL;
         }
+        /* zlib only knows whether it's decompressing once it's read */
+        if (backend->direct != NULL) {
+            qf->raw = backend->direct(qf->handle);
+        }
+    } else {
+        qf->raw = strchr(mode, 'T') != NULL;
     }
     /* init struct fields */
     qf->eof = 0;
     qf->filepos = 0;
     qf->path = strndup(path, QES_MAX_FN_LEN);
     return(qf);
+error:
+    close(fd);
+    return NULL;
+}
+
+struct qes_file *
+qes_file_open_opts_ (const char *path, const char *mode,
+                     const struct qes_file_opts *opts,
+                     qes_errhandler_func onerr, const char *file, int line)
+{
+    int flags = 0;
+    int fd = -1;
+
+    /* Error out with NULL */
+    if (path == NULL || mode == NULL || onerr == NULL || file == NULL) {
+        return NULL;
+    }
+    flags = file_open_flags(mode);
+    if (flags < 0 || !file_opts_ok(opts, onerr, file, line)) {
+        return NULL;
+    }
+    fd = open(path, flags, 0666);
+    if (fd < 0) {
+        (*onerr)("Opening file %s failed:\n%s\n", file, line,
+                path, strerror(errno));
+        return NULL;
+    }
+    return file_dopen(fd, path, mode, opts, onerr, file, line);
+}
+
+struct qes_file *
+qes_file_dopen_ (int fd, const char *mode, const struct qes_file_opts *opts,
+                 qes_errhandler_func onerr, const char *file, int line)
+{
+    char path[32];
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (mode == NULL || onerr == NULL || file == NULL ||
+            !file_opts_ok(opts, onerr, file, line)) {
+        close(fd);
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    return file_dopen(fd, path, mode, opts, onerr, file, line);
+}
+
+int
+__qes_file_grow_buffer (struct qes_file *file)
+{
+    size_t newsize = 0;
+    char *newbuf = NULL;
+
+    if (file == NULL || file->bufsize >= file->max_bufsize) return 1;
+    newsize = file->bufsize << 1;
+    if (newsize > file->max_bufsize) newsize = file->max_bufsize;
+    /* The contents are spent, so there's no need to copy them */
+    newbuf = file_buffer_alloc(newsize);
+    if (newbuf == NULL) return 1;
+    qes_free(file->buffer);
+    file->buffer = newbuf;
+    file->bufsize = newsize;
+    file->bufiter = file->buffer;
+    file->bufend = file->buffer;
+    file->buffer[0] = '\0';
+    return 0;
 }
 
 int
@@ -95,25 +273,207 @@ qes_file_guess_mode (const char *mode)
     return QES_READ_MODE_UNKNOWN;
 }
 
-void
+/* Seek the backend, by reading if it can't seek. The underlying stream is at
+ * the end of the buffer, so that's where reading starts from. Backwards
+ * seeks reopen the file. */
+static int
+file_zseek (struct qes_file *file, off_t offset)
+{
+    off_t pos = file->filepos + (file->bufend - file->bufiter);
+    void *handle = NULL;
+    size_t want = 0;
+    int fd = -1;
+    ssize_t res = -1;
+
+    if (file->backend->seek != NULL) {
+        res = file->backend->seek(file->handle, offset);
+    }
+    if (res >= 0) {
+        return res;
+    }
+    if (file->buffer == NULL) {
+        return 1;
+    }
+    if (offset < pos) {
+        /* Start again from where we got the fd, if we can */
+        if (file->fd_start < 0) return 1;
+        fd = dup(file->fd);
+        if (fd < 0) return 1;
+        file->backend->close(file->handle);
+        file->handle = NULL;
+        file->fp = NULL;
+        if (lseek(fd, file->fd_start, SEEK_SET) != file->fd_start ||
+                (handle = file->backend->dopen(fd, "r", file->zbufsize,
+                                               file->io_depth)) == NULL) {
+            close(fd);
+            return 1;
+        }
+        file->handle = handle;
+        file->fd = fd;
+        if (file->backend == qes_compress_backend(QES_COMPRESSION_GZIP)) {
+            file->fp = handle;
+        }
+        pos = 0;
+    }
+    while (pos < offset) {
+        want = file->bufsize - 1;
+        if ((off_t)want > offset - pos) want = offset - pos;
+        res = file->backend->read(file->handle, file->buffer, want);
+        if (res <= 0) return 1;
+        pos += res;
+    }
+    return 0;
+}
+
+int
 qes_file_rewind (struct qes_file *file)
 {
-    if (qes_file_ok(file)) {
-        QES_ZSEEK(file->fp, 0, SEEK_SET);
-        file->filepos = 0;
+    if (!qes_file_ok(file) || file_zseek(file, 0) != 0) {
+        return 1;
+    }
+    file->filepos = 0;
+    file->eof = 0;
+    file->feof = 0;
+    file->bufiter = file->buffer;
+    file->bufend = file->buffer;
+    if (file->buffer != NULL) {
+        file->buffer[0] = '\0';
+    }
+    return 0;
+}
+
+int
+qes_file_seek (struct qes_file *file, off_t offset)
+{
+    off_t bufstart = 0;
+
+    if (!qes_file_ok(file) || file->mode != QES_READ_MODE_READ || offset < 0) {
+        return 1;
+    }
+    /* ``filepos`` is the offset of ``bufiter``, so we know which part of the
+     * file the buffer holds. Seeking within it is just pointer arithmetic. */
+    bufstart = file->filepos - (file->bufiter - file->buffer);
+    if (offset >= bufstart && offset < file->filepos + \
+            (file->bufend - file->bufiter)) {
+        file->bufiter = file->buffer + (offset - bufstart);
+        file->filepos = offset;
         file->eof = 0;
-        file->feof = 0;
-        file->bufiter = file->buffer;
-        file->bufend = file->buffer;
+        return 0;
     }
+    if (file_zseek(file, offset) != 0) {
+        return 1;
+    }
+    file->filepos = offset;
+    file->eof = 0;
+    file->feof = 0;
+    file->bufiter = file->buffer;
+    file->bufend = file->buffer;
+    file->buffer[0] = '\0';
+    return 0;
+}
+
+/* Write all of ``buf``. Returns 0 on success, 1 on error. */
+static int
+file_write_all (struct qes_file *file, const char *buf, size_t len)
+{
+    return file->backend->write(file->handle, buf, len) != (ssize_t)len;
+}
+
+ssize_t
+qes_file_passthrough (struct qes_file *out, struct qes_file *in, off_t offset,
+                      size_t len)
+{
+    char buf[QES_FILEBUFFER_LEN];
+    off_t bufstart = 0;
+    off_t pos = 0;
+    size_t done = 0;
+    size_t want = 0;
+    ssize_t res = 0;
+
+    if (!qes_file_writable(out) || !qes_file_ok(in) ||
+            in->mode != QES_READ_MODE_READ || offset < 0) {
+        return -2;
+    }
+    if (len == 0) {
+        return 0;
+    }
+#ifdef SPLICE_FOUND
+    if (len >= FILE_SPLICE_MIN_LEN && in->raw && out->raw &&
+            in->fd_start >= 0 && S_ISREG(in->fdmode) &&
+            S_ISFIFO(out->fdmode)) {
+        /* Whatever zlib has buffered must go first */
+        if (out->backend->flush(out->handle) != 0) {
+            return -2;
+        }
+        /* With an explicit offset, splice leaves in->fd's offset alone */
+        pos = in->fd_start + offset;
+        while (done < len) {
+            res = splice(in->fd, &pos, out->fd, NULL, len - done,
+                         SPLICE_F_MORE);
+            if (res < 0 && errno == EINTR) continue;
+            if (res <= 0) break;
+            done += res;
+        }
+        if (done == len) {
+            return len;
+        } else if (done > 0 || res == 0 || errno != EINVAL) {
+            return -2;
+        }
+        /* EINVAL: the filesystem can't splice. Copy it instead. */
+    }
+#endif
+    /* The bytes may well still be in the buffer */
+    bufstart = in->filepos - (in->bufiter - in->buffer);
+    if (offset >= bufstart && offset + (off_t)len <= in->filepos +
+            (in->bufend - in->bufiter)) {
+        if (file_write_all(out, in->buffer + (offset - bufstart), len) != 0) {
+            return -2;
+        }
+        return len;
+    }
+    /* Or we can read them again */
+    if (in->raw && in->fd_start >= 0 && S_ISREG(in->fdmode)) {
+        pos = in->fd_start + offset;
+        for (done = 0; done < len; done += res) {
+            want = len - done < sizeof(buf) ? len - done : sizeof(buf);
+            res = pread(in->fd, buf, want, pos + done);
+            if (res < 0 && errno == EINTR) {
+                res = 0;
+                continue;
+            }
+            if (res <= 0 || file_write_all(out, buf, res) != 0) {
+                return -2;
+            }
+        }
+        return len;
+    }
+    return -1;
+}
+
+int
+qes_file_stats (struct qes_file *file, struct qes_file_stats *stats)
+{
+    if (stats == NULL) return 1;
+    memset(stats, 0, sizeof(*stats));
+#ifdef QES_STATS
+    if (!qes_file_ok(file)) return 1;
+    *stats = file->stats;
+    /* The compressed offset is only looked up on request, as it may cost a
+     * syscall */
+    stats->bytes_compressed = file->backend->offset(file->handle);
+    return 0;
+#else
+    (void) file;
+    return 1;
+#endif
 }
 
 void
 qes_file_close_ (struct qes_file *file)
 {
     if (file != NULL) {
-        if (file->fp != NULL) {
-            QES_ZCLOSE(file->fp);
+        if (file->handle != NULL) {
+            file->backend->close(file->handle);
         }
         qes_free(file->path);
         qes_free(file->buffer);
@@ -127,16 +487,9 @@ qes_file_close_ (struct qes_file *file)
 const char *
 qes_file_error (struct qes_file *file)
 {
-    int error = 0;
-    const char *errstr = "";
-
     if (!qes_file_ok(file)) {
         /* Never return NULL, or we'll SIGSEGV printf */
         return "BAD FILE";
     }
-    errstr = gzerror(file->fp, &error);
-    if (error == Z_ERRNO) {
-        return strerror(errno);
-    }
-    return errstr;
+    return file->backend->error(file->handle);
 }
@@ -21,6 +21,8 @@
 
 #include <qes_util.h>
 #include <qes_str.h>
+#include <qes_compress.h>
+#include <sys/stat.h>
 #ifdef MEMALIGN_FOUND
 #include <malloc.h>
 #endif
@@ -32,18 +34,83 @@ enum qes_read_mode {
     QES_READ_MODE_READWRITE,
 };
 
+/* Counters of work done reading a file. Only kept if libqes is built with
+ * QES_STATS. */
+struct qes_file_stats {
+    /* Bytes read from disk, i.e. compressed bytes for compressed files */
+    uint64_t bytes_compressed;
+    /* Bytes read into the buffer, after decompression */
+    uint64_t bytes_uncompressed;
+    /* Calls to __qes_file_fill_buffer that read */
+    uint64_t n_fills;
+    /* Time spent in the backend's read (i.e. read + decompress) */
+    uint64_t read_nsec;
+    /* Buffer growths in qes_file_getuntil_realloc and friends */
+    uint64_t n_reallocs;
+};
+
+/* Options for qes_file_open_opts. A zeroed struct gives the defaults of
+ * qes_file_open. */
+struct qes_file_opts {
+    /* Size of the read buffer. 0 means QES_FILEBUFFER_LEN */
+    size_t bufsize;
+    /* Size of zlib's internal buffer. 0 means twice the initial bufsize */
+    size_t zbufsize;
+    /* If true, the read buffer doubles in size whenever refilling it took
+     * longer than consuming its previous contents, i.e. while we're waiting on
+     * IO. It never shrinks. */
+    int adaptive;
+    /* Largest an adaptive buffer may grow to. 0 means QES_FILEBUFFER_MAX_LEN */
+    size_t max_bufsize;
+    /* Compression format to read. QES_COMPRESSION_AUTO (0) detects it from
+     * the file's magic bytes. Files are always written with zlib. */
+    enum qes_compression compression;
+    /* Number of reads (or writes) of zbufsize bytes to keep in flight, so
+     * that decompression needn't wait on storage with high latency, e.g.
+     * network filesystems. 0 means plain synchronous IO. Only regular files
+     * are read asynchronously, and only where io_uring is available (see
+     * qes_aio.h). */
+    unsigned io_depth;
+};
+
 struct qes_file {
+    /* The zlib file, if using the gzip backend. Otherwise, writes go through
+     * the backend's write. */
     QES_ZTYPE fp;
+    /* Decompression backend, and its handle on this file */
+    const struct qes_compress_backend *backend;
+    void *handle;
+    /* Size of the backend's input buffer, and IO depth, for reopening */
+    size_t zbufsize;
+    unsigned io_depth;
+    /* The file descriptor under ``handle``, closed with it. ``fd_start`` is
+     * its offset when we got it, or -1 if it can't seek (e.g. a pipe), and
+     * ``fdmode`` its type, as from fstat */
+    int fd;
+    off_t fd_start;
+    mode_t fdmode;
+    /* Is the file uncompressed, i.e. are our offsets also offsets in fd */
+    int raw;
     char *path;
     off_t filepos;
     enum qes_read_mode mode;
     char *buffer;
     char *bufiter;
     char *bufend;
+    /* Allocated size of buffer */
+    size_t bufsize;
+    /* If not zero, buffer may be grown up to this size by adaptive mode */
+    size_t max_bufsize;
+    /* Duration of, and time at the end of, the last refill in adaptive mode */
+    uint64_t fill_nsec;
+    uint64_t fill_end;
     /* Is the fp at EOF, AND do we have nothing left to copy from the buffer */
     int eof  :1;
     /* Is the fp at EOF */
     int feof :1;
+#ifdef QES_STATS
+    struct qes_file_stats stats;
+#endif
 };
 
 /* qes_file_open:
@@ -62,6 +129,62 @@ struct qes_file *qes_file_open_ (const char *path, const char *mode,
 #define    qes_file_open_errprintexit(pth, mod) \
     qes_file_open_(pth, mod, errprintexit, __FILE__, __LINE__)
 
+/*===  FUNCTION  ============================================================*
+Name:           qes_file_open_opts
+Paramters:      const char *path: Path to open.
+                const char *mode: Mode to pass to the fopen equivalent used.
+                const struct qes_file_opts *opts: Buffer options, or NULL for
+                    the defaults.
+Description:    As per qes_file_open, but with the IO buffers sized per
+                ``opts``. Larger buffers mean fewer, larger reads, which suits
+                network filesystems and fast disks.
+Returns:        struct qes_file *: The opened file, or NULL on error.
+ *===========================================================================*/
+struct qes_file *qes_file_open_opts_ (const char *path, const char *mode,
+                                      const struct qes_file_opts *opts,
+                                      qes_errhandler_func onerr,
+                                      const char *file, int line);
+#define    qes_file_open_opts(pth, mod, opt) \
+    qes_file_open_opts_(pth, mod, opt, QES_DEFAULT_ERR_FN, __FILE__, __LINE__)
+#define    qes_file_open_opts_errnil(pth, mod, opt) \
+    qes_file_open_opts_(pth, mod, opt, errnil, __FILE__, __LINE__)
+#define    qes_file_open_opts_errprint(pth, mod, opt) \
+    qes_file_open_opts_(pth, mod, opt, errprint, __FILE__, __LINE__)
+#define    qes_file_open_opts_errprintexit(pth, mod, opt) \
+    qes_file_open_opts_(pth, mod, opt, errprintexit, __FILE__, __LINE__)
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_file_dopen
+Paramters:      int fd: Open file descriptor, e.g. STDIN_FILENO, or a pipe.
+                const char *mode: Mode to pass to the fopen equivalent used.
+                    This must agree with how ``fd`` was opened.
+Description:    As per qes_file_open, but reading or writing ``fd``, which is
+                then owned by the returned file and closed by
+                qes_file_close. Compression of pipes is detected without
+                consuming them where the system allows (see
+                qes_compress_detect_fd), and otherwise assumed to be gzip or
+                plain text; set ``opts->compression`` to be sure. Files that
+                can't seek can't be seeked backwards or rewound. Use mode "wT"
+                to write uncompressed output.
+Returns:        struct qes_file *: The opened file, or NULL on error, in which
+                case ``fd`` has been closed.
+ *===========================================================================*/
+struct qes_file *qes_file_dopen_ (int fd, const char *mode,
+                                  const struct qes_file_opts *opts,
+                                  qes_errhandler_func onerr, const char *file,
+                                  int line);
+#define    qes_file_dopen(fd, mod) \
+    qes_file_dopen_(fd, mod, NULL, QES_DEFAULT_ERR_FN, __FILE__, __LINE__)
+#define    qes_file_dopen_errnil(fd, mod) \
+    qes_file_dopen_(fd, mod, NULL, errnil, __FILE__, __LINE__)
+#define    qes_file_dopen_errprint(fd, mod) \
+    qes_file_dopen_(fd, mod, NULL, errprint, __FILE__, __LINE__)
+#define    qes_file_dopen_errprintexit(fd, mod) \
+    qes_file_dopen_(fd, mod, NULL, errprintexit, __FILE__, __LINE__)
+#define    qes_file_dopen_opts(fd, mod, opt) \
+    qes_file_dopen_(fd, mod, opt, QES_DEFAULT_ERR_FN, __FILE__, __LINE__)
+#define    qes_file_dopen_opts_errnil(fd, mod, opt) \
+    qes_file_dopen_(fd, mod, opt, errnil, __FILE__, __LINE__)
 
 /*===  FUNCTION  ============================================================*
 Name:           qes_file_close
@@ -78,7 +201,73 @@ void qes_file_close_ (struct qes_file *file);
 
 const char * qes_file_error (struct qes_file *file);
 int qes_file_guess_mode (const char *mode);
-void qes_file_rewind (struct qes_file *file);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_file_rewind
+Paramters:      struct qes_file *file: File to rewind.
+Description:    Seek back to the start of ``file``, discarding its buffer.
+                Fails if ``file`` can't be seeked, e.g. if it is a pipe.
+Returns:        int: 0 on success, 1 on error.
+ *===========================================================================*/
+int qes_file_rewind (struct qes_file *file);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_file_seek
+Paramters:      struct qes_file *file: File to seek, opened for reading.
+                off_t offset: Uncompressed byte offset from the start of the
+                    file, as tracked by ``file->filepos``.
+Description:    Moves the read position of ``file`` to ``offset``. If
+                ``offset`` is inside the current buffer, no IO is done.
+                Otherwise the underlying file is seeked and the buffer is
+                emptied. For compressed files, zlib emulates seeking by
+                decompressing, so backwards seeks re-read from the start.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+int qes_file_seek (struct qes_file *file, off_t offset);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_file_passthrough
+Paramters:      struct qes_file *out: File to write to.
+                struct qes_file *in: File to copy from, opened for reading.
+                off_t offset: Uncompressed offset in ``in`` of the bytes to
+                    copy, e.g. the start of a record just read.
+                size_t len: Number of bytes to copy.
+Description:    Copy bytes of ``in`` verbatim to ``out``, without parsing or
+                reformatting them. If both files are uncompressed, ``in`` is a
+                regular file and ``out`` a pipe, long runs of bytes are moved
+                by the kernel with splice(2), never being copied to user space.
+                Otherwise they're written from ``in``'s buffer if they're
+                still in it, or re-read from ``in`` if it's uncompressed and
+                regular. ``in``'s read position is not changed.
+Returns:        ssize_t: ``len`` on success, -1 if the bytes can't be copied
+                this way (so the caller should write them some other way), or
+                -2 on error.
+ *===========================================================================*/
+ssize_t qes_file_passthrough (struct qes_file *out, struct qes_file *in,
+                              off_t offset, size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_file_stats
+Paramters:      struct qes_file *file: File to get counters of.
+                struct qes_file_stats *stats: Filled with the counters.
+Description:    Get the instrumentation counters of ``file``. These are only
+                kept if libqes was built with QES_STATS (cmake -DQES_STATS=ON);
+                otherwise ``stats`` is zeroed.
+Returns:        int: 0 on success, 1 if counters aren't available or on error.
+ *===========================================================================*/
+int qes_file_stats (struct qes_file *file, struct qes_file_stats *stats);
+
+/* Doubles the (empty) read buffer of an adaptive file. Returns 0 on success,
+ * 1 on failure, in which case the old buffer is kept. */
+int __qes_file_grow_buffer (struct qes_file *file);
+
+/* Refills are timed with QES_STATS, or to decide when to grow adaptive
+ * buffers */
+#ifdef QES_STATS
+#   define __QES_FILE_TIMED(file) 1
+#else
+#   define __QES_FILE_TIMED(file) ((file)->max_bufsize > 0)
+#endif
 
 /* INLINE FUNCTIONS */
 
@@ -89,7 +278,7 @@ qes_file_ok(const struct qes_file *qf)
      * NULLness for all pointers we care about in current modes. Which, unless
      * we're Write-only, is all of them */
     return  qf != NULL && \
-            qf->fp != NULL && \
+            qf->handle != NULL && \
             (qf->mode == QES_READ_MODE_WRITE || \
                 (qf->bufiter != NULL && \
                  qf->buffer != NULL)
@@ -100,6 +289,9 @@ static inline int
 __qes_file_fill_buffer (struct qes_file *file)
 {
     ssize_t res = 0;
+    uint64_t start = 0;
+    uint64_t end = 0;
+
     if (!qes_file_ok(file)) {
         return 0;
     }
@@ -107,7 +299,24 @@ __qes_file_fill_buffer (struct qes_file *file)
         file->eof = 1;
         return EOF;
     }
-    res = QES_ZREAD(file->fp, file->buffer, (QES_FILEBUFFER_LEN) - 1);
+    if (__QES_FILE_TIMED(file)) {
+        start = qes_nsec_now();
+    }
+    /* The buffer is spent, so it can be replaced. If the last refill took
+     * longer than the caller took to consume it, we're IO bound: read more
+     * at once. */
+    if (file->bufsize < file->max_bufsize &&
+            start - file->fill_end < file->fill_nsec) {
+        __qes_file_grow_buffer(file);
+    }
+    res = file->backend->read(file->handle, file->buffer, file->bufsize - 1);
+    if (__QES_FILE_TIMED(file)) {
+        end = qes_nsec_now();
+        file->fill_nsec = end - start;
+        file->fill_end = end;
+    }
+    QES_STATS_ADD(file, read_nsec, end - start);
+    QES_STATS_ADD(file, n_fills, 1);
     if (res < 0) {
         /* Errored */
         return 0;
@@ -116,13 +325,14 @@ __qes_file_fill_buffer (struct qes_file *file)
         file->eof = 1;
         file->feof = 1;
         return EOF;
-    } else if (res < (QES_FILEBUFFER_LEN) - 1) {
+    } else if ((size_t)res < file->bufsize - 1) {
         /* At file EOF */
         file->feof = 1;
     }
     file->bufiter = file->buffer;
     file->bufend = file->buffer + res;
     file->bufend[0] = '\0';
+    QES_STATS_ADD(file, bytes_uncompressed, res);
     return 1;
 }
 
@@ -176,6 +386,10 @@ qes_file_peek(struct qes_file *file)
 static inline void
 qes_file_print_str (struct qes_file *stream, const struct qes_str *str)
 {
+    if (stream->fp == NULL) {
+        stream->backend->write(stream->handle, str->str, str->len);
+        return;
+    }
     QES_ZWRITE(stream->fp, str->str, str->len);
 }
 
@@ -188,15 +402,25 @@ qes_file_getc(struct qes_file *file)
     if (file->eof) {
         return EOF;
     }
+    file->filepos++;
     return (file->bufiter++)[0];
 }
 
 static inline ssize_t
 qes_file_puts(struct qes_file *file, const char *str)
 {
+    size_t len = 0;
+
     if (!qes_file_ok(file) || !qes_file_writable(file)) {
         return -2;
     }
+    if (file->fp == NULL) {
+        len = strlen(str);
+        if (file->backend->write(file->handle, str, len) != (ssize_t)len) {
+            return -1;
+        }
+        return len;
+    }
     return QES_ZFPUTS(file->fp, str);
 }
 
@@ -207,6 +431,9 @@ qes_file_putc(struct qes_file *file, const char chr)
     if (!qes_file_ok(file) || !qes_file_writable(file)) {
         return -2;
     }
+    if (file->fp == NULL) {
+        return file->backend->write(file->handle, &chr, 1);
+    }
     res = QES_ZFPUTC(file->fp, chr);
     if (res != chr) {
         return -1;
@@ -215,26 +442,116 @@ qes_file_putc(struct qes_file *file, const char chr)
 }
 
 /*===  FUNCTION  ============================================================*
-Name:           qes_file_getuntil_realloc
-Paramters:      qes_file *file: File to read.
-                int delim: Delimiter char.
-                char **bufref: reference to a `char *` containing the buffer.
-                    Must not refer to a ``char[]`` that cannot be resized with
-                    ``realloc``.
-                size *sizeref: Reference to a variable tracking the allocated
-                    size of the ``char *`` referred to by ``bufref``.
-Description:    Read a string from `file` into a
-                `char *` pointed to by
-                `bufref` up to and inclding the character ``delim``. This
-                function has the added benefit of `realloc`-ing `*bufref` to
-                the next highest base-2 power, if we run out of space.  If it
-                is realloced, `(*sizeref)` is updated to the new buffer size.
-Returns:        ssize_t set to either the length of the line copied to
-                `*bufref`, or one of -1 (EOF) or -2 (error).
-*============================================================================*/
+Name:           qes_file_write
+Paramters:      struct qes_file *file: File to write to.
+                const void *buf: Bytes to write, which may include nulls.
+                size_t len: Number of bytes to write.
+Description:    Write ``len`` bytes of ``buf`` to ``file``. Unlike
+                qes_file_puts, this may be used for binary data.
+Returns:        ssize_t: ``len`` on success, -1 on a failed write, or -2 if
+                ``file`` can't be written.
+ *===========================================================================*/
 static inline ssize_t
-qes_file_getuntil_realloc_ (struct qes_file *file, int delim, char **bufref, size_t *sizeref,
-        qes_errhandler_func onerr, const char *src, const int line)
+qes_file_write(struct qes_file *file, const void *buf, size_t len)
+{
+    if (!qes_file_ok(file) || !qes_file_writable(file) || buf == NULL) {
+        return -2;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    if (file->fp == NULL) {
+        if (file->backend->write(file->handle, buf, len) != (ssize_t)len) {
+            return -1;
+        }
+        return len;
+    }
+    if (QES_ZWRITE(file->fp, buf, len) != (int)len) {
+        return -1;
+    }
+    return len;
+}
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_file_read
+Paramters:      struct qes_file *file: File to read from.
+                void *dest: Buffer of at least ``len`` bytes, or NULL to skip
+                    the bytes instead.
+                size_t len: Number of bytes to read.
+Description:    Read ``len`` bytes from ``file`` into ``dest``. Unlike the
+                line readers, this makes no assumptions about what's read, so
+                it may be used for binary data, including null bytes.
+Returns:        ssize_t: The number of bytes read, which is less than ``len``
+                only at the end of the file, EOF if already there, or -2 on
+                error.
+ *===========================================================================*/
+static inline ssize_t
+qes_file_read(struct qes_file *file, void *dest, size_t len)
+{
+    char *out = dest;
+    size_t done = 0;
+    size_t tocpy = 0;
+    int res = 0;
+
+    if (!qes_file_ok(file) || file->mode != QES_READ_MODE_READ) {
+        return -2;
+    }
+    while (done < len) {
+        if (file->bufiter >= file->bufend) {
+            /* Don't use qes_file_readable, which takes a null byte to mean
+             * an empty buffer */
+            res = __qes_file_fill_buffer(file);
+            if (res == 0) return -2;
+            if (res == EOF) break;
+        }
+        tocpy = file->bufend - file->bufiter;
+        if (tocpy > len - done) tocpy = len - done;
+        if (out != NULL) memcpy(out + done, file->bufiter, tocpy);
+        file->bufiter += tocpy;
+        file->filepos += tocpy;
+        done += tocpy;
+    }
+    if (done == 0 && len > 0) {
+        return EOF;
+    }
+    return done;
+}
+
+/* Grows ``buf`` from ``size`` to at least ``needed`` bytes, either with
+ * realloc or within ``arena`` if it isn't NULL. Returns NULL on error. */
+static inline char *
+__qes_file_grow_buf (char *buf, size_t *size, size_t needed,
+                     struct qes_arena *arena, qes_errhandler_func onerr,
+                     const char *src, const int line)
+{
+    size_t newsize = *size;
+    char *newbuf = NULL;
+
+    /* Work out the final size first, so we only copy once */
+    while (needed >= newsize) {
+        newsize = qes_roundupz(newsize + 1);
+    }
+    if (arena != NULL) {
+        newbuf = qes_arena_realloc(arena, buf, *size, newsize);
+        if (newbuf == NULL) {
+            (*onerr)("Arena allocation failed", src, line);
+        }
+    } else {
+        newbuf = qes_realloc_(buf, sizeof(*buf) * newsize, onerr, src, line);
+    }
+    if (newbuf != NULL) {
+        *size = newsize;
+    }
+    return newbuf;
+}
+
+/* As per qes_file_getuntil_realloc_, but ``*bufref`` is allocated within
+ * ``arena`` if it is not NULL. */
+static inline ssize_t
+__qes_file_getuntil_grow (struct qes_file *file, int delim, char **bufref,
+                          size_t *sizeref, struct qes_arena *arena,
+                          qes_errhandler_func onerr, const char *src,
+                          const int line)
 {
     size_t len = 0;
     size_t tocpy = 0;
@@ -254,8 +571,12 @@ qes_file_getuntil_realloc_ (struct qes_file *file, int delim, char **bufref, siz
     size = *sizeref;
     /* Alloc the buffer if it's NULL */
     if (buf == NULL) {
-        buf = qes_malloc_(__INIT_LINE_LEN * sizeof(*buf), onerr, src, line);
-        size = __INIT_LINE_LEN;
+        size = 0;
+        buf = __qes_file_grow_buf(NULL, &size, __INIT_LINE_LEN - 1, arena,
+                                  onerr, src, line);
+        if (buf == NULL) {
+            return -2;
+        }
         buf[0] = '\0';
     }
     /* Set nextbuf AFTER we may/may not have alloced buf above */
@@ -263,14 +584,18 @@ qes_file_getuntil_realloc_ (struct qes_file *file, int delim, char **bufref, siz
     /* In case we error out below, we always set bufref = buf here, as
        then we don't lose the memory alloced above */
     *bufref = buf;
-    /* Read until delim is in file->buffer, filling buffer */
-    while ((end = strchr(file->bufiter, delim)) == NULL) {
+    /* Read until delim is in file->buffer, filling buffer. memchr is
+     * vectorised by libc for the running CPU, and unlike strchr needn't look
+     * for a '\0' as well. */
+    while ((end = memchr(file->bufiter, delim,
+                         file->bufend - file->bufiter)) == NULL) {
         /* copy the remainder of the buffer */
         tocpy = file->bufend - file->bufiter;
         len += tocpy;
-        while (len + 1 >= size) {
-            size = qes_roundupz(size);
-            buf = qes_realloc_(buf, sizeof(*buf) * size, onerr, src, line);
+        if (len + 1 >= size) {
+            buf = __qes_file_grow_buf(buf, &size, len + 1, arena, onerr, src,
+                                      line);
+            QES_STATS_ADD(file, n_reallocs, 1);
             if (buf == NULL) {
                 /* We bail out here, and *bufref is untouched. This means we
                  * can check for errors, and free *bufref from the calling
@@ -310,9 +635,10 @@ qes_file_getuntil_realloc_ (struct qes_file *file, int delim, char **bufref, siz
     /* we need to ensure that we still have enough room.
      * This happens as above */
     len += tocpy;
-    while (len + 1 >= size) {
-        size = qes_roundupz(size + 1);
-        buf = qes_realloc_(buf, sizeof(*buf) * size, onerr, src, line);
+    if (len + 1 >= size) {
+        buf = __qes_file_grow_buf(buf, &size, len + 1, arena, onerr, src,
+                                  line);
+        QES_STATS_ADD(file, n_reallocs, 1);
         if (buf == NULL) {
             /* We bail out here, and *bufref is untouched. This means we
              * can check for errors, and free *bufref from the calling
@@ -341,6 +667,31 @@ done:
         return -2;
     }
 }
+/*===  FUNCTION  ============================================================*
+Name:           qes_file_getuntil_realloc
+Paramters:      qes_file *file: File to read.
+                int delim: Delimiter char.
+                char **bufref: reference to a `char *` containing the buffer.
+                    Must not refer to a ``char[]`` that cannot be resized with
+                    ``realloc``.
+                size *sizeref: Reference to a variable tracking the allocated
+                    size of the ``char *`` referred to by ``bufref``.
+Description:    Read a string from `file` into a
+                `char *` pointed to by
+                `bufref` up to and inclding the character ``delim``. This
+                function has the added benefit of `realloc`-ing `*bufref` to
+                the next highest base-2 power, if we run out of space.  If it
+                is realloced, `(*sizeref)` is updated to the new buffer size.
+Returns:        ssize_t set to either the length of the line copied to
+                `*bufref`, or one of -1 (EOF) or -2 (error).
+*============================================================================*/
+static inline ssize_t
+qes_file_getuntil_realloc_ (struct qes_file *file, int delim, char **bufref, size_t *sizeref,
+        qes_errhandler_func onerr, const char *src, const int line)
+{
+    return __qes_file_getuntil_grow(file, delim, bufref, sizeref, NULL, onerr,
+                                    src, line);
+}
 #define qes_file_getuntil_realloc(fp, dlm, buf, sz)                         \
     qes_file_getuntil_realloc_(fp, dlm, buf, sz, QES_DEFAULT_ERR_FN,        \
                                __FILE__, __LINE__)
@@ -406,7 +757,8 @@ qes_file_getuntil (struct qes_file *file, const int delim, char *dest, size_t ma
     if (file->eof) {
         return EOF;
     }
-    while ((end = strchr(file->bufiter, delim)) == NULL) {
+    while ((end = memchr(file->bufiter, delim,
+                         file->bufend - file->bufiter)) == NULL) {
         tocpy = file->bufend - file->bufiter;
         if (len + tocpy >= maxlen) {
             /* maxlen - 1 because we always leave space for \0 */
@@ -477,7 +829,7 @@ Paramters:      struct qes_file *file: File to read.
                 struct qes_str *str: struct qes_str object to read into.
 Description:    Convenience wrapper around qes_file_readline_realloc, which reads a
                 line into a struct qes_str object, passing str->str to and str->capacity to
-                qes_file_readline_realloc.
+                qes_file_readline_realloc. Strings in an arena grow within it.
 Returns:        ssize_t set to either the length of the line copied to the
                 struct qes_str, or one of -1 (EOF) or -2 (error).
 * ===========================================================================*/
@@ -489,7 +841,9 @@ qes_file_readline_str (struct qes_file *file, struct qes_str *str)
     if (file == NULL || !qes_str_ok(str)) {
         return -2; /* ERROR, not EOF */
     }
-    len = qes_file_readline_realloc(file, &(str->str), &(str->capacity));
+    len = __qes_file_getuntil_grow(file, '\n', &(str->str), &(str->capacity),
+                                   str->arena, QES_DEFAULT_ERR_FN, __FILE__,
+                                   __LINE__);
     if (len < 0) {
         qes_str_nullify(str);
         return len;
@@ -0,0 +1,175 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_hash.h
+ *
+ *    Description:  Non-cryptographic hash functions
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 10:12:40
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_HASH_H
+#define QES_HASH_H
+
+#include <qes_util.h>
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_hash_fmix64
+Paramters:      uint64_t key: Value to mix.
+Description:    The MurmurHash3 64-bit finaliser. Avalanches all bits of
+                ``key``, which makes it useful for deriving several
+                independent-looking values from one hash.
+Returns:        uint64_t: The mixed value.
+ *===========================================================================*/
+static inline uint64_t
+qes_hash_fmix64 (uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_hash64
+Paramters:      const void *data: Bytes to hash.
+                size_t len: Number of bytes in ``data``.
+                uint64_t seed: Hash seed.
+Description:    MurmurHash64A, by Austin Appleby (public domain). Reads eight
+                bytes at a time with unaligned-safe loads, so ``data`` may
+                point straight into a file buffer.
+Returns:        uint64_t: The hash of ``data``.
+ *===========================================================================*/
+static inline uint64_t
+qes_hash64 (const void *data, size_t len, uint64_t seed)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    const unsigned char *bytes = data;
+    const unsigned char *end = bytes + (len & ~(size_t)7);
+    uint64_t hash = seed ^ (len * m);
+    uint64_t word = 0;
+
+    while (bytes != end) {
+        memcpy(&word, bytes, sizeof(word));
+        word *= m;
+        word ^= word >> r;
+        word *= m;
+        hash ^= word;
+        hash *= m;
+        bytes += 8;
+    }
+    switch (len & 7) {
+        case 7: hash ^= (uint64_t)bytes[6] << 48; /* fall through */
+        case 6: hash ^= (uint64_t)bytes[5] << 40; /* fall through */
+        case 5: hash ^= (uint64_t)bytes[4] << 32; /* fall through */
+        case 4: hash ^= (uint64_t)bytes[3] << 24; /* fall through */
+        case 3: hash ^= (uint64_t)bytes[2] << 16; /* fall through */
+        case 2: hash ^= (uint64_t)bytes[1] << 8;  /* fall through */
+        case 1: hash ^= (uint64_t)bytes[0];
+                hash *= m;
+    }
+    hash ^= hash >> r;
+    hash *= m;
+    hash ^= hash >> r;
+    return hash;
+}
+
+static inline uint64_t
+qes_hash_rotl64 (uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_hash128
+Paramters:      const void *data: Bytes to hash.
+                size_t len: Number of bytes in ``data``.
+                uint64_t seed: Hash seed.
+                uint64_t *out: Two words to store the hash in.
+Description:    MurmurHash3_x64_128, by Austin Appleby (public domain). For
+                when 64 bits would collide too often, e.g. to tell apart
+                hundreds of millions of reads by their hash alone.
+Returns:        void
+ *===========================================================================*/
+static inline void
+qes_hash128 (const void *data, size_t len, uint64_t seed, uint64_t *out)
+{
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const unsigned char *bytes = data;
+    const unsigned char *end = bytes + (len & ~(size_t)15);
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+
+    while (bytes != end) {
+        memcpy(&k1, bytes, sizeof(k1));
+        memcpy(&k2, bytes + 8, sizeof(k2));
+        k1 *= c1;
+        k1 = qes_hash_rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = qes_hash_rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2;
+        k2 = qes_hash_rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        h2 = qes_hash_rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+        bytes += 16;
+    }
+    k1 = k2 = 0;
+    switch (len & 15) {
+        case 15: k2 ^= (uint64_t)bytes[14] << 48; /* fall through */
+        case 14: k2 ^= (uint64_t)bytes[13] << 40; /* fall through */
+        case 13: k2 ^= (uint64_t)bytes[12] << 32; /* fall through */
+        case 12: k2 ^= (uint64_t)bytes[11] << 24; /* fall through */
+        case 11: k2 ^= (uint64_t)bytes[10] << 16; /* fall through */
+        case 10: k2 ^= (uint64_t)bytes[9] << 8;   /* fall through */
+        case 9:  k2 ^= (uint64_t)bytes[8];
+                 k2 *= c2;
+                 k2 = qes_hash_rotl64(k2, 33);
+                 k2 *= c1;
+                 h2 ^= k2;                        /* fall through */
+        case 8:  k1 ^= (uint64_t)bytes[7] << 56;  /* fall through */
+        case 7:  k1 ^= (uint64_t)bytes[6] << 48;  /* fall through */
+        case 6:  k1 ^= (uint64_t)bytes[5] << 40;  /* fall through */
+        case 5:  k1 ^= (uint64_t)bytes[4] << 32;  /* fall through */
+        case 4:  k1 ^= (uint64_t)bytes[3] << 24;  /* fall through */
+        case 3:  k1 ^= (uint64_t)bytes[2] << 16;  /* fall through */
+        case 2:  k1 ^= (uint64_t)bytes[1] << 8;   /* fall through */
+        case 1:  k1 ^= (uint64_t)bytes[0];
+                 k1 *= c1;
+                 k1 = qes_hash_rotl64(k1, 31);
+                 k1 *= c2;
+                 h1 ^= k1;
+    }
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = qes_hash_fmix64(h1);
+    h2 = qes_hash_fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+#endif /* QES_HASH_H */
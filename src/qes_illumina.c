@@ -0,0 +1,188 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_illumina.c
+ *
+ *    Description:  Parse the fields of Illumina read headers
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 04:12:36
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_illumina.h"
+
+/* Most colons in an Illumina name */
+#define ILLUMINA_MAX_COLONS 7
+
+
+/* Parse a decimal integer spanning all of [``iter``, ``end``). Returns 0, or
+ * 1 if it's empty, isn't all digits, or overflows. */
+static inline int
+illumina_uint (const char *iter, const char *end, uint32_t *val)
+{
+    uint64_t res = 0;
+    unsigned digit = 0;
+    unsigned bad = 0;
+
+    if (iter == end || end - iter > 10) return 1;
+    /* Accumulate any non-digit rather than branching on each */
+    for (; iter < end; iter++) {
+        digit = (unsigned char)*iter - '0';
+        bad |= digit > 9;
+        res = res * 10 + digit;
+    }
+    if (bad || res > UINT32_MAX) return 1;
+    *val = res;
+    return 0;
+}
+
+/* Parse the "read:filtered:control:index" comment of CASAVA 1.8 */
+static inline int
+illumina_parse_comment (const char *comment, size_t len,
+                        struct qes_illumina_header *hdr)
+{
+    const char *end = comment + len;
+    const char *iter = NULL;
+    const char *field = NULL;
+
+    /* Only the first word */
+    for (iter = comment; iter < end; iter++) {
+        if (isspace(*iter)) break;
+    }
+    end = iter;
+    iter = memchr(comment, ':', end - comment);
+    if (iter == NULL || illumina_uint(comment, iter, &hdr->read)) return 1;
+    field = iter + 1;
+    if (end - field < 2 || field[1] != ':') return 1;
+    if (field[0] == 'Y') {
+        hdr->filtered = 1;
+    } else if (field[0] == 'N') {
+        hdr->filtered = 0;
+    } else {
+        return 1;
+    }
+    field += 2;
+    iter = memchr(field, ':', end - field);
+    if (iter == NULL || illumina_uint(field, iter, &hdr->control)) return 1;
+    hdr->index = iter + 1;
+    hdr->index_len = end - hdr->index;
+    return 0;
+}
+
+int
+qes_illumina_parse (const char *name, size_t name_len, const char *comment,
+                    size_t comment_len, struct qes_illumina_header *hdr)
+{
+    const char *colons[ILLUMINA_MAX_COLONS + 1];
+    const char *end = name + name_len;
+    const char *iter = name;
+    const char *field = NULL;
+    size_t n_colons = 0;
+    int err = 0;
+
+    if (hdr == NULL) return 1;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->filtered = -1;
+    if (name == NULL) return 1;
+    while (n_colons <= ILLUMINA_MAX_COLONS &&
+            (iter = memchr(iter, ':', end - iter)) != NULL) {
+        colons[n_colons++] = iter++;
+    }
+    hdr->instrument = name;
+    if (n_colons == 6 || n_colons == 7) {
+        /* instrument:run:flowcell:lane:tile:x:y, then ":UMI" from bcl2fastq
+         * 2.20 on, if given, and perhaps a "/read" */
+        hdr->instrument_len = colons[0] - name;
+        err |= illumina_uint(colons[0] + 1, colons[1], &hdr->run);
+        hdr->flowcell = colons[1] + 1;
+        hdr->flowcell_len = colons[2] - hdr->flowcell;
+        err |= illumina_uint(colons[2] + 1, colons[3], &hdr->lane);
+        err |= illumina_uint(colons[3] + 1, colons[4], &hdr->tile);
+        err |= illumina_uint(colons[4] + 1, colons[5], &hdr->x);
+        field = colons[n_colons - 1] + 1;
+        iter = memchr(field, '/', end - field);
+        if (iter != NULL) {
+            err |= illumina_uint(iter + 1, end, &hdr->read);
+            end = iter;
+        }
+        if (n_colons == 7) {
+            hdr->umi = field;
+            hdr->umi_len = end - field;
+            err |= hdr->umi_len == 0;
+            end = colons[6];
+        }
+        err |= illumina_uint(colons[5] + 1, end, &hdr->y);
+        if (comment != NULL && comment_len > 0) {
+            err |= illumina_parse_comment(comment, comment_len, hdr);
+        }
+        hdr->format = QES_ILLUMINA_CASAVA18;
+    } else if (n_colons == 4) {
+        /* instrument:lane:tile:x:y, then "#index" and "/read", if given */
+        hdr->instrument_len = colons[0] - name;
+        err |= illumina_uint(colons[0] + 1, colons[1], &hdr->lane);
+        err |= illumina_uint(colons[1] + 1, colons[2], &hdr->tile);
+        err |= illumina_uint(colons[2] + 1, colons[3], &hdr->x);
+        field = colons[3] + 1;
+        iter = memchr(field, '/', end - field);
+        if (iter != NULL) {
+            err |= illumina_uint(iter + 1, end, &hdr->read);
+            end = iter;
+        }
+        iter = memchr(field, '#', end - field);
+        if (iter != NULL) {
+            hdr->index = iter + 1;
+            hdr->index_len = end - hdr->index;
+            end = iter;
+        }
+        err |= illumina_uint(field, end, &hdr->y);
+        hdr->format = QES_ILLUMINA_OLD;
+    } else {
+        err = 1;
+    }
+    if (err) {
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->filtered = -1;
+        return 1;
+    }
+    return 0;
+}
+
+int
+qes_illumina_parse_seq (const struct qes_seq *seq,
+                        struct qes_illumina_header *hdr)
+{
+    struct qes_str name;
+    struct qes_str comment;
+
+    if (seq == NULL || seq->name.str == NULL) {
+        return qes_illumina_parse(NULL, 0, NULL, 0, hdr);
+    }
+    qes_seq_peek_header(seq, &name, &comment);
+    return qes_illumina_parse(name.str, name.len, comment.str, comment.len,
+                              hdr);
+}
+
+ssize_t
+qes_illumina_parse_batch (const struct qes_seqbatch *batch,
+                          struct qes_illumina_header *hdrs)
+{
+    ssize_t n_parsed = 0;
+    size_t iii = 0;
+
+    if (batch == NULL || hdrs == NULL) return -1;
+    for (iii = 0; iii < batch->n_seqs; iii++) {
+        n_parsed += !qes_illumina_parse(qes_seqbatch_str(batch, name, iii),
+                           qes_seqbatch_len(batch, name, iii),
+                           qes_seqbatch_str(batch, comment, iii),
+                           qes_seqbatch_len(batch, comment, iii),
+                           &hdrs[iii]);
+    }
+    return n_parsed;
+}
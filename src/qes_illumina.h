@@ -0,0 +1,112 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_illumina.h
+ *
+ *    Description:  Parse the fields of Illumina read headers
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 04:12:36
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_ILLUMINA_H
+#define QES_ILLUMINA_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+#include <qes_seqbatch.h>
+
+enum qes_illumina_format {
+    /* Not an Illumina header */
+    QES_ILLUMINA_UNKNOWN = 0,
+    /* CASAVA 1.8 and later, e.g.
+     * @instrument:run:flowcell:lane:tile:x:y read:filtered:control:index,
+     * with a ":UMI" after y if UMIs were read */
+    QES_ILLUMINA_CASAVA18 = 1,
+    /* Earlier pipelines, e.g. @instrument:lane:tile:x:y#index/read */
+    QES_ILLUMINA_OLD = 2,
+};
+
+/* Fields of a header. Strings point into the name or comment parsed, aren't
+ * null-terminated, and are only valid while those are. Fields a format
+ * lacks are 0, or empty. */
+struct qes_illumina_header {
+    enum qes_illumina_format format;
+    const char *instrument;
+    size_t instrument_len;
+    /* CASAVA 1.8 only */
+    uint32_t run;
+    const char *flowcell;
+    size_t flowcell_len;
+    uint32_t lane;
+    uint32_t tile;
+    uint32_t x;
+    uint32_t y;
+    /* Read of the pair, 1 or 2, or 0 if not given */
+    uint32_t read;
+    /* 1 if the read failed the chastity filter, 0 if it passed, or -1 if
+     * not given (which it never is by old headers) */
+    int filtered;
+    /* Control bits, CASAVA 1.8 only */
+    uint32_t control;
+    /* Index sequence(s), e.g. "ACGT" or "ACGT+TGCA", or sample number */
+    const char *index;
+    size_t index_len;
+    /* UMI, e.g. "ACGTAC" or "ACGT+TTGA", from an eighth field of a CASAVA
+     * 1.8 name, or NULL if there isn't one */
+    const char *umi;
+    size_t umi_len;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_illumina_parse
+Paramters:      const char *name, size_t name_len: Read name, without '@'.
+                const char *comment, size_t comment_len: Comment of the read,
+                    which may be empty, and NULL if so.
+                struct qes_illumina_header *hdr: Filled with the fields.
+Description:    Parse an Illumina header in one pass, without allocating or
+                copying. The format is told by the number of colons in the
+                name: six for CASAVA 1.8, or seven if a UMI follows, and four
+                for older pipelines. Anything after the first whitespace of
+                the comment is ignored.
+Returns:        int: 0 on success, 1 if it's not an Illumina header, in which
+                case ``hdr->format`` is QES_ILLUMINA_UNKNOWN.
+ *===========================================================================*/
+int qes_illumina_parse (const char *name, size_t name_len,
+                        const char *comment, size_t comment_len,
+                        struct qes_illumina_header *hdr);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_illumina_parse_seq
+Paramters:      const struct qes_seq *seq: Read whose header to parse, which
+                    may have been read with QES_HEADER_LAZY.
+                struct qes_illumina_header *hdr: Filled with the fields.
+Description:    As per qes_illumina_parse, for the name and comment of
+                ``seq``.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+int qes_illumina_parse_seq (const struct qes_seq *seq,
+                            struct qes_illumina_header *hdr);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_illumina_parse_batch
+Paramters:      const struct qes_seqbatch *batch: Reads to parse.
+                struct qes_illumina_header *hdrs: Array of at least
+                    ``batch->n_seqs`` headers, filled with each read's.
+Description:    As per qes_illumina_parse, for every read of ``batch``. Reads
+                which aren't Illumina headers have QES_ILLUMINA_UNKNOWN.
+Returns:        ssize_t: The number of reads with Illumina headers, or -1 on
+                error.
+ *===========================================================================*/
+ssize_t qes_illumina_parse_batch (const struct qes_seqbatch *batch,
+                                  struct qes_illumina_header *hdrs);
+
+#endif /* QES_ILLUMINA_H */
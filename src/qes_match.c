@@ -19,11 +19,46 @@
 
 #include "qes_match.h"
 
-inline int_fast32_t
+/* Number of chars qes_match_hamming_max compares between checks of ``max`` */
+#define QES_MATCH_BLOCK_LEN 64
+
+/* Counts mismatches in the first ``len`` chars. This has no branches in the
+ * loop, so the compiler vectorises it, once for each ISA level. */
+QES_MULTIVERSION
+static size_t
+match_count_mismatches (const char *seq1, const char *seq2, size_t len)
+{
+    size_t mismatches = 0;
+    size_t iii = 0;
+
+    for (iii = 0; iii < len; iii++) {
+        mismatches += seq1[iii] != seq2[iii];
+    }
+    return mismatches;
+}
+
+/* As per match_count_mismatches, against the reverse complement of the
+ * ``len`` chars ending at ``seq2_end`` */
+QES_MULTIVERSION
+static size_t
+match_count_revcomp_mismatches (const char *seq1, const char *seq2_end,
+                                size_t len)
+{
+    size_t mismatches = 0;
+    size_t iii = 0;
+    char comp = 0;
+
+    for (iii = 0; iii < len; iii++) {
+        comp = qes_sequtil_comp_table[(unsigned char)*(seq2_end - iii - 1)];
+        mismatches += ((seq1[iii] & ~0x20) != comp) | (comp == 'N');
+    }
+    return mismatches;
+}
+
+int_fast32_t
 qes_match_hamming (const char *seq1, const char *seq2, size_t len)
 {
     int_fast32_t mismatches = 0;
-    size_t iii = 0;
 
     /* Error out on bad arguments */
     if (seq1 == NULL || seq2 == NULL) {
@@ -40,22 +75,18 @@ qes_match_hamming (const char *seq1, const char *seq2, size_t len)
     }
     /* Count mismatches. See comment on analagous loop in qes_match_hamming_max
      * for an explanation. */
-    while(iii < len) {
-        if (seq2[iii] != seq1[iii]) {
-            mismatches++;
-        }
-        iii++;
-    }
+    mismatches = match_count_mismatches(seq1, seq2, len);
     return mismatches;
 }
 
 
-inline int_fast32_t
+int_fast32_t
 qes_match_hamming_max(const char *seq1, const char *seq2, size_t len,
                       int_fast32_t max)
 {
     int_fast32_t mismatches = 0;
     size_t iii = 0;
+    size_t block = 0;
 
     /* Error out on bad arguments */
     if (seq1 == NULL || seq2 == NULL || max < 0) {
@@ -74,11 +105,10 @@ qes_match_hamming_max(const char *seq1, const char *seq2, size_t len,
        WTF they were doing. This makes things a bit faster, since these
        functions are expected to be very much inner-loop. */
     while(iii < len) {
-        /* Find mismatch count */
-        if (seq2[iii] != seq1[iii]) {
-            mismatches++;
-        }
-        iii++;
+        /* Count a block at a time, so the count itself can be vectorised */
+        block = len - iii < QES_MATCH_BLOCK_LEN ? len - iii : QES_MATCH_BLOCK_LEN;
+        mismatches += match_count_mismatches(seq1 + iii, seq2 + iii, block);
+        iii += block;
         if (mismatches > max) {
             /* Bail out if we're over max, always cap at max + 1 */
             return max + 1;
@@ -86,3 +116,27 @@ qes_match_hamming_max(const char *seq1, const char *seq2, size_t len,
     }
     return mismatches;
 }
+
+int_fast32_t
+qes_match_hamming_revcomp_max(const char *seq1, const char *seq2, size_t len,
+                              int_fast32_t max)
+{
+    int_fast32_t mismatches = 0;
+    size_t iii = 0;
+    size_t block = 0;
+
+    if (seq1 == NULL || seq2 == NULL || max < 0) {
+        return -1;
+    }
+    /* As per qes_match_hamming_max, but seq2 is walked from its end */
+    while(iii < len) {
+        block = len - iii < QES_MATCH_BLOCK_LEN ? len - iii : QES_MATCH_BLOCK_LEN;
+        mismatches += match_count_revcomp_mismatches(seq1 + iii,
+                                                     seq2 + len - iii, block);
+        iii += block;
+        if (mismatches > max) {
+            return max + 1;
+        }
+    }
+    return mismatches;
+}
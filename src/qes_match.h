@@ -21,6 +21,7 @@
 #define QES_MATCH_H
 
 #include <qes_util.h>
+#include <qes_sequtil.h>
 
 
 /*===  FUNCTION  ============================================================*
@@ -53,4 +54,21 @@ Returns:        The hamming distance between ``seq1`` and ``seq2``, or
 extern int_fast32_t qes_match_hamming_max(const char *seq1, const char *seq2, size_t len,
         int_fast32_t max);
 
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_match_hamming_revcomp_max
+Paramters:      const char *seq1, *seq2: Two sequences to compare.
+                size_t len: Compare ``len`` chars of each.
+                int_fast32_t max: Stop counting at ``max``, return ``max + 1``.
+Description:    As per qes_match_hamming_max, but compare ``seq1`` to the
+                reverse complement of ``seq2``, without making a copy of it.
+                Case is ignored, and Ns never match. This finds where mates
+                of a pair overlap, as read 2 is on the opposite strand.
+Returns:        The hamming distance between ``seq1`` and the reverse
+                complement of ``seq2``, or ``max + 1`` if that exceeds
+                ``max``, or -1 on error.
+ *===========================================================================*/
+extern int_fast32_t qes_match_hamming_revcomp_max(const char *seq1,
+        const char *seq2, size_t len, int_fast32_t max);
+
 #endif /* QES_MATCH_H */
@@ -0,0 +1,466 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_merge.c
+ *
+ *    Description:  Merging overlapping mates of pairs into single reads
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 08:41:05
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include <math.h>
+
+#include "qes_merge.h"
+
+#ifdef OPENMP_FOUND
+#define MERGE_OMP(x) _Pragma(STRINGIFY(omp x))
+#else
+#define MERGE_OMP(x)
+#endif
+
+/* Mates up to this long are normalised on the stack */
+#define MERGE_BUF_LEN 512
+/* Stands in for N in read 2, so it matches nothing in read 1 */
+#define MERGE_NO_MATCH '*'
+/* Bases compared between checks of the mismatches so far. Most offsets are
+ * wrong and fail within a block, so it's short, but a shorter one is fully
+ * unrolled, and gcc 12 then miscompiles the count. */
+#define MERGE_BLOCK_LEN 32
+
+/* Sequence and qualities of one mate. ``qual`` is NULL if there are none. */
+struct merge_mate {
+    const char *seq;
+    const char *qual;
+    size_t len;
+};
+
+
+/* Probability a base with Phred score ``phred`` is wrong. A base can't be
+ * more wrong than a random one. */
+static double
+merge_error (int phred)
+{
+    double err = pow(10.0, -phred / 10.0);
+
+    return err < 0.75 ? err : 0.75;
+}
+
+/* Phred+33 char of ``err``, at most ``max_qual`` */
+static char
+merge_phred_char (double err, int max_qual)
+{
+    int phred = max_qual;
+
+    if (err > 0) {
+        phred = (int)(-10.0 * log10(err) + 0.5);
+    }
+    if (phred > max_qual) phred = max_qual;
+    if (phred < 0) phred = 0;
+    return phred + QES_MERGE_QUAL_OFFSET;
+}
+
+struct qes_merge *
+qes_merge_create (const struct qes_merge_opts *opts)
+{
+    struct qes_merge *merge = qes_calloc_errnil(1, sizeof(*merge));
+    double err1 = 0;
+    double err2 = 0;
+    double right = 0;
+    double swap = 0;
+    double other = 0;
+    int max_qual = 0;
+    int iii = 0;
+    int jjj = 0;
+
+    if (merge == NULL) return NULL;
+    if (opts != NULL) merge->opts = *opts;
+    if (merge->opts.min_overlap == 0) {
+        merge->opts.min_overlap = QES_MERGE_MIN_OVERLAP;
+    }
+    if (merge->opts.max_mismatch_rate <= 0) {
+        merge->opts.max_mismatch_rate = QES_MERGE_MAX_MISMATCH_RATE;
+    }
+    if (merge->opts.max_qual <= 0) merge->opts.max_qual = QES_MERGE_MAX_QUAL;
+    if (merge->opts.max_qual >= QES_MERGE_N_QUALS) {
+        merge->opts.max_qual = QES_MERGE_N_QUALS - 1;
+    }
+    if (merge->opts.n_threads == 0) merge->opts.n_threads = 1;
+    max_qual = merge->opts.max_qual;
+    for (iii = 0; iii < QES_MERGE_N_QUALS; iii++) {
+        err1 = merge_error(iii);
+        for (jjj = 0; jjj < QES_MERGE_N_QUALS; jjj++) {
+            err2 = merge_error(jjj);
+            /* Both right, or both wrong the same way */
+            right = (1 - err1) * (1 - err2);
+            other = err1 * err2 / 3;
+            merge->agree[iii][jjj] = merge_phred_char(other / (right + other),
+                                                      max_qual);
+            /* Read 1's base is taken: it's right and read 2 is wrong, read
+             * 2 is right, or neither is */
+            right = (1 - err1) * err2 / 3;
+            swap = err1 / 3 * (1 - err2);
+            other = 2 * (err1 / 3) * (err2 / 3);
+            merge->disagree[iii][jjj] = merge_phred_char(
+                    (swap + other) / (right + swap + other), max_qual);
+        }
+    }
+    merge->scratch = qes_seq_create();
+    if (merge->scratch == NULL) {
+        qes_merge_destroy(merge);
+        return NULL;
+    }
+    return merge;
+}
+
+/* Find the insert of normalised mates. ``rc2`` is read 2, reverse
+ * complemented. Mismatches are counted as in qes_match_hamming_max, a block at
+ * a time with no branches, so each block is a vector compare, for each ISA
+ * level. Doing this inline, rather than calling qes_match_hamming_max, saves
+ * a call per offset, which cost more than the compare. */
+QES_MULTIVERSION
+static size_t
+merge_scan (const struct qes_merge_opts *opts, const char *seq1, size_t len1,
+            const char *rc2, size_t len2)
+{
+    size_t best_insert = 0;
+    size_t best_overlap = 0;
+    size_t best_mismatches = 0;
+    size_t insert = 0;
+    size_t start = 0;
+    size_t end = 0;
+    size_t overlap = 0;
+    size_t bound = 0;
+    size_t max = 0;
+    size_t mismatches = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+    uint8_t count = 0;
+    const char *seq2 = NULL;
+
+    /* The insert covers read 1 from 0, and read 2 up to ``insert``, so they
+     * overlap from ``start`` to ``end`` */
+    for (insert = opts->min_overlap;
+            insert + opts->min_overlap <= len1 + len2; insert++) {
+        start = insert > len2 ? insert - len2 : 0;
+        end = insert < len1 ? insert : len1;
+        overlap = end - start;
+        if (overlap < opts->min_overlap) continue;
+        max = (size_t)(opts->max_mismatch_rate * overlap);
+        if (best_overlap > 0) {
+            /* Stop counting once this can't beat the best so far */
+            bound = (best_mismatches + 1) * overlap / best_overlap;
+            if (bound == 0) continue;
+            if (bound - 1 < max) max = bound - 1;
+        }
+        seq2 = rc2 + start + len2 - insert;
+        mismatches = 0;
+        for (iii = 0; iii + MERGE_BLOCK_LEN <= overlap;
+                iii += MERGE_BLOCK_LEN) {
+            count = 0;
+            for (jjj = 0; jjj < MERGE_BLOCK_LEN; jjj++) {
+                count += seq1[start + iii + jjj] != seq2[iii + jjj];
+            }
+            mismatches += count;
+            if (mismatches > max) break;
+        }
+        if (mismatches > max) continue;
+        for (; iii < overlap; iii++) {
+            mismatches += seq1[start + iii] != seq2[iii];
+        }
+        if (mismatches > max) continue;
+        if (best_overlap == 0 ||
+                (mismatches + 1) * best_overlap <
+                    (best_mismatches + 1) * overlap ||
+                ((mismatches + 1) * best_overlap ==
+                    (best_mismatches + 1) * overlap &&
+                 overlap > best_overlap)) {
+            best_insert = insert;
+            best_overlap = overlap;
+            best_mismatches = mismatches;
+        }
+    }
+    return best_insert;
+}
+
+size_t
+qes_merge_find_insert (const struct qes_merge *merge, const char *seq1,
+                       size_t len1, const char *seq2, size_t len2)
+{
+    char stack_buf[2 * MERGE_BUF_LEN];
+    char *buf = stack_buf;
+    char *rc2 = NULL;
+    char comp = 0;
+    size_t insert = 0;
+    size_t iii = 0;
+
+    if (merge == NULL || seq1 == NULL || seq2 == NULL) return SIZE_MAX;
+    if (len1 > MERGE_BUF_LEN || len2 > MERGE_BUF_LEN) {
+        buf = qes_malloc_errnil(len1 + len2);
+        if (buf == NULL) return SIZE_MAX;
+    }
+    /* Upper case read 1, and reverse complement read 2, once, rather than
+     * at each offset */
+    rc2 = buf + len1;
+    for (iii = 0; iii < len1; iii++) {
+        buf[iii] = seq1[iii] & ~0x20;
+    }
+    for (iii = 0; iii < len2; iii++) {
+        comp = qes_sequtil_comp_table[(unsigned char)seq2[len2 - iii - 1]];
+        rc2[iii] = comp == 'N' ? MERGE_NO_MATCH : comp;
+    }
+    insert = merge_scan(&merge->opts, buf, len1, rc2, len2);
+    if (buf != stack_buf) qes_free(buf);
+    return insert;
+}
+
+/* Phred score of ``qual``, as an index of the tables */
+static inline int
+merge_phred (char qual)
+{
+    int phred = (unsigned char)qual - QES_MERGE_QUAL_OFFSET;
+
+    if (phred < 0) return 0;
+    if (phred >= QES_MERGE_N_QUALS) return QES_MERGE_N_QUALS - 1;
+    return phred;
+}
+
+/* Write the insert of two mates to ``seq`` and ``qual``, which is NULL if
+ * either mate has no qualities */
+static void
+merge_fill (const struct qes_merge *merge, const struct merge_mate *mate1,
+            const struct merge_mate *mate2, size_t insert, char *seq,
+            char *qual)
+{
+    const size_t start = insert > mate2->len ? insert - mate2->len : 0;
+    const size_t end = insert < mate1->len ? insert : mate1->len;
+    size_t iii = 0;
+    size_t jjj = 0;
+    char base1 = 0;
+    char base2 = 0;
+    int phred1 = 0;
+    int phred2 = 0;
+
+    /* Read 1 alone */
+    memcpy(seq, mate1->seq, start);
+    if (qual != NULL) memcpy(qual, mate1->qual, start);
+    /* Both. Base ``iii`` of the insert is base ``jjj`` of read 2. */
+    for (iii = start; iii < end; iii++) {
+        jjj = insert - iii - 1;
+        base1 = mate1->seq[iii];
+        base2 = qes_sequtil_comp_table[(unsigned char)mate2->seq[jjj]];
+        if (qual == NULL) {
+            seq[iii] = (base1 & ~0x20) == 'N' ? base2 : base1;
+            continue;
+        }
+        phred1 = merge_phred(mate1->qual[iii]);
+        phred2 = merge_phred(mate2->qual[jjj]);
+        if (base2 == 'N') {
+            seq[iii] = base1;
+            qual[iii] = mate1->qual[iii];
+        } else if ((base1 & ~0x20) == 'N') {
+            seq[iii] = base2;
+            qual[iii] = mate2->qual[jjj];
+        } else if ((base1 & ~0x20) == base2) {
+            seq[iii] = base1;
+            qual[iii] = merge->agree[phred1][phred2];
+        } else if (phred1 >= phred2) {
+            seq[iii] = base1;
+            qual[iii] = merge->disagree[phred1][phred2];
+        } else {
+            seq[iii] = base2;
+            qual[iii] = merge->disagree[phred2][phred1];
+        }
+    }
+    /* Read 2 alone */
+    for (iii = end; iii < insert; iii++) {
+        jjj = insert - iii - 1;
+        seq[iii] = qes_sequtil_comp_table[(unsigned char)mate2->seq[jjj]];
+        if (qual != NULL) qual[iii] = mate2->qual[jjj];
+    }
+}
+
+/* Copy ``len`` chars of ``src`` to ``str``, unless ``str`` was never
+ * allocated. Returns 0, or 1 on error. */
+static int
+merge_copy_str (struct qes_str *str, const char *src, size_t len)
+{
+    if (str->str == NULL) return 0;
+    if (qes_str_reserve(str, len + 1) != 0) return 1;
+    if (len > 0) memcpy(str->str, src, len);
+    str->str[len] = '\0';
+    str->len = len;
+    return 0;
+}
+
+/* Fill ``merged`` with the mates, merged over ``insert`` and named
+ * ``name``. Returns 0, or 1 on error. */
+static int
+merge_into (const struct qes_merge *merge, const struct qes_str *name,
+            const struct qes_str *comment, const struct merge_mate *mate1,
+            const struct merge_mate *mate2, size_t insert,
+            struct qes_seq *merged)
+{
+    int has_qual = mate1->qual != NULL && mate2->qual != NULL &&
+                   merged->qual.str != NULL;
+
+    if (merge_copy_str(&merged->name, name->str, name->len) != 0 ||
+            merge_copy_str(&merged->comment, comment->str,
+                           comment->len) != 0 ||
+            qes_str_reserve(&merged->seq, insert + 1) != 0 ||
+            (has_qual && qes_str_reserve(&merged->qual, insert + 1) != 0)) {
+        return 1;
+    }
+    merged->raw_header = 0;
+    merge_fill(merge, mate1, mate2, insert, merged->seq.str,
+               has_qual ? merged->qual.str : NULL);
+    merged->seq.str[insert] = '\0';
+    merged->seq.len = insert;
+    if (merged->qual.str != NULL) {
+        merged->qual.len = has_qual ? insert : 0;
+        merged->qual.str[merged->qual.len] = '\0';
+    }
+    return 0;
+}
+
+/* The qualities of ``seq``, or NULL if it has none. Returns 1 if they don't
+ * match its sequence. */
+static int
+merge_get_qual (const struct qes_seq *seq, const char **qual)
+{
+    *qual = NULL;
+    if (qes_str_ok(&seq->qual) && seq->qual.len > 0) {
+        if (seq->qual.len != seq->seq.len) return 1;
+        *qual = seq->qual.str;
+    }
+    return 0;
+}
+
+ssize_t
+qes_merge_pairs (struct qes_merge *merge, const struct qes_seq *seq1,
+                 const struct qes_seq *seq2, struct qes_seq *merged)
+{
+    struct merge_mate mate1;
+    struct merge_mate mate2;
+    struct qes_str name;
+    struct qes_str comment;
+    size_t insert = 0;
+
+    if (merge == NULL || !qes_seq_ok_no_comment_or_qual(seq1) ||
+            !qes_seq_ok_no_comment_or_qual(seq2) ||
+            !qes_seq_ok_no_comment_or_qual(merged) || merged == seq1 ||
+            merged == seq2 || merge_get_qual(seq1, &mate1.qual) != 0 ||
+            merge_get_qual(seq2, &mate2.qual) != 0) {
+        return -1;
+    }
+    mate1.seq = seq1->seq.str;
+    mate1.len = seq1->seq.len;
+    mate2.seq = seq2->seq.str;
+    mate2.len = seq2->seq.len;
+    merge->n_pairs++;
+    insert = qes_merge_find_insert(merge, mate1.seq, mate1.len, mate2.seq,
+                                   mate2.len);
+    if (insert == SIZE_MAX) return -1;
+    if (insert == 0) return 0;
+    qes_seq_peek_header(seq1, &name, &comment);
+    if (merge_into(merge, &name, &comment, &mate1, &mate2, insert,
+                   merged) != 0) {
+        return -1;
+    }
+    merge->n_merged++;
+    return insert;
+}
+
+/* Mate ``idx`` of ``batch`` */
+static void
+merge_batch_mate (const struct qes_seqbatch *batch, size_t idx,
+                  struct merge_mate *mate)
+{
+    mate->seq = qes_seqbatch_str(batch, seq, idx);
+    mate->len = qes_seqbatch_len(batch, seq, idx);
+    mate->qual = NULL;
+    if (mate->len > 0 && qes_seqbatch_len(batch, qual, idx) == mate->len) {
+        mate->qual = qes_seqbatch_str(batch, qual, idx);
+    }
+}
+
+ssize_t
+qes_merge_batch (struct qes_merge *merge, const struct qes_seqbatch *batch1,
+                 const struct qes_seqbatch *batch2,
+                 struct qes_seqbatch *merged, size_t *inserts)
+{
+    struct merge_mate mate1;
+    struct merge_mate mate2;
+    struct qes_str name;
+    struct qes_str comment;
+    size_t *newinserts = NULL;
+    size_t n_seqs = 0;
+    size_t n_merged = 0;
+    size_t iii = 0;
+
+    if (merge == NULL || batch1 == NULL || batch2 == NULL ||
+            merged == NULL || batch2->n_seqs != batch1->n_seqs ||
+            merged->capacity < batch1->capacity) {
+        return -1;
+    }
+    n_seqs = batch1->n_seqs;
+    if (inserts == NULL) {
+        if (n_seqs > merge->inserts_capacity) {
+            newinserts = qes_realloc_errnil(merge->inserts,
+                                            n_seqs * sizeof(*newinserts));
+            if (newinserts == NULL) return -1;
+            merge->inserts = newinserts;
+            merge->inserts_capacity = n_seqs;
+        }
+        inserts = merge->inserts;
+    }
+    qes_seqbatch_clear(merged);
+    /* Finding overlaps is the expensive part, and can be done in any
+     * order */
+    MERGE_OMP(parallel for num_threads(merge->opts.n_threads) \
+              schedule(static))
+    for (iii = 0; iii < n_seqs; iii++) {
+        inserts[iii] = qes_merge_find_insert(
+                merge, qes_seqbatch_str(batch1, seq, iii),
+                qes_seqbatch_len(batch1, seq, iii),
+                qes_seqbatch_str(batch2, seq, iii),
+                qes_seqbatch_len(batch2, seq, iii));
+    }
+    /* But merged reads are added in order */
+    for (iii = 0; iii < n_seqs; iii++) {
+        if (inserts[iii] == SIZE_MAX) return -1;
+        if (inserts[iii] == 0) continue;
+        merge_batch_mate(batch1, iii, &mate1);
+        merge_batch_mate(batch2, iii, &mate2);
+        name.str = qes_seqbatch_str(batch1, name, iii);
+        name.len = qes_seqbatch_len(batch1, name, iii);
+        comment.str = qes_seqbatch_str(batch1, comment, iii);
+        comment.len = qes_seqbatch_len(batch1, comment, iii);
+        if (merge_into(merge, &name, &comment, &mate1, &mate2, inserts[iii],
+                       merge->scratch) != 0 ||
+                qes_seqbatch_add(merged, merge->scratch) != 0) {
+            return -1;
+        }
+        n_merged++;
+    }
+    merge->n_pairs += n_seqs;
+    merge->n_merged += n_merged;
+    return n_merged;
+}
+
+void
+qes_merge_destroy_ (struct qes_merge *merge)
+{
+    if (merge != NULL) {
+        qes_free(merge->inserts);
+        qes_seq_destroy(merge->scratch);
+        qes_free(merge);
+    }
+}
@@ -0,0 +1,156 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_merge.h
+ *
+ *    Description:  Merging overlapping mates of pairs into single reads
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 08:41:05
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_MERGE_H
+#define QES_MERGE_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+#include <qes_seqbatch.h>
+#include <qes_sequtil.h>
+
+/*---------------------------------------------------------------------------
+  | qes_merge module -- merging mates which overlap into single reads       |
+  ---------------------------------------------------------------------------*/
+
+/* Defaults of struct qes_merge_opts */
+#define QES_MERGE_MIN_OVERLAP 10
+#define QES_MERGE_MAX_MISMATCH_RATE 0.1
+#define QES_MERGE_MAX_QUAL 41
+/* Quality scores are Phred+33, and there are this many such chars */
+#define QES_MERGE_QUAL_OFFSET 33
+#define QES_MERGE_N_QUALS 94
+
+/* Options for qes_merge_create. A zeroed struct gives the defaults. */
+struct qes_merge_opts {
+    /* Fewest bases of the mates which must overlap. 0 means
+     * QES_MERGE_MIN_OVERLAP. */
+    size_t min_overlap;
+    /* Most mismatches allowed per base of the overlap. 0 means
+     * QES_MERGE_MAX_MISMATCH_RATE. Any rate below 1 / min_overlap allows
+     * none. */
+    double max_mismatch_rate;
+    /* Highest Phred score given to a base of the overlap. 0 means
+     * QES_MERGE_MAX_QUAL. */
+    int max_qual;
+    /* Threads finding overlaps in qes_merge_batch, if libqes was built with
+     * OpenMP. 0 means 1. */
+    unsigned n_threads;
+};
+
+struct qes_merge {
+    struct qes_merge_opts opts;
+    /* Phred+33 posterior quality of a base of the overlap, indexed by the
+     * mates' Phred scores, the higher first if they disagree */
+    char agree[QES_MERGE_N_QUALS][QES_MERGE_N_QUALS];
+    char disagree[QES_MERGE_N_QUALS][QES_MERGE_N_QUALS];
+    /* Pairs seen, and of those, merged */
+    uint64_t n_pairs;
+    uint64_t n_merged;
+    /* Inserts of a batch, and a pair being merged */
+    size_t *inserts;
+    size_t inserts_capacity;
+    struct qes_seq *scratch;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_merge_create
+Paramters:      const struct qes_merge_opts *opts: Options, or NULL for the
+                    defaults.
+Description:    Create a merger of paired reads, working out the posterior
+                quality of every pair of scores up front.
+Returns:        struct qes_merge *: The merger, or NULL on error.
+ *===========================================================================*/
+struct qes_merge *qes_merge_create (const struct qes_merge_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_merge_find_insert
+Paramters:      const struct qes_merge *merge: Merger, for its options.
+                const char *seq1, *seq2: Sequences of the mates of a pair.
+                size_t len1, len2: Lengths of ``seq1`` and ``seq2``.
+Description:    Find the insert the mates were read from, by overlapping
+                ``seq1`` with the reverse complement of ``seq2`` at every
+                offset leaving at least ``min_overlap`` bases. Both are
+                normalised once, so each offset is a plain Hamming distance,
+                counted as in qes_match_hamming_max: vectorised, and stopping
+                once too many mismatches are found.
+                Overlaps are ranked by mismatches per base, counting one
+                extra mismatch so short overlaps matching by chance don't
+                beat long ones with a sequencing error. Inserts shorter than
+                a read, which read on into the adapter, are found too.
+                Ns never match.
+Returns:        size_t: The length of the insert, 0 if the mates don't
+                overlap, or SIZE_MAX on error.
+ *===========================================================================*/
+size_t qes_merge_find_insert (const struct qes_merge *merge,
+                              const char *seq1, size_t len1,
+                              const char *seq2, size_t len2);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_merge_pairs
+Paramters:      struct qes_merge *merge: Merger to use.
+                const struct qes_seq *seq1, *seq2: Mates of a pair.
+                struct qes_seq *merged: Filled with the merged read, if the
+                    mates overlap. Must not be ``seq1`` or ``seq2``.
+Description:    Merge the mates of a pair into a read of their whole insert,
+                named as ``seq1``. Outside the overlap, bases come from
+                whichever mate covers them. Within it, bases the mates agree
+                on get the posterior quality of both reads being right, and
+                where they disagree, the base with the higher quality is
+                taken, with the posterior quality of it being right. Reads
+                without qualities (e.g. from FASTA) merge to reads without.
+Returns:        ssize_t: The length of the merged read, 0 if the mates don't
+                overlap, or -1 on error.
+ *===========================================================================*/
+ssize_t qes_merge_pairs (struct qes_merge *merge, const struct qes_seq *seq1,
+                         const struct qes_seq *seq2, struct qes_seq *merged);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_merge_batch
+Paramters:      struct qes_merge *merge: Merger to use.
+                const struct qes_seqbatch *batch1, *batch2: Mates, e.g. from
+                    qes_pairedfile_read_batch.
+                struct qes_seqbatch *merged: Cleared, then filled with the
+                    merged reads, in order. Needs the capacity of
+                    ``batch1``, and a stride (if any) longer than both mates.
+                size_t *inserts: Filled with the insert of each pair, or 0 if
+                    it wasn't merged, or NULL. Undefined on error.
+Description:    As per qes_merge_pairs, for every pair of a batch. Finding
+                the overlaps is the expensive part, and is done in parallel.
+                Pairs with an insert of 0 can be written out as they were.
+Returns:        ssize_t: The number of pairs merged, or -1 on error.
+ *===========================================================================*/
+ssize_t qes_merge_batch (struct qes_merge *merge,
+                         const struct qes_seqbatch *batch1,
+                         const struct qes_seqbatch *batch2,
+                         struct qes_seqbatch *merged, size_t *inserts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_merge_destroy
+Paramters:      struct qes_merge *: Merger to destroy.
+Description:    Deallocate and set to NULL a struct qes_merge on the heap.
+Returns:        void.
+ *===========================================================================*/
+void qes_merge_destroy_ (struct qes_merge *merge);
+#define qes_merge_destroy(merge) do {                                       \
+            qes_merge_destroy_(merge);                                      \
+            merge = NULL;                                                   \
+        } while(0)
+
+#endif /* QES_MERGE_H */
@@ -0,0 +1,248 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_nameset.c
+ *
+ *    Description:  Sets of read names, for extracting reads by name
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 02:31:52
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_nameset.h"
+
+#define NAMESET_SEED 0x6e616d657365747bULL
+#define NAMESET_INIT_SLOTS 1024
+
+
+struct qes_nameset *
+qes_nameset_create (void)
+{
+    struct qes_nameset *set = qes_calloc_errnil(1, sizeof(*set));
+
+    if (set == NULL) return NULL;
+    set->n_slots = NAMESET_INIT_SLOTS;
+    set->arena = qes_arena_create(0);
+    set->hashes = qes_calloc_errnil(set->n_slots, sizeof(*set->hashes));
+    set->names = qes_calloc_errnil(set->n_slots, sizeof(*set->names));
+    if (set->arena == NULL || set->hashes == NULL || set->names == NULL) {
+        qes_nameset_destroy(set);
+        return NULL;
+    }
+    return set;
+}
+
+/* Find the slot of ``name``, or the empty slot where it belongs */
+static inline size_t
+nameset_find (const struct qes_nameset *set, const char *name, size_t len,
+              uint64_t hash)
+{
+    size_t mask = set->n_slots - 1;
+    size_t slot = hash & mask;
+    const char *cur = NULL;
+
+    while ((cur = set->names[slot]) != NULL) {
+        if (set->hashes[slot] == hash && memcmp(cur, name, len) == 0 &&
+                cur[len] == '\0') {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Double the number of slots. Returns 0, or 1 on error. */
+static int
+nameset_grow (struct qes_nameset *set)
+{
+    struct qes_nameset old = *set;
+    size_t mask = 0;
+    size_t slot = 0;
+    size_t iii = 0;
+
+    set->n_slots = old.n_slots << 1;
+    set->hashes = qes_calloc_errnil(set->n_slots, sizeof(*set->hashes));
+    set->names = qes_calloc_errnil(set->n_slots, sizeof(*set->names));
+    if (set->hashes == NULL || set->names == NULL) {
+        qes_free(set->hashes);
+        qes_free(set->names);
+        *set = old;
+        return 1;
+    }
+    mask = set->n_slots - 1;
+    for (iii = 0; iii < old.n_slots; iii++) {
+        if (old.names[iii] == NULL) continue;
+        /* Names are distinct, so there's no need to compare them */
+        slot = old.hashes[iii] & mask;
+        while (set->names[slot] != NULL) slot = (slot + 1) & mask;
+        set->hashes[slot] = old.hashes[iii];
+        set->names[slot] = old.names[iii];
+    }
+    qes_free(old.hashes);
+    qes_free(old.names);
+    return 0;
+}
+
+int
+qes_nameset_add (struct qes_nameset *set, const char *name, size_t len)
+{
+    uint64_t hash = 0;
+    size_t slot = 0;
+
+    if (set == NULL || name == NULL) return 1;
+    if (len == 0) len = strlen(name);
+    /* Keep the load at most a half */
+    if ((set->n_names + 1) * 2 > set->n_slots && nameset_grow(set) != 0) {
+        return 1;
+    }
+    hash = qes_hash64(name, len, NAMESET_SEED);
+    slot = nameset_find(set, name, len, hash);
+    if (set->names[slot] != NULL) return 0;
+    set->names[slot] = qes_arena_strndup(set->arena, name, len);
+    if (set->names[slot] == NULL) return 1;
+    set->hashes[slot] = hash;
+    set->n_names++;
+    return 0;
+}
+
+/* As per qes_nameset_contains, but ``name`` may be empty, and needn't be
+ * null-terminated */
+static inline int
+nameset_has (const struct qes_nameset *set, const char *name, size_t len)
+{
+    uint64_t hash = qes_hash64(name, len, NAMESET_SEED);
+
+    return set->names[nameset_find(set, name, len, hash)] != NULL;
+}
+
+int
+qes_nameset_contains (const struct qes_nameset *set, const char *name,
+                      size_t len)
+{
+    if (set == NULL || name == NULL) return 0;
+    if (len == 0) len = strlen(name);
+    return nameset_has(set, name, len);
+}
+
+ssize_t
+qes_nameset_load (struct qes_nameset *set, const char *path)
+{
+    struct qes_file *qf = NULL;
+    struct qes_str line;
+    ssize_t len = 0;
+    ssize_t n_names = 0;
+    size_t start = 0;
+    size_t end = 0;
+
+    if (set == NULL || path == NULL) return -1;
+    qes_str_init(&line, 128);
+    if (!qes_str_ok(&line)) return -1;
+    qf = qes_file_open_errnil(path, "r");
+    if (qf == NULL) goto error;
+    while ((len = qes_file_readline_str(qf, &line)) != EOF) {
+        if (len < 0) goto error;
+        start = line.str[0] == FASTQ_DELIM || line.str[0] == FASTA_DELIM;
+        for (end = start; end < line.len; end++) {
+            if (isspace(line.str[end])) break;
+        }
+        if (end == start) continue;
+        if (qes_nameset_add(set, line.str + start, end - start) != 0) {
+            goto error;
+        }
+        n_names++;
+    }
+    goto done;
+error:
+    n_names = -1;
+done:
+    qes_file_close(qf);
+    qes_str_destroy_cp(&line);
+    return n_names;
+}
+
+/* Find the name of the record at the start of the file's buffer, without
+ * copying it, as qes_seq_fill_header would. Returns 0 if the header line
+ * isn't all in the buffer. */
+static inline int
+nameset_peek_name (const struct qes_file *qf, const char **name,
+                   size_t *len)
+{
+    const char *start = qf->bufiter + 1;
+    const char *end = NULL;
+    size_t avail = qf->bufend - start;
+    size_t n = 0;
+
+    end = memchr(start, '\n', avail);
+    if (end == NULL) return 0;
+    n = end - start;
+    while (n > 0 && isspace(start[n - 1])) n--;
+    end = memchr(start, ' ', n);
+    if (end != NULL) n = end - start;
+    if (n > 0 && (*start == FASTQ_DELIM || *start == FASTA_DELIM)) {
+        start++;
+        n--;
+    }
+    *name = start;
+    *len = n;
+    return 1;
+}
+
+ssize_t
+qes_nameset_read (const struct qes_nameset *set, struct qes_seqfile *seqfile,
+                  struct qes_seq *seq, int exclude)
+{
+    struct qes_file *qf = NULL;
+    const char *name = NULL;
+    size_t len = 0;
+    ssize_t res = 0;
+    int delim = 0;
+
+    if (set == NULL || !qes_seqfile_ok(seqfile) || !qes_seq_ok(seq)) {
+        return -2;
+    }
+    qf = seqfile->qf;
+    delim = seqfile->format == FASTQ_FMT ? FASTQ_DELIM : FASTA_DELIM;
+    exclude = !!exclude;
+    while (1) {
+        if (qf->eof) return EOF;
+        if (qf->bufiter >= qf->bufend) {
+            res = __qes_file_fill_buffer(qf);
+            if (res == 0) return -2;
+            if (res == EOF) return EOF;
+        }
+        if (qf->bufiter[0] == delim && nameset_peek_name(qf, &name, &len)) {
+            if (nameset_has(set, name, len) != exclude) {
+                return qes_seqfile_read(seqfile, seq);
+            }
+            res = qes_seqfile_skip(seqfile, 1);
+            if (res < 0) return -2;
+            if (res == 0) return EOF;
+        } else {
+            /* Let qes_seqfile_read deal with it */
+            res = qes_seqfile_read(seqfile, seq);
+            if (res < 0) return res;
+            if (qes_seq_split_header(seq) != 0) return -2;
+            if (nameset_has(set, seq->name.str, seq->name.len) != exclude) {
+                return res;
+            }
+        }
+    }
+}
+
+void
+qes_nameset_destroy_ (struct qes_nameset *set)
+{
+    if (set != NULL) {
+        qes_arena_destroy(set->arena);
+        qes_free(set->hashes);
+        qes_free(set->names);
+        qes_free(set);
+    }
+}
@@ -0,0 +1,118 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_nameset.h
+ *
+ *    Description:  Sets of read names, for extracting reads by name
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 02:31:52
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_NAMESET_H
+#define QES_NAMESET_H
+
+#include <qes_util.h>
+#include <qes_hash.h>
+#include <qes_arena.h>
+#include <qes_seq.h>
+#include <qes_seqfile.h>
+
+struct qes_nameset {
+    /* Holds the names, null-terminated */
+    struct qes_arena *arena;
+    /* ``n_slots`` open-addressed slots, each the hash of a name and the name,
+     * or NULL if empty */
+    uint64_t *hashes;
+    const char **names;
+    size_t n_slots;
+    size_t n_names;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_nameset_create
+Paramters:      void
+Description:    Create an empty set of read names. Names are copied into an
+                arena, and found by their 64-bit hash (qes_hash64), which is
+                only verified against the name itself when it matches.
+Returns:        struct qes_nameset *: The set, or NULL on error.
+ *===========================================================================*/
+struct qes_nameset *qes_nameset_create (void);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_nameset_add
+Paramters:      struct qes_nameset *set: Set to add to.
+                const char *name: Name to add, as in ``seq->name``, i.e.
+                    without the leading '@' or '>', or any comment.
+                size_t len: Length of ``name``, or 0 to use strlen.
+Description:    Add ``name`` to ``set``, if it isn't already in it.
+Returns:        int: 0 on success, 1 on error.
+ *===========================================================================*/
+int qes_nameset_add (struct qes_nameset *set, const char *name, size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_nameset_contains
+Paramters:      const struct qes_nameset *set: Set to search.
+                const char *name: Name to find.
+                size_t len: Length of ``name``, or 0 to use strlen.
+Description:    Check if ``name`` is in ``set``.
+Returns:        int: 1 if it is, 0 if not or on error.
+ *===========================================================================*/
+int qes_nameset_contains (const struct qes_nameset *set, const char *name,
+                          size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_nameset_load
+Paramters:      struct qes_nameset *set: Set to add to.
+                const char *path: File of names, one per line, which may be
+                    gzipped.
+Description:    Add each name listed in ``path`` to ``set``. Each line may
+                start with '@' or '>', and ends at its first whitespace, so
+                a list of FASTQ or FASTA headers may be used as is. Blank
+                lines are ignored.
+Returns:        ssize_t: The number of names read, or -1 on error.
+ *===========================================================================*/
+ssize_t qes_nameset_load (struct qes_nameset *set, const char *path);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_nameset_read
+Paramters:      const struct qes_nameset *set: Names to filter by.
+                struct qes_seqfile *seqfile: File to read, in FASTQ or FASTA
+                    format.
+                struct qes_seq *seq: Filled with the next record kept.
+                int exclude: If false, keep records named in ``set``. If
+                    true, keep records not named in it.
+Description:    Read the next record of ``seqfile`` to keep. Each record's
+                name is found straight from the file's buffer, and records
+                not kept are passed over with qes_seqfile_skip, so they're
+                never copied or parsed. Only headers which straddle the end
+                of the buffer are read in full to check their name. Records
+                skipped aren't added to any index of ``seqfile``.
+Returns:        ssize_t: As per qes_seqfile_read: the length of the record
+                kept, EOF if there are no more to keep, or < -1 on error.
+ *===========================================================================*/
+ssize_t qes_nameset_read (const struct qes_nameset *set,
+                          struct qes_seqfile *seqfile, struct qes_seq *seq,
+                          int exclude);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_nameset_destroy
+Paramters:      struct qes_nameset *: Set to destroy.
+Description:    Deallocate and set to NULL a struct qes_nameset on the heap.
+Returns:        void.
+ *===========================================================================*/
+void qes_nameset_destroy_ (struct qes_nameset *set);
+#define qes_nameset_destroy(set) do {                                       \
+            qes_nameset_destroy_(set);                                      \
+            set = NULL;                                                     \
+        } while(0)
+
+#endif /* QES_NAMESET_H */
@@ -0,0 +1,201 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_pairedfile.c
+ *
+ *    Description:  Reading paired-end reads, from two files or interleaved
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 20:05:12
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_pairedfile.h"
+
+#ifdef OPENMP_FOUND
+#define PAIREDFILE_OMP(x) _Pragma(STRINGIFY(omp x))
+#else
+#define PAIREDFILE_OMP(x)
+#endif
+
+
+struct qes_pairedfile *
+qes_pairedfile_create (const char *path1, const char *path2,
+                       const struct qes_file_opts *opts)
+{
+    struct qes_pairedfile *pf = NULL;
+
+    if (path1 == NULL) return NULL;
+    pf = qes_calloc(1, sizeof(*pf));
+    if (pf == NULL) return NULL;
+    pf->r1 = qes_seqfile_create_opts(path1, "r", opts);
+    if (pf->r1 == NULL) goto error;
+    if (path2 != NULL) {
+        pf->r2 = qes_seqfile_create_opts(path2, "r", opts);
+        if (pf->r2 == NULL) goto error;
+    }
+    pf->check_names = 1;
+    return pf;
+error:
+    qes_pairedfile_destroy(pf);
+    return NULL;
+}
+
+/* Check the results of reading a pair, setting errstr if they're bad.
+ * Returns 0 if fine (or at EOF), otherwise 1. */
+static int
+pairedfile_check (struct qes_pairedfile *pf, ssize_t res1, ssize_t res2)
+{
+    if (res1 == EOF && res2 == EOF) {
+        return 0;
+    } else if (res1 == EOF || res2 == EOF) {
+        snprintf(pf->errstr, sizeof(pf->errstr), pf->r2 == NULL ?
+                 "Interleaved file has an odd number of reads" :
+                 "Files have different numbers of reads");
+        return 1;
+    } else if (res1 < 0 || res2 < 0) {
+        snprintf(pf->errstr, sizeof(pf->errstr),
+                 "Couldn't parse record after pair %zu", pf->n_pairs);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+pairedfile_mismatch (struct qes_pairedfile *pf, size_t idx)
+{
+    snprintf(pf->errstr, sizeof(pf->errstr), "Names of pair %zu don't match",
+             pf->n_pairs + idx + 1);
+    return -2;
+}
+
+ssize_t
+qes_pairedfile_read (struct qes_pairedfile *pf, struct qes_seq *seq1,
+                     struct qes_seq *seq2)
+{
+    ssize_t res1 = 0;
+    ssize_t res2 = 0;
+
+    if (pf == NULL || !qes_seqfile_ok(pf->r1) || seq1 == NULL ||
+            seq2 == NULL) {
+        return -2;
+    }
+    res1 = qes_seqfile_read(pf->r1, seq1);
+    res2 = qes_seqfile_read(pf->r2 != NULL ? pf->r2 : pf->r1, seq2);
+    if (pairedfile_check(pf, res1, res2) != 0) {
+        return -2;
+    } else if (res1 == EOF) {
+        return EOF;
+    }
+    if (pf->check_names && (qes_seq_split_header(seq1) != 0 ||
+                qes_seq_split_header(seq2) != 0 ||
+                !qes_pairedfile_mates_match(seq1->name.str, seq1->name.len,
+                                            seq2->name.str, seq2->name.len))) {
+        return pairedfile_mismatch(pf, 0);
+    }
+    pf->n_pairs++;
+    return res1 + res2;
+}
+
+/* Read an interleaved file into two batches */
+static ssize_t
+pairedfile_read_interleaved (struct qes_pairedfile *pf,
+                             struct qes_seqbatch *batch1,
+                             struct qes_seqbatch *batch2)
+{
+    ssize_t res = 0;
+
+    while (batch1->n_seqs < batch1->capacity) {
+        res = qes_pairedfile_read(pf, batch1->scratch, batch2->scratch);
+        if (res == EOF) {
+            break;
+        } else if (res < 0) {
+            return -2;
+        }
+        if (qes_seqbatch_add(batch1, batch1->scratch) != 0 ||
+                qes_seqbatch_add(batch2, batch2->scratch) != 0) {
+            snprintf(pf->errstr, sizeof(pf->errstr),
+                     "Read in pair %zu is too long for the batch",
+                     pf->n_pairs);
+            return -2;
+        }
+    }
+    if (batch1->n_seqs == 0) return EOF;
+    return batch1->n_seqs;
+}
+
+ssize_t
+qes_pairedfile_read_batch (struct qes_pairedfile *pf,
+                           struct qes_seqbatch *batch1,
+                           struct qes_seqbatch *batch2)
+{
+    ssize_t res1 = 0;
+    ssize_t res2 = 0;
+    size_t iii = 0;
+
+    if (pf == NULL || !qes_seqfile_ok(pf->r1) || batch1 == NULL ||
+            batch2 == NULL || batch1->capacity != batch2->capacity) {
+        return -2;
+    }
+    qes_seqbatch_clear(batch1);
+    qes_seqbatch_clear(batch2);
+    if (pf->r2 == NULL) {
+        return pairedfile_read_interleaved(pf, batch1, batch2);
+    }
+    /* Each file is decompressed and parsed on its own thread */
+    PAIREDFILE_OMP(parallel sections num_threads(2))
+    {
+        PAIREDFILE_OMP(section)
+        res1 = qes_seqfile_read_batch(pf->r1, batch1);
+        PAIREDFILE_OMP(section)
+        res2 = qes_seqfile_read_batch(pf->r2, batch2);
+    }
+    if (pairedfile_check(pf, res1, res2) != 0) {
+        return -2;
+    } else if (res1 == EOF) {
+        return EOF;
+    } else if (res1 != res2) {
+        /* Batches are filled unless a file ends, so one file ended first */
+        snprintf(pf->errstr, sizeof(pf->errstr),
+                 "Files have different numbers of reads");
+        return -2;
+    }
+    if (pf->check_names) {
+        for (iii = 0; iii < batch1->n_seqs; iii++) {
+            if (!qes_pairedfile_mates_match(
+                        qes_seqbatch_str(batch1, name, iii),
+                        qes_seqbatch_len(batch1, name, iii),
+                        qes_seqbatch_str(batch2, name, iii),
+                        qes_seqbatch_len(batch2, name, iii))) {
+                return pairedfile_mismatch(pf, iii);
+            }
+        }
+    }
+    pf->n_pairs += batch1->n_seqs;
+    return batch1->n_seqs;
+}
+
+const char *
+qes_pairedfile_error (const struct qes_pairedfile *pf)
+{
+    if (pf == NULL) {
+        return "BAD FILE";
+    }
+    return pf->errstr;
+}
+
+void
+qes_pairedfile_destroy_ (struct qes_pairedfile *pf)
+{
+    if (pf != NULL) {
+        qes_seqfile_destroy(pf->r1);
+        qes_seqfile_destroy(pf->r2);
+        qes_free(pf);
+    }
+}
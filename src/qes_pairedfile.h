@@ -0,0 +1,129 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_pairedfile.h
+ *
+ *    Description:  Reading paired-end reads, from two files or interleaved
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 20:05:12
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_PAIREDFILE_H
+#define QES_PAIREDFILE_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+#include <qes_seqfile.h>
+#include <qes_seqbatch.h>
+
+struct qes_pairedfile {
+    /* First mates, or both if interleaved */
+    struct qes_seqfile *r1;
+    /* Second mates, or NULL if interleaved in ``r1`` */
+    struct qes_seqfile *r2;
+    /* Check that mates' names match (see qes_pairedfile_mates_match). On by
+     * default. */
+    int check_names;
+    /* Pairs read so far */
+    size_t n_pairs;
+    /* Description of the last error */
+    char errstr[128];
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_pairedfile_create
+Paramters:      const char *path1: Path to first mates, or to interleaved
+                    pairs.
+                const char *path2: Path to second mates, or NULL if ``path1``
+                    is interleaved.
+                const struct qes_file_opts *opts: Options for both files, or
+                    NULL for the defaults.
+Description:    Open paired-end reads for reading.
+Returns:        struct qes_pairedfile *: The opened files, or NULL on error.
+ *===========================================================================*/
+struct qes_pairedfile *qes_pairedfile_create (const char *path1,
+                                              const char *path2,
+                                              const struct qes_file_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_pairedfile_mates_match
+Paramters:      const char *name1, *name2: Names of the two mates.
+                size_t len1, len2: Lengths of ``name1`` and ``name2``.
+Description:    Check two reads' names are those of mates: either identical,
+                or identical but for a trailing "/1" and "/2" (or any other
+                "/" and digit), as in older Illumina reads.
+Returns:        int: 1 if they match, otherwise 0.
+ *===========================================================================*/
+static inline int
+qes_pairedfile_mates_match (const char *name1, size_t len1,
+                            const char *name2, size_t len2)
+{
+    if (len1 != len2) return 0;
+    if (len1 >= 2 && name1[len1 - 2] == '/' && name2[len2 - 2] == '/' &&
+            isdigit((unsigned char)name1[len1 - 1]) &&
+            isdigit((unsigned char)name2[len2 - 1])) {
+        len1 -= 2;
+    }
+    return memcmp(name1, name2, len1) == 0;
+}
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_pairedfile_read
+Paramters:      struct qes_pairedfile *pf: Files to read.
+                struct qes_seq *seq1, *seq2: Seqs to read the mates into.
+Description:    Read the next pair.
+Returns:        ssize_t: The combined length of both records, EOF at the end
+                of both files, or -2 on error, including one file ending
+                before the other, or mates' names not matching. See
+                qes_pairedfile_error.
+ *===========================================================================*/
+ssize_t qes_pairedfile_read (struct qes_pairedfile *pf, struct qes_seq *seq1,
+                             struct qes_seq *seq2);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_pairedfile_read_batch
+Paramters:      struct qes_pairedfile *pf: Files to read.
+                struct qes_seqbatch *batch1, *batch2: Batches to read the
+                    first and second mates into. Must have the same capacity.
+Description:    Read pairs until the batches are full, or the files end.
+                Record ``i`` of ``batch1`` is the mate of record ``i`` of
+                ``batch2``. Separate files are read (and decompressed) at the
+                same time on two threads, if libqes was built with OpenMP.
+Returns:        ssize_t: The number of pairs read, EOF if there were none, or
+                -2 on error, as per qes_pairedfile_read.
+ *===========================================================================*/
+ssize_t qes_pairedfile_read_batch (struct qes_pairedfile *pf,
+                                   struct qes_seqbatch *batch1,
+                                   struct qes_seqbatch *batch2);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_pairedfile_error
+Paramters:      const struct qes_pairedfile *pf: Files to query.
+Description:    Describe why the last read failed.
+Returns:        const char *: The description. Never NULL.
+ *===========================================================================*/
+const char *qes_pairedfile_error (const struct qes_pairedfile *pf);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_pairedfile_destroy
+Paramters:      struct qes_pairedfile *: Files to close.
+Description:    Close both files, and deallocate and set to NULL a struct
+                qes_pairedfile on the heap.
+Returns:        void.
+ *===========================================================================*/
+void qes_pairedfile_destroy_ (struct qes_pairedfile *pf);
+#define qes_pairedfile_destroy(pf) do {                                     \
+            qes_pairedfile_destroy_(pf);                                    \
+            pf = NULL;                                                      \
+        } while(0)
+
+#endif /* QES_PAIREDFILE_H */
@@ -0,0 +1,566 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_qual.c
+ *
+ *    Description:  Binning and entropy coding of quality scores
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 06:12:40
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_qual.h"
+
+/* Scores binned at a time, so each bin's pass stays in L1 */
+#define QUAL_CHUNK_LEN 256
+/* Bytes of the coded header before the alphabet: the order, size of the
+ * alphabet, and bucketing of positions */
+#define QUAL_HEADER_LEN 5
+/* The range is renormalised to stay above QUAL_TOP. Frequencies grow by
+ * QUAL_STEP per symbol coded, and are halved once their total would pass
+ * QUAL_MAX_TOTAL, so the model tracks changes in the scores. */
+#define QUAL_TOP (1u << 24)
+#define QUAL_STEP 16
+#define QUAL_MAX_TOTAL ((1 << 16) - 1 - QUAL_STEP)
+/* Largest model, in frequencies. Positions are bucketed more coarsely to
+ * fit, then order 2 falls back to order 1. */
+#define QUAL_MAX_MODEL (1 << 20)
+#define QUAL_MAX_POS 64
+
+
+void
+qes_qual_bins_illumina (struct qes_qual_bins *bins)
+{
+    static const int lows[] = {2, 10, 20, 25, 30, 35, 40};
+    static const int values[] = {6, 15, 22, 27, 33, 37, 40};
+
+    qes_qual_bins_init(bins, lows, values, 7);
+}
+
+int
+qes_qual_bins_init (struct qes_qual_bins *bins, const int *lows,
+                    const int *values, size_t n_bins)
+{
+    const int max = 255 - QES_QUAL_OFFSET;
+    size_t iii = 0;
+
+    if (bins == NULL || lows == NULL || values == NULL || n_bins == 0 ||
+            n_bins > QES_QUAL_MAX_BINS) {
+        return 1;
+    }
+    for (iii = 0; iii < n_bins; iii++) {
+        if (lows[iii] < 0 || lows[iii] > max || values[iii] < 0 ||
+                values[iii] > max ||
+                (iii > 0 && lows[iii] <= lows[iii - 1])) {
+            return 1;
+        }
+    }
+    for (iii = 0; iii < n_bins; iii++) {
+        bins->lows[iii] = lows[iii] + QES_QUAL_OFFSET;
+        bins->values[iii] = values[iii] + QES_QUAL_OFFSET;
+    }
+    bins->n_bins = n_bins;
+    return 0;
+}
+
+/* Each pass is a branchless select over the chunk, which vectorises */
+QES_MULTIVERSION
+static void
+qual_bin_chunk (const struct qes_qual_bins *bins, unsigned char *qual,
+                size_t len)
+{
+    unsigned char binned[QUAL_CHUNK_LEN];
+    unsigned char low = 0;
+    unsigned char value = 0;
+    size_t bin = 0;
+    size_t iii = 0;
+
+    for (iii = 0; iii < len; iii++) binned[iii] = qual[iii];
+    for (bin = 0; bin < bins->n_bins; bin++) {
+        low = bins->lows[bin];
+        value = bins->values[bin];
+        for (iii = 0; iii < len; iii++) {
+            binned[iii] = qual[iii] >= low ? value : binned[iii];
+        }
+    }
+    for (iii = 0; iii < len; iii++) qual[iii] = binned[iii];
+}
+
+void
+qes_qual_bin (const struct qes_qual_bins *bins, char *qual, size_t len)
+{
+    size_t chunk = 0;
+    size_t iii = 0;
+
+    if (bins == NULL || qual == NULL) return;
+    for (iii = 0; iii < len; iii += chunk) {
+        chunk = len - iii < QUAL_CHUNK_LEN ? len - iii : QUAL_CHUNK_LEN;
+        qual_bin_chunk(bins, (unsigned char *)qual + iii, chunk);
+    }
+}
+
+void
+qes_qual_bin_batch (const struct qes_qual_bins *bins,
+                    struct qes_seqbatch *batch)
+{
+    if (batch == NULL) return;
+    /* The '\0's between and after records are below any bin, so the whole
+     * column can be binned at once */
+    qes_qual_bin(bins, batch->qual.data, batch->qual.len);
+}
+
+struct qes_qual_codec *
+qes_qual_codec_create (int order)
+{
+    struct qes_qual_codec *codec = NULL;
+
+    if (order != 1 && order != 2) return NULL;
+    codec = qes_calloc_errnil(1, sizeof(*codec));
+    if (codec == NULL) return NULL;
+    codec->order = order;
+    return codec;
+}
+
+size_t
+qes_qual_encode_bound (size_t len)
+{
+    /* No symbol costs more than 16 bits, as QUAL_MAX_TOTAL < 2^16 */
+    return QUAL_HEADER_LEN + 256 + len * 2 + 16;
+}
+
+/* Shape of the model. Each score's context is the previous one or two
+ * scores of the read (0 before its start), and its position in the read,
+ * shifted right by ``pos_shift``. Quality falls along a read, and some
+ * cycles are worse than others, so position alone says a lot. */
+struct qual_model {
+    int order;
+    size_t n_syms;
+    unsigned pos_shift;
+    size_t n_pos;
+    /* Contexts of previous scores, per position */
+    size_t n_ctx;
+};
+
+static inline size_t
+qual_model_size (const struct qual_model *model)
+{
+    return model->n_pos * model->n_ctx * (model->n_syms + 1);
+}
+
+/* Shape a model for reads of up to ``max_len``, to fit QUAL_MAX_MODEL */
+static void
+qual_model_plan (struct qual_model *model, int order, size_t n_syms,
+                 size_t max_len)
+{
+    size_t max_pos = 0;
+
+    model->n_syms = n_syms;
+    model->order = order;
+    model->n_ctx = n_syms + 1;
+    if (order == 2) model->n_ctx *= n_syms + 1;
+    if (model->n_ctx * (n_syms + 1) > QUAL_MAX_MODEL) {
+        model->order = 1;
+        model->n_ctx = n_syms + 1;
+    }
+    max_pos = QUAL_MAX_MODEL / (model->n_ctx * (n_syms + 1));
+    if (max_pos > QUAL_MAX_POS) max_pos = QUAL_MAX_POS;
+    model->pos_shift = 0;
+    while (max_len > 0 && ((max_len - 1) >> model->pos_shift) >= max_pos) {
+        model->pos_shift++;
+    }
+    model->n_pos = max_len > 0 ? ((max_len - 1) >> model->pos_shift) + 1 : 1;
+}
+
+/* Reset the frequencies of ``model``. Most contexts are never seen, so
+ * each is zeroed here, and made flat when first used. Returns 0, or 1 on
+ * error. */
+static int
+qual_model_init (struct qes_qual_codec *codec, const struct qual_model *model)
+{
+    size_t n_freqs = qual_model_size(model);
+    uint16_t *freqs = NULL;
+
+    if (n_freqs > codec->freqs_capacity) {
+        freqs = qes_realloc_errnil(codec->freqs, n_freqs * sizeof(*freqs));
+        if (freqs == NULL) return 1;
+        codec->freqs = freqs;
+        codec->freqs_capacity = n_freqs;
+    }
+    memset(codec->freqs, 0, n_freqs * sizeof(*codec->freqs));
+    return 0;
+}
+
+static inline void
+qual_model_update (uint16_t *freqs, size_t n_syms, size_t sym)
+{
+    size_t iii = 0;
+
+    freqs[sym] += QUAL_STEP;
+    freqs[n_syms] += QUAL_STEP;
+    if (freqs[n_syms] > QUAL_MAX_TOTAL) {
+        freqs[n_syms] = 0;
+        for (iii = 0; iii < n_syms; iii++) {
+            freqs[iii] = (freqs[iii] + 1) >> 1;
+            freqs[n_syms] += freqs[iii];
+        }
+    }
+}
+
+/* Frequencies of the next symbol, at ``pos``, after ``last`` and
+ * ``last2`` */
+static inline uint16_t *
+qual_context (const struct qes_qual_codec *codec,
+              const struct qual_model *model, size_t pos, size_t last,
+              size_t last2)
+{
+    size_t bucket = pos >> model->pos_shift;
+    size_t ctx = last;
+    size_t iii = 0;
+    uint16_t *freqs = NULL;
+
+    /* Only decoding with other lengths than were coded goes past the end */
+    if (bucket >= model->n_pos) bucket = model->n_pos - 1;
+    if (model->order == 2) ctx += last2 * (model->n_syms + 1);
+    ctx += bucket * model->n_ctx;
+    freqs = codec->freqs + ctx * (model->n_syms + 1);
+    if (freqs[model->n_syms] == 0) {
+        for (iii = 0; iii < model->n_syms; iii++) freqs[iii] = 1;
+        freqs[model->n_syms] = model->n_syms;
+    }
+    return freqs;
+}
+
+/* A range coder, with carries propagated through a cached byte as in
+ * LZMA */
+struct qual_encoder {
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    size_t cache_size;
+    uint8_t *out;
+    uint8_t *end;
+};
+
+static inline void
+qual_shift_low (struct qual_encoder *enc)
+{
+    uint8_t carry = 0;
+    uint8_t byte = 0;
+
+    if ((uint32_t)enc->low < 0xFF000000u || (enc->low >> 32) != 0) {
+        carry = enc->low >> 32;
+        byte = enc->cache;
+        do {
+            /* Out of room is noticed once coding's done */
+            if (enc->out < enc->end) *enc->out = byte + carry;
+            enc->out++;
+            byte = 0xFF;
+        } while (--enc->cache_size != 0);
+        enc->cache = (enc->low >> 24) & 0xFF;
+    }
+    enc->cache_size++;
+    enc->low = (enc->low & 0x00FFFFFFu) << 8;
+}
+
+static inline void
+qual_encode_sym (struct qual_encoder *enc, const uint16_t *freqs,
+                 size_t n_syms, size_t sym)
+{
+    uint32_t cum = 0;
+    uint32_t step = enc->range / freqs[n_syms];
+    size_t iii = 0;
+
+    for (iii = 0; iii < sym; iii++) cum += freqs[iii];
+    enc->low += (uint64_t)step * cum;
+    enc->range = step * freqs[sym];
+    while (enc->range < QUAL_TOP) {
+        enc->range <<= 8;
+        qual_shift_low(enc);
+    }
+}
+
+struct qual_decoder {
+    uint32_t range;
+    uint32_t code;
+    const uint8_t *in;
+    const uint8_t *end;
+};
+
+/* Past the end, the encoder's final bytes were zeros it never wrote */
+static inline uint8_t
+qual_next_byte (struct qual_decoder *dec)
+{
+    return dec->in < dec->end ? *dec->in++ : 0;
+}
+
+static inline size_t
+qual_decode_sym (struct qual_decoder *dec, const uint16_t *freqs,
+                 size_t n_syms)
+{
+    uint32_t step = dec->range / freqs[n_syms];
+    uint32_t target = dec->code / step;
+    uint32_t cum = 0;
+    size_t sym = 0;
+
+    /* Only corrupt input can point past the total */
+    if (target >= freqs[n_syms]) target = freqs[n_syms] - 1;
+    while (cum + freqs[sym] <= target) cum += freqs[sym++];
+    dec->code -= step * cum;
+    dec->range = step * freqs[sym];
+    while (dec->range < QUAL_TOP) {
+        dec->range <<= 8;
+        dec->code = (dec->code << 8) | qual_next_byte(dec);
+    }
+    return sym;
+}
+
+/* Reads are at ``offsets``, or back to back if it's NULL. One read of
+ * ``len`` if ``lens`` is NULL. */
+#define qual_read_len(lens, len, idx) ((lens) != NULL ? (lens)[idx] : (len))
+#define qual_read_start(offsets, pos, idx)                                  \
+    ((offsets) != NULL ? (offsets)[idx] : (pos))
+
+static ssize_t
+qual_encode (struct qes_qual_codec *codec, const char *data,
+             const size_t *offsets, const size_t *lens, size_t n_reads,
+             size_t len, uint8_t *out, size_t out_len)
+{
+    struct qual_encoder enc;
+    struct qual_model model;
+    const unsigned char *qual = NULL;
+    size_t counts[256];
+    uint8_t syms[256];
+    uint8_t byte = 0;
+    size_t n_syms = 0;
+    size_t read_len = 0;
+    size_t max_len = 0;
+    size_t pos = 0;
+    size_t last = 0;
+    size_t last2 = 0;
+    size_t sym = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+    uint16_t *freqs = NULL;
+
+    if (codec == NULL || (data == NULL && len > 0) || out == NULL) return -1;
+    if (lens == NULL) n_reads = 1;
+    /* The alphabet: the distinct scores, commonest first, as symbols are
+     * found by a linear scan of their frequencies */
+    memset(counts, 0, sizeof(counts));
+    for (iii = 0, pos = 0; iii < n_reads; iii++) {
+        read_len = qual_read_len(lens, len, iii);
+        qual = (const unsigned char *)data +
+               qual_read_start(offsets, pos, iii);
+        for (jjj = 0; jjj < read_len; jjj++) counts[qual[jjj]]++;
+        if (read_len > max_len) max_len = read_len;
+        pos += read_len;
+    }
+    if (pos != len) return -1;
+    if (out_len < QUAL_HEADER_LEN) return -1;
+    for (iii = 0; iii < 256; iii++) {
+        if (counts[iii] > 0) syms[n_syms++] = iii;
+    }
+    if (QUAL_HEADER_LEN + n_syms > out_len) return -1;
+    for (iii = 1; iii < n_syms; iii++) {
+        byte = syms[iii];
+        for (jjj = iii; jjj > 0 && counts[syms[jjj - 1]] < counts[byte];
+                jjj--) {
+            syms[jjj] = syms[jjj - 1];
+        }
+        syms[jjj] = byte;
+    }
+    /* Then map scores to their symbols */
+    for (iii = 0; iii < n_syms; iii++) {
+        out[QUAL_HEADER_LEN + iii] = syms[iii];
+    }
+    for (iii = 0; iii < n_syms; iii++) syms[out[QUAL_HEADER_LEN + iii]] = iii;
+    qual_model_plan(&model, codec->order, n_syms, max_len);
+    if (qual_model_init(codec, &model) != 0) return -1;
+    out[0] = model.order;
+    out[1] = n_syms & 0xFF;
+    out[2] = n_syms >> 8;
+    out[3] = model.pos_shift;
+    out[4] = model.n_pos;
+    if (len == 0) return QUAL_HEADER_LEN + n_syms;
+    enc.low = 0;
+    enc.range = 0xFFFFFFFFu;
+    enc.cache = 0;
+    enc.cache_size = 1;
+    enc.out = out + QUAL_HEADER_LEN + n_syms;
+    enc.end = out + out_len;
+    for (iii = 0, pos = 0; iii < n_reads; iii++) {
+        read_len = qual_read_len(lens, len, iii);
+        qual = (const unsigned char *)data +
+               qual_read_start(offsets, pos, iii);
+        last = last2 = 0;
+        for (jjj = 0; jjj < read_len; jjj++) {
+            sym = syms[qual[jjj]];
+            freqs = qual_context(codec, &model, jjj, last, last2);
+            qual_encode_sym(&enc, freqs, n_syms, sym);
+            qual_model_update(freqs, n_syms, sym);
+            last2 = last;
+            last = sym + 1;
+        }
+        pos += read_len;
+    }
+    for (iii = 0; iii < 5; iii++) qual_shift_low(&enc);
+    if (enc.out > enc.end) return -1;
+    return enc.out - out;
+}
+
+static int
+qual_decode (struct qes_qual_codec *codec, const uint8_t *in, size_t in_len,
+             char *data, const size_t *offsets, const size_t *lens,
+             size_t n_reads, size_t len)
+{
+    struct qual_decoder dec;
+    struct qual_model model;
+    const uint8_t *syms = NULL;
+    unsigned char *qual = NULL;
+    size_t n_syms = 0;
+    size_t read_len = 0;
+    size_t pos = 0;
+    size_t last = 0;
+    size_t last2 = 0;
+    size_t sym = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+    uint16_t *freqs = NULL;
+
+    if (codec == NULL || in == NULL || (data == NULL && len > 0) ||
+            in_len < QUAL_HEADER_LEN) {
+        return 1;
+    }
+    if (lens == NULL) n_reads = 1;
+    for (iii = 0, pos = 0; iii < n_reads; iii++) {
+        pos += qual_read_len(lens, len, iii);
+    }
+    n_syms = in[1] | (size_t)in[2] << 8;
+    if (pos != len || n_syms > 256 || in_len < QUAL_HEADER_LEN + n_syms ||
+            (n_syms == 0 && len > 0) || (in[0] != 1 && in[0] != 2) ||
+            in[3] >= 64 || in[4] == 0 || in[4] > QUAL_MAX_POS) {
+        return 1;
+    }
+    model.order = in[0];
+    model.n_syms = n_syms;
+    model.pos_shift = in[3];
+    model.n_pos = in[4];
+    model.n_ctx = n_syms + 1;
+    if (model.order == 2) model.n_ctx *= n_syms + 1;
+    if (qual_model_size(&model) > QUAL_MAX_MODEL ||
+            qual_model_init(codec, &model) != 0) {
+        return 1;
+    }
+    if (len == 0) return 0;
+    syms = in + QUAL_HEADER_LEN;
+    dec.range = 0xFFFFFFFFu;
+    dec.code = 0;
+    dec.in = in + QUAL_HEADER_LEN + n_syms;
+    dec.end = in + in_len;
+    for (iii = 0; iii < 5; iii++) {
+        dec.code = (dec.code << 8) | qual_next_byte(&dec);
+    }
+    for (iii = 0, pos = 0; iii < n_reads; iii++) {
+        read_len = qual_read_len(lens, len, iii);
+        qual = (unsigned char *)data + qual_read_start(offsets, pos, iii);
+        last = last2 = 0;
+        for (jjj = 0; jjj < read_len; jjj++) {
+            freqs = qual_context(codec, &model, jjj, last, last2);
+            sym = qual_decode_sym(&dec, freqs, n_syms);
+            qual_model_update(freqs, n_syms, sym);
+            qual[jjj] = syms[sym];
+            last2 = last;
+            last = sym + 1;
+        }
+        pos += read_len;
+    }
+    return 0;
+}
+
+ssize_t
+qes_qual_encode (struct qes_qual_codec *codec, const char *quals,
+                 size_t len, const size_t *lens, size_t n_reads,
+                 uint8_t *out, size_t out_len)
+{
+    return qual_encode(codec, quals, NULL, lens, n_reads, len, out,
+                       out_len);
+}
+
+int
+qes_qual_decode (struct qes_qual_codec *codec, const uint8_t *in,
+                 size_t in_len, char *quals, size_t len, const size_t *lens,
+                 size_t n_reads)
+{
+    return qual_decode(codec, in, in_len, quals, NULL, lens, n_reads, len);
+}
+
+ssize_t
+qes_qual_encode_batch (struct qes_qual_codec *codec,
+                       const struct qes_seqbatch *batch, uint8_t *out,
+                       size_t out_len)
+{
+    size_t len = 0;
+    size_t iii = 0;
+
+    if (batch == NULL) return -1;
+    for (iii = 0; iii < batch->n_seqs; iii++) len += batch->qual.lens[iii];
+    return qual_encode(codec, batch->qual.data, batch->qual.offsets,
+                       batch->qual.lens, batch->n_seqs, len, out, out_len);
+}
+
+int
+qes_qual_decode_batch (struct qes_qual_codec *codec, const uint8_t *in,
+                       size_t in_len, struct qes_seqbatch *batch)
+{
+    struct qes_seqbatch_col *col = NULL;
+    size_t len = 0;
+    size_t start = 0;
+    size_t newcap = 0;
+    size_t iii = 0;
+    char *newdata = NULL;
+
+    if (batch == NULL) return 1;
+    col = &batch->qual;
+    /* Lay the column out as qes_seqbatch_add would, then decode into it */
+    col->len = 0;
+    for (iii = 0; iii < batch->n_seqs; iii++) {
+        len = batch->seq.lens[iii];
+        if (batch->stride > 0) {
+            start = iii * batch->stride;
+            memset(col->data + start + len, 0, batch->stride - len);
+            col->len = start + batch->stride;
+        } else {
+            start = col->len;
+            if (start + len + 1 > col->capacity) {
+                newcap = qes_roundupz(start + len + 1);
+                newdata = qes_realloc_errnil(col->data, newcap);
+                if (newdata == NULL) return 1;
+                col->data = newdata;
+                col->capacity = newcap;
+            }
+            col->data[start + len] = '\0';
+            col->len = start + len + 1;
+        }
+        col->offsets[iii] = start;
+        col->lens[iii] = len;
+    }
+    for (iii = 0, len = 0; iii < batch->n_seqs; iii++) len += col->lens[iii];
+    return qual_decode(codec, in, in_len, col->data, col->offsets, col->lens,
+                       batch->n_seqs, len);
+}
+
+void
+qes_qual_codec_destroy_ (struct qes_qual_codec *codec)
+{
+    if (codec != NULL) {
+        qes_free(codec->freqs);
+        qes_free(codec);
+    }
+}
@@ -0,0 +1,201 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_qual.h
+ *
+ *    Description:  Binning and entropy coding of quality scores
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 06:12:40
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_QUAL_H
+#define QES_QUAL_H
+
+#include <qes_util.h>
+#include <qes_seqbatch.h>
+
+/*---------------------------------------------------------------------------
+  | qes_qual module -- quality scores, binned and coded compactly           |
+  ---------------------------------------------------------------------------*/
+
+#define QES_QUAL_OFFSET 33
+#define QES_QUAL_MAX_BINS 16
+
+/* Bins of quality scores, as Phred+33 characters. Those from ``lows[i]`` up
+ * to ``lows[i + 1]`` become ``values[i]``. Those below ``lows[0]`` are left
+ * as they are. */
+struct qes_qual_bins {
+    unsigned char lows[QES_QUAL_MAX_BINS];
+    unsigned char values[QES_QUAL_MAX_BINS];
+    size_t n_bins;
+};
+
+/* Reusable state of the coder. Quality scores are coded with an adaptive
+ * range coder, whose model of each score is conditioned on the previous one
+ * or two scores of the same read, and on its position in the read. Runs and
+ * slow drifts of quality are the norm, so this context captures most of
+ * their redundancy, and does much better than gzip. */
+struct qes_qual_codec {
+    /* Context order asked for, 1 or 2 */
+    int order;
+    /* Per context, the frequency of each symbol, then their total */
+    uint16_t *freqs;
+    size_t freqs_capacity;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_bins_illumina
+Paramters:      struct qes_qual_bins *bins: Filled with the bins.
+Description:    Fill ``bins`` with Illumina's eight-level binning: Q2-9 to 6,
+                Q10-19 to 15, Q20-24 to 22, Q25-29 to 27, Q30-34 to 33, Q35-39
+                to 37 and Q40 and above to 40. Q0 and Q1 are left as they are.
+Returns:        void.
+ *===========================================================================*/
+void qes_qual_bins_illumina (struct qes_qual_bins *bins);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_bins_init
+Paramters:      struct qes_qual_bins *bins: Filled with the bins.
+                const int *lows: Lowest Phred score of each bin, ascending.
+                const int *values: Phred score each bin becomes.
+                size_t n_bins: Number of bins, at most QES_QUAL_MAX_BINS.
+Description:    Fill ``bins`` with custom bins. Scores below ``lows[0]`` are
+                left as they are.
+Returns:        int: 0 on success, 1 if the bins are invalid.
+ *===========================================================================*/
+int qes_qual_bins_init (struct qes_qual_bins *bins, const int *lows,
+                        const int *values, size_t n_bins);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_bin
+Paramters:      const struct qes_qual_bins *bins: Bins to apply.
+                char *qual: Quality scores, binned in place.
+                size_t len: Number of scores.
+Description:    Bin ``len`` quality scores. Rather than looking each score up
+                in a table, each bin is applied with a branchless compare
+                and select over a chunk of scores, which the compiler
+                vectorises for each ISA level.
+Returns:        void.
+ *===========================================================================*/
+void qes_qual_bin (const struct qes_qual_bins *bins, char *qual, size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_bin_batch
+Paramters:      const struct qes_qual_bins *bins: Bins to apply.
+                struct qes_seqbatch *batch: Batch whose qualities are binned.
+Description:    Bin the qualities of every record in ``batch``, in a single
+                pass over its quality column.
+Returns:        void.
+ *===========================================================================*/
+void qes_qual_bin_batch (const struct qes_qual_bins *bins,
+                         struct qes_seqbatch *batch);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_codec_create
+Paramters:      int order: Number of previous scores each is conditioned on,
+                    1 or 2. Order 2's bigger model takes more scores to learn,
+                    so it only compresses better for megabytes of them. For
+                    very many distinct scores, order 1 is used anyway.
+Description:    Create a quality score coder.
+Returns:        struct qes_qual_codec *: The coder, or NULL on error.
+ *===========================================================================*/
+struct qes_qual_codec *qes_qual_codec_create (int order);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_encode_bound
+Paramters:      size_t len: Number of quality scores.
+Description:    Find the most bytes qes_qual_encode can need for ``len``
+                scores.
+Returns:        size_t: The number of bytes.
+ *===========================================================================*/
+size_t qes_qual_encode_bound (size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_encode
+Paramters:      struct qes_qual_codec *codec: Coder to use.
+                const char *quals: Quality scores of reads, back to back.
+                size_t len: Number of scores in ``quals``.
+                const size_t *lens: Number of scores of each read, or NULL if
+                    ``quals`` is one read.
+                size_t n_reads: Number of reads in ``lens``.
+                uint8_t *out: Buffer to write the coded scores to.
+                size_t out_len: Size of ``out``. qes_qual_encode_bound gives
+                    enough.
+Description:    Code ``quals``. Each read's context starts afresh, so the same
+                lengths must be given to qes_qual_decode.
+Returns:        ssize_t: Bytes written to ``out``, or -1 on error, including
+                if ``out`` is too small.
+ *===========================================================================*/
+ssize_t qes_qual_encode (struct qes_qual_codec *codec, const char *quals,
+                         size_t len, const size_t *lens, size_t n_reads,
+                         uint8_t *out, size_t out_len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_decode
+Paramters:      struct qes_qual_codec *codec: Coder to use.
+                const uint8_t *in: Scores coded by qes_qual_encode.
+                size_t in_len: Size of ``in``.
+                char *quals: Filled with the scores, back to back.
+                size_t len: Number of scores to decode.
+                const size_t *lens: As given to qes_qual_encode.
+                size_t n_reads: As given to qes_qual_encode.
+Description:    Decode scores coded by qes_qual_encode. Corrupt input gives
+                wrong scores rather than an error, unless its header is bad.
+Returns:        int: 0 on success, 1 on error.
+ *===========================================================================*/
+int qes_qual_decode (struct qes_qual_codec *codec, const uint8_t *in,
+                     size_t in_len, char *quals, size_t len,
+                     const size_t *lens, size_t n_reads);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_encode_batch
+Paramters:      struct qes_qual_codec *codec: Coder to use.
+                const struct qes_seqbatch *batch: Batch whose qualities to
+                    code.
+                uint8_t *out: Buffer to write the coded scores to.
+                size_t out_len: Size of ``out``. qes_qual_encode_bound of the
+                    batch's total quality length is enough.
+Description:    As per qes_qual_encode, for the qualities of each record of
+                ``batch``.
+Returns:        ssize_t: Bytes written to ``out``, or -1 on error.
+ *===========================================================================*/
+ssize_t qes_qual_encode_batch (struct qes_qual_codec *codec,
+                               const struct qes_seqbatch *batch,
+                               uint8_t *out, size_t out_len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_decode_batch
+Paramters:      struct qes_qual_codec *codec: Coder to use.
+                const uint8_t *in: Scores coded by qes_qual_encode_batch.
+                size_t in_len: Size of ``in``.
+                struct qes_seqbatch *batch: Batch of the same records, whose
+                    qualities are replaced.
+Description:    Decode the qualities of each record of ``batch``, which have
+                as many scores as their sequences have bases.
+Returns:        int: 0 on success, 1 on error.
+ *===========================================================================*/
+int qes_qual_decode_batch (struct qes_qual_codec *codec, const uint8_t *in,
+                           size_t in_len, struct qes_seqbatch *batch);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_qual_codec_destroy
+Paramters:      struct qes_qual_codec *: Coder to destroy.
+Description:    Deallocate and set to NULL a struct qes_qual_codec.
+Returns:        void.
+ *===========================================================================*/
+void qes_qual_codec_destroy_ (struct qes_qual_codec *codec);
+#define qes_qual_codec_destroy(codec) do {                                  \
+            qes_qual_codec_destroy_(codec);                                 \
+            codec = NULL;                                                   \
+        } while(0)
+
+#endif /* QES_QUAL_H */
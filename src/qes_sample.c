@@ -0,0 +1,175 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_sample.c
+ *
+ *    Description:  Random subsampling of records
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 01:20:43
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_sample.h"
+
+#include <math.h>
+
+
+/* splitmix64 */
+static inline uint64_t
+sample_rand (struct qes_sampler *sampler)
+{
+    uint64_t x = (sampler->rng += 0x9e3779b97f4a7c15ULL);
+
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Uniform in (0, 1], so its log is finite */
+static inline double
+sample_uniform (struct qes_sampler *sampler)
+{
+    return ((sample_rand(sampler) >> 11) + 1) * 0x1.0p-53;
+}
+
+/* Number of failures before a success, with ``log_fail`` the log of the
+ * chance of failure */
+static inline uint64_t
+sample_geometric (struct qes_sampler *sampler, double log_fail)
+{
+    double skip = floor(log(sample_uniform(sampler)) / log_fail);
+
+    /* Also catches the infinity of log_fail == -0.0 */
+    if (!(skip < 0x1.0p63)) return INT64_MAX;
+    return skip;
+}
+
+static struct qes_sampler *
+sample_create (struct qes_seqfile *seqfile, uint64_t seed)
+{
+    struct qes_sampler *sampler = NULL;
+
+    if (!qes_seqfile_ok(seqfile)) return NULL;
+    sampler = qes_calloc_errnil(1, sizeof(*sampler));
+    if (sampler == NULL) return NULL;
+    sampler->seqfile = seqfile;
+    sampler->rng = seed;
+    return sampler;
+}
+
+struct qes_sampler *
+qes_sampler_create_fraction (struct qes_seqfile *seqfile, double fraction,
+                             uint64_t seed)
+{
+    struct qes_sampler *sampler = NULL;
+
+    /* Written so NaN fails too */
+    if (!(fraction >= 0.0 && fraction <= 1.0)) return NULL;
+    sampler = sample_create(seqfile, seed);
+    if (sampler == NULL) return NULL;
+    sampler->fraction = fraction;
+    return sampler;
+}
+
+static int
+sample_cmp (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+struct qes_sampler *
+qes_sampler_create_count (struct qes_seqfile *seqfile, size_t count,
+                          uint64_t seed)
+{
+    struct qes_sampler *sampler = sample_create(seqfile, seed);
+    off_t start = 0;
+    size_t n_records = 0;
+    ssize_t n_left = 0;
+    uint64_t idx = 0;
+    uint64_t skip = 0;
+    double weight = 0.0;
+    size_t iii = 0;
+
+    if (sampler == NULL) return NULL;
+    sampler->fraction = -1.0;
+    /* Count the records, then go back */
+    start = seqfile->qf->filepos;
+    n_records = seqfile->n_records;
+    n_left = qes_seqfile_skip(seqfile, SIZE_MAX);
+    if (n_left < 0 || qes_file_seek(seqfile->qf, start) != 0) goto error;
+    seqfile->n_records = n_records;
+    sampler->n_keep = count < (size_t)n_left ? count : (size_t)n_left;
+    if (sampler->n_keep == 0) return sampler;
+    sampler->keep = qes_calloc_errnil(sampler->n_keep,
+                                      sizeof(*sampler->keep));
+    if (sampler->keep == NULL) goto error;
+    for (iii = 0; iii < sampler->n_keep; iii++) sampler->keep[iii] = iii;
+    /* Algorithm L: the reservoir holds the first n_keep records. Each later
+     * record replaces one of them with a chance that falls as we go, so
+     * rather than rolling for each record, skip ahead a geometric number of
+     * records to the next that does. */
+    idx = sampler->n_keep - 1;
+    weight = exp(log(sample_uniform(sampler)) / sampler->n_keep);
+    while (idx < (uint64_t)n_left) {
+        skip = sample_geometric(sampler, log1p(-weight));
+        if (skip >= (uint64_t)n_left - idx - 1) break;
+        idx += skip + 1;
+        iii = ((sample_rand(sampler) >> 11) * 0x1.0p-53) * sampler->n_keep;
+        sampler->keep[iii] = idx;
+        weight *= exp(log(sample_uniform(sampler)) / sampler->n_keep);
+    }
+    qsort(sampler->keep, sampler->n_keep, sizeof(*sampler->keep),
+          sample_cmp);
+    return sampler;
+error:
+    qes_sampler_destroy(sampler);
+    return NULL;
+}
+
+ssize_t
+qes_sampler_read (struct qes_sampler *sampler, struct qes_seq *seq)
+{
+    ssize_t res = 0;
+    uint64_t skip = 0;
+
+    if (sampler == NULL || !qes_seq_ok(seq)) return -2;
+    if (sampler->fraction < 0.0) {
+        if (sampler->next_keep == sampler->n_keep) return EOF;
+        skip = sampler->keep[sampler->next_keep++] - sampler->pos;
+    } else if (sampler->fraction <= 0.0) {
+        return EOF;
+    } else if (sampler->fraction < 1.0) {
+        skip = sample_geometric(sampler, log1p(-sampler->fraction));
+    }
+    if (skip > 0) {
+        res = qes_seqfile_skip(sampler->seqfile, skip);
+        if (res < 0) return -2;
+        sampler->pos += res;
+        if ((uint64_t)res < skip) {
+            /* Only a count sample knows the file's length */
+            return sampler->fraction < 0.0 ? -2 : EOF;
+        }
+    }
+    res = qes_seqfile_read(sampler->seqfile, seq);
+    if (res >= 0) sampler->pos++;
+    return res;
+}
+
+void
+qes_sampler_destroy_ (struct qes_sampler *sampler)
+{
+    if (sampler != NULL) {
+        qes_free(sampler->keep);
+        qes_free(sampler);
+    }
+}
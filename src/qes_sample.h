@@ -0,0 +1,101 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_sample.h
+ *
+ *    Description:  Random subsampling of records
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 01:20:43
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_SAMPLE_H
+#define QES_SAMPLE_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+#include <qes_seqfile.h>
+
+struct qes_sampler {
+    /* Not owned by the sampler */
+    struct qes_seqfile *seqfile;
+    /* Chance of keeping each record, or -1 if sampling a count */
+    double fraction;
+    /* Indices of records to keep, in order, if sampling a count */
+    uint64_t *keep;
+    size_t n_keep;
+    size_t next_keep;
+    /* Index of the next record of ``seqfile`` */
+    uint64_t pos;
+    /* State of the random number generator */
+    uint64_t rng;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sampler_create_fraction
+Paramters:      struct qes_seqfile *seqfile: File to sample from.
+                double fraction: Chance of keeping each record, from 0 to 1.
+                uint64_t seed: Seed of the random number generator.
+Description:    Create a sampler of each record of ``seqfile`` with
+                probability ``fraction``. Rather than drawing a random number
+                per record, the number of records until the next one kept is
+                drawn from a geometric distribution, and those records are
+                skipped with qes_seqfile_skip, so only sampled records are
+                parsed.
+Returns:        struct qes_sampler *: A sampler, or NULL on error.
+ *===========================================================================*/
+struct qes_sampler *qes_sampler_create_fraction (struct qes_seqfile *seqfile,
+                                                 double fraction,
+                                                 uint64_t seed);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sampler_create_count
+Paramters:      struct qes_seqfile *seqfile: File to sample from, which must
+                    be seekable.
+                size_t count: Number of records to sample.
+                uint64_t seed: Seed of the random number generator.
+Description:    Create a sampler of ``count`` records of ``seqfile`` chosen
+                uniformly at random, or all of them if there are fewer. The
+                remaining records are counted with qes_seqfile_skip, then the
+                indices to keep are picked by reservoir sampling (Li's
+                algorithm L, which skips ahead rather than drawing a random
+                number per record). ``seqfile`` is then seeked back to where it
+                was, and records are read in file order, skipping the rest.
+Returns:        struct qes_sampler *: A sampler, or NULL on error, e.g. if
+                ``seqfile`` can't seek.
+ *===========================================================================*/
+struct qes_sampler *qes_sampler_create_count (struct qes_seqfile *seqfile,
+                                              size_t count, uint64_t seed);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sampler_read
+Paramters:      struct qes_sampler *sampler: Sampler to read from.
+                struct qes_seq *seq: Filled with the next sampled record.
+Description:    Read the next sampled record, skipping the records between.
+Returns:        ssize_t: As per qes_seqfile_read: the length of the record,
+                EOF if there are no more sampled records, or < -1 on error.
+ *===========================================================================*/
+ssize_t qes_sampler_read (struct qes_sampler *sampler, struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sampler_destroy
+Paramters:      struct qes_sampler *: Sampler to destroy.
+Description:    Deallocate and set to NULL a struct qes_sampler on the heap.
+                The file it samples is not closed.
+Returns:        void.
+ *===========================================================================*/
+void qes_sampler_destroy_ (struct qes_sampler *sampler);
+#define qes_sampler_destroy(sampler) do {                                   \
+            qes_sampler_destroy_(sampler);                                  \
+            sampler = NULL;                                                 \
+        } while(0)
+
+#endif /* QES_SAMPLE_H */
@@ -27,6 +27,8 @@ qes_seq_create (void)
     qes_str_init(&seq->comment, __INIT_LINE_LEN);
     qes_str_init(&seq->seq, __INIT_LINE_LEN);
     qes_str_init(&seq->qual, __INIT_LINE_LEN);
+    seq->arena = NULL;
+    seq->raw_header = 0;
     return seq;
 }
 
@@ -41,6 +43,9 @@ qes_seq_create_no_qual (void)
     seq->qual.capacity = 0;
     seq->qual.len = 0;
     seq->qual.str = NULL;
+    seq->qual.arena = NULL;
+    seq->arena = NULL;
+    seq->raw_header = 0;
     return seq;
 }
 
@@ -53,9 +58,31 @@ qes_seq_create_no_qual_or_comment (void)
     seq->qual.capacity = 0;
     seq->qual.len = 0;
     seq->qual.str = NULL;
+    seq->qual.arena = NULL;
     seq->comment.capacity = 0;
     seq->comment.len = 0;
     seq->comment.str = NULL;
+    seq->comment.arena = NULL;
+    seq->arena = NULL;
+    seq->raw_header = 0;
+    return seq;
+}
+
+struct qes_seq *
+qes_seq_create_arena (struct qes_arena *arena)
+{
+    struct qes_seq *seq = NULL;
+
+    if (arena == NULL) return NULL;
+    seq = qes_arena_alloc(arena, sizeof(*seq));
+    if (seq == NULL) return NULL;
+    qes_str_init_arena(&seq->name, __INIT_LINE_LEN, arena);
+    qes_str_init_arena(&seq->comment, __INIT_LINE_LEN, arena);
+    qes_str_init_arena(&seq->seq, __INIT_LINE_LEN, arena);
+    qes_str_init_arena(&seq->qual, __INIT_LINE_LEN, arena);
+    seq->arena = arena;
+    seq->raw_header = 0;
+    if (!qes_seq_ok(seq)) return NULL;
     return seq;
 }
 
@@ -67,6 +94,7 @@ qes_seq_fill_name (struct qes_seq *seqobj, const char *name, size_t len)
         return 1;
     }
     qes_str_fill_charptr(&seqobj->name, name, len);
+    seqobj->raw_header = 0;
     return 0;
 }
 
@@ -77,6 +105,7 @@ qes_seq_fill_comment (struct qes_seq *seqobj, const char *comment, size_t len)
         return 1;
     }
     qes_str_fill_charptr(&seqobj->comment, comment, len);
+    seqobj->raw_header = 0;
     return 0;
 }
 
@@ -125,6 +154,56 @@ qes_seq_fill_header (struct qes_seq *seqobj, char *header, size_t len)
         qes_str_fill_charptr(&seqobj->name, header + startfrom, len - startfrom);
         qes_str_nullify(&seqobj->comment);
     }
+    seqobj->raw_header = 0;
+    return 0;
+}
+
+inline int
+qes_seq_fill_raw_header (struct qes_seq *seqobj, size_t len)
+{
+    struct qes_str *name = NULL;
+
+    if (seqobj == NULL || !qes_str_ok(&seqobj->name) ||
+            len > seqobj->name.len) {
+        return 1;
+    }
+    name = &seqobj->name;
+    while (len > 0 && isspace(name->str[len - 1])) {
+        len--;
+    }
+    name->str[len] = '\0';
+    name->len = len;
+    qes_str_nullify(&seqobj->comment);
+    seqobj->raw_header = 1;
+    return 0;
+}
+
+int
+qes_seq_split_header (struct qes_seq *seqobj)
+{
+    struct qes_str *name = NULL;
+    char *tmp = NULL;
+    size_t startfrom = 0;
+
+    if (seqobj == NULL) return 1;
+    if (!seqobj->raw_header) return 0;
+    name = &seqobj->name;
+    tmp = memchr(name->str, ' ', name->len);
+    if (tmp != NULL) {
+        if (!qes_str_fill_charptr(&seqobj->comment, tmp + 1,
+                                  name->str + name->len - tmp - 1)) {
+            return 1;
+        }
+        *tmp = '\0';
+        name->len = tmp - name->str;
+    }
+    /* As per qes_seq_fill_header */
+    startfrom = name->str[0] == '@' || name->str[0] == '>' ? 1 : 0;
+    if (startfrom) {
+        memmove(name->str, name->str + 1, name->len);
+        name->len--;
+    }
+    seqobj->raw_header = 0;
     return 0;
 }
 
@@ -157,6 +236,8 @@ qes_seq_destroy_ (struct qes_seq *seq)
         qes_str_destroy_cp(&seq->comment);
         qes_str_destroy_cp(&seq->seq);
         qes_str_destroy_cp(&seq->qual);
-        qes_free(seq);
+        if (seq->arena == NULL) {
+            qes_free(seq);
+        }
     }
 }
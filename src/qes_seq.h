@@ -32,6 +32,11 @@ struct qes_seq {
     struct qes_str comment;
     struct qes_str seq;
     struct qes_str qual;
+    /* If not NULL, this struct and its members were allocated from arena */
+    struct qes_arena *arena;
+    /* If true, ``name`` holds the whole header line and ``comment`` is empty,
+     * until qes_seq_split_header is called. See QES_HEADER_LAZY. */
+    int raw_header;
 };
 
 /* PROTOTYPES */
@@ -48,6 +53,18 @@ struct qes_seq *qes_seq_create (void);
 struct qes_seq *qes_seq_create_no_qual (void);
 struct qes_seq *qes_seq_create_no_qual_or_comment (void);
 
+/*===  FUNCTION  ============================================================*
+Name:           qes_seq_create_arena
+Paramters:      struct qes_arena *arena: Arena to allocate from.
+Description:    As per qes_seq_create, but the ``struct qes_seq`` and all its
+                members are allocated from ``arena``, and grow within it. No
+                malloc or free is done per seq. The seq is only valid until
+                ``arena`` is reset; qes_seq_destroy on it is optional.
+Returns:        struct qes_seq *: A non-null memory address on success,
+                otherwise NULL.
+ *===========================================================================*/
+struct qes_seq *qes_seq_create_arena (struct qes_arena *arena);
+
 
 /*===  FUNCTION  ============================================================*
 Name:           qes_seq_ok
@@ -130,6 +147,83 @@ Returns:        int: 1 on success, otherwise 0 for failure.
  *===========================================================================*/
 extern int qes_seq_fill_header(struct qes_seq *seqobj, char *header, size_t len);
 
+/*===  FUNCTION  ============================================================*
+Name:           qes_seq_fill_raw_header
+Paramters:      struct qes_seq *seqobj: Seq object holding the header.
+                size_t len: Length of the header line in ``seqobj->name``.
+Description:    Mark the header line just read into ``seqobj->name`` as not
+                yet split, trimming trailing whitespace. Splitting is left to
+                qes_seq_split_header, on first access of the name or comment.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+extern int qes_seq_fill_raw_header(struct qes_seq *seqobj, size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seq_split_header
+Paramters:      struct qes_seq *seqobj: Seq object whose header to split.
+Description:    If ``seqobj`` holds a raw header (see QES_HEADER_LAZY), split
+                it into name and comment as qes_seq_fill_header would. The
+                name is split in place, and only the comment is copied.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+extern int qes_seq_split_header(struct qes_seq *seqobj);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seq_name, qes_seq_comment
+Paramters:      struct qes_seq *seq: Seq to get the name or comment of.
+Description:    Get the name or comment of ``seq``, splitting its header first
+                if it was read lazily.
+Returns:        const struct qes_str *: The name or comment, or NULL on error.
+ *===========================================================================*/
+static inline const struct qes_str *
+qes_seq_name (struct qes_seq *seq)
+{
+    if (seq == NULL || qes_seq_split_header(seq) != 0) return NULL;
+    return &seq->name;
+}
+
+static inline const struct qes_str *
+qes_seq_comment (struct qes_seq *seq)
+{
+    if (seq == NULL || qes_seq_split_header(seq) != 0) return NULL;
+    return &seq->comment;
+}
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seq_peek_header
+Paramters:      const struct qes_seq *seq: Seq whose header to look at.
+                struct qes_str *name: Set to the name of ``seq``.
+                struct qes_str *comment: Set to the comment of ``seq``.
+Description:    Find the name and comment of ``seq`` without splitting a raw
+                header, e.g. if ``seq`` is const. These are as
+                qes_seq_split_header would give, including dropping a leading
+                '@' or '>' from the name. ``name`` and ``comment`` point into
+                ``seq``, and are only valid while it is unchanged. Neither is
+                null-terminated, and neither may be modified.
+Returns:        void
+ *===========================================================================*/
+static inline void
+qes_seq_peek_header (const struct qes_seq *seq, struct qes_str *name,
+                     struct qes_str *comment)
+{
+    const char *sep = NULL;
+
+    *name = seq->name;
+    *comment = seq->comment;
+    if (!seq->raw_header) return;
+    sep = memchr(seq->name.str, ' ', seq->name.len);
+    if (sep != NULL) {
+        name->len = sep - seq->name.str;
+        comment->str = seq->name.str + name->len + 1;
+        comment->len = seq->name.len - name->len - 1;
+    }
+    /* As per qes_seq_split_header */
+    if (name->len > 0 && (name->str[0] == '@' || name->str[0] == '>')) {
+        name->str++;
+        name->len--;
+    }
+}
+
 
 /*===  FUNCTION  ============================================================*
 Name:           qes_seq_fill_X
@@ -186,6 +280,7 @@ qes_seq_copy(struct qes_seq *dest, const struct qes_seq *src)
     if (qes_str_copy(&dest->comment, &src->comment) != 0) return 1;
     if (qes_str_copy(&dest->seq, &src->seq) != 0) return 1;
     if (qes_str_copy(&dest->qual, &src->qual) != 0) return 1;
+    dest->raw_header = src->raw_header;
     return 0;
 }
 
@@ -0,0 +1,216 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_seqbatch.c
+ *
+ *    Description:  Columnar (structure-of-arrays) batches of sequences
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 15:10:44
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_seqbatch.h"
+
+
+static int
+seqbatch_col_init (struct qes_seqbatch_col *col, size_t n_recs, size_t bytes)
+{
+    col->len = 0;
+    col->capacity = bytes;
+    col->data = qes_calloc(bytes, 1);
+    col->offsets = qes_calloc(n_recs, sizeof(*col->offsets));
+    col->lens = qes_calloc(n_recs, sizeof(*col->lens));
+    return col->data == NULL || col->offsets == NULL || col->lens == NULL;
+}
+
+static void
+seqbatch_col_destroy (struct qes_seqbatch_col *col)
+{
+    qes_free(col->data);
+    qes_free(col->offsets);
+    qes_free(col->lens);
+}
+
+/* Store ``str`` as record ``idx`` of ``col``, at ``idx * stride`` if
+ * ``stride`` is not 0, otherwise at the end of ``col``. */
+static int
+seqbatch_col_add (struct qes_seqbatch_col *col, size_t idx, size_t stride,
+                  const struct qes_str *str)
+{
+    size_t len = str->str != NULL ? str->len : 0;
+    size_t start = col->len;
+    size_t newcap = 0;
+    char *newdata = NULL;
+
+    if (stride > 0) {
+        if (len >= stride) return 1;
+        start = idx * stride;
+        memcpy(col->data + start, str->str, len);
+        /* Clear the tail, which may hold a longer read from before a clear */
+        memset(col->data + start + len, 0, stride - len);
+        col->len = start + stride;
+    } else {
+        if (start + len + 1 > col->capacity) {
+            newcap = qes_roundupz(start + len + 1);
+            newdata = qes_realloc(col->data, newcap);
+            if (newdata == NULL) return 1;
+            col->data = newdata;
+            col->capacity = newcap;
+        }
+        if (len > 0) memcpy(col->data + start, str->str, len);
+        col->data[start + len] = '\0';
+        col->len = start + len + 1;
+    }
+    col->offsets[idx] = start;
+    col->lens[idx] = len;
+    return 0;
+}
+
+struct qes_seqbatch *
+qes_seqbatch_create (size_t capacity, size_t stride)
+{
+    struct qes_seqbatch *batch = NULL;
+    const size_t n_bytes = stride > 0 ? capacity * stride
+                                      : capacity * __INIT_LINE_LEN;
+    int err = 0;
+
+    if (capacity == 0) return NULL;
+    batch = qes_calloc(1, sizeof(*batch));
+    if (batch == NULL) return NULL;
+    batch->capacity = capacity;
+    batch->stride = stride;
+    err |= seqbatch_col_init(&batch->name, capacity,
+                             capacity * __INIT_LINE_LEN / 4);
+    err |= seqbatch_col_init(&batch->comment, capacity,
+                             capacity * __INIT_LINE_LEN / 4);
+    err |= seqbatch_col_init(&batch->seq, capacity, n_bytes);
+    err |= seqbatch_col_init(&batch->qual, capacity, n_bytes);
+    batch->scratch = qes_seq_create();
+    if (err || batch->scratch == NULL) {
+        qes_seqbatch_destroy_(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+int
+qes_seqbatch_add (struct qes_seqbatch *batch, const struct qes_seq *seq)
+{
+    const size_t idx = batch != NULL ? batch->n_seqs : 0;
+    struct qes_str name;
+    struct qes_str comment;
+    size_t lens[4];
+    int err = 0;
+
+    if (batch == NULL || seq == NULL || idx >= batch->capacity) return 1;
+    if (batch->stride > 0 && (seq->seq.len >= batch->stride ||
+                              (seq->qual.str != NULL &&
+                               seq->qual.len >= batch->stride))) {
+        return 1;
+    }
+    lens[0] = batch->name.len;
+    lens[1] = batch->comment.len;
+    lens[2] = batch->seq.len;
+    lens[3] = batch->qual.len;
+    qes_seq_peek_header(seq, &name, &comment);
+    err |= seqbatch_col_add(&batch->name, idx, 0, &name);
+    err |= seqbatch_col_add(&batch->comment, idx, 0, &comment);
+    err |= seqbatch_col_add(&batch->seq, idx, batch->stride, &seq->seq);
+    err |= seqbatch_col_add(&batch->qual, idx, batch->stride, &seq->qual);
+    if (err) {
+        /* Drop the half-added record from every column. The offsets of a
+         * column that failed were never set, so go by the old lengths. */
+        batch->name.len = lens[0];
+        batch->comment.len = lens[1];
+        batch->seq.len = lens[2];
+        batch->qual.len = lens[3];
+        return 1;
+    }
+    batch->n_seqs++;
+    return 0;
+}
+
+int
+qes_seqbatch_get (const struct qes_seqbatch *batch, size_t idx,
+                  struct qes_seq *seq)
+{
+    if (batch == NULL || seq == NULL || idx >= batch->n_seqs) return 1;
+    if (!qes_str_fill_charptr(&seq->name,
+                              qes_seqbatch_str(batch, name, idx),
+                              qes_seqbatch_len(batch, name, idx))) {
+        return 1;
+    }
+    /* fill_charptr treats a length of 0 as "use strlen", which is fine as
+     * empty values are "" */
+    if (seq->comment.str != NULL &&
+            !qes_str_fill_charptr(&seq->comment,
+                                  qes_seqbatch_str(batch, comment, idx),
+                                  qes_seqbatch_len(batch, comment, idx))) {
+        return 1;
+    }
+    if (!qes_str_fill_charptr(&seq->seq, qes_seqbatch_str(batch, seq, idx),
+                              qes_seqbatch_len(batch, seq, idx))) {
+        return 1;
+    }
+    if (seq->qual.str != NULL &&
+            !qes_str_fill_charptr(&seq->qual,
+                                  qes_seqbatch_str(batch, qual, idx),
+                                  qes_seqbatch_len(batch, qual, idx))) {
+        return 1;
+    }
+    return 0;
+}
+
+ssize_t
+qes_seqfile_read_batch (struct qes_seqfile *seqfile,
+                        struct qes_seqbatch *batch)
+{
+    ssize_t res = 0;
+
+    if (!qes_seqfile_ok(seqfile) || batch == NULL) return -2;
+    qes_seqbatch_clear(batch);
+    while (batch->n_seqs < batch->capacity) {
+        res = qes_seqfile_read(seqfile, batch->scratch);
+        if (res == EOF) {
+            break;
+        } else if (res < 0) {
+            return -2;
+        }
+        if (qes_seqbatch_add(batch, batch->scratch) != 0) {
+            return -2;
+        }
+    }
+    if (batch->n_seqs == 0) return EOF;
+    return batch->n_seqs;
+}
+
+void
+qes_seqbatch_clear (struct qes_seqbatch *batch)
+{
+    if (batch == NULL) return;
+    batch->n_seqs = 0;
+    batch->name.len = 0;
+    batch->comment.len = 0;
+    batch->seq.len = 0;
+    batch->qual.len = 0;
+}
+
+void
+qes_seqbatch_destroy_ (struct qes_seqbatch *batch)
+{
+    if (batch != NULL) {
+        seqbatch_col_destroy(&batch->name);
+        seqbatch_col_destroy(&batch->comment);
+        seqbatch_col_destroy(&batch->seq);
+        seqbatch_col_destroy(&batch->qual);
+        qes_seq_destroy(batch->scratch);
+        qes_free(batch);
+    }
+}
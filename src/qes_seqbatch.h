@@ -0,0 +1,128 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_seqbatch.h
+ *
+ *    Description:  Columnar (structure-of-arrays) batches of sequences
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 15:10:44
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_SEQBATCH_H
+#define QES_SEQBATCH_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+#include <qes_seqfile.h>
+
+/* One field of every record in a batch. Values are stored back to back in
+ * ``data``, each followed by a '\0', so each is also a C string. */
+struct qes_seqbatch_col {
+    char *data;
+    size_t len;
+    size_t capacity;
+    /* Start of each record's value in ``data`` */
+    size_t *offsets;
+    /* Length of each record's value, excluding the '\0' */
+    size_t *lens;
+};
+
+/* A batch stores up to ``capacity`` records column-wise: all names in one
+ * block of memory, all sequences in another, and so on. Kernels can then
+ * stream through the sequences (or qualities) of many reads linearly.
+ *
+ * If ``stride`` is not 0, the sequence and quality of record ``i`` start
+ * at ``i * stride``, and are padded with '\0' to ``stride`` bytes. This suits
+ * fixed-length reads, as e.g. base ``j`` of every read is at a fixed distance
+ * from base ``j`` of the previous one. */
+struct qes_seqbatch {
+    size_t n_seqs;
+    size_t capacity;
+    size_t stride;
+    struct qes_seqbatch_col name;
+    struct qes_seqbatch_col comment;
+    struct qes_seqbatch_col seq;
+    struct qes_seqbatch_col qual;
+    /* Records are read into this before being added */
+    struct qes_seq *scratch;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqbatch_create
+Paramters:      size_t capacity: Maximum number of records in the batch.
+                size_t stride: Fixed stride of sequences and qualities, or 0
+                    to store them packed. Must exceed the longest read.
+Description:    Create an empty ``struct qes_seqbatch``.
+Returns:        struct qes_seqbatch *: A new batch, or NULL on error.
+ *===========================================================================*/
+struct qes_seqbatch *qes_seqbatch_create (size_t capacity, size_t stride);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqbatch_add
+Paramters:      struct qes_seqbatch *batch: Batch to add to.
+                const struct qes_seq *seq: Record to copy into ``batch``.
+Description:    Append a copy of ``seq`` to ``batch``. Fails if ``batch`` is
+                full, or if ``seq`` is too long for the batch's stride.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+int qes_seqbatch_add (struct qes_seqbatch *batch, const struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqbatch_get
+Paramters:      const struct qes_seqbatch *batch: Batch to read from.
+                size_t idx: Index of the record in ``batch``.
+                struct qes_seq *seq: Seq to copy the record into.
+Description:    Copy record ``idx`` of ``batch`` into ``seq``.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+int qes_seqbatch_get (const struct qes_seqbatch *batch, size_t idx,
+                      struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_read_batch
+Paramters:      struct qes_seqfile *seqfile: File to read.
+                struct qes_seqbatch *batch: Batch to read into. Cleared first.
+Description:    Read records from ``seqfile`` until ``batch`` is full or the
+                file ends.
+Returns:        ssize_t: The number of records read, EOF if there were none,
+                or -2 on error (including a read too long for the stride).
+ *===========================================================================*/
+ssize_t qes_seqfile_read_batch (struct qes_seqfile *seqfile,
+                                struct qes_seqbatch *batch);
+
+/* Accessors for field ``col`` of record ``idx``. ``idx`` is not checked. */
+#define qes_seqbatch_str(batch, col, idx)                                   \
+    ((batch)->col.data + (batch)->col.offsets[idx])
+#define qes_seqbatch_len(batch, col, idx)                                   \
+    ((batch)->col.lens[idx])
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqbatch_clear
+Paramters:      struct qes_seqbatch *batch: Batch to empty.
+Description:    Remove all records from ``batch``, keeping its memory.
+Returns:        void
+ *===========================================================================*/
+void qes_seqbatch_clear (struct qes_seqbatch *batch);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqbatch_destroy
+Paramters:      struct qes_seqbatch *: batch to destroy.
+Description:    Deallocate and set to NULL a struct qes_seqbatch on the heap.
+Returns:        void.
+ *===========================================================================*/
+void qes_seqbatch_destroy_ (struct qes_seqbatch *batch);
+#define qes_seqbatch_destroy(batch) do {                                    \
+            qes_seqbatch_destroy_(batch);                                   \
+            batch = NULL;                                                   \
+        } while(0)
+
+#endif /* QES_SEQBATCH_H */
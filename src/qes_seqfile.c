@@ -17,6 +17,47 @@
  */
 
 #include "qes_seqfile.h"
+#include "qes_seqindex.h"
+#include "qes_binseq.h"
+
+/* Read a header line, after its delimiter, as per ``seqfile->header``.
+ * Returns its length, or < 1 on error. */
+static inline ssize_t
+seqfile_read_header (struct qes_seqfile *seqfile, struct qes_seq *seq)
+{
+    struct qes_file *qf = seqfile->qf;
+    ssize_t len = 0;
+    char *end = NULL;
+    int res = 0;
+
+    if (seqfile->header == QES_HEADER_LAZY) {
+        len = qes_file_readline_str(qf, &seq->name);
+        if (len < 1 || qes_seq_fill_raw_header(seq, len) != 0) return -1;
+        return len;
+    } else if (seqfile->header == QES_HEADER_SKIP) {
+        /* As per qes_seqfile_skip, without copying */
+        qes_str_nullify(&seq->name);
+        qes_str_nullify(&seq->comment);
+        seq->raw_header = 0;
+        while (1) {
+            if (qf->bufiter >= qf->bufend) {
+                res = __qes_file_fill_buffer(qf);
+                if (res == 0) return -1;
+                if (res == EOF) return len;
+            }
+            end = memchr(qf->bufiter, '\n', qf->bufend - qf->bufiter);
+            if (end == NULL) end = qf->bufend - 1;
+            len += end + 1 - qf->bufiter;
+            qf->filepos += end + 1 - qf->bufiter;
+            qf->bufiter = end + 1;
+            if (*end == '\n') return len;
+        }
+    }
+    len = qes_file_readline_str(qf, &seqfile->scratch);
+    if (len < 1) return len;
+    qes_seq_fill_header(seq, seqfile->scratch.str, seqfile->scratch.len);
+    return len;
+}
 
 static inline ssize_t
 read_fastq_seqfile(struct qes_seqfile *seqfile, struct qes_seq *seq)
@@ -41,13 +82,12 @@ read_fastq_seqfile(struct qes_seqfile *seqfile, struct qes_seq *seq)
         errcode = -3;
         goto error;
     }
-    len = qes_file_readline_str(seqfile->qf, &seqfile->scratch);
+    len = seqfile_read_header(seqfile, seq);
     if (len < 1) {
         /* Weird truncated file */
         errcode = -3;
         goto error;
     }
-    qes_seq_fill_header(seq, seqfile->scratch.str, seqfile->scratch.len);
     /* Fill the actual sequence directly */
     len = qes_file_readline_str(seqfile->qf, &seq->seq);
     errcode = -4;
@@ -81,6 +121,7 @@ error:
     qes_str_nullify(&seq->comment);
     qes_str_nullify(&seq->seq);
     qes_str_nullify(&seq->qual);
+    seq->raw_header = 0;
     return errcode;
 #undef CHECK_AND_TRIM
 }
@@ -107,11 +148,10 @@ read_fasta_seqfile(struct qes_seqfile *seqfile, struct qes_seq *seq)
         /* This ain't a fasta! WTF! */
         goto error;
     }
-    len = qes_file_readline_str(seqfile->qf, &seqfile->scratch);
+    len = seqfile_read_header(seqfile, seq);
     if (len < 1) {
         goto error;
     }
-    qes_seq_fill_header(seq, seqfile->scratch.str, seqfile->scratch.len);
     /* we need to nullify seq, as we rely on seq.len being 0 as we enter this
      *  while loop */
     qes_str_nullify(&seq->seq);
@@ -125,10 +165,7 @@ read_fasta_seqfile(struct qes_seqfile *seqfile, struct qes_seq *seq)
         seq->seq.len += len - 1;
         seq->seq.str[seq->seq.len] = '\0';
         if (seq->seq.capacity -  1 <= seq->seq.len) {
-            seq->seq.capacity = qes_roundupz(seq->seq.capacity);
-            seq->seq.str = qes_realloc(seq->seq.str,
-                    sizeof(*seq->seq.str) * seq->seq.capacity);
-            if (seq->seq.str == NULL) {
+            if (qes_str_reserve(&seq->seq, seq->seq.capacity + 1) != 0) {
                 goto error;
             }
         }
@@ -143,39 +180,184 @@ error:
     qes_str_nullify(&seq->comment);
     qes_str_nullify(&seq->seq);
     qes_str_nullify(&seq->qual);
+    seq->raw_header = 0;
     return -2;
 #undef CHECK_AND_TRIM
 }
 
-ssize_t
-qes_seqfile_read (struct qes_seqfile *seqfile, struct qes_seq *seq)
+static inline ssize_t
+seqfile_read (struct qes_seqfile *seqfile, struct qes_seq *seq)
 {
+    off_t recstart = 0;
+    ssize_t res = 0;
+
     if (!qes_seqfile_ok(seqfile) || !qes_seq_ok(seq)) {
         return -2;
     }
+    /* Binary records can't be passed through or indexed by offset */
+    if (seqfile->format == BINSEQ_FMT) {
+        seqfile->rec_len = 0;
+        if (seqfile->index != NULL) return -2;
+        return qes_binseq_read_(seqfile, seq);
+    }
     if (seqfile->qf->eof) {
         return EOF;
     }
+    recstart = seqfile->qf->filepos;
     if (seqfile->format == FASTQ_FMT) {
-        return read_fastq_seqfile(seqfile, seq);
+        res = read_fastq_seqfile(seqfile, seq);
     } else if (seqfile->format == FASTA_FMT) {
-        return read_fasta_seqfile(seqfile, seq);
+        res = read_fasta_seqfile(seqfile, seq);
+    } else {
+        goto error;
     }
+    /* The record is only verbatim if we read all of its final line */
+    seqfile->rec_offset = recstart;
+    seqfile->rec_len = 0;
+    if (res >= 0 && seqfile->qf->bufiter > seqfile->qf->buffer &&
+            seqfile->qf->bufiter[-1] == '\n') {
+        seqfile->rec_len = seqfile->qf->filepos - recstart;
+    }
+    if (res >= 0 && seqfile->index != NULL) {
+        if (seqfile->header == QES_HEADER_SKIP ||
+                qes_seq_split_header(seq) != 0 ||
+                qes_seqindex_add(seqfile->index, seq->name.str,
+                                 seq->name.len, recstart) != 0) {
+            return -2;
+        }
+    }
+    return res;
+error:
     /* If we reach here, bail out with an error */
     qes_str_nullify(&seq->name);
     qes_str_nullify(&seq->comment);
     qes_str_nullify(&seq->seq);
     qes_str_nullify(&seq->qual);
+    seq->raw_header = 0;
     return -2;
 }
 
+ssize_t
+qes_seqfile_read (struct qes_seqfile *seqfile, struct qes_seq *seq)
+{
+    ssize_t res = seqfile_read(seqfile, seq);
+
+#ifdef QES_STATS
+    if (seqfile != NULL) {
+        QES_STATS_ADD(seqfile, n_results[res >= 0 ? 0 :
+                                         res > -QES_SEQFILE_N_RESULTS ? -res :
+                                         QES_SEQFILE_N_RESULTS - 1], 1);
+    }
+#endif
+    return res;
+}
+
+ssize_t
+qes_seqfile_skip (struct qes_seqfile *seqfile, size_t n)
+{
+    struct qes_file *qf = NULL;
+    char *end = NULL;
+    size_t n_skipped = 0;
+    /* Lines into the current record, and whether we're at a line's start */
+    size_t n_lines = 0;
+    int line_start = 1;
+    int fastq = 0;
+    int res = 0;
+
+    if (qes_seqfile_ok(seqfile) && seqfile->format == BINSEQ_FMT) {
+        return qes_binseq_skip_(seqfile, n);
+    }
+    if (!qes_seqfile_ok(seqfile) || !qes_file_readable(seqfile->qf)) {
+        return seqfile != NULL && seqfile->qf != NULL && seqfile->qf->eof ?
+            0 : -2;
+    }
+    if (seqfile->format != FASTQ_FMT && seqfile->format != FASTA_FMT) {
+        return -2;
+    }
+    qf = seqfile->qf;
+    fastq = seqfile->format == FASTQ_FMT;
+    seqfile->rec_len = 0;
+    while (n_skipped < n) {
+        if (qf->bufiter >= qf->bufend) {
+            res = __qes_file_fill_buffer(qf);
+            if (res == 0) return -2;
+            if (res == EOF) break;
+        }
+        if (line_start) {
+            if (fastq && n_lines == 0 && qf->bufiter[0] != FASTQ_DELIM) {
+                return -2;
+            }
+            if (!fastq && qf->bufiter[0] == FASTA_DELIM) {
+                /* The next record's header ends the current one, which we
+                 * leave unread when done */
+                if (n_lines > 0 && ++n_skipped == n) break;
+                n_lines = 0;
+            } else if (!fastq && n_lines == 0) {
+                return -2;
+            }
+        }
+        end = memchr(qf->bufiter, '\n', qf->bufend - qf->bufiter);
+        if (end == NULL) {
+            qf->filepos += qf->bufend - qf->bufiter;
+            qf->bufiter = qf->bufend;
+            line_start = 0;
+            continue;
+        }
+        qf->filepos += end + 1 - qf->bufiter;
+        qf->bufiter = end + 1;
+        line_start = 1;
+        if (++n_lines == 4 && fastq) {
+            n_lines = 0;
+            n_skipped++;
+        }
+    }
+    /* The last record needn't end with a newline. A partial FASTQ record is
+     * an error. */
+    if (n_skipped < n && n_lines > 0) {
+        if (fastq && n_lines + !line_start < 4) return -2;
+        n_skipped++;
+    }
+    seqfile->n_records += n_skipped;
+    return n_skipped;
+}
+
+int
+qes_seqfile_counters (struct qes_seqfile *seqfile,
+                      struct qes_seqfile_counters *counters,
+                      struct qes_file_stats *stats)
+{
+    int ret = 0;
+
+    if (counters == NULL) return 1;
+    memset(counters, 0, sizeof(*counters));
+    if (stats != NULL) {
+        ret = qes_file_stats(seqfile != NULL ? seqfile->qf : NULL, stats);
+    }
+#ifdef QES_STATS
+    if (seqfile == NULL) return 1;
+    *counters = seqfile->stats;
+    return ret;
+#else
+    (void) seqfile;
+    (void) ret;
+    return 1;
+#endif
+}
+
 struct qes_seqfile *
 qes_seqfile_create (const char *path, const char *mode)
+{
+    return qes_seqfile_create_opts(path, mode, NULL);
+}
+
+struct qes_seqfile *
+qes_seqfile_create_opts (const char *path, const char *mode,
+                         const struct qes_file_opts *opts)
 {
     struct qes_seqfile *sf = NULL;
     if (path == NULL || mode == NULL) return NULL;
     sf = qes_calloc(1, sizeof(*sf));
-    sf->qf = qes_file_open(path, mode);
+    sf->qf = qes_file_open_opts(path, mode, opts);
     if (sf->qf == NULL) {
         qes_free(sf->qf);
         qes_free(sf);
@@ -187,6 +369,23 @@ qes_seqfile_create (const char *path, const char *mode)
     return sf;
 }
 
+struct qes_seqfile *
+qes_seqfile_dopen (int fd, const char *mode, const struct qes_file_opts *opts)
+{
+    struct qes_seqfile *sf = NULL;
+    if (fd < 0 || mode == NULL) return NULL;
+    sf = qes_calloc(1, sizeof(*sf));
+    sf->qf = qes_file_dopen_opts(fd, mode, opts);
+    if (sf->qf == NULL) {
+        qes_free(sf);
+        return NULL;
+    }
+    qes_str_init(&sf->scratch, __INIT_LINE_LEN);
+    sf->n_records = 0;
+    qes_seqfile_guess_format(sf);
+    return sf;
+}
+
 enum qes_seqfile_format
 qes_seqfile_guess_format (struct qes_seqfile *seqfile)
 {
@@ -204,6 +403,11 @@ qes_seqfile_guess_format (struct qes_seqfile *seqfile)
             return FASTA_FMT;
             break;
         default:
+            if (seqfile->qf->bufend - seqfile->qf->bufiter >= 4 &&
+                    memcmp(seqfile->qf->bufiter, QES_BINSEQ_MAGIC, 4) == 0) {
+                seqfile->format = BINSEQ_FMT;
+                return BINSEQ_FMT;
+            }
             seqfile->format = UNKNOWN_FMT;
             return UNKNOWN_FMT;
     }
@@ -217,10 +421,32 @@ qes_seqfile_set_format (struct qes_seqfile *seqfile,
     seqfile->format = format;
 }
 
+void
+qes_seqfile_set_index (struct qes_seqfile *seqfile,
+                       struct qes_seqindex *index)
+{
+    if (!qes_seqfile_ok(seqfile)) return;
+    seqfile->index = index;
+}
+
+int
+qes_seqfile_set_header (struct qes_seqfile *seqfile,
+                        enum qes_seqfile_header header)
+{
+    if (!qes_seqfile_ok(seqfile)) return 1;
+    if (header != QES_HEADER_SPLIT && header != QES_HEADER_LAZY &&
+            header != QES_HEADER_SKIP) {
+        return 1;
+    }
+    seqfile->header = header;
+    return 0;
+}
+
 void
 qes_seqfile_destroy_(struct qes_seqfile *seqfile)
 {
     if (seqfile != NULL) {
+        if (seqfile->binseq != NULL) qes_binseq_close_(seqfile);
         qes_file_close(seqfile->qf);
         qes_str_destroy_cp(&seqfile->scratch);
         qes_free(seqfile);
@@ -258,6 +484,7 @@ qes_seqfile_format_seq(const struct qes_seq *seq, enum qes_seqfile_format fmt,
                     seq->seq.str);
             return len;
             break;
+        case BINSEQ_FMT:
         case UNKNOWN_FMT:
         default:
             return 0;
@@ -268,11 +495,11 @@ qes_seqfile_format_seq(const struct qes_seq *seq, enum qes_seqfile_format fmt,
 ssize_t
 qes_seqfile_write (struct qes_seqfile *seqfile, struct qes_seq *seq)
 {
-#define sf_putc_check(c) ret = QES_ZFPUTC(seqfile->qf->fp, c);                  \
-    if (ret != c) {return -2;}                                              \
+#define sf_putc_check(c) ret = qes_file_putc(seqfile->qf, c);               \
+    if (ret != 1) {return -2;}                                              \
     else res_len += 1;                                                      \
     ret = 0
-#define sf_puts_check(s) ret = QES_ZFPUTS(seqfile->qf->fp, s);                  \
+#define sf_puts_check(s) ret = qes_file_puts(seqfile->qf, s);               \
     if (ret < 0) {return -2;}                                               \
     else res_len += ret;                                                    \
     ret = 0
@@ -313,6 +540,8 @@ qes_seqfile_write (struct qes_seqfile *seqfile, struct qes_seq *seq)
 
             }
             break;
+        case BINSEQ_FMT:
+            return qes_binseq_write_(seqfile, seq);
         case UNKNOWN_FMT:
         default:
             return -2;
@@ -322,3 +551,22 @@ qes_seqfile_write (struct qes_seqfile *seqfile, struct qes_seq *seq)
 #undef sf_putc_check
 #undef sf_puts_check
 }
+
+ssize_t
+qes_seqfile_write_passthrough (struct qes_seqfile *out,
+                               struct qes_seqfile *in, struct qes_seq *seq)
+{
+    ssize_t res = -1;
+
+    if (!qes_seqfile_ok(out) || !qes_seqfile_ok(in)) {
+        return -2;
+    }
+    if (out->format == in->format && in->rec_len > 0) {
+        res = qes_file_passthrough(out->qf, in->qf, in->rec_offset,
+                                   in->rec_len);
+    }
+    if (res == -1) {
+        res = qes_seqfile_write(out, seq);
+    }
+    return res;
+}
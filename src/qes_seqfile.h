@@ -34,6 +34,35 @@ enum qes_seqfile_format {
     UNKNOWN_FMT = 0,
     FASTA_FMT = 1,
     FASTQ_FMT = 2,
+    /* Blocks of packed records, see qes_binseq.h */
+    BINSEQ_FMT = 3,
+};
+
+/* How qes_seqfile_read handles each record's header line */
+enum qes_seqfile_header {
+    /* Split it into ``seq->name`` and ``seq->comment`` */
+    QES_HEADER_SPLIT = 0,
+    /* Read it whole into ``seq->name``, leaving ``seq->comment`` empty, and
+     * set ``seq->raw_header``. It's split in place on the first call of
+     * qes_seq_name, qes_seq_comment or qes_seq_split_header, so tools that
+     * never look at names don't pay to split them. A raw header is written
+     * out as it was read. */
+    QES_HEADER_LAZY = 1,
+    /* Don't store it at all: ``seq->name`` and ``seq->comment`` are empty */
+    QES_HEADER_SKIP = 2,
+};
+
+struct qes_seqindex;
+struct qes_binseq;
+
+/* Results of qes_seqfile_read are counted by ``-result``, with successful
+ * reads counted at 0. qes_seqfile_read returns at worst -7. */
+#define QES_SEQFILE_N_RESULTS 8
+
+/* Counters of records read, by result. Only kept if libqes is built with
+ * QES_STATS. */
+struct qes_seqfile_counters {
+    uint64_t n_results[QES_SEQFILE_N_RESULTS];
 };
 
 struct qes_seqfile {
@@ -43,6 +72,18 @@ struct qes_seqfile {
     /* A buffer to store misc shit in while reading.
        One per file to keep it re-entrant */
     struct qes_str scratch;
+    /* If not NULL, each record read is added to this index */
+    struct qes_seqindex *index;
+    /* Offset and length of the last record read, for passing it through
+     * verbatim. ``rec_len`` is 0 if we can't. */
+    off_t rec_offset;
+    size_t rec_len;
+    enum qes_seqfile_header header;
+    /* State of a file in BINSEQ_FMT, created on first use */
+    struct qes_binseq *binseq;
+#ifdef QES_STATS
+    struct qes_seqfile_counters stats;
+#endif
 };
 
 
@@ -56,6 +97,33 @@ Returns:        A fully usable ``struct qes_seqfile *`` or NULL.
  *===========================================================================*/
 struct qes_seqfile *qes_seqfile_create (const char *path, const char *mode);
 
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_create_opts
+Paramters:      const char *path: Path to open.
+                const char *mode: Mode to pass to the fopen equivalent used.
+                const struct qes_file_opts *opts: Options for the internal
+                    file handle, or NULL for the defaults.
+Description:    As per qes_seqfile_create, with the internal file handle opened
+                by qes_file_open_opts.
+Returns:        A fully usable ``struct qes_seqfile *`` or NULL.
+ *===========================================================================*/
+struct qes_seqfile *qes_seqfile_create_opts (const char *path, const char *mode,
+                                             const struct qes_file_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_dopen
+Paramters:      int fd: Open file descriptor, e.g. STDIN_FILENO.
+                const char *mode: Mode to pass to the fopen equivalent used.
+                const struct qes_file_opts *opts: Options for the internal
+                    file handle, or NULL for the defaults.
+Description:    As per qes_seqfile_create_opts, but reading or writing ``fd``
+                (see qes_file_dopen), which is closed with the seqfile.
+Returns:        A fully usable ``struct qes_seqfile *`` or NULL, in which case
+                ``fd`` has been closed.
+ *===========================================================================*/
+struct qes_seqfile *qes_seqfile_dopen (int fd, const char *mode,
+                                       const struct qes_file_opts *opts);
+
 
 /*===  FUNCTION  ============================================================*
 Name:           qes_seqfile_ok
@@ -90,10 +158,87 @@ enum qes_seqfile_format qes_seqfile_guess_format(struct qes_seqfile *file);
 void qes_seqfile_set_format (struct qes_seqfile *file,
                              enum qes_seqfile_format format);
 
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_set_index
+Paramters:      struct qes_seqfile *file: File to index.
+                struct qes_seqindex *index: Index to fill, or NULL to stop.
+Description:    Add the name and offset of each record subsequently read from
+                ``file`` to ``index`` (see qes_seqindex.h). Attach the index
+                before the first read to index the whole file. The index is
+                not owned by ``file``.
+Returns:        void
+ *===========================================================================*/
+void qes_seqfile_set_index (struct qes_seqfile *file,
+                            struct qes_seqindex *index);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_set_header
+Paramters:      struct qes_seqfile *file: File to read.
+                enum qes_seqfile_header header: How to handle headers.
+Description:    Set how each record's header line is handled by subsequent
+                calls to qes_seqfile_read; see enum qes_seqfile_header. Lazy
+                headers are split before being added to an index, and an
+                index can't be kept of a file whose headers are skipped.
+Returns:        int: 0 on success, 1 on error.
+ *===========================================================================*/
+int qes_seqfile_set_header (struct qes_seqfile *file,
+                            enum qes_seqfile_header header);
+
 ssize_t qes_seqfile_read (struct qes_seqfile *file, struct qes_seq *seq);
 
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_skip
+Paramters:      struct qes_seqfile *file: File to skip records of.
+                size_t n: Number of records to skip. SIZE_MAX skips to the end,
+                    e.g. to count records.
+Description:    Advance ``file`` past ``n`` records without parsing or copying
+                them. FASTQ records are skipped by counting newlines in the
+                read buffer, and FASTA records by finding the next line
+                starting with '>'. Only the first character of each record is
+                checked, so a malformed record is not noticed until it is
+                read. Skipped records aren't added to the file's index.
+Returns:        ssize_t: The number of records skipped, which is less than
+                ``n`` only at the end of the file, or -2 on error.
+ *===========================================================================*/
+ssize_t qes_seqfile_skip (struct qes_seqfile *file, size_t n);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_counters
+Paramters:      struct qes_seqfile *file: File to get counters of.
+                struct qes_seqfile_counters *counters: Filled with the number
+                    of calls to qes_seqfile_read that returned each result.
+                struct qes_file_stats *stats: If not NULL, filled with the
+                    counters of the underlying ``struct qes_file``.
+Description:    Get the instrumentation counters of ``file``. These are only
+                kept if libqes was built with QES_STATS; otherwise the outputs
+                are zeroed.
+Returns:        int: 0 on success, 1 if counters aren't available or on error.
+ *===========================================================================*/
+int qes_seqfile_counters (struct qes_seqfile *file,
+                          struct qes_seqfile_counters *counters,
+                          struct qes_file_stats *stats);
+
 ssize_t qes_seqfile_write (struct qes_seqfile *file, struct qes_seq *seq);
 
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_write_passthrough
+Paramters:      struct qes_seqfile *out: File to write to.
+                struct qes_seqfile *in: File ``seq`` was just read from.
+                struct qes_seq *seq: The last record read from ``in``,
+                    unmodified.
+Description:    Write ``seq`` to ``out`` as the bytes it was read from, rather
+                than reformatting it, when ``in`` and ``out`` have the same
+                format. This skips formatting the record, and keeps its
+                original layout (e.g. line-wrapped FASTA). To splice runs of
+                records, pass their whole range to qes_file_passthrough. If
+                the record can't be passed through, it is written with
+                qes_seqfile_write.
+Returns:        ssize_t: Bytes written, or -2 on error.
+ *===========================================================================*/
+ssize_t qes_seqfile_write_passthrough (struct qes_seqfile *out,
+                                       struct qes_seqfile *in,
+                                       struct qes_seq *seq);
+
 size_t qes_seqfile_format_seq(const struct qes_seq *seq, enum qes_seqfile_format fmt,
         char *buffer, size_t maxlen);
 
@@ -0,0 +1,425 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_seqindex.c
+ *
+ *    Description:  Record offset index for sequence files, with lookup by
+ *                  record number and by read name.
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 10:40:12
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_seqindex.h"
+
+/* First 8 bytes of an index file. Bump the digit if the layout changes. */
+static const char qes_seqindex_magic[8] = "QESIDX1";
+#define QES_SEQINDEX_SEED 0x51e5c0ffee15ea5eULL
+#define QES_SEQINDEX_EMPTY UINT64_MAX
+/* Give up on a bucket after this many displacements. At 99% load, the last
+   buckets need about 100 tries, so this is never reached in practice. */
+#define QES_SEQINDEX_MAX_DISPLACEMENT (1u << 24)
+
+static inline uint64_t
+seqindex_bucket (uint64_t hash, uint64_t n_buckets)
+{
+    return hash % n_buckets;
+}
+
+static inline uint64_t
+seqindex_slot (uint64_t hash, uint32_t displacement, uint64_t n_slots)
+{
+    /* (displacement + 1) times the golden ratio, so displacement 0 still
+     * perturbs the hash differently to the bucket function */
+    return qes_hash_fmix64(hash ^ ((uint64_t)displacement + 1) *
+                           0x9e3779b97f4a7c15ULL) % n_slots;
+}
+
+static inline uint32_t
+seqindex_fingerprint (uint64_t hash)
+{
+    return (uint32_t)(hash >> 32);
+}
+
+struct qes_seqindex *
+qes_seqindex_create (void)
+{
+    struct qes_seqindex *idx = qes_calloc(1, sizeof(*idx));
+
+    if (idx == NULL) return NULL;
+    idx->capacity = __INIT_LINE_LEN;
+    idx->offsets = qes_calloc(idx->capacity, sizeof(*idx->offsets));
+    idx->hashes = qes_calloc(idx->capacity, sizeof(*idx->hashes));
+    if (idx->offsets == NULL || idx->hashes == NULL) {
+        qes_seqindex_destroy(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+int
+qes_seqindex_add (struct qes_seqindex *idx, const char *name, size_t len,
+                  off_t offset)
+{
+    if (idx == NULL || name == NULL || offset < 0 || idx->hashes == NULL) {
+        /* A loaded index has no name hashes, so it can't be extended */
+        return 1;
+    }
+    if (idx->n_records >= idx->capacity) {
+        size_t newcap = qes_roundupz(idx->capacity + 1);
+        uint64_t *offsets = qes_realloc(idx->offsets,
+                                        newcap * sizeof(*offsets));
+        uint64_t *hashes = NULL;
+
+        if (offsets == NULL) return 1;
+        idx->offsets = offsets;
+        hashes = qes_realloc(idx->hashes, newcap * sizeof(*hashes));
+        if (hashes == NULL) return 1;
+        idx->hashes = hashes;
+        idx->capacity = newcap;
+    }
+    idx->offsets[idx->n_records] = offset;
+    idx->hashes[idx->n_records] = qes_hash64(name, len, QES_SEQINDEX_SEED);
+    idx->n_records++;
+    idx->built = 0;
+    return 0;
+}
+
+int
+qes_seqindex_build (struct qes_seqindex *idx)
+{
+    uint64_t *bucket_starts = NULL;
+    uint64_t *keys = NULL;
+    uint64_t *buckets_by_size = NULL;
+    uint64_t *size_starts = NULL;
+    uint64_t *sizes = NULL;
+    uint8_t *taken = NULL;
+    uint64_t positions[256];
+    uint64_t max_size = 0;
+    uint64_t iii = 0;
+    int ret = 1;
+
+    if (idx == NULL || idx->hashes == NULL) return 1;
+    if (idx->built) return 0;
+    qes_free(idx->displacements);
+    qes_free(idx->slots);
+    qes_free(idx->fingerprints);
+    idx->n_buckets = idx->n_records / QES_SEQINDEX_BUCKET_SIZE + 1;
+    idx->n_slots = idx->n_records + idx->n_records / 100 + 1;
+    idx->displacements = qes_calloc(idx->n_buckets,
+                                    sizeof(*idx->displacements));
+    idx->slots = qes_malloc(idx->n_slots * sizeof(*idx->slots));
+    idx->fingerprints = qes_calloc(idx->n_slots, sizeof(*idx->fingerprints));
+    bucket_starts = qes_calloc(idx->n_buckets + 1, sizeof(*bucket_starts));
+    keys = qes_malloc((idx->n_records + 1) * sizeof(*keys));
+    buckets_by_size = qes_malloc(idx->n_buckets * sizeof(*buckets_by_size));
+    sizes = qes_malloc(idx->n_buckets * sizeof(*sizes));
+    taken = qes_calloc(idx->n_slots / 8 + 1, sizeof(*taken));
+    if (idx->displacements == NULL || idx->slots == NULL || keys == NULL ||
+            idx->fingerprints == NULL || bucket_starts == NULL ||
+            buckets_by_size == NULL || sizes == NULL || taken == NULL) {
+        goto done;
+    }
+    for (iii = 0; iii < idx->n_slots; iii++) {
+        idx->slots[iii] = QES_SEQINDEX_EMPTY;
+    }
+    /* Counting sort of records into buckets */
+    for (iii = 0; iii < idx->n_records; iii++) {
+        bucket_starts[seqindex_bucket(idx->hashes[iii], idx->n_buckets) + 1]++;
+    }
+    for (iii = 0; iii < idx->n_buckets; iii++) {
+        bucket_starts[iii + 1] += bucket_starts[iii];
+    }
+    {
+        uint64_t *fill = qes_malloc(idx->n_buckets * sizeof(*fill));
+        if (fill == NULL) goto done;
+        memcpy(fill, bucket_starts, idx->n_buckets * sizeof(*fill));
+        for (iii = 0; iii < idx->n_records; iii++) {
+            uint64_t bucket = seqindex_bucket(idx->hashes[iii], idx->n_buckets);
+            keys[fill[bucket]++] = iii;
+        }
+        qes_free(fill);
+    }
+    /* Drop later records with the same name hash as an earlier one, as no
+     * displacement could separate them, before sizing the buckets. Keys are
+     * in file order, so the first record of a name is kept. */
+    for (iii = 0; iii < idx->n_buckets; iii++) {
+        uint64_t *bkeys = keys + bucket_starts[iii];
+        uint64_t size = bucket_starts[iii + 1] - bucket_starts[iii];
+        uint64_t n_kept = 0;
+        uint64_t jjj = 0;
+        uint64_t kkk = 0;
+
+        for (jjj = 0; jjj < size; jjj++) {
+            for (kkk = 0; kkk < n_kept; kkk++) {
+                if (idx->hashes[bkeys[jjj]] == idx->hashes[bkeys[kkk]]) break;
+            }
+            if (kkk < n_kept) continue;
+            if (n_kept == sizeof(positions) / sizeof(*positions)) {
+                /* Pathological hash distribution, give up */
+                goto done;
+            }
+            bkeys[n_kept++] = bkeys[jjj];
+        }
+        sizes[iii] = n_kept;
+        if (n_kept > max_size) max_size = n_kept;
+    }
+    /* Place the largest buckets first, while the table is empty. This is
+     * another counting sort, by descending bucket size. */
+    size_starts = qes_calloc(max_size + 2, sizeof(*size_starts));
+    if (size_starts == NULL) goto done;
+    for (iii = 0; iii < idx->n_buckets; iii++) {
+        size_starts[max_size - sizes[iii] + 1]++;
+    }
+    for (iii = 0; iii <= max_size; iii++) {
+        size_starts[iii + 1] += size_starts[iii];
+    }
+    for (iii = 0; iii < idx->n_buckets; iii++) {
+        buckets_by_size[size_starts[max_size - sizes[iii]]++] = iii;
+    }
+    for (iii = 0; iii < idx->n_buckets; iii++) {
+        uint64_t bucket = buckets_by_size[iii];
+        uint64_t *bkeys = keys + bucket_starts[bucket];
+        uint64_t size = sizes[bucket];
+        uint64_t jjj = 0;
+        uint64_t kkk = 0;
+        uint32_t disp = 0;
+
+        if (size == 0) break;
+        for (disp = 0; disp < QES_SEQINDEX_MAX_DISPLACEMENT; disp++) {
+            for (jjj = 0; jjj < size; jjj++) {
+                uint64_t pos = seqindex_slot(idx->hashes[bkeys[jjj]], disp,
+                                             idx->n_slots);
+                if (taken[pos >> 3] & (1 << (pos & 7))) break;
+                for (kkk = 0; kkk < jjj; kkk++) {
+                    if (positions[kkk] == pos) break;
+                }
+                if (kkk < jjj) break;
+                positions[jjj] = pos;
+            }
+            if (jjj == size) break;
+        }
+        if (disp == QES_SEQINDEX_MAX_DISPLACEMENT) goto done;
+        idx->displacements[bucket] = disp;
+        for (jjj = 0; jjj < size; jjj++) {
+            uint64_t pos = positions[jjj];
+            taken[pos >> 3] |= 1 << (pos & 7);
+            idx->slots[pos] = bkeys[jjj];
+            idx->fingerprints[pos] = seqindex_fingerprint(
+                    idx->hashes[bkeys[jjj]]);
+        }
+    }
+    idx->built = 1;
+    ret = 0;
+done:
+    qes_free(bucket_starts);
+    qes_free(keys);
+    qes_free(buckets_by_size);
+    qes_free(size_starts);
+    qes_free(sizes);
+    qes_free(taken);
+    return ret;
+}
+
+int64_t
+qes_seqindex_lookup (const struct qes_seqindex *idx, const char *name,
+                     size_t len)
+{
+    uint64_t hash = 0;
+    uint64_t pos = 0;
+
+    if (idx == NULL || name == NULL || !idx->built || idx->n_records == 0) {
+        return -1;
+    }
+    hash = qes_hash64(name, len, QES_SEQINDEX_SEED);
+    pos = seqindex_slot(hash,
+            idx->displacements[seqindex_bucket(hash, idx->n_buckets)],
+            idx->n_slots);
+    if (idx->slots[pos] == QES_SEQINDEX_EMPTY ||
+            idx->fingerprints[pos] != seqindex_fingerprint(hash)) {
+        return -1;
+    }
+    return (int64_t)idx->slots[pos];
+}
+
+int
+qes_seqindex_save (struct qes_seqindex *idx, const char *path)
+{
+    FILE *fp = NULL;
+    uint64_t header[3];
+    int ret = 1;
+
+    if (idx == NULL || path == NULL) return 1;
+    if (!idx->built && qes_seqindex_build(idx) != 0) return 1;
+    fp = fopen(path, "wb");
+    if (fp == NULL) return 1;
+    header[0] = idx->n_records;
+    header[1] = idx->n_buckets;
+    header[2] = idx->n_slots;
+    if (fwrite(qes_seqindex_magic, 1, sizeof(qes_seqindex_magic), fp) !=
+                sizeof(qes_seqindex_magic) ||
+            fwrite(header, sizeof(*header), 3, fp) != 3 ||
+            fwrite(idx->offsets, sizeof(*idx->offsets), idx->n_records, fp) !=
+                idx->n_records ||
+            fwrite(idx->displacements, sizeof(*idx->displacements),
+                   idx->n_buckets, fp) != idx->n_buckets ||
+            fwrite(idx->slots, sizeof(*idx->slots), idx->n_slots, fp) !=
+                idx->n_slots ||
+            fwrite(idx->fingerprints, sizeof(*idx->fingerprints),
+                   idx->n_slots, fp) != idx->n_slots) {
+        goto done;
+    }
+    ret = 0;
+done:
+    if (fclose(fp) != 0) ret = 1;
+    return ret;
+}
+
+struct qes_seqindex *
+qes_seqindex_load (const char *path)
+{
+    struct qes_seqindex *idx = NULL;
+    FILE *fp = NULL;
+    char magic[sizeof(qes_seqindex_magic)];
+    uint64_t header[3];
+    uint64_t left = 0;
+    uint64_t iii = 0;
+    off_t fsize = 0;
+
+    if (path == NULL) return NULL;
+    fp = fopen(path, "rb");
+    if (fp == NULL) return NULL;
+    if (fseeko(fp, 0, SEEK_END) != 0 || (fsize = ftello(fp)) < 0 ||
+            fseeko(fp, 0, SEEK_SET) != 0 ||
+            fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+            memcmp(magic, qes_seqindex_magic, sizeof(magic)) != 0 ||
+            fread(header, sizeof(*header), 3, fp) != 3 ||
+            header[1] == 0 || header[2] == 0) {
+        goto error;
+    }
+    /* The counts must account for exactly the rest of the file. Checking
+     * each against what's left first means none of this can overflow. */
+    left = fsize - sizeof(magic) - sizeof(header);
+    if (header[0] > left / sizeof(*idx->offsets)) goto error;
+    left -= header[0] * sizeof(*idx->offsets);
+    if (header[1] > left / sizeof(*idx->displacements)) goto error;
+    left -= header[1] * sizeof(*idx->displacements);
+    if (header[2] > left / (sizeof(*idx->slots) +
+                            sizeof(*idx->fingerprints)) ||
+            left != header[2] * (sizeof(*idx->slots) +
+                                 sizeof(*idx->fingerprints))) {
+        goto error;
+    }
+    idx = qes_calloc(1, sizeof(*idx));
+    if (idx == NULL) goto error;
+    idx->n_records = header[0];
+    idx->n_buckets = header[1];
+    idx->n_slots = header[2];
+    idx->capacity = idx->n_records;
+    idx->offsets = qes_malloc((idx->n_records + 1) * sizeof(*idx->offsets));
+    idx->displacements = qes_malloc(idx->n_buckets *
+                                    sizeof(*idx->displacements));
+    idx->slots = qes_malloc(idx->n_slots * sizeof(*idx->slots));
+    idx->fingerprints = qes_malloc(idx->n_slots * sizeof(*idx->fingerprints));
+    if (idx->offsets == NULL || idx->displacements == NULL ||
+            idx->slots == NULL || idx->fingerprints == NULL) {
+        goto error;
+    }
+    if (fread(idx->offsets, sizeof(*idx->offsets), idx->n_records, fp) !=
+                idx->n_records ||
+            fread(idx->displacements, sizeof(*idx->displacements),
+                  idx->n_buckets, fp) != idx->n_buckets ||
+            fread(idx->slots, sizeof(*idx->slots), idx->n_slots, fp) !=
+                idx->n_slots ||
+            fread(idx->fingerprints, sizeof(*idx->fingerprints),
+                  idx->n_slots, fp) != idx->n_slots) {
+        goto error;
+    }
+    /* Lookups index ``offsets`` by slot, so a bad one must not get in */
+    for (iii = 0; iii < idx->n_slots; iii++) {
+        if (idx->slots[iii] != QES_SEQINDEX_EMPTY &&
+                idx->slots[iii] >= idx->n_records) {
+            goto error;
+        }
+    }
+    fclose(fp);
+    idx->built = 1;
+    return idx;
+error:
+    fclose(fp);
+    qes_seqindex_destroy(idx);
+    return NULL;
+}
+
+ssize_t
+qes_seqfile_fetch (struct qes_seqfile *seqfile, const struct qes_seqindex *idx,
+                   uint64_t recnum, struct qes_seq *seq)
+{
+    struct qes_seqindex *attached = NULL;
+    ssize_t res = 0;
+
+    if (!qes_seqfile_ok(seqfile) || idx == NULL || !qes_seq_ok(seq)) {
+        return -2;
+    }
+    if (recnum >= idx->n_records) {
+        return EOF;
+    }
+    if (qes_file_seek(seqfile->qf, idx->offsets[recnum]) != 0) {
+        return -2;
+    }
+    /* Don't index the records we fetch, if we're being indexed */
+    attached = seqfile->index;
+    seqfile->index = NULL;
+    res = qes_seqfile_read(seqfile, seq);
+    seqfile->index = attached;
+    return res;
+}
+
+ssize_t
+qes_seqfile_fetch_name (struct qes_seqfile *seqfile,
+                        const struct qes_seqindex *idx, const char *name,
+                        struct qes_seq *seq)
+{
+    int64_t recnum = 0;
+    ssize_t res = 0;
+
+    if (!qes_seqfile_ok(seqfile) || idx == NULL || name == NULL ||
+            !qes_seq_ok(seq)) {
+        return -2;
+    }
+    recnum = qes_seqindex_lookup(idx, name, strlen(name));
+    if (recnum < 0) {
+        return EOF;
+    }
+    res = qes_seqfile_fetch(seqfile, idx, recnum, seq);
+    if (res >= 0 && (qes_seq_split_header(seq) != 0 ||
+                     strcmp(seq->name.str, name) != 0)) {
+        /* Fingerprint false positive */
+        qes_str_nullify(&seq->name);
+        qes_str_nullify(&seq->comment);
+        qes_str_nullify(&seq->seq);
+        qes_str_nullify(&seq->qual);
+        return EOF;
+    }
+    return res;
+}
+
+void
+qes_seqindex_destroy_ (struct qes_seqindex *idx)
+{
+    if (idx != NULL) {
+        qes_free(idx->offsets);
+        qes_free(idx->hashes);
+        qes_free(idx->displacements);
+        qes_free(idx->slots);
+        qes_free(idx->fingerprints);
+        qes_free(idx);
+    }
+}
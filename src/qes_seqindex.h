@@ -0,0 +1,165 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_seqindex.h
+ *
+ *    Description:  Record offset index for sequence files, with lookup by
+ *                  record number and by read name.
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 10:40:12
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_SEQINDEX_H
+#define QES_SEQINDEX_H
+
+#include <qes_util.h>
+#include <qes_hash.h>
+#include <qes_seq.h>
+#include <qes_seqfile.h>
+
+/*---------------------------------------------------------------------------
+  | qes_seqindex module -- sidecar index of record offsets and read names   |
+  ---------------------------------------------------------------------------*/
+
+/* Suffix appended to a sequence file's path to name its sidecar index */
+#define QES_SEQINDEX_SUFFIX ".qesi"
+/* Average number of keys per bucket of the name hash. Higher is smaller but
+   slower to build. */
+#define QES_SEQINDEX_BUCKET_SIZE 4
+
+/* The index holds the uncompressed byte offset of each record, in file order,
+ * and a perfect hash from read name to record number. The hash is of the
+ * hash-and-displace kind: names are split into buckets, and each bucket gets a
+ * displacement that sends its names to unused slots. The table is kept at 99%
+ * load, which keeps building linear-time. Only a 32-bit fingerprint of each
+ * name is stored, so a lookup can return a false positive which the caller
+ * must check against the record's name (qes_seqfile_fetch_name does this). */
+struct qes_seqindex {
+    uint64_t n_records;
+    uint64_t *offsets;
+    /* Hashes of each record's name, only kept until the name hash is built */
+    uint64_t *hashes;
+    size_t capacity;
+    uint64_t n_buckets;
+    uint32_t *displacements;
+    uint64_t n_slots;
+    uint64_t *slots;
+    uint32_t *fingerprints;
+    int built;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqindex_create
+Paramters:      void
+Description:    Create an empty ``struct qes_seqindex``. Attach it to a
+                ``struct qes_seqfile`` with qes_seqfile_set_index to fill it
+                during a normal read pass.
+Returns:        struct qes_seqindex *: A new index, or NULL on error.
+ *===========================================================================*/
+struct qes_seqindex *qes_seqindex_create (void);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqindex_add
+Paramters:      struct qes_seqindex *idx: Index to add to.
+                const char *name, size_t len: The record's name.
+                off_t offset: Byte offset of the start of the record.
+Description:    Append a record to ``idx``. Records must be added in file
+                order, as their record number is their position in ``idx``.
+                Invalidates any built name hash.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+int qes_seqindex_add (struct qes_seqindex *idx, const char *name, size_t len,
+                      off_t offset);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqindex_build
+Paramters:      struct qes_seqindex *idx: Index to build.
+Description:    Build the perfect hash of read names. Records whose name
+                duplicates an earlier one are only reachable by number.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+int qes_seqindex_build (struct qes_seqindex *idx);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqindex_lookup
+Paramters:      const struct qes_seqindex *idx: A built index.
+                const char *name, size_t len: Name to look up.
+Description:    Find the record number of the record named ``name``. May
+                return the number of a record with a different name, with a
+                probability of about 2^-32 for names not in the index.
+Returns:        int64_t: The record number, or -1 if ``name`` is not indexed.
+ *===========================================================================*/
+int64_t qes_seqindex_lookup (const struct qes_seqindex *idx, const char *name,
+                             size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqindex_save
+Paramters:      struct qes_seqindex *idx: Index to save. Built if needed.
+                const char *path: Path of the index file, normally the
+                    sequence file's path with QES_SEQINDEX_SUFFIX appended.
+Description:    Write ``idx`` to ``path`` in native byte order.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+int qes_seqindex_save (struct qes_seqindex *idx, const char *path);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqindex_load
+Paramters:      const char *path: Path of an index written by
+                    qes_seqindex_save.
+Description:    Read a built index from ``path``.
+Returns:        struct qes_seqindex *: The index, or NULL on error.
+ *===========================================================================*/
+struct qes_seqindex *qes_seqindex_load (const char *path);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_fetch
+Paramters:      struct qes_seqfile *seqfile: File ``idx`` was built from.
+                const struct qes_seqindex *idx: Index of ``seqfile``.
+                uint64_t recnum: Zero-based record number to fetch.
+                struct qes_seq *seq: Seq to read into.
+Description:    Seek to record ``recnum`` and read it into ``seq``. Sequential
+                reads continue from the record after ``recnum``.
+Returns:        ssize_t: As per qes_seqfile_read, or EOF if there is no record
+                ``recnum``.
+ *===========================================================================*/
+ssize_t qes_seqfile_fetch (struct qes_seqfile *seqfile,
+                           const struct qes_seqindex *idx, uint64_t recnum,
+                           struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_fetch_name
+Paramters:      struct qes_seqfile *seqfile: File ``idx`` was built from.
+                const struct qes_seqindex *idx: Built index of ``seqfile``.
+                const char *name: Name of the record to fetch.
+                struct qes_seq *seq: Seq to read into.
+Description:    Look up ``name`` in ``idx`` and read the record into ``seq``,
+                checking the name of the record read.
+Returns:        ssize_t: As per qes_seqfile_read, or EOF if there is no record
+                named ``name``.
+ *===========================================================================*/
+ssize_t qes_seqfile_fetch_name (struct qes_seqfile *seqfile,
+                                const struct qes_seqindex *idx,
+                                const char *name, struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqindex_destroy
+Paramters:      struct qes_seqindex *: index to destroy.
+Description:    Deallocate and set to NULL a struct qes_seqindex on the heap.
+Returns:        void.
+ *===========================================================================*/
+void qes_seqindex_destroy_ (struct qes_seqindex *idx);
+#define qes_seqindex_destroy(idx) do {                                      \
+            qes_seqindex_destroy_(idx);                                     \
+            idx = NULL;                                                     \
+        } while(0)
+
+#endif /* QES_SEQINDEX_H */
@@ -0,0 +1,206 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_seqpool.c
+ *
+ *    Description:  Thread-safe recycling pool of sequence structs
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 14:02:17
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_seqpool.h"
+
+
+/* Puts the chain of nodes from ``first`` to ``last`` in a free slot, or on
+ * the overflow stack if there are none. */
+static void
+seqpool_push_batch (struct qes_seqpool_cache *cache,
+                    struct qes_seqpool_node *first,
+                    struct qes_seqpool_node *last)
+{
+    struct qes_seqpool *pool = cache->pool;
+    struct qes_seqpool_node *old = NULL;
+    size_t iii = 0;
+    size_t slot = 0;
+
+    last->next = NULL;
+    for (iii = 0; iii < QES_SEQPOOL_SLOTS; iii++) {
+        slot = (cache->slot + iii) % QES_SEQPOOL_SLOTS;
+        old = NULL;
+        if (__atomic_load_n(&pool->slots[slot], __ATOMIC_RELAXED) == NULL &&
+                __atomic_compare_exchange_n(&pool->slots[slot], &old, first,
+                                            0, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+            cache->slot = slot;
+            return;
+        }
+    }
+    old = __atomic_load_n(&pool->overflow, __ATOMIC_RELAXED);
+    do {
+        last->next = old;
+    } while (!__atomic_compare_exchange_n(&pool->overflow, &old, first, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Takes a batch of nodes from the pool, returning NULL if it is empty */
+static struct qes_seqpool_node *
+seqpool_pop_batch (struct qes_seqpool_cache *cache)
+{
+    struct qes_seqpool *pool = cache->pool;
+    struct qes_seqpool_node *batch = NULL;
+    size_t iii = 0;
+    size_t slot = 0;
+
+    for (iii = 0; iii < QES_SEQPOOL_SLOTS; iii++) {
+        slot = (cache->slot + iii) % QES_SEQPOOL_SLOTS;
+        if (__atomic_load_n(&pool->slots[slot], __ATOMIC_RELAXED) != NULL) {
+            batch = __atomic_exchange_n(&pool->slots[slot], NULL,
+                                        __ATOMIC_ACQUIRE);
+            if (batch != NULL) {
+                cache->slot = slot;
+                return batch;
+            }
+        }
+    }
+    /* Only ever take the whole overflow stack, which avoids ABA */
+    return __atomic_exchange_n(&pool->overflow, NULL, __ATOMIC_ACQUIRE);
+}
+
+static struct qes_seqpool_node *
+seqpool_node_create (struct qes_seqpool *pool)
+{
+    struct qes_seqpool_node *node = qes_malloc(sizeof(*node));
+
+    if (node == NULL) return NULL;
+    qes_str_init(&node->seq.name, __INIT_LINE_LEN);
+    qes_str_init(&node->seq.comment, __INIT_LINE_LEN);
+    qes_str_init(&node->seq.seq, __INIT_LINE_LEN);
+    qes_str_init(&node->seq.qual, __INIT_LINE_LEN);
+    node->seq.arena = NULL;
+    node->seq.raw_header = 0;
+    node->next = NULL;
+    if (!qes_seq_ok(&node->seq)) {
+        qes_seq_destroy_(&node->seq);
+        return NULL;
+    }
+    __atomic_add_fetch(&pool->n_created, 1, __ATOMIC_RELAXED);
+    return node;
+}
+
+struct qes_seqpool *
+qes_seqpool_create (void)
+{
+    return qes_calloc(1, sizeof(struct qes_seqpool));
+}
+
+struct qes_seqpool_cache *
+qes_seqpool_cache_create (struct qes_seqpool *pool)
+{
+    struct qes_seqpool_cache *cache = NULL;
+
+    if (pool == NULL) return NULL;
+    cache = qes_calloc(1, sizeof(*cache));
+    if (cache == NULL) return NULL;
+    cache->pool = pool;
+    /* Spread caches' starting slots across the pool */
+    cache->slot = __atomic_fetch_add(&pool->n_caches, 1, __ATOMIC_RELAXED) *
+                  (QES_SEQPOOL_SLOTS / 16) % QES_SEQPOOL_SLOTS;
+    return cache;
+}
+
+struct qes_seq *
+qes_seqpool_get (struct qes_seqpool_cache *cache)
+{
+    struct qes_seqpool_node *node = NULL;
+
+    if (cache == NULL) return NULL;
+    if (cache->head == NULL) {
+        cache->head = seqpool_pop_batch(cache);
+        for (node = cache->head; node != NULL; node = node->next) {
+            cache->len++;
+        }
+    }
+    if (cache->head == NULL) {
+        node = seqpool_node_create(cache->pool);
+        return node != NULL ? &node->seq : NULL;
+    }
+    node = cache->head;
+    cache->head = node->next;
+    cache->len--;
+    node->next = NULL;
+    return &node->seq;
+}
+
+int
+qes_seqpool_put (struct qes_seqpool_cache *cache, struct qes_seq *seq)
+{
+    struct qes_seqpool_node *node = (struct qes_seqpool_node *)seq;
+    struct qes_seqpool_node *last = NULL;
+    size_t iii = 0;
+
+    if (cache == NULL || !qes_seq_ok(seq)) return 1;
+    qes_str_nullify(&seq->name);
+    qes_str_nullify(&seq->comment);
+    qes_str_nullify(&seq->seq);
+    qes_str_nullify(&seq->qual);
+    seq->raw_header = 0;
+    node->next = cache->head;
+    cache->head = node;
+    cache->len++;
+    if (cache->len > 2 * QES_SEQPOOL_CACHE_LEN) {
+        /* Give a batch of QES_SEQPOOL_CACHE_LEN nodes back to the pool */
+        last = cache->head;
+        for (iii = 1; iii < QES_SEQPOOL_CACHE_LEN; iii++) {
+            last = last->next;
+        }
+        node = cache->head;
+        cache->head = last->next;
+        cache->len -= QES_SEQPOOL_CACHE_LEN;
+        seqpool_push_batch(cache, node, last);
+    }
+    return 0;
+}
+
+void
+qes_seqpool_cache_destroy_ (struct qes_seqpool_cache *cache)
+{
+    struct qes_seqpool_node *last = NULL;
+
+    if (cache != NULL) {
+        if (cache->head != NULL) {
+            last = cache->head;
+            while (last->next != NULL) {
+                last = last->next;
+            }
+            seqpool_push_batch(cache, cache->head, last);
+        }
+        qes_free(cache);
+    }
+}
+
+void
+qes_seqpool_destroy_ (struct qes_seqpool *pool)
+{
+    struct qes_seqpool_node *node = NULL;
+    struct qes_seqpool_node *next = NULL;
+    size_t iii = 0;
+
+    if (pool != NULL) {
+        for (iii = 0; iii <= QES_SEQPOOL_SLOTS; iii++) {
+            node = iii < QES_SEQPOOL_SLOTS ? pool->slots[iii] : pool->overflow;
+            for (; node != NULL; node = next) {
+                next = node->next;
+                qes_seq_destroy_(&node->seq);
+            }
+        }
+        qes_free(pool);
+    }
+}
@@ -0,0 +1,127 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_seqpool.h
+ *
+ *    Description:  Thread-safe recycling pool of sequence structs
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 14:02:17
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_SEQPOOL_H
+#define QES_SEQPOOL_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+
+/* Number of free seqs a thread's cache returns to the pool at once. A cache
+ * holds at most twice this many. */
+#define QES_SEQPOOL_CACHE_LEN 64
+/* Number of batches of QES_SEQPOOL_CACHE_LEN seqs the pool keeps in slots */
+#define QES_SEQPOOL_SLOTS 256
+
+struct qes_seqpool_node {
+    /* Must be first, so a ``struct qes_seq *`` is also a node pointer */
+    struct qes_seq seq;
+    struct qes_seqpool_node *next;
+};
+
+/* Seqs are handed out and returned through a per-thread ``struct
+ * qes_seqpool_cache``, which only touches the shared pool when it runs empty
+ * or overfull, and then moves a whole batch of seqs at a time. Batches are
+ * placed in and taken from the pool's slots by compare-and-swap and atomic
+ * exchange, so the pool is lock-free and not subject to the ABA problem.
+ * Batches that don't fit in a slot go on a lock-free stack, which is only
+ * ever emptied all at once. */
+struct qes_seqpool {
+    struct qes_seqpool_node *slots[QES_SEQPOOL_SLOTS];
+    struct qes_seqpool_node *overflow;
+    /* Number of seqs allocated by this pool */
+    size_t n_created;
+    size_t n_caches;
+};
+
+/* A thread's private cache of free seqs. Not thread-safe: use one per
+ * thread. */
+struct qes_seqpool_cache {
+    struct qes_seqpool *pool;
+    struct qes_seqpool_node *head;
+    size_t len;
+    /* Slot to start looking at, so threads don't all fight over one */
+    size_t slot;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqpool_create
+Paramters:      void
+Description:    Create an empty ``struct qes_seqpool``.
+Returns:        struct qes_seqpool *: A new pool, or NULL on error.
+ *===========================================================================*/
+struct qes_seqpool *qes_seqpool_create (void);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqpool_cache_create
+Paramters:      struct qes_seqpool *pool: Pool to draw from.
+Description:    Create a cache through which one thread gets seqs from, and
+                returns seqs to, ``pool``.
+Returns:        struct qes_seqpool_cache *: A new cache, or NULL on error.
+ *===========================================================================*/
+struct qes_seqpool_cache *qes_seqpool_cache_create (struct qes_seqpool *pool);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqpool_get
+Paramters:      struct qes_seqpool_cache *cache: This thread's cache.
+Description:    Get an empty seq, reusing a returned one if possible. Reused
+                seqs keep the capacity of their strings.
+Returns:        struct qes_seq *: A seq, or NULL on error.
+ *===========================================================================*/
+struct qes_seq *qes_seqpool_get (struct qes_seqpool_cache *cache);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqpool_put
+Paramters:      struct qes_seqpool_cache *cache: This thread's cache.
+                struct qes_seq *seq: A seq from qes_seqpool_get, possibly on
+                    another thread's cache of the same pool.
+Description:    Return ``seq`` to the pool. ``seq`` is emptied, and must not be
+                used afterwards.
+Returns:        int: 0 on success, 1 on failure.
+ *===========================================================================*/
+int qes_seqpool_put (struct qes_seqpool_cache *cache, struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqpool_cache_destroy
+Paramters:      struct qes_seqpool_cache *: cache to destroy.
+Description:    Return all seqs in the cache to its pool, free the cache and
+                set it to NULL.
+Returns:        void.
+ *===========================================================================*/
+void qes_seqpool_cache_destroy_ (struct qes_seqpool_cache *cache);
+#define qes_seqpool_cache_destroy(cache) do {                               \
+            qes_seqpool_cache_destroy_(cache);                              \
+            cache = NULL;                                                   \
+        } while(0)
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqpool_destroy
+Paramters:      struct qes_seqpool *: pool to destroy.
+Description:    Free all seqs held by ``pool``, and ``pool`` itself. All caches
+                must be destroyed first. Seqs not returned to the pool must be
+                freed with qes_seq_destroy.
+Returns:        void.
+ *===========================================================================*/
+void qes_seqpool_destroy_ (struct qes_seqpool *pool);
+#define qes_seqpool_destroy(pool) do {                                      \
+            qes_seqpool_destroy_(pool);                                     \
+            pool = NULL;                                                    \
+        } while(0)
+
+#endif /* QES_SEQPOOL_H */
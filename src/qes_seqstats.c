@@ -0,0 +1,575 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_seqstats.c
+ *
+ *    Description:  Summary statistics of sequence files, from a fast scan
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 20:52:36
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_seqstats.h"
+
+#ifdef OPENMP_FOUND
+#define SEQSTATS_OMP(x) _Pragma(STRINGIFY(omp x))
+#else
+#define SEQSTATS_OMP(x)
+#endif
+
+/* Smallest chunk worth a thread of its own */
+#define SEQSTATS_MIN_CHUNK (1<<16)
+
+/* Where we are in a record. FASTA only uses HEADER and SEQ. */
+enum seqstats_state {
+    ST_HEADER,
+    ST_SEQ,
+    ST_PLUS,
+    ST_QUAL,
+};
+
+/* A scan of part of a file, fed a buffer at a time */
+struct seqstats_scan {
+    struct qes_seqstats *stats;
+    size_t max_positions;
+    enum seqstats_state state;
+    int at_line_start;
+    /* FASTA: we've seen a header */
+    int in_record;
+    /* Length of the current record's sequence, and quality so far */
+    uint64_t seqlen;
+    uint64_t quallen;
+    /* File offset of the next byte */
+    off_t offset;
+    /* Stop at the first record starting here or later, if >= 0 */
+    off_t limit;
+    int done;
+    int error;
+};
+
+/* These loops have no branches, so are vectorised once for each ISA level */
+QES_MULTIVERSION
+static uint64_t
+seqstats_count_gc (const char *seq, size_t len)
+{
+    uint64_t n_gc = 0;
+    size_t iii = 0;
+    unsigned char chr = 0;
+
+    for (iii = 0; iii < len; iii++) {
+        chr = seq[iii] | 0x20;
+        n_gc += (chr == 'g') | (chr == 'c');
+    }
+    return n_gc;
+}
+
+QES_MULTIVERSION
+static void
+seqstats_count_qual (const char *qual, size_t len, uint64_t *n_q20,
+                     uint64_t *n_q30)
+{
+    uint64_t n20 = 0;
+    uint64_t n30 = 0;
+    size_t iii = 0;
+    unsigned char chr = 0;
+
+    for (iii = 0; iii < len; iii++) {
+        chr = qual[iii];
+        n20 += chr >= QES_SEQSTATS_QUAL_OFFSET + 20;
+        n30 += chr >= QES_SEQSTATS_QUAL_OFFSET + 30;
+    }
+    *n_q20 += n20;
+    *n_q30 += n30;
+}
+
+static struct qes_seqstats *
+seqstats_create (void)
+{
+    struct qes_seqstats *stats = qes_calloc_errnil(1, sizeof(*stats));
+
+    if (stats == NULL) return NULL;
+    stats->len_hist = qes_calloc_errnil(QES_SEQSTATS_LEN_HIST_LEN,
+                                        sizeof(*stats->len_hist));
+    if (stats->len_hist == NULL) {
+        qes_free(stats);
+        return NULL;
+    }
+    stats->min_len = UINT64_MAX;
+    return stats;
+}
+
+/* Make the quality histogram at least ``n_positions`` long */
+static int
+seqstats_grow_hist (struct qes_seqstats *stats, size_t n_positions)
+{
+    uint64_t *hist = NULL;
+    size_t newsize = stats->n_positions > 0 ? stats->n_positions : 64;
+
+    while (newsize < n_positions) newsize <<= 1;
+    hist = qes_realloc_errnil(stats->qual_hist,
+                              newsize * QES_SEQSTATS_N_QUALS * sizeof(*hist));
+    if (hist == NULL) return 1;
+    memset(hist + stats->n_positions * QES_SEQSTATS_N_QUALS, 0,
+           (newsize - stats->n_positions) * QES_SEQSTATS_N_QUALS *
+           sizeof(*hist));
+    stats->qual_hist = hist;
+    stats->n_positions = newsize;
+    return 0;
+}
+
+static int
+seqstats_add_len (struct qes_seqstats *stats, uint64_t len)
+{
+    uint64_t *lens = NULL;
+    size_t cap = 0;
+
+    stats->n_records++;
+    stats->n_bases += len;
+    if (len < stats->min_len) stats->min_len = len;
+    if (len > stats->max_len) stats->max_len = len;
+    if (len < QES_SEQSTATS_LEN_HIST_LEN) {
+        stats->len_hist[len]++;
+        return 0;
+    }
+    if (stats->n_long_lens == stats->long_lens_cap) {
+        cap = stats->long_lens_cap > 0 ? stats->long_lens_cap << 1 : 64;
+        lens = qes_realloc_errnil(stats->long_lens, cap * sizeof(*lens));
+        if (lens == NULL) return 1;
+        stats->long_lens = lens;
+        stats->long_lens_cap = cap;
+    }
+    stats->long_lens[stats->n_long_lens++] = len;
+    return 0;
+}
+
+/* Histogram the qualities of positions ``pos`` onwards */
+static int
+seqstats_hist_qual (struct seqstats_scan *sc, const char *qual, size_t len,
+                    uint64_t pos)
+{
+    uint64_t *row = NULL;
+    size_t iii = 0;
+    int score = 0;
+
+    if (pos >= sc->max_positions) return 0;
+    if (len > sc->max_positions - pos) len = sc->max_positions - pos;
+    if (pos + len > sc->stats->n_positions &&
+            seqstats_grow_hist(sc->stats, pos + len) != 0) {
+        return 1;
+    }
+    row = sc->stats->qual_hist + pos * QES_SEQSTATS_N_QUALS;
+    for (iii = 0; iii < len; iii++, row += QES_SEQSTATS_N_QUALS) {
+        score = (unsigned char)qual[iii] - QES_SEQSTATS_QUAL_OFFSET;
+        if (score < 0) score = 0;
+        if (score >= QES_SEQSTATS_N_QUALS) score = QES_SEQSTATS_N_QUALS - 1;
+        row[score]++;
+    }
+    return 0;
+}
+
+/* Scan the ``len`` bytes at ``buf``, a line at a time. Returns the number of
+ * bytes consumed, which is less than ``len`` only if we stopped at the
+ * limit, or on error. */
+static size_t
+seqstats_scan_fastq (struct seqstats_scan *sc, const char *buf, size_t len)
+{
+    struct qes_seqstats *stats = sc->stats;
+    const char *iter = buf;
+    const char *end = buf + len;
+    const char *nl = NULL;
+    size_t seglen = 0;
+
+    while (iter < end) {
+        if (sc->at_line_start) {
+            if (sc->state == ST_HEADER) {
+                if (sc->limit >= 0 &&
+                        sc->offset + (iter - buf) >= sc->limit) {
+                    sc->done = 1;
+                    break;
+                }
+                if (*iter != FASTQ_DELIM) goto error;
+            } else if (sc->state == ST_PLUS && *iter != FASTQ_QUAL_DELIM) {
+                goto error;
+            }
+            sc->at_line_start = 0;
+        }
+        /* glibc's memchr is vectorised, which is most of the work */
+        nl = memchr(iter, '\n', end - iter);
+        seglen = (nl != NULL ? nl : end) - iter;
+        if (sc->state == ST_SEQ) {
+            stats->n_gc += seqstats_count_gc(iter, seglen);
+            sc->seqlen += seglen;
+        } else if (sc->state == ST_QUAL) {
+            seqstats_count_qual(iter, seglen, &stats->n_q20, &stats->n_q30);
+            if (sc->max_positions > 0 &&
+                    seqstats_hist_qual(sc, iter, seglen, sc->quallen) != 0) {
+                goto error;
+            }
+            sc->quallen += seglen;
+        }
+        iter += seglen;
+        if (nl == NULL) break;
+        iter++;
+        sc->at_line_start = 1;
+        if (sc->state == ST_QUAL) {
+            if (sc->quallen != sc->seqlen ||
+                    seqstats_add_len(stats, sc->seqlen) != 0) {
+                goto error;
+            }
+            sc->seqlen = sc->quallen = 0;
+            sc->state = ST_HEADER;
+        } else {
+            sc->state++;
+        }
+    }
+    sc->offset += iter - buf;
+    return iter - buf;
+error:
+    sc->error = 1;
+    return iter - buf;
+}
+
+static size_t
+seqstats_scan_fasta (struct seqstats_scan *sc, const char *buf, size_t len)
+{
+    struct qes_seqstats *stats = sc->stats;
+    const char *iter = buf;
+    const char *end = buf + len;
+    const char *nl = NULL;
+    size_t seglen = 0;
+
+    while (iter < end) {
+        if (sc->at_line_start) {
+            if (*iter == FASTA_DELIM) {
+                if (sc->in_record &&
+                        seqstats_add_len(stats, sc->seqlen) != 0) {
+                    goto error;
+                }
+                sc->in_record = 0;
+                if (sc->limit >= 0 &&
+                        sc->offset + (iter - buf) >= sc->limit) {
+                    sc->done = 1;
+                    break;
+                }
+                sc->in_record = 1;
+                sc->seqlen = 0;
+                sc->state = ST_HEADER;
+            } else if (!sc->in_record) {
+                goto error;
+            } else {
+                sc->state = ST_SEQ;
+            }
+            sc->at_line_start = 0;
+        }
+        nl = memchr(iter, '\n', end - iter);
+        seglen = (nl != NULL ? nl : end) - iter;
+        if (sc->state == ST_SEQ) {
+            stats->n_gc += seqstats_count_gc(iter, seglen);
+            sc->seqlen += seglen;
+        }
+        iter += seglen;
+        if (nl == NULL) break;
+        iter++;
+        sc->at_line_start = 1;
+    }
+    sc->offset += iter - buf;
+    return iter - buf;
+error:
+    sc->error = 1;
+    return iter - buf;
+}
+
+/* Finish the record at the end of the scan. Returns 0, or 1 on error. */
+static int
+seqstats_scan_finish (struct seqstats_scan *sc)
+{
+    if (sc->stats->format == FASTA_FMT) {
+        if (sc->in_record && !sc->done) {
+            return seqstats_add_len(sc->stats, sc->seqlen);
+        }
+        return 0;
+    }
+    if (sc->state == ST_QUAL && !sc->at_line_start && sc->quallen > 0) {
+        /* No newline at the end of the file */
+        if (sc->quallen != sc->seqlen) return 1;
+        return seqstats_add_len(sc->stats, sc->seqlen);
+    }
+    return sc->state != ST_HEADER || !sc->at_line_start;
+}
+
+/* Skip to the start of the next line. Returns 0, or 1 at EOF. */
+static int
+seqstats_next_line (struct qes_file *file)
+{
+    char *nl = NULL;
+
+    while (1) {
+        if (file->bufiter >= file->bufend &&
+                __qes_file_fill_buffer(file) != 1) {
+            return 1;
+        }
+        nl = memchr(file->bufiter, '\n', file->bufend - file->bufiter);
+        if (nl != NULL) {
+            file->filepos += nl + 1 - file->bufiter;
+            file->bufiter = nl + 1;
+            return 0;
+        }
+        file->filepos += file->bufend - file->bufiter;
+        file->bufiter = file->bufend;
+    }
+}
+
+/* Move ``file`` to the first record starting at or after ``offset``.
+ * Returns 0, or 1 if there's none. */
+static int
+seqstats_sync (struct qes_file *file, enum qes_seqfile_format format,
+               off_t offset)
+{
+    off_t starts[3];
+    int chars[3];
+    size_t n_lines = 0;
+
+    /* From the byte before, so we don't skip a line starting at offset */
+    if (qes_file_seek(file, offset - 1) != 0 || seqstats_next_line(file)) {
+        return 1;
+    }
+    for (n_lines = 0; ; n_lines++) {
+        starts[n_lines % 3] = file->filepos;
+        chars[n_lines % 3] = qes_file_peek(file);
+        if (chars[n_lines % 3] < 0) return 1;
+        if (format == FASTA_FMT && chars[n_lines % 3] == FASTA_DELIM) {
+            break;
+        }
+        /* A quality line may start with '@', but then the line after next
+         * is sequence, not the '+' line */
+        if (format == FASTQ_FMT && n_lines >= 2 &&
+                chars[(n_lines - 2) % 3] == FASTQ_DELIM &&
+                chars[n_lines % 3] == FASTQ_QUAL_DELIM) {
+            n_lines -= 2;
+            break;
+        }
+        if (seqstats_next_line(file)) return 1;
+    }
+    return qes_file_seek(file, starts[n_lines % 3]);
+}
+
+/* Scan ``file`` from where it is, into ``stats``, up to ``limit`` */
+static int
+seqstats_scan_file (struct qes_file *file, struct qes_seqstats *stats,
+                    const struct qes_seqstats_opts *opts, off_t limit)
+{
+    struct seqstats_scan sc;
+    size_t used = 0;
+    int res = 0;
+
+    memset(&sc, 0, sizeof(sc));
+    sc.stats = stats;
+    sc.max_positions = opts->max_positions;
+    sc.state = ST_HEADER;
+    sc.at_line_start = 1;
+    sc.offset = file->filepos;
+    sc.limit = limit;
+    while (!sc.done) {
+        if (file->bufiter >= file->bufend) {
+            res = __qes_file_fill_buffer(file);
+            if (res == 0) return 1;
+            if (res == EOF) break;
+        }
+        if (stats->format == FASTQ_FMT) {
+            used = seqstats_scan_fastq(&sc, file->bufiter,
+                                       file->bufend - file->bufiter);
+        } else {
+            used = seqstats_scan_fasta(&sc, file->bufiter,
+                                       file->bufend - file->bufiter);
+        }
+        file->bufiter += used;
+        file->filepos += used;
+        if (sc.error) return 1;
+    }
+    return seqstats_scan_finish(&sc);
+}
+
+/* Add the counts of ``src`` to ``dest`` */
+static int
+seqstats_merge (struct qes_seqstats *dest, const struct qes_seqstats *src)
+{
+    size_t iii = 0;
+
+    dest->n_records += src->n_records;
+    dest->n_bases += src->n_bases;
+    dest->n_gc += src->n_gc;
+    dest->n_q20 += src->n_q20;
+    dest->n_q30 += src->n_q30;
+    if (src->min_len < dest->min_len) dest->min_len = src->min_len;
+    if (src->max_len > dest->max_len) dest->max_len = src->max_len;
+    for (iii = 0; iii < QES_SEQSTATS_LEN_HIST_LEN; iii++) {
+        dest->len_hist[iii] += src->len_hist[iii];
+    }
+    for (iii = 0; iii < src->n_long_lens; iii++) {
+        /* These counted once already */
+        dest->n_records--;
+        dest->n_bases -= src->long_lens[iii];
+        if (seqstats_add_len(dest, src->long_lens[iii]) != 0) return 1;
+    }
+    if (src->n_positions > dest->n_positions &&
+            seqstats_grow_hist(dest, src->n_positions) != 0) {
+        return 1;
+    }
+    for (iii = 0; iii < src->n_positions * QES_SEQSTATS_N_QUALS; iii++) {
+        dest->qual_hist[iii] += src->qual_hist[iii];
+    }
+    return 0;
+}
+
+static int
+seqstats_cmp_desc (const void *a, const void *b)
+{
+    uint64_t lena = *(const uint64_t *)a;
+    uint64_t lenb = *(const uint64_t *)b;
+
+    return (lena < lenb) - (lena > lenb);
+}
+
+/* Work out the N50 once all reads are counted */
+static void
+seqstats_n50 (struct qes_seqstats *stats)
+{
+    uint64_t sum = 0;
+    size_t iii = 0;
+
+    if (stats->n_records == 0) {
+        stats->min_len = 0;
+        return;
+    }
+    if (stats->n_long_lens > 0) {
+        qsort(stats->long_lens, stats->n_long_lens,
+              sizeof(*stats->long_lens), seqstats_cmp_desc);
+    }
+    for (iii = 0; iii < stats->n_long_lens; iii++) {
+        sum += stats->long_lens[iii];
+        if (sum * 2 >= stats->n_bases) {
+            stats->n50 = stats->long_lens[iii];
+            return;
+        }
+    }
+    for (iii = QES_SEQSTATS_LEN_HIST_LEN; iii-- > 0; ) {
+        sum += stats->len_hist[iii] * iii;
+        if (stats->len_hist[iii] > 0 && sum * 2 >= stats->n_bases) {
+            stats->n50 = iii;
+            return;
+        }
+    }
+}
+
+/* Scan the chunks of a raw file in parallel */
+static int
+seqstats_scan_parallel (const char *path, struct qes_seqstats *stats,
+                        const struct qes_seqstats_opts *opts, off_t size,
+                        size_t n_chunks)
+{
+    struct qes_seqstats **chunks = NULL;
+    off_t chunk_len = size / n_chunks;
+    size_t iii = 0;
+    int ret = 0;
+
+    chunks = qes_calloc_errnil(n_chunks, sizeof(*chunks));
+    if (chunks == NULL) return 1;
+    SEQSTATS_OMP(parallel for num_threads(opts->n_threads) \
+                   schedule(dynamic, 1) reduction(|:ret))
+    for (iii = 0; iii < n_chunks; iii++) {
+        struct qes_file *file = NULL;
+        off_t start = iii * chunk_len;
+        off_t end = iii + 1 < n_chunks ? start + chunk_len : -1;
+
+        chunks[iii] = seqstats_create();
+        file = qes_file_open_opts_errnil(path, "r", opts->file_opts);
+        if (chunks[iii] == NULL || file == NULL) {
+            ret |= 1;
+        } else {
+            chunks[iii]->format = stats->format;
+            if (start == 0 || seqstats_sync(file, stats->format, start) == 0) {
+                ret |= seqstats_scan_file(file, chunks[iii], opts, end);
+            }
+        }
+        qes_file_close(file);
+    }
+    for (iii = 0; iii < n_chunks; iii++) {
+        if (ret == 0 && seqstats_merge(stats, chunks[iii]) != 0) ret = 1;
+        qes_seqstats_destroy(chunks[iii]);
+    }
+    qes_free(chunks);
+    return ret;
+}
+
+struct qes_seqstats *
+qes_seqfile_stats (const char *path, const struct qes_seqstats_opts *opts)
+{
+    struct qes_seqstats_opts defaults;
+    struct qes_seqstats *stats = NULL;
+    struct qes_file *file = NULL;
+    size_t n_chunks = 1;
+    int first = 0;
+    int ret = 0;
+
+    if (path == NULL) return NULL;
+    if (opts == NULL) {
+        memset(&defaults, 0, sizeof(defaults));
+        opts = &defaults;
+    }
+    file = qes_file_open_opts_errnil(path, "r", opts->file_opts);
+    stats = seqstats_create();
+    if (file == NULL || stats == NULL) goto error;
+    first = qes_file_peek(file);
+    if (first == FASTQ_DELIM) {
+        stats->format = FASTQ_FMT;
+    } else if (first == FASTA_DELIM) {
+        stats->format = FASTA_FMT;
+    } else if (file->eof) {
+        stats->format = UNKNOWN_FMT;
+        qes_file_close(file);
+        seqstats_n50(stats);
+        return stats;
+    } else {
+        goto error;
+    }
+    /* Only uncompressed files can be split into chunks at arbitrary offsets.
+     * The chunks must be big enough to be worth a thread. */
+    if (opts->n_threads > 1 && file->raw && file->fd_start == 0 &&
+            S_ISREG(file->fdmode)) {
+        n_chunks = lseek(file->fd, 0, SEEK_END) / SEQSTATS_MIN_CHUNK;
+        if (n_chunks > opts->n_threads) n_chunks = opts->n_threads;
+        if (n_chunks < 1) n_chunks = 1;
+    }
+    if (n_chunks > 1) {
+        ret = seqstats_scan_parallel(path, stats, opts,
+                                     lseek(file->fd, 0, SEEK_END), n_chunks);
+    } else {
+        ret = seqstats_scan_file(file, stats, opts, -1);
+    }
+    if (ret != 0) goto error;
+    qes_file_close(file);
+    seqstats_n50(stats);
+    return stats;
+error:
+    qes_file_close(file);
+    qes_seqstats_destroy(stats);
+    return NULL;
+}
+
+void
+qes_seqstats_destroy_ (struct qes_seqstats *stats)
+{
+    if (stats != NULL) {
+        qes_free(stats->qual_hist);
+        qes_free(stats->len_hist);
+        qes_free(stats->long_lens);
+        qes_free(stats);
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_seqstats.h
+ *
+ *    Description:  Summary statistics of sequence files, from a fast scan
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 20:52:36
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_SEQSTATS_H
+#define QES_SEQSTATS_H
+
+#include <qes_util.h>
+#include <qes_file.h>
+#include <qes_seqfile.h>
+
+/* Quality scores are Phred+33, and clamped to 0 to QES_SEQSTATS_N_QUALS - 1 */
+#define QES_SEQSTATS_QUAL_OFFSET 33
+#define QES_SEQSTATS_N_QUALS 94
+/* Reads shorter than this are counted in a histogram, for N50 */
+#define QES_SEQSTATS_LEN_HIST_LEN (1<<16)
+
+/* Options for qes_seqfile_stats. A zeroed struct scans serially, without a
+ * per-position quality histogram. */
+struct qes_seqstats_opts {
+    /* Options for reading the file, or NULL for the defaults */
+    const struct qes_file_opts *file_opts;
+    /* Number of threads. Uncompressed files are split into this many
+     * chunks, which are scanned in parallel if libqes was built with OpenMP.
+     * Compressed files are always scanned serially. */
+    unsigned n_threads;
+    /* Histogram the quality scores of this many positions of each read. */
+    size_t max_positions;
+};
+
+struct qes_seqstats {
+    enum qes_seqfile_format format;
+    uint64_t n_records;
+    /* Total, shortest, longest and N50 length */
+    uint64_t n_bases;
+    uint64_t min_len;
+    uint64_t max_len;
+    uint64_t n50;
+    /* Bases that are G or C */
+    uint64_t n_gc;
+    /* Bases with quality of at least 20 and 30 */
+    uint64_t n_q20;
+    uint64_t n_q30;
+    /* Number of bases of quality ``q`` at position ``p`` of reads is
+     * ``qual_hist[p * QES_SEQSTATS_N_QUALS + q]``, for p < ``n_positions`` */
+    uint64_t *qual_hist;
+    size_t n_positions;
+    /* Read lengths, for N50: a histogram of those shorter than
+     * QES_SEQSTATS_LEN_HIST_LEN, and a list of the rest */
+    uint64_t *len_hist;
+    uint64_t *long_lens;
+    size_t n_long_lens;
+    size_t long_lens_cap;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqfile_stats
+Paramters:      const char *path: FASTA or FASTQ file to scan.
+                const struct qes_seqstats_opts *opts: Options, or NULL for
+                    the defaults.
+Description:    Count the records and bases of ``path``, and summarise their
+                lengths, GC content and qualities. Rather than parsing each
+                record into a struct qes_seq, this scans the file's buffer in
+                place, so it's limited by IO rather than copying. As with
+                qes_seqfile_read, FASTQ records must have one line each of
+                sequence and quality.
+Returns:        struct qes_seqstats *: The statistics, or NULL if ``path``
+                couldn't be read or isn't FASTA or FASTQ. An empty file has
+                no records, and format UNKNOWN_FMT.
+ *===========================================================================*/
+struct qes_seqstats *qes_seqfile_stats (const char *path,
+                                        const struct qes_seqstats_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_seqstats_destroy
+Paramters:      struct qes_seqstats *: stats to destroy.
+Description:    Deallocate and set to NULL a struct qes_seqstats on the heap.
+Returns:        void.
+ *===========================================================================*/
+void qes_seqstats_destroy_ (struct qes_seqstats *stats);
+#define qes_seqstats_destroy(stats) do {                                    \
+            qes_seqstats_destroy_(stats);                                   \
+            stats = NULL;                                                   \
+        } while(0)
+
+#endif /* QES_SEQSTATS_H */
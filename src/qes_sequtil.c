@@ -220,42 +220,55 @@ qes_sequtil_translate_codon (const char *codon)
 }
 
 
+const char qes_sequtil_comp_table[257] =
+    "NNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNN"
+    "NNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNN"
+    "NTNGNNNCNNNNNNNNNNNNANNNNNNNNNNN"
+    "NTNGNNNCNNNNNNNNNNNNANNNNNNNNNNN"
+    "NNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNN"
+    "NNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNN"
+    "NNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNN"
+    "NNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNN";
+
 inline char *
 qes_sequtil_revcomp (const char *seq, size_t len)
 {
-    size_t seqlen = strlen(seq);
-    char *outseq = strdup(seq);
-    seqlen = seqlen < len ? seqlen : len - 1;
+    size_t seqlen = 0;
+    char *outseq = NULL;
 
-    if (outseq[seqlen - 1] == '\n') {
-        outseq[seqlen - 1] = '\0';
-        seqlen--;
+    if (seq == NULL) return NULL;
+    seqlen = strlen(seq);
+    if (len > 0 && len < seqlen) {
+        seqlen = len;
     }
-
-    qes_sequtil_revcomp_inplace(outseq, len);
+    outseq = strndup(seq, seqlen);
+    if (outseq == NULL) return NULL;
+    qes_sequtil_revcomp_inplace(outseq, seqlen);
     return outseq;
 }
 
 inline void
 qes_sequtil_revcomp_inplace (char *seq, size_t len)
 {
-    size_t iii;
+    size_t iii = 0;
+    size_t jjj = 0;
+    char tmp = 0;
+
+    if (seq == NULL) return;
+    len = strnlen(seq, len);
     /* Trim trailing whitespace */
     while (len > 0 && isspace(seq[len - 1])) {
         seq[--len] = '\0';
     }
-    for (iii = 0; iii < len && seq[iii] != '\0'; iii++) {
-        size_t endpos = len - iii - 1;
-        char endchar = seq[endpos];
-        if (seq[iii] == 'a' || seq[iii] == 'A') seq[endpos] = 'T';
-        else if (seq[iii] == 'c' || seq[iii] == 'C') seq[endpos] = 'G';
-        else if (seq[iii] == 'g' || seq[iii] == 'G') seq[endpos] = 'C';
-        else if (seq[iii] == 't' || seq[iii] == 'T') seq[endpos] = 'A';
-        else seq[endpos] = 'N';
-        if (endchar == 'a' || endchar == 'A') seq[iii] = 'T';
-        else if (endchar == 'c' || endchar == 'C') seq[iii] = 'G';
-        else if (endchar == 'g' || endchar == 'G') seq[iii] = 'C';
-        else if (endchar == 't' || endchar == 'T') seq[iii] = 'A';
-        else seq[iii] = 'N';
+    if (len == 0) return;
+    /* Swap and complement from both ends, with table lookups rather than
+     * branches */
+    for (iii = 0, jjj = len - 1; iii < jjj; iii++, jjj--) {
+        tmp = qes_sequtil_comp_table[(unsigned char)seq[iii]];
+        seq[iii] = qes_sequtil_comp_table[(unsigned char)seq[jjj]];
+        seq[jjj] = tmp;
+    }
+    if (iii == jjj) {
+        seq[iii] = qes_sequtil_comp_table[(unsigned char)seq[iii]];
     }
 }
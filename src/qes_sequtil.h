@@ -21,7 +21,31 @@
 #include <qes_util.h>
 
 extern char qes_sequtil_translate_codon(const char *codon);
+
+/* Complement of each char, in upper case, with anything that isn't a base
+ * becoming 'N' */
+extern const char qes_sequtil_comp_table[257];
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sequtil_revcomp
+Paramters:      const char *seq: Sequence to reverse complement.
+                size_t len: Use the first ``len`` chars of ``seq``, or all of
+                    it if 0.
+Description:    Reverse complement a copy of ``seq``. Trailing whitespace is
+                removed. Bases are complemented to upper case, and anything
+                that isn't A, C, G or T becomes N.
+Returns:        char *: The reverse complement, to be freed by the caller, or
+                NULL on error.
+ *===========================================================================*/
 extern char *qes_sequtil_revcomp(const char *seq, size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sequtil_revcomp_inplace
+Paramters:      char *seq: Sequence to reverse complement.
+                size_t len: Length of ``seq``.
+Description:    As per qes_sequtil_revcomp, but ``seq`` is modified in place.
+Returns:        void
+ *===========================================================================*/
 extern void qes_sequtil_revcomp_inplace(char *seq, size_t len);
 
 #endif /* QES_SEQUTIL_H */
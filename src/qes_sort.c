@@ -0,0 +1,964 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_sort.c
+ *
+ *    Description:  External merge sort of sequence records
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 00:14:27
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_sort.h"
+#include "qes_arena.h"
+#include "qes_hash.h"
+
+#include <zlib.h>
+
+#ifdef OPENMP_FOUND
+#define SORT_OMP(x) _Pragma(STRINGIFY(omp x))
+#else
+#define SORT_OMP(x)
+#endif
+
+/* Buckets this small are insertion sorted */
+#define SORT_INSERTION_LEN 32
+/* Size of the buffers of temporary files */
+#define SORT_IOBUF_LEN (256<<10)
+#define SORT_MINIMIZER_SEED 0x9e3779b97f4a7c15ULL
+
+/* A record in memory. The record is stored formatted, as it's spilled. */
+struct sort_ent {
+    /* Records are ordered by ``prefix``, then ``key`` */
+    uint64_t prefix;
+    const char *key;
+    const char *rec;
+    uint32_t key_len;
+    uint32_t name_len;
+    uint32_t comment_len;
+    uint32_t seq_len;
+};
+
+struct qes_sort_slot {
+    struct qes_arena *arena;
+    struct sort_ent *ents;
+    size_t n_ents;
+    size_t capacity;
+    /* Bytes used of this slot's share of the budget */
+    size_t bytes;
+    /* Path spilled to, and the errno if that failed */
+    char *run;
+    int error;
+};
+
+/* A temporary file being written */
+struct sort_writer {
+    int fd;
+    int compress;
+    z_stream strm;
+    unsigned char *inbuf;
+    size_t len;
+    unsigned char *outbuf;
+};
+
+/* The head of a run being merged */
+struct sort_head {
+    struct qes_seqfile *sf;
+    struct qes_seq *seq;
+    uint64_t prefix;
+    const char *key;
+    size_t key_len;
+    int done;
+};
+
+/* 2-bit codes of bases, plus one. 0 is not a base. */
+static const uint8_t sort_nt_codes[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+    ['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4,
+};
+
+
+struct qes_sorter *
+qes_sorter_create (const struct qes_sort_opts *opts)
+{
+    struct qes_sorter *sorter = qes_calloc(1, sizeof(*sorter));
+    unsigned iii = 0;
+
+    if (sorter == NULL) return NULL;
+    if (opts != NULL) sorter->opts = *opts;
+    if (sorter->opts.format == UNKNOWN_FMT) sorter->opts.format = FASTQ_FMT;
+    if (sorter->opts.mem_budget == 0) {
+        sorter->opts.mem_budget = QES_SORT_MEM_BUDGET;
+    }
+    if (sorter->opts.tmp_dir == NULL) sorter->opts.tmp_dir = getenv("TMPDIR");
+    if (sorter->opts.tmp_dir == NULL) sorter->opts.tmp_dir = "/tmp";
+    if (sorter->opts.level == 0) sorter->opts.level = QES_SORT_LEVEL;
+    if (sorter->opts.minimizer_k == 0) {
+        sorter->opts.minimizer_k = QES_SORT_MINIMIZER_K;
+    }
+    if (sorter->opts.max_fanin == 0) {
+        sorter->opts.max_fanin = QES_SORT_MAX_FANIN;
+    }
+    if (sorter->opts.n_threads == 0) sorter->opts.n_threads = 1;
+    if (sorter->opts.minimizer_k > 32 || sorter->opts.max_fanin < 2 ||
+            sorter->opts.level > 9) {
+        goto error;
+    }
+    sorter->slots = qes_calloc(sorter->opts.n_threads,
+                               sizeof(*sorter->slots));
+    sorter->scratch = qes_seq_create();
+    if (sorter->slots == NULL || sorter->scratch == NULL) goto error;
+    for (iii = 0; iii < sorter->opts.n_threads; iii++) {
+        sorter->slots[iii].arena = qes_arena_create(0);
+        if (sorter->slots[iii].arena == NULL) goto error;
+    }
+    return sorter;
+error:
+    qes_sorter_destroy(sorter);
+    return NULL;
+}
+
+/* The smallest hash of the canonical k-mers of ``seq``, or UINT64_MAX if it
+ * has none */
+static inline uint64_t
+sort_minimizer (const char *seq, size_t len, unsigned k)
+{
+    uint64_t mask = k < 32 ? (1ULL << (2 * k)) - 1 : UINT64_MAX;
+    uint64_t fwd = 0;
+    uint64_t rev = 0;
+    uint64_t hash = 0;
+    uint64_t min = UINT64_MAX;
+    unsigned shift = 2 * (k - 1);
+    size_t n_valid = 0;
+    size_t iii = 0;
+    uint64_t code = 0;
+
+    for (iii = 0; iii < len; iii++) {
+        code = sort_nt_codes[(unsigned char)seq[iii]];
+        if (code == 0) {
+            n_valid = 0;
+            continue;
+        }
+        code--;
+        fwd = ((fwd << 2) | code) & mask;
+        rev = (rev >> 2) | ((3 - code) << shift);
+        if (++n_valid >= k) {
+            hash = qes_hash_fmix64((fwd < rev ? fwd : rev) ^
+                                   SORT_MINIMIZER_SEED);
+            if (hash < min) min = hash;
+        }
+    }
+    return min;
+}
+
+static inline void
+sort_key (const struct qes_sorter *sorter, const char *name, size_t name_len,
+          const char *seq, size_t seq_len, uint64_t *prefix,
+          const char **key, size_t *key_len)
+{
+    *prefix = 0;
+    if (sorter->opts.key == QES_SORT_NAME) {
+        *key = name;
+        *key_len = name_len;
+        return;
+    }
+    if (sorter->opts.key == QES_SORT_MINIMIZER) {
+        *prefix = sort_minimizer(seq, seq_len, sorter->opts.minimizer_k);
+    }
+    *key = seq;
+    *key_len = seq_len;
+}
+
+static inline int
+sort_key_cmp (uint64_t prefix1, const char *key1, size_t len1,
+              uint64_t prefix2, const char *key2, size_t len2)
+{
+    int res = 0;
+
+    if (prefix1 != prefix2) return prefix1 < prefix2 ? -1 : 1;
+    res = memcmp(key1, key2, len1 < len2 ? len1 : len2);
+    if (res != 0) return res;
+    return (len1 > len2) - (len1 < len2);
+}
+
+/*
+ * Sorting a run in memory
+ */
+
+static inline int
+sort_ent_cmp (const struct sort_ent *ent1, const struct sort_ent *ent2)
+{
+    return sort_key_cmp(ent1->prefix, ent1->key, ent1->key_len,
+                        ent2->prefix, ent2->key, ent2->key_len);
+}
+
+/* Byte ``depth`` of the sort key, plus one, or 0 past its end. The first 8
+ * bytes are those of ``prefix``, most significant first. */
+static inline unsigned
+sort_ent_byte (const struct sort_ent *ent, size_t depth)
+{
+    if (depth < 8) return ((ent->prefix >> (56 - 8 * depth)) & 0xff) + 1;
+    depth -= 8;
+    if (depth >= ent->key_len) return 0;
+    return (unsigned char)ent->key[depth] + 1;
+}
+
+static void
+sort_insertion (struct sort_ent *ents, size_t n)
+{
+    struct sort_ent ent;
+    size_t iii = 0;
+    size_t jjj = 0;
+
+    for (iii = 1; iii < n; iii++) {
+        ent = ents[iii];
+        for (jjj = iii; jjj > 0 && sort_ent_cmp(&ents[jjj - 1], &ent) > 0;
+                jjj--) {
+            ents[jjj] = ents[jjj - 1];
+        }
+        ents[jjj] = ent;
+    }
+}
+
+/* Stable MSD radix sort of ``n`` entries sharing their first ``depth`` key
+ * bytes. ``tmp`` has room for ``n`` entries. */
+static void
+sort_radix (struct sort_ent *ents, struct sort_ent *tmp, size_t n,
+            size_t depth)
+{
+    size_t counts[257];
+    size_t start = 0;
+    size_t count = 0;
+    size_t iii = 0;
+    unsigned byte = 0;
+
+    while (n > SORT_INSERTION_LEN) {
+        memset(counts, 0, sizeof(counts));
+        for (iii = 0; iii < n; iii++) {
+            counts[sort_ent_byte(&ents[iii], depth)]++;
+        }
+        /* Bytes all keys share are skipped without recursing, so long common
+         * prefixes (e.g. of read names) don't eat the stack */
+        byte = sort_ent_byte(&ents[0], depth);
+        if (counts[byte] == n) {
+            /* All keys ended, so are equal */
+            if (byte == 0) return;
+            depth++;
+            continue;
+        }
+        start = 0;
+        for (byte = 0; byte < 257; byte++) {
+            count = counts[byte];
+            counts[byte] = start;
+            start += count;
+        }
+        for (iii = 0; iii < n; iii++) {
+            tmp[counts[sort_ent_byte(&ents[iii], depth)]++] = ents[iii];
+        }
+        memcpy(ents, tmp, n * sizeof(*ents));
+        /* counts[byte] is now the end of each bucket. Keys which ended are
+         * equal, so bucket 0 is sorted. */
+        start = counts[0];
+        for (byte = 1; byte < 257; byte++) {
+            if (counts[byte] - start > 1) {
+                sort_radix(ents + start, tmp, counts[byte] - start,
+                           depth + 1);
+            }
+            start = counts[byte];
+        }
+        return;
+    }
+    sort_insertion(ents, n);
+}
+
+/*
+ * Temporary files
+ */
+
+/* Write all of ``len`` bytes of ``buf`` to ``fd``. Returns 0, or 1 on error,
+ * with errno set. */
+static int
+sort_write_all (int fd, const unsigned char *buf, size_t len)
+{
+    ssize_t res = 0;
+
+    while (len > 0) {
+        res = write(fd, buf, len);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) {
+            if (res == 0) errno = EIO;
+            return 1;
+        }
+        buf += res;
+        len -= res;
+    }
+    return 0;
+}
+
+/* Create a temporary file in ``tmp_dir``, and set ``*path`` to its path.
+ * Returns 0, or 1 on error, with errno set. */
+static int
+sort_writer_open (struct sort_writer *writer, const struct qes_sorter *sorter,
+                  char **path)
+{
+    size_t len = strlen(sorter->opts.tmp_dir) + 24;
+
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+    writer->compress = sorter->opts.level > 0;
+    *path = qes_malloc_errnil(len);
+    writer->inbuf = qes_malloc_errnil(SORT_IOBUF_LEN);
+    if (writer->compress) writer->outbuf = qes_malloc_errnil(SORT_IOBUF_LEN);
+    if (*path == NULL || writer->inbuf == NULL ||
+            (writer->compress && writer->outbuf == NULL)) {
+        errno = ENOMEM;
+        goto error;
+    }
+    snprintf(*path, len, "%s/qes_sort.XXXXXX", sorter->opts.tmp_dir);
+    if (writer->compress &&
+            deflateInit2(&writer->strm, sorter->opts.level, Z_DEFLATED,
+                         15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        errno = ENOMEM;
+        writer->compress = 0;
+        goto error;
+    }
+    writer->fd = mkstemp(*path);
+    if (writer->fd < 0) {
+        if (writer->compress) deflateEnd(&writer->strm);
+        goto error;
+    }
+    return 0;
+error:
+    qes_free(*path);
+    qes_free(writer->inbuf);
+    qes_free(writer->outbuf);
+    return 1;
+}
+
+/* Compress (or not) and write ``len`` bytes of ``data`` */
+static int
+sort_writer_emit (struct sort_writer *writer, const unsigned char *data,
+                  size_t len, int flush)
+{
+    int res = Z_OK;
+
+    if (!writer->compress) return sort_write_all(writer->fd, data, len);
+    writer->strm.next_in = (unsigned char *)data;
+    writer->strm.avail_in = len;
+    do {
+        writer->strm.next_out = writer->outbuf;
+        writer->strm.avail_out = SORT_IOBUF_LEN;
+        res = deflate(&writer->strm, flush);
+        if (res == Z_STREAM_ERROR) {
+            errno = EINVAL;
+            return 1;
+        }
+        if (sort_write_all(writer->fd, writer->outbuf,
+                           SORT_IOBUF_LEN - writer->strm.avail_out) != 0) {
+            return 1;
+        }
+    } while (writer->strm.avail_out == 0 ||
+             (flush == Z_FINISH && res != Z_STREAM_END));
+    return 0;
+}
+
+static inline int
+sort_writer_put (struct sort_writer *writer, const char *data, size_t len)
+{
+    if (writer->len + len > SORT_IOBUF_LEN) {
+        if (sort_writer_emit(writer, writer->inbuf, writer->len,
+                             Z_NO_FLUSH) != 0) {
+            return 1;
+        }
+        writer->len = 0;
+    }
+    if (len > SORT_IOBUF_LEN) {
+        return sort_writer_emit(writer, (const unsigned char *)data, len,
+                                Z_NO_FLUSH);
+    }
+    memcpy(writer->inbuf + writer->len, data, len);
+    writer->len += len;
+    return 0;
+}
+
+/* Finish and close the file. Returns 0, or 1 on error, with errno set. */
+static int
+sort_writer_close (struct sort_writer *writer)
+{
+    int ret = 0;
+
+    ret = sort_writer_emit(writer, writer->inbuf, writer->len, Z_FINISH);
+    if (writer->compress) deflateEnd(&writer->strm);
+    if (close(writer->fd) != 0) ret = 1;
+    qes_free(writer->inbuf);
+    qes_free(writer->outbuf);
+    return ret;
+}
+
+/* Format a record as per qes_seqfile_write into ``out``, if not NULL. Only
+ * FASTQ records have ``qual``. Returns its length. */
+static inline size_t
+sort_format (char *out, const char *name, size_t name_len,
+             const char *comment, size_t comment_len, const char *seq,
+             size_t seq_len, const char *qual)
+{
+    size_t len = 1 + name_len + 1 + seq_len + 1;
+    char *iter = out;
+
+    if (comment_len > 0) len += 1 + comment_len;
+    if (qual != NULL) len += 2 + seq_len + 1;
+    if (out == NULL) return len;
+    *iter++ = qual != NULL ? FASTQ_DELIM : FASTA_DELIM;
+    memcpy(iter, name, name_len);
+    iter += name_len;
+    if (comment_len > 0) {
+        *iter++ = ' ';
+        memcpy(iter, comment, comment_len);
+        iter += comment_len;
+    }
+    *iter++ = '\n';
+    memcpy(iter, seq, seq_len);
+    iter += seq_len;
+    *iter++ = '\n';
+    if (qual != NULL) {
+        *iter++ = FASTQ_QUAL_DELIM;
+        *iter++ = '\n';
+        memcpy(iter, qual, seq_len);
+        iter += seq_len;
+        *iter++ = '\n';
+    }
+    return len;
+}
+
+/* Start of the sequence of an entry's record */
+static inline const char *
+sort_ent_seq (const struct sort_ent *ent)
+{
+    size_t offset = 1 + ent->name_len + 1;
+
+    if (ent->comment_len > 0) offset += ent->comment_len + 1;
+    return ent->rec + offset;
+}
+
+static inline size_t
+sort_ent_len (const struct qes_sorter *sorter, const struct sort_ent *ent)
+{
+    return sort_format(NULL, NULL, ent->name_len, NULL, ent->comment_len,
+                       NULL, ent->seq_len,
+                       sorter->opts.format == FASTQ_FMT ? "" : NULL);
+}
+
+/* Sort the records of ``slot``. Returns 0, or 1 on error. */
+static int
+sort_slot_sort (const struct qes_sorter *sorter, struct qes_sort_slot *slot)
+{
+    struct sort_ent *tmp = NULL;
+    /* Only minimizers use the prefix */
+    size_t depth = sorter->opts.key == QES_SORT_MINIMIZER ? 0 : 8;
+
+    if (slot->n_ents <= SORT_INSERTION_LEN) {
+        sort_insertion(slot->ents, slot->n_ents);
+        return 0;
+    }
+    tmp = qes_malloc_errnil(slot->n_ents * sizeof(*tmp));
+    if (tmp == NULL) return 1;
+    sort_radix(slot->ents, tmp, slot->n_ents, depth);
+    qes_free(tmp);
+    return 0;
+}
+
+static void
+sort_slot_reset (struct qes_sort_slot *slot)
+{
+    qes_arena_reset(slot->arena);
+    slot->n_ents = 0;
+    slot->bytes = 0;
+}
+
+/* Sort the records of ``slot``, and write them to a new temporary file,
+ * ``slot->run``. Returns 0, or an errno. */
+static int
+sort_slot_spill (const struct qes_sorter *sorter, struct qes_sort_slot *slot)
+{
+    struct sort_writer writer;
+    size_t iii = 0;
+    int ret = 0;
+
+    slot->run = NULL;
+    if (sort_slot_sort(sorter, slot) != 0) return ENOMEM;
+    if (sort_writer_open(&writer, sorter, &slot->run) != 0) return errno;
+    for (iii = 0; iii < slot->n_ents && ret == 0; iii++) {
+        ret = sort_writer_put(&writer, slot->ents[iii].rec,
+                              sort_ent_len(sorter, &slot->ents[iii]));
+    }
+    if (ret != 0) ret = errno;
+    if (sort_writer_close(&writer) != 0 && ret == 0) ret = errno;
+    if (ret != 0) {
+        unlink(slot->run);
+        qes_free(slot->run);
+        return ret;
+    }
+    sort_slot_reset(slot);
+    return 0;
+}
+
+/* Spill the first ``n_slots`` slots in parallel, and append their runs in
+ * order. Returns 0, or 1 on error. */
+static int
+sort_spill (struct qes_sorter *sorter, unsigned n_slots)
+{
+    char **runs = NULL;
+    size_t capacity = 0;
+    unsigned iii = 0;
+    int ret = 0;
+
+    if (sorter->n_runs + n_slots > sorter->runs_capacity) {
+        capacity = sorter->runs_capacity > 0 ? sorter->runs_capacity : 16;
+        while (capacity < sorter->n_runs + n_slots) capacity <<= 1;
+        runs = qes_realloc_errnil(sorter->runs, capacity * sizeof(*runs));
+        if (runs == NULL) {
+            snprintf(sorter->errstr, sizeof(sorter->errstr),
+                     "Couldn't allocate list of runs");
+            return 1;
+        }
+        sorter->runs = runs;
+        sorter->runs_capacity = capacity;
+    }
+    SORT_OMP(parallel for num_threads(n_slots) schedule(dynamic, 1))
+    for (iii = 0; iii < n_slots; iii++) {
+        sorter->slots[iii].error = sort_slot_spill(sorter,
+                                                   &sorter->slots[iii]);
+    }
+    for (iii = 0; iii < n_slots; iii++) {
+        if (sorter->slots[iii].error != 0) {
+            snprintf(sorter->errstr, sizeof(sorter->errstr),
+                     "Couldn't write sorted run to %s: %s",
+                     sorter->opts.tmp_dir,
+                     strerror(sorter->slots[iii].error));
+            ret = 1;
+            continue;
+        }
+        sorter->runs[sorter->n_runs++] = sorter->slots[iii].run;
+        sorter->slots[iii].run = NULL;
+    }
+    sorter->cur_slot = 0;
+    return ret;
+}
+
+int
+qes_sorter_add (struct qes_sorter *sorter, const struct qes_seq *seq)
+{
+    struct qes_sort_slot *slot = NULL;
+    struct sort_ent *ents = NULL;
+    struct sort_ent *ent = NULL;
+    struct qes_str name;
+    struct qes_str comment;
+    size_t capacity = 0;
+    size_t key_len = 0;
+    size_t len = 0;
+    char *rec = NULL;
+    int fastq = 0;
+
+    if (sorter == NULL || !qes_seq_ok(seq)) return 1;
+    qes_seq_peek_header(seq, &name, &comment);
+    fastq = sorter->opts.format == FASTQ_FMT;
+    if (fastq && seq->qual.len != seq->seq.len) {
+        snprintf(sorter->errstr, sizeof(sorter->errstr),
+                 "Record %.64s has no qualities", seq->name.str);
+        return 1;
+    }
+    if (name.len >= UINT32_MAX || comment.len >= UINT32_MAX ||
+            seq->seq.len >= UINT32_MAX) {
+        snprintf(sorter->errstr, sizeof(sorter->errstr),
+                 "Record %.64s is too long", seq->name.str);
+        return 1;
+    }
+    slot = &sorter->slots[sorter->cur_slot];
+    if (slot->n_ents == slot->capacity) {
+        capacity = slot->capacity > 0 ? slot->capacity << 1 : 1024;
+        ents = qes_realloc_errnil(slot->ents, capacity * sizeof(*ents));
+        if (ents == NULL) goto nomem;
+        slot->ents = ents;
+        slot->capacity = capacity;
+    }
+    len = sort_format(NULL, NULL, name.len, NULL, comment.len, NULL,
+                      seq->seq.len, fastq ? "" : NULL);
+    rec = qes_arena_alloc(slot->arena, len);
+    if (rec == NULL) goto nomem;
+    sort_format(rec, name.str, name.len, comment.str, comment.len,
+                seq->seq.str, seq->seq.len, fastq ? seq->qual.str : NULL);
+    ent = &slot->ents[slot->n_ents++];
+    ent->rec = rec;
+    ent->name_len = name.len;
+    ent->comment_len = comment.len;
+    ent->seq_len = seq->seq.len;
+    sort_key(sorter, rec + 1, ent->name_len, sort_ent_seq(ent), ent->seq_len,
+             &ent->prefix, &ent->key, &key_len);
+    ent->key_len = key_len;
+    sorter->n_records++;
+    /* Entries are counted twice, for the copy made while sorting */
+    slot->bytes += len + 2 * sizeof(*ent);
+    if (slot->bytes >= sorter->opts.mem_budget / sorter->opts.n_threads) {
+        if (++sorter->cur_slot == sorter->opts.n_threads) {
+            return sort_spill(sorter, sorter->opts.n_threads);
+        }
+    }
+    return 0;
+nomem:
+    snprintf(sorter->errstr, sizeof(sorter->errstr),
+             "Couldn't allocate memory for records");
+    return 1;
+}
+
+/*
+ * Merging
+ */
+
+static inline int
+sort_str_set (struct qes_str *str, const char *cp, size_t len)
+{
+    if (len == 0) return qes_str_nullify(str);
+    return qes_str_fill_charptr(str, cp, len) ? 0 : 1;
+}
+
+/* Write the records of slot 0, which must be sorted, to ``out`` */
+static int
+sort_write_slot (struct qes_sorter *sorter, struct qes_seqfile *out)
+{
+    struct qes_sort_slot *slot = &sorter->slots[0];
+    struct qes_seq *seq = sorter->scratch;
+    const struct sort_ent *ent = NULL;
+    const char *seq_str = NULL;
+    size_t iii = 0;
+    int fastq = sorter->opts.format == FASTQ_FMT;
+
+    for (iii = 0; iii < slot->n_ents; iii++) {
+        ent = &slot->ents[iii];
+        seq_str = sort_ent_seq(ent);
+        if (sort_str_set(&seq->name, ent->rec + 1, ent->name_len) != 0 ||
+                sort_str_set(&seq->comment, ent->rec + 2 + ent->name_len,
+                             ent->comment_len) != 0 ||
+                sort_str_set(&seq->seq, seq_str, ent->seq_len) != 0 ||
+                sort_str_set(&seq->qual, seq_str + ent->seq_len + 3,
+                             fastq ? ent->seq_len : 0) != 0 ||
+                qes_seqfile_write(out, seq) < 0) {
+            snprintf(sorter->errstr, sizeof(sorter->errstr),
+                     "Couldn't write record");
+            return 1;
+        }
+    }
+    sort_slot_reset(slot);
+    return 0;
+}
+
+/* Read the next record of a run. Returns 0, or 1 on error. */
+static int
+sort_head_next (const struct qes_sorter *sorter, struct sort_head *head)
+{
+    ssize_t res = qes_seqfile_read(head->sf, head->seq);
+
+    if (res == EOF) {
+        head->done = 1;
+        return 0;
+    }
+    if (res < 0) return 1;
+    sort_key(sorter, head->seq->name.str, head->seq->name.len,
+             head->seq->seq.str, head->seq->seq.len, &head->prefix,
+             &head->key, &head->key_len);
+    return 0;
+}
+
+/* Does run ``idx1`` go before ``idx2``? Finished runs go last, and equal
+ * records come from earlier runs first, keeping the sort stable. */
+static inline int
+sort_head_less (const struct sort_head *heads, size_t idx1, size_t idx2)
+{
+    const struct sort_head *head1 = &heads[idx1];
+    const struct sort_head *head2 = &heads[idx2];
+    int res = 0;
+
+    if (head1->done || head2->done) return head2->done && !head1->done;
+    res = sort_key_cmp(head1->prefix, head1->key, head1->key_len,
+                       head2->prefix, head2->key, head2->key_len);
+    return res < 0 || (res == 0 && idx1 < idx2);
+}
+
+/* Write the record at the head of a run, to ``out`` or else ``writer`` */
+static int
+sort_head_write (struct qes_sorter *sorter, const struct sort_head *head,
+                 struct qes_seqfile *out, struct sort_writer *writer)
+{
+    const struct qes_seq *seq = head->seq;
+    int fastq = sorter->opts.format == FASTQ_FMT;
+    size_t len = 0;
+    char *buf = NULL;
+
+    if (out != NULL) return qes_seqfile_write(out, head->seq) < 0;
+    if (fastq && seq->qual.len != seq->seq.len) return 1;
+    len = sort_format(NULL, NULL, seq->name.len, NULL, seq->comment.len,
+                      NULL, seq->seq.len, fastq ? "" : NULL);
+    if (len > sorter->fmt_capacity) {
+        buf = qes_realloc_errnil(sorter->fmt_buf, len);
+        if (buf == NULL) return 1;
+        sorter->fmt_buf = buf;
+        sorter->fmt_capacity = len;
+    }
+    sort_format(sorter->fmt_buf, seq->name.str, seq->name.len,
+                seq->comment.str, seq->comment.len, seq->seq.str,
+                seq->seq.len, fastq ? seq->qual.str : NULL);
+    return sort_writer_put(writer, sorter->fmt_buf, len);
+}
+
+/* Replay the loser tree from leaf ``idx``, whose run has a new head */
+static inline void
+sort_tree_replay (const struct sort_head *heads, size_t *tree, size_t n_runs,
+                  size_t idx)
+{
+    size_t winner = idx;
+    size_t loser = 0;
+    size_t node = 0;
+
+    for (node = (n_runs + idx) / 2; node > 0; node /= 2) {
+        if (sort_head_less(heads, tree[node], winner)) {
+            loser = winner;
+            winner = tree[node];
+            tree[node] = loser;
+        }
+    }
+    tree[0] = winner;
+}
+
+/* Merge ``n_runs`` runs to ``out`` or else ``writer``. Returns 0, or 1 on
+ * error. */
+static int
+sort_merge (struct qes_sorter *sorter, char **runs, size_t n_runs,
+            struct qes_seqfile *out, struct sort_writer *writer)
+{
+    struct sort_head *heads = qes_calloc_errnil(n_runs, sizeof(*heads));
+    /* Node n of the tree has children 2n and 2n + 1, and run i is leaf
+     * n_runs + i. Each node keeps the loser of the match there, and node 0
+     * the overall winner. ``winners`` keeps the winners while building. */
+    size_t *tree = qes_calloc_errnil(3 * n_runs, sizeof(*tree));
+    size_t *winners = tree + n_runs;
+    struct sort_head *head = NULL;
+    size_t left = 0;
+    size_t right = 0;
+    size_t iii = 0;
+    int ret = 1;
+
+    if (heads == NULL || tree == NULL) {
+        snprintf(sorter->errstr, sizeof(sorter->errstr),
+                 "Couldn't allocate merge of %zu runs", n_runs);
+        goto end;
+    }
+    for (iii = 0; iii < n_runs; iii++) {
+        heads[iii].sf = qes_seqfile_create(runs[iii], "r");
+        heads[iii].seq = qes_seq_create();
+        if (heads[iii].sf == NULL || heads[iii].seq == NULL) goto readerr;
+        qes_seqfile_set_format(heads[iii].sf, sorter->opts.format);
+        if (sort_head_next(sorter, &heads[iii]) != 0) goto readerr;
+    }
+    for (iii = 0; iii < n_runs; iii++) winners[n_runs + iii] = iii;
+    for (iii = n_runs - 1; iii > 0; iii--) {
+        left = winners[2 * iii];
+        right = winners[2 * iii + 1];
+        if (sort_head_less(heads, right, left)) {
+            winners[iii] = right;
+            tree[iii] = left;
+        } else {
+            winners[iii] = left;
+            tree[iii] = right;
+        }
+    }
+    tree[0] = n_runs > 1 ? winners[1] : 0;
+    while (!heads[tree[0]].done) {
+        head = &heads[tree[0]];
+        if (sort_head_write(sorter, head, out, writer) != 0) {
+            snprintf(sorter->errstr, sizeof(sorter->errstr),
+                     "Couldn't write record %.64s", head->seq->name.str);
+            goto end;
+        }
+        if (sort_head_next(sorter, head) != 0) {
+            iii = tree[0];
+            goto readerr;
+        }
+        sort_tree_replay(heads, tree, n_runs, tree[0]);
+    }
+    ret = 0;
+    goto end;
+readerr:
+    snprintf(sorter->errstr, sizeof(sorter->errstr),
+             "Couldn't read sorted run %.64s", runs[iii]);
+end:
+    for (iii = 0; heads != NULL && iii < n_runs; iii++) {
+        qes_seqfile_destroy(heads[iii].sf);
+        qes_seq_destroy(heads[iii].seq);
+    }
+    qes_free(heads);
+    qes_free(tree);
+    return ret;
+}
+
+/* Delete runs ``[0, n_runs)`` of ``runs`` */
+static void
+sort_delete_runs (char **runs, size_t n_runs)
+{
+    size_t iii = 0;
+
+    for (iii = 0; iii < n_runs; iii++) {
+        if (runs[iii] == NULL) continue;
+        unlink(runs[iii]);
+        qes_free(runs[iii]);
+    }
+}
+
+/* Merge consecutive groups of ``max_fanin`` runs into single runs, until
+ * there are at most ``max_fanin``. Returns 0, or 1 on error. */
+static int
+sort_merge_passes (struct qes_sorter *sorter)
+{
+    struct sort_writer writer;
+    char *path = NULL;
+    size_t fanin = sorter->opts.max_fanin;
+    size_t n_merged = 0;
+    size_t start = 0;
+    size_t len = 0;
+    int res = 0;
+
+    while (sorter->n_runs > fanin) {
+        n_merged = 0;
+        for (start = 0; start < sorter->n_runs; start += fanin) {
+            len = sorter->n_runs - start < fanin ?
+                    sorter->n_runs - start : fanin;
+            if (len == 1) {
+                sorter->runs[n_merged++] = sorter->runs[start];
+                sorter->runs[start] = NULL;
+                continue;
+            }
+            if (sort_writer_open(&writer, sorter, &path) != 0) {
+                snprintf(sorter->errstr, sizeof(sorter->errstr),
+                         "Couldn't create run in %s: %s",
+                         sorter->opts.tmp_dir, strerror(errno));
+                return 1;
+            }
+            res = sort_merge(sorter, sorter->runs + start, len, NULL,
+                             &writer);
+            if (sort_writer_close(&writer) != 0 && res == 0) {
+                snprintf(sorter->errstr, sizeof(sorter->errstr),
+                         "Couldn't write run %.64s: %s", path,
+                         strerror(errno));
+                res = 1;
+            }
+            sort_delete_runs(sorter->runs + start, len);
+            memset(sorter->runs + start, 0, len * sizeof(*sorter->runs));
+            /* The merged run takes the place of its first, so runs stay in
+             * order */
+            sorter->runs[n_merged++] = path;
+            /* Runs yet to be merged are still listed, to be deleted */
+            if (res != 0) return 1;
+        }
+        sorter->n_runs = n_merged;
+    }
+    return 0;
+}
+
+int
+qes_sorter_finish (struct qes_sorter *sorter, struct qes_seqfile *out)
+{
+    unsigned n_slots = 0;
+    int ret = 1;
+
+    if (sorter == NULL) return 1;
+    if (!qes_seqfile_ok(out)) {
+        snprintf(sorter->errstr, sizeof(sorter->errstr), "BAD FILE");
+        return 1;
+    }
+    if (out->format == UNKNOWN_FMT) {
+        qes_seqfile_set_format(out, sorter->opts.format);
+    }
+    n_slots = sorter->cur_slot + (sorter->slots[sorter->cur_slot].n_ents > 0);
+    if (sorter->n_runs == 0 && n_slots <= 1) {
+        /* Everything fit in memory */
+        ret = sort_slot_sort(sorter, &sorter->slots[0]) != 0 ||
+              sort_write_slot(sorter, out) != 0;
+        if (ret != 0 && sorter->slots[0].n_ents > 0) {
+            snprintf(sorter->errstr, sizeof(sorter->errstr),
+                     "Couldn't sort records");
+        }
+        goto end;
+    }
+    if (n_slots > 0 && sort_spill(sorter, n_slots) != 0) goto end;
+    if (sort_merge_passes(sorter) != 0) goto end;
+    ret = sort_merge(sorter, sorter->runs, sorter->n_runs, out, NULL);
+end:
+    /* Whatever happened, start again */
+    for (n_slots = 0; n_slots < sorter->opts.n_threads; n_slots++) {
+        sort_slot_reset(&sorter->slots[n_slots]);
+    }
+    sort_delete_runs(sorter->runs, sorter->n_runs);
+    sorter->n_runs = 0;
+    sorter->cur_slot = 0;
+    sorter->n_records = 0;
+    return ret;
+}
+
+const char *
+qes_sorter_error (const struct qes_sorter *sorter)
+{
+    if (sorter == NULL) return "BAD FILE";
+    return sorter->errstr;
+}
+
+int
+qes_sort_file (struct qes_seqfile *in, struct qes_seqfile *out,
+               const struct qes_sort_opts *opts)
+{
+    struct qes_sort_opts our_opts;
+    struct qes_sorter *sorter = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    ssize_t res = 0;
+    int ret = 1;
+
+    if (!qes_seqfile_ok(in) || seq == NULL) goto end;
+    memset(&our_opts, 0, sizeof(our_opts));
+    if (opts != NULL) our_opts = *opts;
+    if (our_opts.format == UNKNOWN_FMT) our_opts.format = in->format;
+    sorter = qes_sorter_create(&our_opts);
+    if (sorter == NULL) goto end;
+    while ((res = qes_seqfile_read(in, seq)) > 0) {
+        if (qes_sorter_add(sorter, seq) != 0) goto end;
+    }
+    if (res != EOF) goto end;
+    ret = qes_sorter_finish(sorter, out);
+end:
+    qes_sorter_destroy(sorter);
+    qes_seq_destroy(seq);
+    return ret;
+}
+
+void
+qes_sorter_destroy_ (struct qes_sorter *sorter)
+{
+    unsigned iii = 0;
+
+    if (sorter != NULL) {
+        for (iii = 0; sorter->slots != NULL && iii < sorter->opts.n_threads;
+                iii++) {
+            qes_arena_destroy(sorter->slots[iii].arena);
+            qes_free(sorter->slots[iii].ents);
+        }
+        qes_free(sorter->slots);
+        sort_delete_runs(sorter->runs, sorter->n_runs);
+        qes_free(sorter->runs);
+        qes_seq_destroy(sorter->scratch);
+        qes_free(sorter->fmt_buf);
+        qes_free(sorter);
+    }
+}
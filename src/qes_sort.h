@@ -0,0 +1,163 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_sort.h
+ *
+ *    Description:  External merge sort of sequence records
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 00:14:27
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_SORT_H
+#define QES_SORT_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+#include <qes_seqfile.h>
+
+/* Defaults of struct qes_sort_opts */
+#define QES_SORT_MEM_BUDGET (256<<20)
+#define QES_SORT_MINIMIZER_K 15
+#define QES_SORT_MAX_FANIN 64
+#define QES_SORT_LEVEL 1
+
+enum qes_sort_key {
+    /* Records' names, byte-wise, without their comments */
+    QES_SORT_NAME = 0,
+    /* Records' sequences, byte-wise */
+    QES_SORT_SEQ = 1,
+    /* The smallest hash of any canonical k-mer of each sequence, then the
+     * sequence. Reads sharing k-mers, from either strand, end up together,
+     * which helps compression. */
+    QES_SORT_MINIMIZER = 2,
+};
+
+/* Options for qes_sorter_create. A zeroed struct gives the defaults. */
+struct qes_sort_opts {
+    enum qes_sort_key key;
+    /* Format of records. UNKNOWN_FMT (0) means FASTQ_FMT, in which case each
+     * record needs a quality score per base. */
+    enum qes_seqfile_format format;
+    /* Bytes of records (and their sort keys) held in memory before they're
+     * sorted and spilled to a temporary file. 0 means QES_SORT_MEM_BUDGET. */
+    size_t mem_budget;
+    /* Directory for temporary files. NULL means $TMPDIR, or /tmp. */
+    const char *tmp_dir;
+    /* gzip compression level of temporary files, 1-9, or -1 to not compress
+     * them. 0 means QES_SORT_LEVEL. */
+    int level;
+    /* k-mer length of QES_SORT_MINIMIZER, at most 32. 0 means
+     * QES_SORT_MINIMIZER_K. */
+    unsigned minimizer_k;
+    /* Most temporary files merged at once. 0 means QES_SORT_MAX_FANIN. */
+    unsigned max_fanin;
+    /* Threads sorting and spilling runs, if libqes was built with OpenMP.
+     * Each gets an equal share of ``mem_budget``. 0 means 1. */
+    unsigned n_threads;
+};
+
+/* Records in memory, waiting to be sorted. Private to qes_sort.c. */
+struct qes_sort_slot;
+
+struct qes_sorter {
+    struct qes_sort_opts opts;
+    /* ``opts.n_threads`` slots, filled in turn, then sorted and spilled
+     * together */
+    struct qes_sort_slot *slots;
+    unsigned cur_slot;
+    /* Paths of the sorted runs spilled, in the order they were read */
+    char **runs;
+    size_t n_runs;
+    size_t runs_capacity;
+    /* Records added since the last qes_sorter_finish */
+    uint64_t n_records;
+    /* Buffers for records being merged */
+    struct qes_seq *scratch;
+    char *fmt_buf;
+    size_t fmt_capacity;
+    /* Description of the last error */
+    char errstr[128];
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sorter_create
+Paramters:      const struct qes_sort_opts *opts: Options, or NULL for the
+                    defaults.
+Description:    Create a sorter of records too many to fit in memory. Records
+                added are copied into arenas, and when ``mem_budget`` fills,
+                each arena's records are radix-sorted and spilled to a
+                compressed temporary file, by many threads at once.
+                qes_sorter_finish then merges the sorted runs. The sort is
+                stable: records with equal keys stay in the order added.
+Returns:        struct qes_sorter *: An empty sorter, or NULL on error.
+ *===========================================================================*/
+struct qes_sorter *qes_sorter_create (const struct qes_sort_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sorter_add
+Paramters:      struct qes_sorter *sorter: Sorter to add to.
+                const struct qes_seq *seq: Record to add, which is copied.
+Description:    Add ``seq`` to ``sorter``, spilling sorted runs of records to
+                temporary files if memory is full.
+Returns:        int: 0 on success, 1 on error. See qes_sorter_error.
+ *===========================================================================*/
+int qes_sorter_add (struct qes_sorter *sorter, const struct qes_seq *seq);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sorter_finish
+Paramters:      struct qes_sorter *sorter: Sorter to finish.
+                struct qes_seqfile *out: File to write records to. If its
+                    format is unknown, it's set to that of ``sorter``.
+Description:    Write every record added to ``sorter`` to ``out``, in order.
+                If nothing was spilled, records are written from memory.
+                Otherwise, runs are k-way merged with a loser tree, in
+                several passes if there are more than ``max_fanin``.
+                ``sorter`` is then empty, and may be reused.
+Returns:        int: 0 on success, 1 on error. See qes_sorter_error.
+ *===========================================================================*/
+int qes_sorter_finish (struct qes_sorter *sorter, struct qes_seqfile *out);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sorter_error
+Paramters:      const struct qes_sorter *sorter: Sorter to query.
+Description:    Describe why the last add or finish failed.
+Returns:        const char *: The description. Never NULL.
+ *===========================================================================*/
+const char *qes_sorter_error (const struct qes_sorter *sorter);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sort_file
+Paramters:      struct qes_seqfile *in: File to read with qes_seqfile_read.
+                struct qes_seqfile *out: File to write to.
+                const struct qes_sort_opts *opts: Options, or NULL for the
+                    defaults. An unknown ``format`` is taken from ``in``.
+Description:    Sort all remaining records of ``in`` into ``out``, with a
+                qes_sorter.
+Returns:        int: 0 on success, 1 on error.
+ *===========================================================================*/
+int qes_sort_file (struct qes_seqfile *in, struct qes_seqfile *out,
+                   const struct qes_sort_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_sorter_destroy
+Paramters:      struct qes_sorter *: Sorter to destroy.
+Description:    Delete any temporary files, and deallocate and set to NULL a
+                struct qes_sorter on the heap.
+Returns:        void.
+ *===========================================================================*/
+void qes_sorter_destroy_ (struct qes_sorter *sorter);
+#define qes_sorter_destroy(sorter) do {                                     \
+            qes_sorter_destroy_(sorter);                                    \
+            sorter = NULL;                                                  \
+        } while(0)
+
+#endif /* QES_SORT_H */
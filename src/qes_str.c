@@ -29,7 +29,14 @@ qes_str_print (const struct qes_str *str, FILE *stream)
 void
 qes_str_destroy_cp (struct qes_str *str)
 {
-    if (str != NULL) qes_free(str->str);
+    if (str == NULL) return;
+    if (str->arena != NULL) {
+        str->str = NULL;
+        str->capacity = 0;
+        str->len = 0;
+    } else {
+        qes_free(str->str);
+    }
 }
 
 void
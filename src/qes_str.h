@@ -20,11 +20,14 @@
 #define QES_STR_H
 
 #include <qes_util.h>
+#include <qes_arena.h>
 
 struct qes_str {
     char *str;
     size_t len;
     size_t capacity;
+    /* If not NULL, ``str`` was allocated from, and grows within, ``arena`` */
+    struct qes_arena *arena;
 };
 
 
@@ -56,6 +59,33 @@ qes_str_init (struct qes_str *str, size_t capacity)
     str->len = 0;
     str->str = qes_calloc(capacity, sizeof(*str->str));
     str->capacity = capacity;
+    str->arena = NULL;
+}
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_str_init_arena
+Parameters:     struct qes_str *str: String to initialise.
+                size_t len: Initial capacity of `struct qes_str`.
+                struct qes_arena *arena: Arena to allocate from.
+Description:    As per qes_str_init, but `str->str` is allocated from `arena`,
+                and stays there as it grows. Such strings are only valid until
+                `arena` is reset.
+Returns:        void
+ *===========================================================================*/
+static inline void
+qes_str_init_arena (struct qes_str *str, size_t capacity,
+                    struct qes_arena *arena)
+{
+    if (str == NULL) return;
+    if (arena == NULL) {
+        qes_str_init(str, capacity);
+        return;
+    }
+    str->len = 0;
+    str->str = qes_arena_alloc(arena, capacity);
+    str->capacity = str->str != NULL ? capacity : 0;
+    str->arena = arena;
+    if (str->str != NULL) str->str[0] = '\0';
 }
 
 /*===  FUNCTION  ============================================================*
@@ -75,6 +105,36 @@ qes_str_create (size_t capacity)
     return str;
 }
 
+/*===  FUNCTION  ============================================================*
+Name:           qes_str_reserve
+Parameters:     struct qes_str *str: String to grow.
+                size_t capacity: Capacity required.
+Description:    Ensure `str` can hold `capacity` chars (including the '\0'),
+                growing it to the next power of two if it can't. The contents
+                are kept.
+Returns:        int: 0 on success, 1 on failure (`str` is untouched).
+ *===========================================================================*/
+static inline int
+qes_str_reserve (struct qes_str *str, size_t capacity)
+{
+    size_t newcap = 0;
+    char *newstr = NULL;
+
+    if (str == NULL) return 1;
+    if (str->capacity >= capacity) return 0;
+    newcap = qes_roundupz(capacity);
+    if (str->arena != NULL) {
+        newstr = qes_arena_realloc(str->arena, str->str, str->capacity,
+                                   newcap);
+    } else {
+        newstr = qes_realloc(str->str, newcap * sizeof(*str->str));
+    }
+    if (newstr == NULL) return 1;
+    str->str = newstr;
+    str->capacity = newcap;
+    return 0;
+}
+
 static inline int
 qes_str_fill_charptr (struct qes_str *str, const char *cp, size_t len)
 {
@@ -82,13 +142,7 @@ qes_str_fill_charptr (struct qes_str *str, const char *cp, size_t len)
     if (len == 0) {
         len = strlen(cp);
     }
-    if (str->capacity < len + 1) {
-        while (str->capacity < len + 1) {
-            str->capacity = qes_roundupz(str->capacity);
-        }
-        str->str = qes_realloc(str->str, str->capacity * sizeof(*str->str));
-    }
-    /* FIXME: check for null after realloc */
+    if (qes_str_reserve(str, len + 1) != 0) return 0;
     memcpy(str->str, cp, len);
     str->str[len] = '\0';
     str->len = len;
@@ -115,7 +169,10 @@ qes_str_copy (struct qes_str *dest, const struct qes_str *src)
 {
     if (!qes_str_ok(src) || dest == NULL) return 1;
     if (!qes_str_ok(dest)) qes_str_init(dest, src->capacity);
-    memcpy(dest->str, src->str, src->capacity);
+    if (qes_str_reserve(dest, src->len + 1) != 0) return 1;
+    memcpy(dest->str, src->str, src->len);
+    dest->str[src->len] = '\0';
+    dest->len = src->len;
     return 0;
 }
 
@@ -134,6 +191,7 @@ Name:           qes_str_destroy_cp
 Paramters:      struct qes_str *: String to destrop
 Description:    Frees `str->str` without freeing the struct qes_str struct
                 itself. For use on `struct qes_str`s allocated on the stack.
+                Strings in an arena are just invalidated.
 Returns:        void
  *===========================================================================*/
 extern void qes_str_destroy_cp (struct qes_str *str);
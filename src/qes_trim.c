@@ -0,0 +1,274 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_trim.c
+ *
+ *    Description:  Trimming of low quality and ambiguous bases from reads
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 21:58:03
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "qes_trim.h"
+
+/* Sum of the raw quality chars. This has no branches in the loop, so the
+ * compiler vectorises it, once for each ISA level. */
+QES_MULTIVERSION
+static int64_t
+trim_sum_qual (const char *qual, size_t len)
+{
+    int64_t sum = 0;
+    size_t iii = 0;
+
+    for (iii = 0; iii < len; iii++) {
+        sum += (unsigned char)qual[iii];
+    }
+    return sum;
+}
+
+size_t
+qes_trim_qual_mott (const char *qual, size_t len, int cutoff)
+{
+    int64_t sum = 0;
+    int64_t max = 0;
+    size_t keep = len;
+    size_t iii = len;
+
+    if (qual == NULL) return len;
+    while (iii-- > 0) {
+        sum += cutoff - ((unsigned char)qual[iii] - QES_TRIM_QUAL_OFFSET);
+        if (sum < 0) break;
+        if (sum > max) {
+            max = sum;
+            keep = iii;
+        }
+    }
+    return keep;
+}
+
+size_t
+qes_trim_qual_window (const char *qual, size_t len, size_t window,
+                      int cutoff)
+{
+    int64_t sum = 0;
+    int64_t min_sum = 0;
+    size_t iii = 0;
+
+    if (qual == NULL || window == 0 || len == 0) return len;
+    if (window > len) window = len;
+    /* Compare sums rather than means, to avoid dividing */
+    min_sum = (int64_t)(cutoff + QES_TRIM_QUAL_OFFSET) * window;
+    sum = trim_sum_qual(qual, window);
+    if (sum < min_sum) return 0;
+    for (iii = window; iii < len; iii++) {
+        sum += (unsigned char)qual[iii];
+        sum -= (unsigned char)qual[iii - window];
+        if (sum < min_sum) return iii - window + 1;
+    }
+    return len;
+}
+
+size_t
+qes_trim_ns (const char *seq, size_t len)
+{
+    if (seq == NULL) return len;
+    while (len > 0 && (seq[len - 1] | 0x20) == 'n') len--;
+    return len;
+}
+
+size_t
+qes_trim_adapter (const char *seq, size_t len, const char *adapter,
+                  size_t adapter_len, const struct qes_trim_opts *opts)
+{
+    size_t min_overlap = QES_TRIM_MIN_OVERLAP;
+    size_t overlap = 0;
+    size_t iii = 0;
+    int_fast32_t max = 0;
+
+    if (seq == NULL || adapter == NULL || adapter_len == 0 || opts == NULL) {
+        return len;
+    }
+    if (opts->min_overlap > 0) min_overlap = opts->min_overlap;
+    if (min_overlap > adapter_len) min_overlap = adapter_len;
+    for (iii = 0; iii + min_overlap <= len; iii++) {
+        overlap = len - iii < adapter_len ? len - iii : adapter_len;
+        max = (int_fast32_t)(opts->max_mismatch_rate * overlap);
+        /* Most positions fail on the first few bases, so try those alone
+         * before comparing the whole overlap */
+        if (max == 0 && seq[iii] != adapter[0]) continue;
+        if (qes_match_hamming_max(seq + iii, adapter, overlap, max) <= max) {
+            return iii;
+        }
+    }
+    return len;
+}
+
+size_t
+qes_trim_mate_overlap (const char *seq1, size_t len1, const char *seq2,
+                       size_t len2, const struct qes_trim_opts *opts)
+{
+    size_t min_overlap = QES_TRIM_MIN_MATE_OVERLAP;
+    size_t insert = 0;
+    int_fast32_t max = 0;
+
+    if (seq1 == NULL || seq2 == NULL || opts == NULL) return 0;
+    if (opts->min_mate_overlap > 0) min_overlap = opts->min_mate_overlap;
+    /* An insert as long as the shorter read has no adapter to trim. Shorter
+     * overlaps match by chance more often, so the longest is taken. */
+    insert = len1 < len2 ? len1 : len2;
+    while (insert-- > min_overlap) {
+        max = (int_fast32_t)(opts->max_mismatch_rate * insert);
+        if (qes_match_hamming_revcomp_max(seq1, seq2, insert, max) <= max) {
+            return insert;
+        }
+    }
+    return 0;
+}
+
+/* As per qes_trim_len, with the adapter given */
+static size_t
+trim_len (const char *seq, const char *qual, size_t len, const char *adapter,
+          const struct qes_trim_opts *opts)
+{
+    size_t keep = len;
+
+    if (adapter != NULL) {
+        keep = qes_trim_adapter(seq, keep, adapter, strlen(adapter), opts);
+    }
+    if (opts->trim_ns) {
+        keep = qes_trim_ns(seq, keep);
+    }
+    if (qual == NULL) return keep;
+    /* Each kernel only needs to look at what's left */
+    if (opts->window_len > 0) {
+        keep = qes_trim_qual_window(qual, keep, opts->window_len,
+                                    opts->window_cutoff);
+    }
+    if (opts->mott_cutoff > 0) {
+        keep = qes_trim_qual_mott(qual, keep, opts->mott_cutoff);
+    }
+    return keep;
+}
+
+size_t
+qes_trim_len (const char *seq, const char *qual, size_t len,
+              const struct qes_trim_opts *opts)
+{
+    if (opts == NULL) return len;
+    return trim_len(seq, qual, len, opts->adapter, opts);
+}
+
+/* The qualities of ``seq``, or NULL if it has none. Returns 1 if they don't
+ * match its sequence. */
+static int
+trim_get_qual (const struct qes_seq *seq, const char **qual)
+{
+    *qual = NULL;
+    if (qes_str_ok(&seq->qual) && seq->qual.len > 0) {
+        if (seq->qual.len != seq->seq.len) return 1;
+        *qual = seq->qual.str;
+    }
+    return 0;
+}
+
+/* Cut ``seq`` to ``keep`` bases. Returns the number trimmed. */
+static size_t
+trim_seq_to (struct qes_seq *seq, size_t keep)
+{
+    size_t trimmed = seq->seq.len - keep;
+
+    if (trimmed > 0) {
+        seq->seq.len = keep;
+        seq->seq.str[keep] = '\0';
+        if (seq->qual.len > 0) {
+            seq->qual.len = keep;
+            seq->qual.str[keep] = '\0';
+        }
+    }
+    return trimmed;
+}
+
+ssize_t
+qes_trim_seq (struct qes_seq *seq, const struct qes_trim_opts *opts)
+{
+    const char *qual = NULL;
+
+    if (!qes_seq_ok_no_comment_or_qual(seq) || opts == NULL ||
+            trim_get_qual(seq, &qual) != 0) {
+        return -1;
+    }
+    return trim_seq_to(seq, trim_len(seq->seq.str, qual, seq->seq.len,
+                                     opts->adapter, opts));
+}
+
+ssize_t
+qes_trim_pair (struct qes_seq *seq1, struct qes_seq *seq2,
+               const struct qes_trim_opts *opts)
+{
+    const char *qual1 = NULL;
+    const char *qual2 = NULL;
+    const char *adapter1 = NULL;
+    const char *adapter2 = NULL;
+    size_t insert = 0;
+    size_t len1 = 0;
+    size_t len2 = 0;
+
+    if (!qes_seq_ok_no_comment_or_qual(seq1) ||
+            !qes_seq_ok_no_comment_or_qual(seq2) || opts == NULL ||
+            trim_get_qual(seq1, &qual1) != 0 ||
+            trim_get_qual(seq2, &qual2) != 0) {
+        return -1;
+    }
+    len1 = seq1->seq.len;
+    len2 = seq2->seq.len;
+    insert = qes_trim_mate_overlap(seq1->seq.str, len1, seq2->seq.str, len2,
+                                   opts);
+    if (insert > 0) {
+        /* The adapters are already gone */
+        len1 = len2 = insert;
+    } else {
+        adapter1 = opts->adapter;
+        adapter2 = opts->adapter2;
+    }
+    len1 = trim_len(seq1->seq.str, qual1, len1, adapter1, opts);
+    len2 = trim_len(seq2->seq.str, qual2, len2, adapter2, opts);
+    return trim_seq_to(seq1, len1) + trim_seq_to(seq2, len2);
+}
+
+ssize_t
+qes_trim_batch (struct qes_seqbatch *batch, const struct qes_trim_opts *opts)
+{
+    const char *qual = NULL;
+    size_t trimmed = 0;
+    size_t keep = 0;
+    size_t len = 0;
+    size_t iii = 0;
+
+    if (batch == NULL || opts == NULL) return -1;
+    for (iii = 0; iii < batch->n_seqs; iii++) {
+        len = qes_seqbatch_len(batch, seq, iii);
+        qual = NULL;
+        if (qes_seqbatch_len(batch, qual, iii) == len) {
+            qual = qes_seqbatch_str(batch, qual, iii);
+        }
+        keep = qes_trim_len(qes_seqbatch_str(batch, seq, iii), qual, len,
+                            opts);
+        if (keep == len) continue;
+        /* Keep each value '\0' terminated */
+        qes_seqbatch_len(batch, seq, iii) = keep;
+        qes_seqbatch_str(batch, seq, iii)[keep] = '\0';
+        if (qual != NULL) {
+            qes_seqbatch_len(batch, qual, iii) = keep;
+            qes_seqbatch_str(batch, qual, iii)[keep] = '\0';
+        }
+        trimmed += len - keep;
+    }
+    return trimmed;
+}
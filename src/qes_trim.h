@@ -0,0 +1,186 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  qes_trim.h
+ *
+ *    Description:  Trimming of low quality and ambiguous bases from reads
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 21:58:03
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#ifndef QES_TRIM_H
+#define QES_TRIM_H
+
+#include <qes_util.h>
+#include <qes_seq.h>
+#include <qes_seqbatch.h>
+#include <qes_match.h>
+
+/* Quality scores are Phred+33 */
+#define QES_TRIM_QUAL_OFFSET 33
+/* Defaults for the shortest partial adapter, and overlap of mates, trimmed */
+#define QES_TRIM_MIN_OVERLAP 3
+#define QES_TRIM_MIN_MATE_OVERLAP 15
+
+/* Which trimming to do. A zeroed struct trims nothing. Each kernel finds the
+ * length to keep, and the read is cut to the shortest of them. */
+struct qes_trim_opts {
+    /* Trim the 3' end with the modified Mott algorithm (as per BWA's -q) at
+     * this quality. 0 to skip. */
+    int mott_cutoff;
+    /* Cut the read at the first window of ``window_len`` bases with a mean
+     * quality below ``window_cutoff``. 0 to skip. */
+    size_t window_len;
+    int window_cutoff;
+    /* Trim Ns (or n) from the 3' end */
+    int trim_ns;
+    /* Cut the read at the 3' adapter ``adapter``, or ``adapter2`` for second
+     * mates in qes_trim_pair. NULL to skip. See qes_trim_adapter. */
+    const char *adapter;
+    const char *adapter2;
+    /* Shortest partial adapter at the end of a read to trim. 0 means
+     * QES_TRIM_MIN_OVERLAP. */
+    size_t min_overlap;
+    /* Mismatches allowed per base of the overlap with an adapter or mate */
+    double max_mismatch_rate;
+    /* Shortest overlap of mates that qes_trim_pair takes as a short insert.
+     * 0 means QES_TRIM_MIN_MATE_OVERLAP. */
+    size_t min_mate_overlap;
+};
+
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_trim_qual_mott
+Paramters:      const char *qual: Phred+33 qualities of a read.
+                size_t len: Length of ``qual``.
+                int cutoff: Quality cutoff.
+Description:    Find where to cut the 3' end of a read with the modified Mott
+                algorithm. Walking from the 3' end, sum ``cutoff - q`` for
+                each base's quality ``q``, stopping if the sum goes negative.
+                The read is cut where the sum was greatest. Only the bases
+                trimmed (and one more) are looked at.
+Returns:        size_t: The number of bases to keep.
+ *===========================================================================*/
+size_t qes_trim_qual_mott (const char *qual, size_t len, int cutoff);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_trim_qual_window
+Paramters:      const char *qual: Phred+33 qualities of a read.
+                size_t len: Length of ``qual``.
+                size_t window: Number of bases averaged.
+                int cutoff: Minimum mean quality.
+Description:    Slide a window along the read from the 5' end, and find the
+                first window whose mean quality is below ``cutoff``. Reads
+                shorter than ``window`` are averaged as a whole.
+Returns:        size_t: The number of bases to keep: the start of that
+                window, or ``len`` if there is none.
+ *===========================================================================*/
+size_t qes_trim_qual_window (const char *qual, size_t len, size_t window,
+                             int cutoff);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_trim_ns
+Paramters:      const char *seq: Sequence of a read.
+                size_t len: Length of ``seq``.
+Description:    Find the Ns at the 3' end of ``seq``.
+Returns:        size_t: The number of bases to keep, before any trailing Ns.
+ *===========================================================================*/
+size_t qes_trim_ns (const char *seq, size_t len);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_trim_adapter
+Paramters:      const char *seq: Sequence of a read.
+                size_t len: Length of ``seq``.
+                const char *adapter: Adapter sequence.
+                size_t adapter_len: Length of ``adapter``.
+                const struct qes_trim_opts *opts: Options, for
+                    ``min_overlap`` and ``max_mismatch_rate``.
+Description:    Find the leftmost occurrence of ``adapter`` in ``seq``. Where
+                fewer than ``adapter_len`` bases of the read are left, a
+                prefix of the adapter at the very end of the read counts,
+                down to ``min_overlap`` bases. Each comparison is a
+                qes_match_hamming_max, allowing ``max_mismatch_rate``
+                mismatches per base compared.
+Returns:        size_t: The number of bases to keep, before the adapter, or
+                ``len`` if there is none.
+ *===========================================================================*/
+size_t qes_trim_adapter (const char *seq, size_t len, const char *adapter,
+                         size_t adapter_len, const struct qes_trim_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_trim_mate_overlap
+Paramters:      const char *seq1, *seq2: Sequences of the mates of a pair.
+                size_t len1, len2: Lengths of ``seq1`` and ``seq2``.
+                const struct qes_trim_opts *opts: Options, for
+                    ``min_mate_overlap`` and ``max_mismatch_rate``.
+Description:    Detect an insert shorter than the reads. Then each mate reads
+                through the whole insert into the adapter, so the first
+                bases of read 1 are the reverse complement of the first
+                bases of read 2. Needs no adapter sequence.
+Returns:        size_t: The length of the insert, or 0 if no insert shorter
+                than both reads was found.
+ *===========================================================================*/
+size_t qes_trim_mate_overlap (const char *seq1, size_t len1,
+                              const char *seq2, size_t len2,
+                              const struct qes_trim_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_trim_len
+Paramters:      const char *seq, *qual: Sequence and qualities of a read.
+                    ``qual`` may be NULL, to only trim Ns.
+                size_t len: Length of the read.
+                const struct qes_trim_opts *opts: Trimming to do.
+Description:    Run each of the kernels in ``opts`` over a read. The adapter
+                (``opts->adapter``) is removed first.
+Returns:        size_t: The number of bases to keep.
+ *===========================================================================*/
+size_t qes_trim_len (const char *seq, const char *qual, size_t len,
+                     const struct qes_trim_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_trim_seq
+Paramters:      struct qes_seq *seq: Read to trim.
+                const struct qes_trim_opts *opts: Trimming to do.
+Description:    Trim the 3' end of ``seq`` in place. Only the lengths of its
+                sequence and quality change, so nothing is copied. Reads
+                without qualities (e.g. from FASTA) are only trimmed of Ns.
+Returns:        ssize_t: The number of bases trimmed, or -1 on error.
+ *===========================================================================*/
+ssize_t qes_trim_seq (struct qes_seq *seq, const struct qes_trim_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_trim_pair
+Paramters:      struct qes_seq *seq1, *seq2: Mates to trim.
+                const struct qes_trim_opts *opts: Trimming to do.
+Description:    As per qes_trim_seq, for the mates of a pair. If the mates
+                overlap (see qes_trim_mate_overlap), both are first cut to
+                the insert, catching adapters too short or too mismatched to
+                find alone. Otherwise ``seq1`` is searched for
+                ``opts->adapter``, and ``seq2`` for ``opts->adapter2``.
+Returns:        ssize_t: The number of bases trimmed from both, or -1 on
+                error.
+ *===========================================================================*/
+ssize_t qes_trim_pair (struct qes_seq *seq1, struct qes_seq *seq2,
+                       const struct qes_trim_opts *opts);
+
+/*===  FUNCTION  ============================================================*
+Name:           qes_trim_batch
+Paramters:      struct qes_seqbatch *batch: Reads to trim.
+                const struct qes_trim_opts *opts: Trimming to do.
+Description:    As per qes_trim_seq, for every read of ``batch``. Records
+                stay where they are in the batch's columns, so this works
+                with fixed strides too.
+Returns:        ssize_t: The number of bases trimmed, or -1 on error.
+ *===========================================================================*/
+ssize_t qes_trim_batch (struct qes_seqbatch *batch,
+                        const struct qes_trim_opts *opts);
+
+#endif /* QES_TRIM_H */
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include "qes_config.h"
 #include "qes_compat.h"
 
@@ -53,6 +54,8 @@ extern const char *libqes_version;
 #define QES_MAX_FN_LEN (1<<16)
 /* Size of buffers for file IO */
 #define    QES_FILEBUFFER_LEN (16384)
+/* Largest an adaptive file buffer grows to, unless told otherwise */
+#define    QES_FILEBUFFER_MAX_LEN (1<<23)
 /* Starting point for allocing a char pointer. Set to slightly larger than the
    standard size of whatever you're reading in. */
 #define    __INIT_LINE_LEN (128)
@@ -81,6 +84,25 @@ extern const char *libqes_version;
     #define STMT_END } while (0)
 #endif
 
+/* Compile a function once per ISA level, and pick the best one for the
+ * running CPU at load time (via an ifunc resolver). Use on hot, vectorisable
+ * loops; the library is otherwise built for the baseline ISA. */
+#ifdef TARGET_CLONES_FOUND
+    #define QES_MULTIVERSION \
+        __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", \
+                                     "default")))
+#else
+    #define QES_MULTIVERSION
+#endif
+
+/* Instrumentation counters, which compile to nothing unless libqes is built
+ * with QES_STATS. ``obj`` must have a ``stats`` member. */
+#ifdef QES_STATS
+    #define QES_STATS_ADD(obj, field, n) ((obj)->stats.field += (n))
+#else
+    #define QES_STATS_ADD(obj, field, n) STMT_NIL
+#endif
+
 /* This can be helpful in some macros, particularly with #pragma */
 #ifndef STRINGIFY
     #define STRINGIFY(a) #a
@@ -147,6 +169,16 @@ qes_roundup32 (uint32_t u32)
     return u32 + 1;
 }
 
+/* Monotonic time in nanoseconds, for timing things */
+static inline uint64_t
+qes_nsec_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static inline uint64_t
 qes_roundup64 (uint64_t u64)
 {
@@ -3,7 +3,7 @@
  *
  *       Filename:  benchmarks.c
  *
- *    Description:  Some benchmarks
+ *    Description:  Throughput benchmarks, over real or synthetic data
  *
  *        Version:  1.0
  *        Created:  16/05/14 12:27:04
@@ -19,91 +19,327 @@
 
 #include <qes_file.h>
 #include <qes_seqfile.h>
+#include <qes_seqbatch.h>
+#include <qes_arena.h>
+#include <qes_match.h>
+#include <qes_sequtil.h>
+#include <qes_qual.h>
+#include <qes_merge.h>
 #include <time.h>
 #include <zlib.h>
 #include <assert.h>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#   include <x86intrin.h>
+#   define BENCH_HAVE_TSC
+#endif
 
 #include "helpers.h"
 
 #include "kseq.h"
 
-void bench_qes_file_readline_realloc_file(int silent);
-void bench_qes_file_readline_file(int silent);
-#ifdef GELINE_FOUND
-void bench_gnu_getline_file(int silent);
+/* Number of records loaded into memory for the write and kernel benchmarks */
+#define BENCH_KERNEL_RECS (1<<16)
+/* Records per arena reset in the arena parsing benchmark */
+#define BENCH_ARENA_RECS 1024
+
+struct bench_result {
+    /* Bytes processed. 0 means the whole (uncompressed) input file. */
+    size_t bytes;
+    size_t records;
+};
+
+void bench_qes_file_readline_realloc_file(struct bench_result *res);
+void bench_qes_file_readline_file(struct bench_result *res);
+#ifdef GETLINE_FOUND
+void bench_gnu_getline_file(struct bench_result *res);
 #endif
-void bench_qes_seqfile_parse_fq(int silent);
-void bench_kseq_parse_fq(int silent);
-void bench_qes_seqfile_write(int silent);
+void bench_qes_seqfile_parse_fq(struct bench_result *res);
+void bench_qes_seqfile_parse_arena(struct bench_result *res);
+void bench_qes_seqfile_read_batch(struct bench_result *res);
+void bench_kseq_parse_fq(struct bench_result *res);
+void bench_qes_seqfile_write(struct bench_result *res);
+void bench_qes_seqfile_write_gz(struct bench_result *res);
+void bench_qes_match_hamming(struct bench_result *res);
+void bench_qes_match_hamming_max(struct bench_result *res);
+void bench_qes_sequtil_revcomp(struct bench_result *res);
+void bench_qes_sequtil_translate(struct bench_result *res);
+void bench_qes_qual_encode(struct bench_result *res);
+void bench_zlib_qual_encode(struct bench_result *res);
+void bench_qes_merge_pairs(struct bench_result *res);
 #ifdef OPENMP_FOUND
-void bench_qes_seqfile_par_iter_fq_macro(int silent);
+void bench_qes_seqfile_par_iter_fq_macro(struct bench_result *res);
 #endif
 
 
 KSEQ_INIT(gzFile, gzread)
 
 static char *infile;
+/* Records of infile, for benchmarks that don't read it */
+static struct qes_seq **records;
+static size_t n_records;
 
 typedef struct __bench {
     const char *name;
-    void (*fn)(int silent);
+    void (*fn)(struct bench_result *res);
+    /* Does this benchmark need ``records``? */
+    int needs_records;
 } bench_t;
 
+/* A benchmark's timings, summarised over all rounds */
+struct bench_stats {
+    const char *name;
+    double seconds;
+    double best_seconds;
+    double mb_per_s;
+    double records_per_s;
+    double cycles_per_byte;
+    long peak_rss_kb;
+};
+
+
+/*
+ * Helpers
+ */
+
+static double
+bench_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t
+bench_cycles (void)
+{
+#ifdef BENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static long
+bench_peak_rss_kb (void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+    /* ru_maxrss is in kilobytes on Linux */
+    return usage.ru_maxrss;
+}
+
+/* Makes a temporary file, returning its path, which the caller frees */
+static char *
+bench_tmpfile (void)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    char *path = NULL;
+    int fd = 0;
+
+    if (tmpdir == NULL) tmpdir = "/tmp";
+    path = malloc(strlen(tmpdir) + 32);
+    assert(path != NULL);
+    sprintf(path, "%s/libqes_bench_XXXXXX", tmpdir);
+    fd = mkstemp(path);
+    if (fd < 0) {
+        free(path);
+        return NULL;
+    }
+    close(fd);
+    return path;
+}
+
+/* Parses sizes like 512, 64k, 100M or 2G */
+static size_t
+bench_parse_size (const char *str)
+{
+    char *end = NULL;
+    double size = strtod(str, &end);
+
+    switch (*end) {
+        case 'g': case 'G': size *= 1024;   /* fall through */
+        case 'm': case 'M': size *= 1024;   /* fall through */
+        case 'k': case 'K': size *= 1024;   break;
+        default: break;
+    }
+    return size < 0 ? 0 : (size_t)size;
+}
+
+static uint64_t bench_rng = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t
+bench_rand (void)
+{
+    /* xorshift64* */
+    bench_rng ^= bench_rng >> 12;
+    bench_rng ^= bench_rng << 25;
+    bench_rng ^= bench_rng >> 27;
+    return bench_rng * 0x2545f4914f6cdd1dULL;
+}
+
+/* Writes about ``size`` bytes (before compression) of random reads of length
+ * ``read_len`` to ``path``. ``level`` is the gzip level, or 0 for none. */
+static int
+bench_generate (const char *path, size_t size, size_t read_len, int fasta,
+                int level)
+{
+    static const char bases[] = "ACGT";
+    char mode[8];
+    char *buf = malloc(2 * read_len + 128);
+    gzFile fp = NULL;
+    size_t written = 0;
+    size_t n_reads = 0;
+    size_t len = 0;
+    size_t iii = 0;
+    uint64_t rnd = 0;
+
+    if (buf == NULL) return 1;
+    if (level > 0) {
+        snprintf(mode, sizeof(mode), "wb%d", level > 9 ? 9 : level);
+    } else {
+        strcpy(mode, "wT");
+    }
+    fp = gzopen(path, mode);
+    if (fp == NULL) {
+        free(buf);
+        return 1;
+    }
+    while (written < size) {
+        len = sprintf(buf, "%csynth_%zu length=%zu\n", fasta ? '>' : '@',
+                      n_reads++, read_len);
+        for (iii = 0; iii < read_len; iii++) {
+            if (iii % 32 == 0) rnd = bench_rand();
+            buf[len++] = bases[rnd & 3];
+            rnd >>= 2;
+        }
+        buf[len++] = '\n';
+        if (!fasta) {
+            buf[len++] = '+';
+            buf[len++] = '\n';
+            for (iii = 0; iii < read_len; iii++) {
+                /* Phred 2 to 41 */
+                buf[len++] = '#' + bench_rand() % 40;
+            }
+            buf[len++] = '\n';
+        }
+        if (gzwrite(fp, buf, len) != (int)len) {
+            gzclose(fp);
+            free(buf);
+            return 1;
+        }
+        written += len;
+    }
+    gzclose(fp);
+    free(buf);
+    return 0;
+}
+
+/* Counts the uncompressed bytes in ``path`` */
+static size_t
+bench_file_bytes (const char *path)
+{
+    gzFile fp = gzopen(path, "r");
+    char buf[1<<16];
+    size_t total = 0;
+    int len = 0;
+
+    if (fp == NULL) return 0;
+    while ((len = gzread(fp, buf, sizeof(buf))) > 0) {
+        total += len;
+    }
+    gzclose(fp);
+    return total;
+}
+
+static void
+bench_load_records (void)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq *seq = NULL;
+
+    if (records != NULL) return;
+    records = calloc(BENCH_KERNEL_RECS, sizeof(*records));
+    assert(records != NULL);
+    sf = qes_seqfile_create(infile, "r");
+    assert(sf != NULL);
+    while (n_records < BENCH_KERNEL_RECS) {
+        seq = qes_seq_create();
+        if (qes_seqfile_read(sf, seq) < 1) {
+            qes_seq_destroy(seq);
+            break;
+        }
+        records[n_records++] = seq;
+    }
+    qes_seqfile_destroy(sf);
+}
+
+static void
+bench_free_records (void)
+{
+    size_t iii = 0;
+
+    for (iii = 0; iii < n_records; iii++) {
+        qes_seq_destroy(records[iii]);
+    }
+    free(records);
+    records = NULL;
+    n_records = 0;
+}
+
+
+/*
+ * Benchmarks
+ */
+
 void
-bench_qes_file_readline_realloc_file(int silent)
+bench_qes_file_readline_realloc_file(struct bench_result *res)
 {
     size_t bsz = 1<<4;
     char *buf = malloc(bsz);
     ssize_t len = 0;
-    off_t flen = 0;
     struct qes_file *file = qes_file_open(infile, "r");
 
     assert(buf != NULL);
     while ((len = qes_file_readline_realloc(file, &buf, &bsz)) != EOF) {
-        flen += len;
+        res->bytes += len;
+        res->records++;
     }
-    if (!silent)
-        printf("[qes_file_readline_realloc]\tFile of %lu chars\n",
-               (long unsigned)flen);
     qes_file_close(file);
     free(buf);
 }
 
 void
-bench_qes_file_readline_file(int silent)
+bench_qes_file_readline_file(struct bench_result *res)
 {
     size_t bsz = 1<<10;
     char buf[bsz];
     ssize_t len = 0;
-    off_t flen = 0;
 
     struct qes_file *file = qes_file_open(infile, "r");
     while ((len = qes_file_readline(file, buf, bsz)) != EOF) {
-        flen += len;
+        res->bytes += len;
+        res->records++;
     }
-    if (!silent)
-        printf("[qes_file_readline]\t\tFile of %lu chars\n",
-               (long unsigned)flen);
     qes_file_close(file);
 }
 
-#ifdef GELINE_FOUND
+#ifdef GETLINE_FOUND
 void
-bench_gnu_getline_file(int silent)
+bench_gnu_getline_file(struct bench_result *res)
 {
     size_t bsz = 1<<4;
     char *buf = malloc(bsz);
     ssize_t len = 0;
-    off_t flen = 0;
     FILE *file = fopen(infile, "r");
 
     assert(buf != NULL);
     while ((len = getline(&buf, &bsz, file)) != EOF) {
-        flen += len;
+        res->bytes += len;
+        res->records++;
     }
-    if (!silent)
-        printf("[getline]\t\tFile of %lu chars\n",
-               (long unsigned)flen);
     fclose(file);
     free(buf);
 }
@@ -112,172 +348,596 @@ bench_gnu_getline_file(int silent)
 
 #ifdef OPENMP_FOUND
 void
-bench_qes_seqfile_par_iter_fq_macro(int silent)
+bench_qes_seqfile_par_iter_fq_macro(struct bench_result *res)
 {
     struct qes_seqfile *sf = qes_seqfile_create(infile, "r");
-    size_t total_len = 0;
+    size_t n_recs = 0;
 
-    QES_SEQFILE_ITER_PARALLEL_SINGLE_BEGIN(sf, seq, seq_len, shared(total_len))
-        #pragma omp critical
-        {
-        total_len += seq->seq.len;
-        }
+    QES_SEQFILE_ITER_PARALLEL_SINGLE_BEGIN(sf, seq, seq_len, shared(n_recs))
+        #pragma omp atomic
+        n_recs++;
     QES_SEQFILE_ITER_PARALLEL_SINGLE_END(seq)
 
-    if (!silent) {
-        printf("[qes_seqfile_iter_fq_macro] Total seq len %lu\n",
-               (long unsigned)total_len);
-    }
+    res->records = n_recs;
     qes_seqfile_destroy(sf);
 }
 #endif
 
 void
-bench_qes_seqfile_parse_fq(int silent)
+bench_qes_seqfile_parse_fq(struct bench_result *res)
 {
     struct qes_seq *seq = qes_seq_create();
     struct qes_seqfile *sf = qes_seqfile_create(infile, "r");
-    ssize_t res = 0;
-    size_t n_recs = 0;
-    size_t seq_len = 0;
 
-    while (res != EOF) {
-        res = qes_seqfile_read(sf, seq);
-        if (res < 1) {
-            break;
+    while (qes_seqfile_read(sf, seq) > 0) {
+        res->records++;
+    }
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+}
+
+void
+bench_qes_seqfile_parse_arena(struct bench_result *res)
+{
+    struct qes_arena *arena = qes_arena_create(0);
+    struct qes_seqfile *sf = qes_seqfile_create(infile, "r");
+    struct qes_seq *seq = NULL;
+
+    while (1) {
+        /* A new seq per record, as when records are kept for a batch */
+        seq = qes_seq_create_arena(arena);
+        if (qes_seqfile_read(sf, seq) < 1) break;
+        if (++res->records % BENCH_ARENA_RECS == 0) {
+            qes_arena_reset(arena);
         }
-        seq_len += res;
-        n_recs++;
     }
-    if (!silent) {
-        printf("[qes_seqfile_fq] Total seq len %lu\n",
-               (long unsigned)seq_len);
+    qes_seqfile_destroy(sf);
+    qes_arena_destroy(arena);
+}
+
+void
+bench_qes_seqfile_read_batch(struct bench_result *res)
+{
+    struct qes_seqbatch *batch = qes_seqbatch_create(1024, 0);
+    struct qes_seqfile *sf = qes_seqfile_create(infile, "r");
+    ssize_t n = 0;
+
+    while ((n = qes_seqfile_read_batch(sf, batch)) > 0) {
+        res->records += n;
     }
     qes_seqfile_destroy(sf);
-    qes_seq_destroy(seq);
+    qes_seqbatch_destroy(batch);
 }
 
 void
-bench_kseq_parse_fq(int silent)
+bench_kseq_parse_fq(struct bench_result *res)
 {
     gzFile fp = gzopen(infile, "r");
     kseq_t *seq = kseq_init(fp);
-    ssize_t res = 0;
-    size_t n_recs = 0;
-    size_t seq_len = 0;
 
-    while ((res = kseq_read(seq)) >= 0) {
-        seq_len += res;
-        n_recs++;
-    }
-    if (!silent) {
-        printf("[kseq_fq] Total seq len %lu\n",
-               (long unsigned) seq_len);
+    while (kseq_read(seq) >= 0) {
+        res->records++;
     }
     kseq_destroy(seq);
     gzclose(fp);
 }
 
-void
-bench_qes_seqfile_write(int silent)
+static void
+bench_write (struct bench_result *res, const char *mode)
 {
-    struct qes_seq *seq = qes_seq_create();
-    ssize_t res = 0;
     struct qes_seqfile *sf = NULL;
-    char *fname = tmpnam(NULL);
+    char *fname = bench_tmpfile();
+    ssize_t len = 0;
     size_t iii = 0;
 
-    /* Make a seq to write */
-    qes_seq_fill_name(seq, "HWI-TEST", 8);
-    qes_seq_fill_comment(seq, "testseq 1 2 3", 13);
-    qes_seq_fill_seq(seq, "ACTCAATT", 8);
-    qes_seq_fill_qual(seq, "IIIIIIII", 8);
-    /* Setup file for writing */
-    sf = qes_seqfile_create(fname, "wT");
-    qes_seqfile_set_format(sf, FASTQ_FMT);
-    for (iii = 0; iii < 1<<11; iii++) {
-        res += qes_seqfile_write(sf, seq);
-    }
-    if (!silent) {
-        printf("[qes_seqfile_write] Total file len %lu to %s\n",
-               (long unsigned)res, fname);
+    assert(fname != NULL);
+    sf = qes_seqfile_create(fname, mode);
+    qes_seqfile_set_format(sf, records[0]->qual.len > 0 ? FASTQ_FMT : FASTA_FMT);
+    for (iii = 0; iii < n_records; iii++) {
+        len = qes_seqfile_write(sf, records[iii]);
+        if (len < 0) break;
+        res->bytes += len;
+        res->records++;
     }
     qes_seqfile_destroy(sf);
-    qes_seq_destroy(seq);
     remove(fname);
+    free(fname);
+}
 
+void
+bench_qes_seqfile_write(struct bench_result *res)
+{
+    bench_write(res, "wT");
+}
+
+void
+bench_qes_seqfile_write_gz(struct bench_result *res)
+{
+    bench_write(res, "w");
+}
+
+void
+bench_qes_match_hamming(struct bench_result *res)
+{
+    volatile int_fast32_t sink = 0;
+    size_t iii = 0;
+    size_t len = 0;
+
+    for (iii = 1; iii < n_records; iii++) {
+        len = records[iii]->seq.len < records[iii - 1]->seq.len ?
+              records[iii]->seq.len : records[iii - 1]->seq.len;
+        sink += qes_match_hamming(records[iii]->seq.str,
+                                  records[iii - 1]->seq.str, len);
+        res->bytes += len;
+        res->records++;
+    }
+    (void) sink;
+}
+
+void
+bench_qes_match_hamming_max(struct bench_result *res)
+{
+    volatile int_fast32_t sink = 0;
+    size_t iii = 0;
+    size_t len = 0;
+
+    /* Compare each read to itself, so the whole read is scanned as it would
+     * be for a near match */
+    for (iii = 0; iii < n_records; iii++) {
+        len = records[iii]->seq.len;
+        sink += qes_match_hamming_max(records[iii]->seq.str,
+                                      records[iii]->seq.str, len, 3);
+        res->bytes += len;
+        res->records++;
+    }
+    (void) sink;
+}
+
+void
+bench_qes_sequtil_revcomp(struct bench_result *res)
+{
+    size_t iii = 0;
+
+    for (iii = 0; iii < n_records; iii++) {
+        qes_sequtil_revcomp_inplace(records[iii]->seq.str,
+                                    records[iii]->seq.len);
+        res->bytes += records[iii]->seq.len;
+        res->records++;
+    }
+}
+
+void
+bench_qes_sequtil_translate(struct bench_result *res)
+{
+    volatile char sink = 0;
+    char codon[4] = "";
+    size_t iii = 0;
+    size_t jjj = 0;
+
+    for (iii = 0; iii < n_records; iii++) {
+        for (jjj = 0; jjj + 3 <= records[iii]->seq.len; jjj += 3) {
+            memcpy(codon, records[iii]->seq.str + jjj, 3);
+            sink ^= qes_sequtil_translate_codon(codon);
+        }
+        res->bytes += records[iii]->seq.len;
+        res->records++;
+    }
+    (void) sink;
+}
+
+/* Code every quality score as one block, with qes_qual or with zlib at
+ * gzip's default level */
+static void
+bench_qual (struct bench_result *res, int zlib)
+{
+    struct qes_qual_codec *codec = qes_qual_codec_create(2);
+    size_t *lens = calloc(n_records, sizeof(*lens));
+    char *quals = NULL;
+    uint8_t *out = NULL;
+    uLongf out_len = 0;
+    size_t len = 0;
+    size_t iii = 0;
+
+    assert(codec != NULL && lens != NULL);
+    for (iii = 0; iii < n_records; iii++) {
+        lens[iii] = records[iii]->qual.len;
+        len += lens[iii];
+    }
+    quals = malloc(len + 1);
+    out_len = qes_qual_encode_bound(len) + compressBound(len);
+    out = malloc(out_len);
+    assert(quals != NULL && out != NULL);
+    for (iii = 0, len = 0; iii < n_records; iii++) {
+        memcpy(quals + len, records[iii]->qual.str, lens[iii]);
+        len += lens[iii];
+    }
+    if (zlib) {
+        if (compress2(out, &out_len, (uint8_t *)quals, len, 6) != Z_OK) {
+            len = 0;
+        }
+    } else if (qes_qual_encode(codec, quals, len, lens, n_records, out,
+                               out_len) < 0) {
+        len = 0;
+    }
+    res->bytes = len;
+    res->records = len > 0 ? n_records : 0;
+    qes_qual_codec_destroy(codec);
+    free(lens);
+    free(quals);
+    free(out);
+}
+
+void
+bench_qes_qual_encode(struct bench_result *res)
+{
+    bench_qual(res, 0);
+}
+
+void
+bench_zlib_qual_encode(struct bench_result *res)
+{
+    bench_qual(res, 1);
+}
+
+void
+bench_qes_merge_pairs(struct bench_result *res)
+{
+    struct qes_merge *merge = qes_merge_create(NULL);
+    struct qes_seq *mate = qes_seq_create();
+    struct qes_seq *merged = qes_seq_create();
+    size_t iii = 0;
+
+    assert(merge != NULL && mate != NULL && merged != NULL);
+    /* Pair each read with the next, which mostly don't overlap, so every
+     * offset is scanned. Every other pair is the read and its own reverse
+     * complement, which overlap fully. */
+    for (iii = 1; iii < n_records; iii++) {
+        qes_seq_copy(mate, records[iii - (iii & 1)]);
+        qes_sequtil_revcomp_inplace(mate->seq.str, mate->seq.len);
+        qes_merge_pairs(merge, records[iii - 1], mate, merged);
+        res->bytes += records[iii - 1]->seq.len + mate->seq.len;
+        res->records++;
+    }
+    qes_merge_destroy(merge);
+    qes_seq_destroy(mate);
+    qes_seq_destroy(merged);
 }
 
 static const bench_t benchmarks[] = {
-    { "qes_file_readline", &bench_qes_file_readline_file},
-    { "qes_file_readline_realloc", &bench_qes_file_readline_realloc_file},
-#ifdef GELINE_FOUND
-    { "gnu_getline", &bench_gnu_getline_file},
+    { "qes_file_readline", &bench_qes_file_readline_file, 0},
+    { "qes_file_readline_realloc", &bench_qes_file_readline_realloc_file, 0},
+#ifdef GETLINE_FOUND
+    { "gnu_getline", &bench_gnu_getline_file, 0},
 #endif
-    { "qes_seqfile_parse_fq", &bench_qes_seqfile_parse_fq},
+    { "qes_seqfile_parse_fq", &bench_qes_seqfile_parse_fq, 0},
+    { "qes_seqfile_parse_arena", &bench_qes_seqfile_parse_arena, 0},
+    { "qes_seqfile_read_batch", &bench_qes_seqfile_read_batch, 0},
 #ifdef OPENMP_FOUND
-    { "qes_seqfile_par_iter_fq_macro", &bench_qes_seqfile_par_iter_fq_macro},
+    { "qes_seqfile_par_iter_fq_macro", &bench_qes_seqfile_par_iter_fq_macro, 0},
 #endif
-    { "kseq_parse_fq", &bench_kseq_parse_fq},
-    { "qes_seqfile_write", &bench_qes_seqfile_write},
-    { NULL, NULL}
+    { "kseq_parse_fq", &bench_kseq_parse_fq, 0},
+    { "qes_seqfile_write", &bench_qes_seqfile_write, 1},
+    { "qes_seqfile_write_gz", &bench_qes_seqfile_write_gz, 1},
+    { "qes_match_hamming", &bench_qes_match_hamming, 1},
+    { "qes_match_hamming_max", &bench_qes_match_hamming_max, 1},
+    { "qes_sequtil_revcomp", &bench_qes_sequtil_revcomp, 1},
+    { "qes_sequtil_translate", &bench_qes_sequtil_translate, 1},
+    { "qes_qual_encode", &bench_qes_qual_encode, 1},
+    { "zlib_qual_encode", &bench_zlib_qual_encode, 1},
+    { "qes_merge_pairs", &bench_qes_merge_pairs, 1},
+    { NULL, NULL, 0}
 };
 
+
+/*
+ * Running and reporting
+ */
+
+static const bench_t *
+find_bench (const char *name)
+{
+    size_t iii = 0;
+
+    for (iii = 0; benchmarks[iii].name != NULL; iii++) {
+        if (strcmp(name, benchmarks[iii].name) == 0) {
+            return &benchmarks[iii];
+        }
+    }
+    return NULL;
+}
+
+static void
+run_bench (const bench_t *bench, int rounds, size_t file_bytes,
+           struct bench_stats *stats)
+{
+    struct bench_result res;
+    double start = 0.0;
+    double took = 0.0;
+    double total = 0.0;
+    double best = 0.0;
+    uint64_t cycles = 0;
+    uint64_t best_cycles = 0;
+    size_t bytes = 0;
+    int rnd = 0;
+
+    if (bench->needs_records) {
+        bench_load_records();
+    }
+    for (rnd = 0; rnd < rounds; rnd++) {
+        memset(&res, 0, sizeof(res));
+        cycles = bench_cycles();
+        start = bench_now();
+        (*bench->fn)(&res);
+        took = bench_now() - start;
+        cycles = bench_cycles() - cycles;
+        total += took;
+        if (rnd == 0 || took < best) {
+            best = took;
+            best_cycles = cycles;
+        }
+    }
+    /* File readers all process the whole file, whatever they count */
+    bytes = bench->needs_records ? res.bytes : file_bytes;
+    stats->name = bench->name;
+    stats->seconds = total / rounds;
+    stats->best_seconds = best;
+    stats->mb_per_s = best > 0 ? bytes / best / 1e6 : 0.0;
+    stats->records_per_s = best > 0 ? res.records / best : 0.0;
+    stats->cycles_per_byte = bytes > 0 ? (double)best_cycles / bytes : 0.0;
+    stats->peak_rss_kb = bench_peak_rss_kb();
+}
+
+static int
+write_json (const char *path, const struct bench_stats *stats, size_t n_stats,
+            int rounds, size_t file_bytes, int synthetic, size_t read_len,
+            int fasta, int level)
+{
+    FILE *fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    size_t iii = 0;
+
+    if (fp == NULL) return 1;
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"libqes_version\": \"%s\",\n", libqes_version);
+    fprintf(fp, "  \"input\": {\n");
+    fprintf(fp, "    \"path\": \"%s\",\n", synthetic ? "" : infile);
+    fprintf(fp, "    \"bytes\": %zu,\n", file_bytes);
+    fprintf(fp, "    \"synthetic\": %s,\n", synthetic ? "true" : "false");
+    fprintf(fp, "    \"read_len\": %zu,\n", read_len);
+    fprintf(fp, "    \"format\": \"%s\",\n", fasta ? "fasta" : "fastq");
+    fprintf(fp, "    \"compression_level\": %d\n", level);
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"rounds\": %d,\n", rounds);
+    fprintf(fp, "  \"benchmarks\": [\n");
+    for (iii = 0; iii < n_stats; iii++) {
+        fprintf(fp, "    {\"name\": \"%s\", \"seconds\": %.6f, "
+                "\"best_seconds\": %.6f, \"mb_per_s\": %.3f, "
+                "\"records_per_s\": %.1f, \"cycles_per_byte\": %.3f, "
+                "\"peak_rss_kb\": %ld}%s\n",
+                stats[iii].name, stats[iii].seconds, stats[iii].best_seconds,
+                stats[iii].mb_per_s, stats[iii].records_per_s,
+                stats[iii].cycles_per_byte, stats[iii].peak_rss_kb,
+                iii + 1 < n_stats ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    if (fp != stdout) fclose(fp);
+    return 0;
+}
+
+/* Finds the mb_per_s of benchmark ``name`` in a JSON file written by
+ * write_json, returning a negative number if it isn't there */
+static double
+baseline_mb_per_s (const char *json, const char *name)
+{
+    char key[256];
+    const char *pos = NULL;
+
+    snprintf(key, sizeof(key), "\"name\": \"%s\",", name);
+    pos = strstr(json, key);
+    if (pos == NULL) return -1.0;
+    pos = strstr(pos, "\"mb_per_s\":");
+    if (pos == NULL) return -1.0;
+    return strtod(pos + strlen("\"mb_per_s\":"), NULL);
+}
+
+/* Compares throughput to that in the baseline JSON at ``path``. Returns the
+ * number of benchmarks slower than baseline by more than ``tolerance``. */
+static int
+compare_baseline (const char *path, const struct bench_stats *stats,
+                  size_t n_stats, double tolerance)
+{
+    FILE *fp = fopen(path, "r");
+    char *json = NULL;
+    long len = 0;
+    double base = 0.0;
+    double change = 0.0;
+    int n_regressed = 0;
+    size_t iii = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr, "Couldn't open baseline %s\n", path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    json = calloc(len + 1, 1);
+    assert(json != NULL);
+    if (fread(json, 1, len, fp) != (size_t)len) {
+        fclose(fp);
+        free(json);
+        return -1;
+    }
+    fclose(fp);
+    printf("Comparison with baseline %s (tolerance %.0f%%):\n", path,
+           tolerance * 100);
+    for (iii = 0; iii < n_stats; iii++) {
+        base = baseline_mb_per_s(json, stats[iii].name);
+        if (base <= 0.0) {
+            printf("  %-32s no baseline\n", stats[iii].name);
+            continue;
+        }
+        change = stats[iii].mb_per_s / base - 1.0;
+        printf("  %-32s %10.2f MB/s vs %10.2f MB/s (%+.1f%%)%s\n",
+               stats[iii].name, stats[iii].mb_per_s, base, change * 100,
+               change < -tolerance ? "  REGRESSION" : "");
+        if (change < -tolerance) n_regressed++;
+    }
+    free(json);
+    return n_regressed;
+}
+
+static void
+usage (void)
+{
+    size_t iii = 0;
+
+    fprintf(stderr, "USAGE:\n"
+            "bench <file> <rounds> <bench> [<bench> ...]\n"
+            "bench [options] [<bench> ...]\n\n"
+            "With no benchmarks given, all are run.\n\n"
+            "Options:\n"
+            "  -i FILE   Benchmark reading FILE.\n"
+            "  -s SIZE   Generate SIZE bytes of synthetic reads (e.g. 512M)\n"
+            "            instead. [default: 64M]\n"
+            "  -l LEN    Read length of synthetic reads. [default: 150]\n"
+            "  -a        Generate FASTA, not FASTQ.\n"
+            "  -z LEVEL  Gzip synthetic reads at LEVEL (1-9). [default: none]\n"
+            "  -k FILE   Keep synthetic reads in FILE.\n"
+            "  -r N      Rounds per benchmark; the best is reported.\n"
+            "            [default: 3]\n"
+            "  -j FILE   Write results as JSON to FILE ('-' for stdout).\n"
+            "  -b FILE   Compare to baseline JSON FILE, and fail on slowdowns.\n"
+            "  -t FRAC   Tolerated slowdown vs. baseline. [default: 0.1]\n"
+            "\nAvailable benchmarks are:\n");
+    for (iii = 0; benchmarks[iii].name != NULL; iii++) {
+        fprintf(stderr, "%s\n", benchmarks[iii].name);
+    }
+}
+
 int
 main (int argc, char *argv[])
 {
-    bench_t thisbench;
-    clock_t start, end;
+    const bench_t *thisbench = NULL;
+    struct bench_stats *stats = NULL;
+    const char *json_path = NULL;
+    const char *baseline_path = NULL;
+    const char *keep_path = NULL;
+    char *synth_path = NULL;
+    double tolerance = 0.1;
+    size_t synth_size = 64<<20;
+    size_t read_len = 150;
+    size_t file_bytes = 0;
+    size_t n_stats = 0;
     size_t iii = 0;
-    int rnds = 0;
-    size_t nbench = 0;
+    int fasta = 0;
+    int level = 0;
+    int rnds = 3;
+    int first_bench = 0;
+    int n_benches = 0;
+    int legacy = 0;
+    int ret = EXIT_SUCCESS;
+    int opt = 0;
 
     if (argc == 1) {
-        fprintf(stderr, "USAGE:\nbench <file> <rounds> <bench> [<bench> ...]\n\n");
-        fprintf(stderr, "\nAvalilable benchmarks are:\n");
-        nbench = 0;
-        while (1) {
-            thisbench = benchmarks[nbench++];
-            if ((thisbench.name && thisbench.fn)) {
-                fprintf(stderr, "%s\n", thisbench.name);
-            } else {
-                return EXIT_FAILURE;
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (argv[1][0] != '-') {
+        /* The original interface: bench <file> <rounds> <bench> ... */
+        if (argc < 4) {
+            usage();
+            return EXIT_FAILURE;
+        }
+        legacy = 1;
+        infile = strdup(argv[1]);
+        rnds = atoi(argv[2]);
+        first_bench = 3;
+    } else {
+        while ((opt = getopt(argc, argv, "i:s:l:az:k:r:j:b:t:h")) != -1) {
+            switch (opt) {
+                case 'i': infile = strdup(optarg); break;
+                case 's': synth_size = bench_parse_size(optarg); break;
+                case 'l': read_len = strtoul(optarg, NULL, 10); break;
+                case 'a': fasta = 1; break;
+                case 'z': level = atoi(optarg); break;
+                case 'k': keep_path = optarg; break;
+                case 'r': rnds = atoi(optarg); break;
+                case 'j': json_path = optarg; break;
+                case 'b': baseline_path = optarg; break;
+                case 't': tolerance = strtod(optarg, NULL); break;
+                default:
+                    usage();
+                    return EXIT_FAILURE;
             }
         }
+        first_bench = optind;
     }
-    if (argc < 4) {
-        fprintf(stderr, "USAGE:\nbench <file> <rounds> <bench> [<bench> ...]\n\n");
+    if (rnds < 1 || read_len < 1) {
+        usage();
         return EXIT_FAILURE;
-    } else {
-        infile = strdup(argv[1]);
-        rnds = atoi(argv[2]);
-        printf("Begining benchmarks.\n");
-        printf("---------------------------------------------------------------------\n");
     }
-    for (iii = 3; iii < (unsigned int) argc; iii++) {
-        nbench = 0;
-        while (1) {
-            thisbench = benchmarks[nbench++];
-            if (!(thisbench.name && thisbench.fn)) {
-                fprintf(stderr, "bad benchmark %s\n", argv[iii]);
-                break;
-            }
-            if  (strcmp(argv[iii], thisbench.name) == 0) {
-                int rnd = 0;
-                start = clock();
-                for (rnd = 0; rnd<rnds; rnd++) {
-                    (*thisbench.fn)(rnd != rnds - 1);
-                }
-                end = clock();
-                printf("Benchmark %s took %0.6fs per round [%d rounds]\n",
-                        thisbench.name,
-                        (float)(end - start) / (float)(CLOCKS_PER_SEC * rnds),
-                        rnds);
-                printf("---------------------------------------------------------------------\n");
-                break;
+    if (infile == NULL) {
+        synth_path = keep_path != NULL ? strdup(keep_path) : bench_tmpfile();
+        if (synth_path == NULL ||
+                bench_generate(synth_path, synth_size, read_len, fasta,
+                               level) != 0) {
+            fprintf(stderr, "Couldn't generate synthetic reads\n");
+            free(synth_path);
+            return EXIT_FAILURE;
+        }
+        infile = strdup(synth_path);
+    }
+    file_bytes = bench_file_bytes(infile);
+    n_benches = argc - first_bench;
+    if (n_benches < 1) {
+        /* Run them all */
+        n_benches = 0;
+        while (benchmarks[n_benches].name != NULL) {
+            n_benches++;
+        }
+    }
+    stats = calloc(n_benches, sizeof(*stats));
+    assert(stats != NULL);
+    printf("Begining benchmarks of %s (%zu bytes).\n", infile, file_bytes);
+    printf("---------------------------------------------------------------------\n");
+    for (iii = 0; iii < (size_t)n_benches; iii++) {
+        if (first_bench < argc) {
+            thisbench = find_bench(argv[first_bench + iii]);
+            if (thisbench == NULL) {
+                fprintf(stderr, "bad benchmark %s\n", argv[first_bench + iii]);
+                continue;
             }
+        } else {
+            thisbench = &benchmarks[iii];
         }
+        run_bench(thisbench, rnds, file_bytes, &stats[n_stats]);
+        if (legacy) {
+            printf("Benchmark %s took %0.6fs per round [%d rounds]\n",
+                   thisbench->name, stats[n_stats].seconds, rnds);
+        }
+        printf("%-32s %10.2f MB/s %12.0f rec/s %8.2f cyc/B %8ld KB RSS\n",
+               thisbench->name, stats[n_stats].mb_per_s,
+               stats[n_stats].records_per_s, stats[n_stats].cycles_per_byte,
+               stats[n_stats].peak_rss_kb);
+        printf("---------------------------------------------------------------------\n");
+        n_stats++;
+    }
+    if (json_path != NULL &&
+            write_json(json_path, stats, n_stats, rnds, file_bytes,
+                       synth_path != NULL, read_len, fasta, level) != 0) {
+        fprintf(stderr, "Couldn't write JSON to %s\n", json_path);
+        ret = EXIT_FAILURE;
+    }
+    if (baseline_path != NULL &&
+            compare_baseline(baseline_path, stats, n_stats, tolerance) != 0) {
+        ret = EXIT_FAILURE;
+    }
+    if (synth_path != NULL && keep_path == NULL) {
+        remove(synth_path);
     }
+    bench_free_records();
+    free(synth_path);
+    free(stats);
     free(infile);
-    return EXIT_SUCCESS;
+    return ret;
 } /* ----------  end of function main  ---------- */
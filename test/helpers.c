@@ -145,3 +145,34 @@ crc32_file(const char *filepath)
     crcbuf[len] = '\0';
     return strdup(crcbuf);
 }
+
+
+/*===  FUNCTION  ============================================================*
+Name:           read_whole_file
+Paramters:      const char *: filename
+                size_t *: Set to the length of the file
+Description:    Read all of a file into memory, with a terminating '\0'.
+Returns:        char *: The contents, on the heap, or NULL on error.
+ *===========================================================================*/
+
+char *
+read_whole_file(const char *fname, size_t *len)
+{
+    FILE *fp = fopen(fname, "rb");
+    char *buf = NULL;
+    struct stat st;
+
+    if (fp == NULL || stat(fname, &st) != 0) goto err;
+    buf = malloc(st.st_size + 1);
+    if (buf == NULL || fread(buf, 1, st.st_size, fp) != (size_t)st.st_size) {
+        goto err;
+    }
+    buf[st.st_size] = '\0';
+    *len = st.st_size;
+    fclose(fp);
+    return buf;
+err:
+    if (fp != NULL) fclose(fp);
+    free(buf);
+    return NULL;
+}
@@ -43,5 +43,6 @@ char *find_data_file(const char * filepath);
 char *get_writable_file(void);
 void clean_writable_file(char *filepath);
 char *crc32_file(const char *filepath);
+char *read_whole_file(const char *fname, size_t *len);
 
 #endif /* HELPERS_H */
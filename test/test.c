@@ -26,6 +26,24 @@ struct testgroup_t libqes_tests[] = {
     {"qes/seqfile/", qes_seqfile_tests},
     {"qes/seq/", qes_seq_tests},
     {"qes/sequtil/", qes_sequtil_tests},
+    {"qes/seqindex/", qes_seqindex_tests},
+    {"qes/arena/", qes_arena_tests},
+    {"qes/seqpool/", qes_seqpool_tests},
+    {"qes/seqbatch/", qes_seqbatch_tests},
+    {"qes/compress/", qes_compress_tests},
+    {"qes/aio/", qes_aio_tests},
+    {"qes/pairedfile/", qes_pairedfile_tests},
+    {"qes/seqstats/", qes_seqstats_tests},
+    {"qes/trim/", qes_trim_tests},
+    {"qes/demux/", qes_demux_tests},
+    {"qes/dedup/", qes_dedup_tests},
+    {"qes/sort/", qes_sort_tests},
+    {"qes/sample/", qes_sample_tests},
+    {"qes/nameset/", qes_nameset_tests},
+    {"qes/illumina/", qes_illumina_tests},
+    {"qes/binseq/", qes_binseq_tests},
+    {"qes/qual/", qes_qual_tests},
+    {"qes/merge/", qes_merge_tests},
     {"testdata/", data_tests},
     END_OF_GROUPS
 };
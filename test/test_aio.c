@@ -0,0 +1,326 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_aio.c
+ *
+ *    Description:  Tests for the qes_aio module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 19:40:21
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <fcntl.h>
+#include <qes_aio.h>
+#include <qes_seqfile.h>
+
+
+static void
+test_qes_aio_read (void *ptr)
+{
+    struct qes_aio *aio = NULL;
+    char *fname = NULL;
+    char *expect = NULL;
+    char buf[1000];
+    size_t expect_len = 0;
+    size_t pos = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+    ssize_t res = 0;
+    int fd = -1;
+    const unsigned depths[] = {0, 1, 2, 8};
+    const size_t bufsizes[] = {7, 777, 4096, 1<<16};
+    const off_t offsets[] = {100000, 1, 65000, 65536, 0, 144000};
+
+    (void) ptr;
+    fname = find_data_file("test.fastq");
+    expect = read_whole_file(fname, &expect_len);
+    tt_ptr_op(expect, !=, NULL);
+    fd = open(fname, O_RDONLY);
+    tt_int_op(fd, >=, 0);
+    for (iii = 0; iii < sizeof(depths) / sizeof(*depths); iii++) {
+    for (jjj = 0; jjj < sizeof(bufsizes) / sizeof(*bufsizes); jjj++) {
+        /* Start part-way in, as for an fd handed to qes_file_dopen */
+        tt_int_op(lseek(fd, 10, SEEK_SET), ==, 10);
+        aio = qes_aio_open(fd, 0, depths[iii], bufsizes[jjj]);
+        tt_ptr_op(aio, !=, NULL);
+        if (depths[iii] < 2) {
+            tt_int_op(qes_aio_async(aio), ==, 0);
+        }
+        pos = 10;
+        while ((res = qes_aio_read(aio, buf, sizeof(buf))) > 0) {
+            tt_assert(pos + res <= expect_len);
+            tt_int_op(memcmp(buf, expect + pos, res), ==, 0);
+            pos += res;
+            tt_int_op(qes_aio_tell(aio), ==, pos);
+        }
+        tt_int_op(res, ==, 0);
+        tt_int_op(pos, ==, expect_len);
+        for (pos = 0; pos < sizeof(offsets) / sizeof(*offsets); pos++) {
+            tt_int_op(qes_aio_seek(aio, offsets[pos]), ==, 0);
+            tt_int_op(qes_aio_tell(aio), ==, offsets[pos]);
+            res = qes_aio_read(aio, buf, 100);
+            tt_int_op(res, ==, 100);
+            tt_int_op(memcmp(buf, expect + offsets[pos], 100), ==, 0);
+        }
+        /* Writing to a reader is an error */
+        tt_int_op(qes_aio_write(aio, buf, 1), ==, -1);
+        tt_int_op(qes_aio_close(aio), ==, 0);
+        aio = NULL;
+        /* The fd is left where we stopped reading */
+        tt_int_op(lseek(fd, 0, SEEK_CUR), ==, offsets[pos - 1] + 100);
+    }
+    }
+    /* Bad arguments */
+    tt_ptr_op(qes_aio_open(-1, 0, 4, 100), ==, NULL);
+    tt_ptr_op(qes_aio_open(fd, 0, 4, 0), ==, NULL);
+    tt_int_op(qes_aio_read(NULL, buf, 1), ==, -1);
+    tt_int_op(qes_aio_close(NULL), ==, 0);
+end:
+    qes_aio_close(aio);
+    if (fd >= 0) close(fd);
+    free(fname);
+    free(expect);
+}
+
+static void
+test_qes_aio_write (void *ptr)
+{
+    struct qes_aio *aio = NULL;
+    char *fname = NULL;
+    char *outname = NULL;
+    char *expect = NULL;
+    char *got = NULL;
+    size_t expect_len = 0;
+    size_t got_len = 0;
+    size_t pos = 0;
+    size_t len = 0;
+    size_t iii = 0;
+    int fd = -1;
+    const unsigned depths[] = {0, 1, 4};
+
+    (void) ptr;
+    fname = find_data_file("test.fastq");
+    expect = read_whole_file(fname, &expect_len);
+    tt_ptr_op(expect, !=, NULL);
+    for (iii = 0; iii < sizeof(depths) / sizeof(*depths); iii++) {
+        outname = get_writable_file();
+        fd = open(outname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        tt_int_op(fd, >=, 0);
+        /* Whatever was written before us stays put */
+        tt_int_op(write(fd, expect, 5), ==, 5);
+        aio = qes_aio_open(fd, 1, depths[iii], 1000);
+        tt_ptr_op(aio, !=, NULL);
+        /* Writes both smaller and larger than the buffers */
+        for (pos = 5, len = 1; pos < expect_len; pos += len, len = 3 * len) {
+            if (len > expect_len - pos) len = expect_len - pos;
+            tt_int_op(qes_aio_write(aio, expect + pos, len), ==, len);
+        }
+        tt_int_op(qes_aio_tell(aio), ==, expect_len);
+        tt_int_op(qes_aio_flush(aio), ==, 0);
+        tt_int_op(qes_aio_tell(aio), ==, expect_len);
+        tt_int_op(qes_aio_read(aio, got, 1), ==, -1);
+        tt_int_op(qes_aio_close(aio), ==, 0);
+        aio = NULL;
+        tt_int_op(lseek(fd, 0, SEEK_CUR), ==, expect_len);
+        close(fd);
+        fd = -1;
+        got = read_whole_file(outname, &got_len);
+        tt_ptr_op(got, !=, NULL);
+        tt_int_op(got_len, ==, expect_len);
+        tt_int_op(memcmp(got, expect, expect_len), ==, 0);
+        free(got);
+        got = NULL;
+        clean_writable_file(outname);
+        outname = NULL;
+    }
+end:
+    qes_aio_close(aio);
+    if (fd >= 0) close(fd);
+    if (outname != NULL) clean_writable_file(outname);
+    free(fname);
+    free(expect);
+    free(got);
+}
+
+static void
+test_qes_aio_pipe (void *ptr)
+{
+    struct qes_aio *aio = NULL;
+    const char *data = "Pipes can't be read asynchronously\n";
+    char buf[100];
+    int pfd[2] = {-1, -1};
+    ssize_t res = 0;
+
+    (void) ptr;
+    tt_int_op(pipe(pfd), ==, 0);
+    tt_int_op(write(pfd[1], data, strlen(data)), ==, strlen(data));
+    close(pfd[1]);
+    pfd[1] = -1;
+    /* So we fall back to synchronous reads */
+    aio = qes_aio_open(pfd[0], 0, 8, 4);
+    tt_ptr_op(aio, !=, NULL);
+    tt_int_op(qes_aio_async(aio), ==, 0);
+    tt_int_op(aio->depth, ==, 1);
+    res = qes_aio_read(aio, buf, sizeof(buf));
+    tt_int_op(res, ==, strlen(data));
+    tt_int_op(memcmp(buf, data, res), ==, 0);
+    tt_int_op(qes_aio_read(aio, buf, sizeof(buf)), ==, 0);
+    tt_int_op(qes_aio_tell(aio), ==, strlen(data));
+    tt_int_op(qes_aio_seek(aio, 0), ==, 1);
+end:
+    qes_aio_close(aio);
+    if (pfd[0] >= 0) close(pfd[0]);
+    if (pfd[1] >= 0) close(pfd[1]);
+}
+
+/* qes_file and qes_seqfile, with reads and writes in flight */
+static void
+test_qes_aio_file (void *ptr)
+{
+    struct qes_file *file = NULL;
+    struct qes_seqfile *in = NULL;
+    struct qes_seqfile *out = NULL;
+    struct qes_seq *seq = NULL;
+    struct qes_file_opts opts = {.bufsize = 1000, .zbufsize = 4096,
+                                 .io_depth = 4};
+    gzFile gz = NULL;
+    FILE *fp = NULL;
+    char *fname = NULL;
+    char *outname = NULL;
+    char *expect = NULL;
+    char *buf = NULL;
+    size_t expect_len = 0;
+    size_t bufsize = 1<<10;
+    size_t pos = 0;
+    size_t iii = 0;
+    ssize_t res = 0;
+    const char *fnames[] = {"test.fastq", "test.fastq.gz", "test.fastq.bgz",
+                            "test.fastq.bz2", "test.fastq.xz",
+                            "test.fastq.zst"};
+    const char *wmodes[] = {"w", "w1", "wT"};
+
+    (void) ptr;
+    fname = find_data_file("test.fastq");
+    expect = read_whole_file(fname, &expect_len);
+    tt_ptr_op(expect, !=, NULL);
+    free(fname);
+    fname = NULL;
+    buf = malloc(bufsize);
+    for (iii = 0; iii < sizeof(fnames) / sizeof(*fnames); iii++) {
+        fname = find_data_file(fnames[iii]);
+        file = qes_file_open_opts_errnil(fname, "r", &opts);
+        free(fname);
+        fname = NULL;
+        if (file == NULL) {
+            /* Not built with this format */
+            continue;
+        }
+        /* zlib's gz* functions can't read ahead */
+        tt_ptr_op(file->fp, ==, NULL);
+        tt_int_op(file->raw, ==, iii == 0);
+        pos = 0;
+        while ((res = qes_file_readline_realloc(file, &buf, &bufsize)) > 0) {
+            tt_assert(pos + res <= expect_len);
+            tt_int_op(memcmp(buf, expect + pos, res), ==, 0);
+            pos += res;
+        }
+        tt_int_op(res, ==, EOF);
+        tt_int_op(pos, ==, expect_len);
+        /* Backwards, which reopens compressed files */
+        tt_int_op(qes_file_seek(file, 65000), ==, 0);
+        res = qes_file_readline(file, buf, bufsize);
+        tt_int_op(res, >, 0);
+        tt_int_op(memcmp(buf, expect + 65000, res), ==, 0);
+        qes_file_close(file);
+    }
+    /* Gzip members concatenated, then junk, which is ignored like gzread */
+    outname = get_writable_file();
+    gz = gzopen(outname, "wb");
+    tt_int_op(gzwrite(gz, expect, 100000), ==, 100000);
+    gzclose(gz);
+    gz = gzopen(outname, "ab");
+    tt_int_op(gzwrite(gz, expect + 100000, expect_len - 100000), ==,
+              expect_len - 100000);
+    gzclose(gz);
+    gz = NULL;
+    fp = fopen(outname, "ab");
+    tt_ptr_op(fp, !=, NULL);
+    tt_int_op(fwrite("junk\n", 1, 5, fp), ==, 5);
+    fclose(fp);
+    fp = NULL;
+    file = qes_file_open_opts(outname, "r", &opts);
+    tt_ptr_op(file, !=, NULL);
+    pos = 0;
+    while ((res = qes_file_readline_realloc(file, &buf, &bufsize)) > 0) {
+        tt_int_op(memcmp(buf, expect + pos, res), ==, 0);
+        pos += res;
+    }
+    tt_int_op(res, ==, EOF);
+    tt_int_op(pos, ==, expect_len);
+    qes_file_close(file);
+    clean_writable_file(outname);
+    outname = NULL;
+    /* Writing, compressed and not, and reading back */
+    for (iii = 0; iii < sizeof(wmodes) / sizeof(*wmodes); iii++) {
+        fname = find_data_file("test.fastq");
+        outname = get_writable_file();
+        in = qes_seqfile_create(fname, "r");
+        tt_ptr_op(in, !=, NULL);
+        out = qes_seqfile_dopen(open(outname, O_WRONLY | O_CREAT | O_TRUNC,
+                                     0666), wmodes[iii], &opts);
+        tt_ptr_op(out, !=, NULL);
+        tt_ptr_op(out->qf->fp, ==, NULL);
+        tt_int_op(out->qf->raw, ==, wmodes[iii][1] == 'T');
+        qes_seqfile_set_format(out, FASTQ_FMT);
+        seq = qes_seq_create();
+        while (qes_seqfile_read(in, seq) > 0) {
+            tt_int_op(qes_seqfile_write(out, seq), >, 0);
+        }
+        qes_seq_destroy(seq);
+        qes_seqfile_destroy(in);
+        qes_seqfile_destroy(out);
+        free(fname);
+        fname = NULL;
+        file = qes_file_open(outname, "r");
+        tt_ptr_op(file, !=, NULL);
+        tt_int_op(file->raw, ==, wmodes[iii][1] == 'T');
+        pos = 0;
+        while ((res = qes_file_readline_realloc(file, &buf, &bufsize)) > 0) {
+            tt_int_op(memcmp(buf, expect + pos, res), ==, 0);
+            pos += res;
+        }
+        tt_int_op(res, ==, EOF);
+        tt_int_op(pos, ==, expect_len);
+        qes_file_close(file);
+        clean_writable_file(outname);
+        outname = NULL;
+    }
+end:
+    qes_file_close(file);
+    qes_seq_destroy(seq);
+    qes_seqfile_destroy(in);
+    qes_seqfile_destroy(out);
+    if (gz != NULL) gzclose(gz);
+    if (fp != NULL) fclose(fp);
+    if (outname != NULL) clean_writable_file(outname);
+    free(fname);
+    free(expect);
+    free(buf);
+}
+
+struct testcase_t qes_aio_tests[] = {
+    { "qes_aio_read", test_qes_aio_read, 0, NULL, NULL},
+    { "qes_aio_write", test_qes_aio_write, 0, NULL, NULL},
+    { "qes_aio_pipe", test_qes_aio_pipe, 0, NULL, NULL},
+    { "qes_aio_file", test_qes_aio_file, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
@@ -0,0 +1,137 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_arena.c
+ *
+ *    Description:  Tests for the qes_arena module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 13:40:22
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_arena.h>
+#include <qes_seqfile.h>
+
+
+static void
+test_qes_arena_alloc (void *ptr)
+{
+    struct qes_arena *arena = NULL;
+    char *first = NULL;
+    char *a = NULL;
+    char *b = NULL;
+    char *big = NULL;
+    size_t size = 0;
+
+    (void) ptr;
+    arena = qes_arena_create(1024);
+    tt_ptr_op(arena, !=, NULL);
+    /* Allocations are aligned and don't overlap */
+    a = qes_arena_alloc(arena, 3);
+    b = qes_arena_alloc(arena, 100);
+    first = a;
+    tt_ptr_op(a, !=, NULL);
+    tt_ptr_op(b, !=, NULL);
+    tt_int_op((uintptr_t)a % QES_ARENA_ALIGN, ==, 0);
+    tt_int_op((uintptr_t)b % QES_ARENA_ALIGN, ==, 0);
+    tt_assert(b >= a + 3);
+    /* The last allocation grows in place */
+    memset(b, 'b', 100);
+    tt_ptr_op(qes_arena_realloc(arena, b, 100, 200), ==, b);
+    /* Others are copied */
+    memcpy(a, "ab", 3);
+    a = qes_arena_realloc(arena, a, 3, 50);
+    tt_str_op(a, ==, "ab");
+    tt_int_op(b[99], ==, 'b');
+    /* Allocations larger than a block get their own block */
+    big = qes_arena_alloc(arena, 4096);
+    tt_ptr_op(big, !=, NULL);
+    memset(big, 0, 4096);
+    tt_str_op(qes_arena_strndup(arena, "hello world", 5), ==, "hello");
+    /* Reset keeps the blocks for reuse */
+    size = qes_arena_size(arena);
+    qes_arena_reset(arena);
+    tt_ptr_op(qes_arena_alloc(arena, 3), ==, first);
+    big = qes_arena_alloc(arena, 4000);
+    tt_ptr_op(big, !=, NULL);
+    tt_int_op(qes_arena_size(arena), ==, size);
+    /* Bad arguments */
+    tt_ptr_op(qes_arena_alloc(NULL, 1), ==, NULL);
+    tt_ptr_op(qes_arena_strndup(arena, NULL, 1), ==, NULL);
+end:
+    qes_arena_destroy(arena);
+    tt_ptr_op(arena, ==, NULL);
+}
+
+static void
+test_qes_arena_seqfile (void *ptr)
+{
+    struct qes_arena *arena = NULL;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqfile *heapsf = NULL;
+    struct qes_seq *seq = NULL;
+    struct qes_seq *heapseq = qes_seq_create();
+    char *fname = NULL;
+    const char *files[] = {"test.fastq", "test.fasta"};
+    size_t size = 0;
+    size_t jjj = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    arena = qes_arena_create(0);
+    tt_ptr_op(arena, !=, NULL);
+    for (jjj = 0; jjj < sizeof(files) / sizeof(*files); jjj++) {
+        fname = find_data_file(files[jjj]);
+        tt_assert(fname != NULL);
+        sf = qes_seqfile_create(fname, "r");
+        heapsf = qes_seqfile_create(fname, "r");
+        /* One seq per record, all freed at once by a reset */
+        while (1) {
+            seq = qes_seq_create_arena(arena);
+            tt_ptr_op(seq, !=, NULL);
+            tt_ptr_op(seq->arena, ==, arena);
+            res = qes_seqfile_read(sf, seq);
+            tt_int_op(qes_seqfile_read(heapsf, heapseq), ==, res);
+            if (res < 1) break;
+            tt_str_op(seq->name.str, ==, heapseq->name.str);
+            tt_str_op(seq->comment.str, ==, heapseq->comment.str);
+            tt_str_op(seq->seq.str, ==, heapseq->seq.str);
+            tt_str_op(seq->qual.str, ==, heapseq->qual.str);
+            if (sf->n_records % 100 == 0) {
+                qes_seq_destroy(seq);
+                qes_arena_reset(arena);
+            }
+        }
+        tt_int_op(res, ==, EOF);
+        qes_seqfile_destroy(sf);
+        qes_seqfile_destroy(heapsf);
+        free(fname);
+        fname = NULL;
+    }
+    /* Resetting means the arena stops growing */
+    size = qes_arena_size(arena);
+    tt_int_op(size, <=, 2 * QES_ARENA_BLOCK_LEN + 2 * QES_ARENA_ALIGN);
+    tt_ptr_op(qes_seq_create_arena(NULL), ==, NULL);
+end:
+    qes_seqfile_destroy(sf);
+    qes_seqfile_destroy(heapsf);
+    qes_seq_destroy(heapseq);
+    qes_arena_destroy(arena);
+    if (fname != NULL) free(fname);
+}
+
+
+struct testcase_t qes_arena_tests[] = {
+    { "qes_arena_alloc", test_qes_arena_alloc, 0, NULL, NULL},
+    { "qes_arena_seqfile", test_qes_arena_seqfile, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
@@ -0,0 +1,334 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_binseq.c
+ *
+ *    Description:  Tests for the qes_binseq module
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 05:03:17
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_binseq.h>
+
+/* Read all records of ``fname`` */
+static struct qes_seq **
+load_seqs (const char *fname, size_t *n)
+{
+    struct qes_seqfile *sf = qes_seqfile_create(fname, "r");
+    struct qes_seq **seqs = calloc(1001, sizeof(*seqs));
+
+    *n = 0;
+    while (*n < 1001) {
+        seqs[*n] = qes_seq_create();
+        if (qes_seqfile_read(sf, seqs[*n]) < 0) {
+            qes_seq_destroy(seqs[*n]);
+            break;
+        }
+        (*n)++;
+    }
+    qes_seqfile_destroy(sf);
+    return seqs;
+}
+
+static void
+free_seqs (struct qes_seq **seqs, size_t n)
+{
+    size_t iii = 0;
+
+    if (seqs == NULL) return;
+    for (iii = 0; iii < n; iii++) qes_seq_destroy(seqs[iii]);
+    free(seqs);
+}
+
+#define str_eq(a, b)                                                        \
+    ((a)->len == (b)->len && memcmp((a)->str, (b)->str, (a)->len) == 0)
+
+static int
+seq_eq (const struct qes_seq *a, const struct qes_seq *b)
+{
+    return str_eq(&a->name, &b->name) && str_eq(&a->comment, &b->comment) &&
+           str_eq(&a->seq, &b->seq) && str_eq(&a->qual, &b->qual);
+}
+
+/* Write ``seqs`` to ``path`` in BINSEQ_FMT */
+static int
+write_seqs (const char *path, struct qes_seq **seqs, size_t n,
+            const struct qes_binseq_opts *opts)
+{
+    struct qes_seqfile *sf = qes_seqfile_create(path, "wT");
+    size_t iii = 0;
+    int ret = 1;
+
+    if (qes_binseq_set_opts(sf, opts) != 0) goto end;
+    for (iii = 0; iii < n; iii++) {
+        if (qes_seqfile_write(sf, seqs[iii]) <= 0) goto end;
+    }
+    ret = qes_binseq_finish(sf);
+end:
+    qes_seqfile_destroy(sf);
+    return ret;
+}
+
+static void
+test_qes_binseq_roundtrip (void *ptr)
+{
+    struct qes_binseq_opts opts;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq **seqs = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *path = get_writable_file();
+    char *fname = NULL;
+    const char *files[] = {"test.fastq", "test.fasta"};
+    const int levels[] = {-1, 0, 9, -1, 0};
+    size_t n_seqs = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+    size_t kkk = 0;
+
+    (void) ptr;
+    for (iii = 0; iii < 2; iii++) {
+        fname = find_data_file(files[iii]);
+        seqs = load_seqs(fname, &n_seqs);
+        tt_int_op(n_seqs, >, 500);
+        for (jjj = 0; jjj < 5; jjj++) {
+            memset(&opts, 0, sizeof(opts));
+            opts.block_size = 4096;
+            opts.level = levels[jjj];
+            /* Qualities coded by qes_qual, whether the rest is or not */
+            opts.qual_order = jjj < 3 ? 0 : jjj - 2;
+            tt_int_op(write_seqs(path, seqs, n_seqs, &opts), ==, 0);
+            sf = qes_seqfile_create(path, "r");
+            tt_int_op(sf->format, ==, BINSEQ_FMT);
+            for (kkk = 0; kkk < n_seqs; kkk++) {
+                tt_int_op(qes_seqfile_read(sf, seq), ==, seqs[kkk]->seq.len);
+                tt_assert(seq_eq(seq, seqs[kkk]));
+            }
+            tt_int_op(qes_seqfile_read(sf, seq), ==, EOF);
+            tt_int_op(sf->n_records, ==, n_seqs);
+            qes_seqfile_destroy(sf);
+        }
+        free_seqs(seqs, n_seqs);
+        seqs = NULL;
+        free(fname);
+        fname = NULL;
+    }
+    /* Odd bases, in runs, are kept as they were */
+    tt_int_op(qes_seq_fill(seq, "odd", "c", "NNACGTnnNRTTn", "IIIIIIIIIIIII"),
+              ==, 0);
+    tt_int_op(write_seqs(path, &seq, 1, NULL), ==, 0);
+    qes_seq_fill(seq, "x", "y", "A", "I");
+    sf = qes_seqfile_create(path, "r");
+    tt_int_op(qes_seqfile_read(sf, seq), ==, 13);
+    tt_str_op(seq->seq.str, ==, "NNACGTnnNRTTn");
+    tt_str_op(seq->name.str, ==, "odd");
+    tt_str_op(seq->comment.str, ==, "c");
+    qes_seqfile_destroy(sf);
+    /* Binned qualities, and no names */
+    memset(&opts, 0, sizeof(opts));
+    opts.bin_quals = 1;
+    tt_int_op(qes_seq_fill(seq, "bin", "c", "ACGTACGTA", "!%+5:?DIK"), ==,
+              0);
+    tt_int_op(write_seqs(path, &seq, 1, &opts), ==, 0);
+    sf = qes_seqfile_create(path, "r");
+    tt_int_op(qes_seqfile_set_header(sf, QES_HEADER_SKIP), ==, 0);
+    tt_int_op(qes_seqfile_read(sf, seq), ==, 9);
+    tt_str_op(seq->qual.str, ==, "!'07<BFII");
+    tt_int_op(seq->name.len, ==, 0);
+    tt_int_op(seq->comment.len, ==, 0);
+    qes_seqfile_destroy(sf);
+    /* No records at all */
+    tt_int_op(write_seqs(path, NULL, 0, NULL), ==, 0);
+    sf = qes_seqfile_create(path, "r");
+    tt_int_op(sf->format, ==, BINSEQ_FMT);
+    tt_int_op(qes_seqfile_read(sf, seq), ==, EOF);
+    qes_seqfile_destroy(sf);
+    /* Reading a file opened to write */
+    sf = qes_seqfile_create(path, "wT");
+    qes_seqfile_set_format(sf, BINSEQ_FMT);
+    tt_int_op(qes_seqfile_read(sf, seq), ==, -2);
+    tt_int_op(qes_seqfile_write(sf, seq), >, 0);
+    /* Too late to change the options */
+    tt_int_op(qes_binseq_set_opts(sf, NULL), ==, 1);
+end:
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+    free_seqs(seqs, n_seqs);
+    clean_writable_file(path);
+    free(fname);
+}
+
+static void
+test_qes_binseq_skip (void *ptr)
+{
+    struct qes_binseq_opts opts;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq **seqs = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *path = get_writable_file();
+    char *fname = find_data_file("test.fastq");
+    char *buf = NULL;
+    FILE *fp = NULL;
+    size_t n_seqs = 0;
+    size_t len = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    seqs = load_seqs(fname, &n_seqs);
+    memset(&opts, 0, sizeof(opts));
+    opts.block_size = 4096;
+    tt_int_op(write_seqs(path, seqs, n_seqs, &opts), ==, 0);
+    sf = qes_seqfile_create(path, "r");
+    tt_int_op(qes_seqfile_skip(sf, 1), ==, 1);
+    tt_int_op(qes_seqfile_read(sf, seq), >, 0);
+    tt_assert(seq_eq(seq, seqs[1]));
+    /* Whole blocks are skipped */
+    tt_int_op(qes_seqfile_skip(sf, 600), ==, 600);
+    tt_int_op(qes_seqfile_read(sf, seq), >, 0);
+    tt_assert(seq_eq(seq, seqs[602]));
+    tt_int_op(sf->n_records, ==, 603);
+    tt_int_op(qes_seqfile_skip(sf, SIZE_MAX), ==, n_seqs - 603);
+    tt_int_op(qes_seqfile_read(sf, seq), ==, EOF);
+    tt_int_op(qes_seqfile_skip(sf, 1), ==, 0);
+    qes_seqfile_destroy(sf);
+    /* Without its index, a file is truncated */
+    buf = read_whole_file(path, &len);
+    fp = fopen(path, "w");
+    tt_ptr_op(fp, !=, NULL);
+    tt_int_op(fwrite(buf, 1, len / 2, fp), ==, len / 2);
+    fclose(fp);
+    sf = qes_seqfile_create(path, "r");
+    do {
+        res = qes_seqfile_read(sf, seq);
+    } while (res > 0);
+    tt_int_op(res, ==, -2);
+    tt_int_op(sf->n_records, <, n_seqs / 2 + 50);
+    qes_seqfile_destroy(sf);
+    sf = qes_seqfile_create(path, "r");
+    tt_int_op(qes_seqfile_skip(sf, SIZE_MAX), ==, -2);
+end:
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+    free_seqs(seqs, n_seqs);
+    clean_writable_file(path);
+    free(fname);
+    free(buf);
+}
+
+static void
+test_qes_binseq_map (void *ptr)
+{
+    struct qes_binseq_opts opts;
+    struct qes_binseq_map *map = NULL;
+    struct qes_binseq_block *block = qes_binseq_block_create();
+    struct qes_seq **seqs = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *path = get_writable_file();
+    char *fname = find_data_file("test.fastq");
+    const uint64_t records[] = {999, 0, 1, 500, 501, 998};
+    int64_t blk = 0;
+    size_t n_seqs = 0;
+    size_t iii = 0;
+
+    (void) ptr;
+    seqs = load_seqs(fname, &n_seqs);
+    memset(&opts, 0, sizeof(opts));
+    opts.block_size = 4096;
+    opts.qual_order = 2;
+    tt_int_op(write_seqs(path, seqs, n_seqs, &opts), ==, 0);
+    map = qes_binseq_map_open(path);
+    tt_ptr_op(map, !=, NULL);
+    tt_int_op(map->n_records, ==, n_seqs);
+    tt_int_op(map->n_blocks, >, 10);
+    for (iii = 0; iii < 6; iii++) {
+        blk = qes_binseq_map_find(map, records[iii]);
+        tt_int_op(blk, >=, 0);
+        tt_int_op(qes_binseq_map_block(map, blk, block), ==, 0);
+        tt_int_op(block->first_record, <=, records[iii]);
+        tt_int_op(block->first_record + block->n_records, >, records[iii]);
+        tt_int_op(qes_binseq_block_get(block,
+                                       records[iii] - block->first_record,
+                                       seq), ==, seqs[records[iii]]->seq.len);
+        tt_assert(seq_eq(seq, seqs[records[iii]]));
+    }
+    tt_int_op(qes_binseq_map_find(map, n_seqs), ==, -1);
+    tt_int_op(qes_binseq_map_block(map, map->n_blocks, block), ==, 1);
+    tt_int_op(qes_binseq_block_get(block, block->n_records, seq), ==, -2);
+    qes_binseq_map_close(map);
+    tt_ptr_op(map, ==, NULL);
+    /* Not in BINSEQ_FMT */
+    tt_ptr_op(qes_binseq_map_open(fname), ==, NULL);
+    tt_ptr_op(qes_binseq_map_open(NULL), ==, NULL);
+end:
+    qes_binseq_map_close(map);
+    qes_binseq_block_destroy(block);
+    qes_seq_destroy(seq);
+    free_seqs(seqs, n_seqs);
+    clean_writable_file(path);
+    free(fname);
+}
+
+static void
+test_qes_binseq_finish (void *ptr)
+{
+    struct qes_binseq_map *map = NULL;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq **seqs = NULL;
+    char *path = get_writable_file();
+    char *fname = find_data_file("test.fastq");
+    size_t n_seqs = 0;
+
+    (void) ptr;
+    seqs = load_seqs(fname, &n_seqs);
+    sf = qes_seqfile_create(path, "wT");
+    /* Not in BINSEQ_FMT yet */
+    tt_int_op(qes_binseq_finish(sf), ==, 1);
+    tt_int_op(qes_binseq_set_opts(sf, NULL), ==, 0);
+    tt_int_op(qes_seqfile_write(sf, seqs[0]), >, 0);
+    tt_int_op(qes_binseq_flush(sf), ==, 0);
+    tt_int_op(qes_seqfile_write(sf, seqs[1]), >, 0);
+    tt_int_op(qes_binseq_finish(sf), ==, 0);
+    /* Finished files take no more records, nor a second index */
+    tt_int_op(qes_seqfile_write(sf, seqs[2]), ==, -2);
+    tt_int_op(qes_binseq_flush(sf), ==, 1);
+    tt_int_op(qes_binseq_finish(sf), ==, 1);
+    qes_seqfile_destroy(sf);
+    map = qes_binseq_map_open(path);
+    tt_ptr_op(map, !=, NULL);
+    tt_int_op(map->n_records, ==, 2);
+    tt_int_op(map->n_blocks, ==, 2);
+    /* A full disk is reported, rather than leaving a truncated file */
+    sf = qes_seqfile_create("/dev/full", "wT");
+    tt_ptr_op(sf, !=, NULL);
+    tt_int_op(qes_binseq_set_opts(sf, NULL), ==, 0);
+    tt_int_op(qes_seqfile_write(sf, seqs[0]), >, 0);
+    tt_int_op(qes_binseq_finish(sf), ==, 1);
+    qes_seqfile_destroy(sf);
+    /* Reading files can't be finished */
+    sf = qes_seqfile_create(fname, "r");
+    tt_int_op(qes_binseq_finish(sf), ==, 1);
+    tt_int_op(qes_binseq_finish(NULL), ==, 1);
+end:
+    qes_seqfile_destroy(sf);
+    qes_binseq_map_close(map);
+    free_seqs(seqs, n_seqs);
+    clean_writable_file(path);
+    free(fname);
+}
+
+struct testcase_t qes_binseq_tests[] = {
+    { "qes_binseq_roundtrip", test_qes_binseq_roundtrip, 0, NULL, NULL},
+    { "qes_binseq_skip", test_qes_binseq_skip, 0, NULL, NULL},
+    { "qes_binseq_map", test_qes_binseq_map, 0, NULL, NULL},
+    { "qes_binseq_finish", test_qes_binseq_finish, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
@@ -0,0 +1,412 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_compress.c
+ *
+ *    Description:  Tests for the qes_compress module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 16:58:03
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_file.h>
+#include <sys/wait.h>
+
+/* test.fastq in each format we can detect */
+static const struct {
+    const char *fname;
+    enum qes_compression type;
+} compressed_files[] = {
+    {"test.fastq", QES_COMPRESSION_GZIP},
+    {"test.fastq.gz", QES_COMPRESSION_GZIP},
+    {"test.fastq.bgz", QES_COMPRESSION_BGZF},
+    {"test.fastq.bz2", QES_COMPRESSION_BZIP2},
+    {"test.fastq.xz", QES_COMPRESSION_XZ},
+    {"test.fastq.zst", QES_COMPRESSION_ZSTD},
+};
+#define N_COMPRESSED_FILES (sizeof(compressed_files) / \
+                            sizeof(*compressed_files))
+
+/* Fork a child writing ``len`` bytes of ``data`` to a pipe, returning the
+ * pipe's read end */
+static int
+feed_pipe (const char *data, size_t len, pid_t *pid)
+{
+    int pfd[2];
+    ssize_t res = 0;
+
+    if (pipe(pfd) != 0) return -1;
+    *pid = fork();
+    if (*pid < 0) {
+        close(pfd[0]);
+        close(pfd[1]);
+        return -1;
+    } else if (*pid == 0) {
+        close(pfd[0]);
+        while (len > 0 && (res = write(pfd[1], data, len)) > 0) {
+            data += res;
+            len -= res;
+        }
+        _exit(len == 0 ? 0 : 1);
+    }
+    close(pfd[1]);
+    return pfd[0];
+}
+
+static void
+test_qes_compress_detect (void *ptr)
+{
+    char *fname = NULL;
+    size_t iii = 0;
+    enum qes_compression type = QES_COMPRESSION_AUTO;
+
+    (void) ptr;
+    type = qes_compress_detect((const unsigned char *)"BZh9", 4);
+    tt_int_op(type, ==, QES_COMPRESSION_BZIP2);
+    type = qes_compress_detect((const unsigned char *)"BZhx", 4);
+    tt_int_op(type, ==, QES_COMPRESSION_GZIP);
+    type = qes_compress_detect((const unsigned char *)"\xfd" "7zXZ\0", 6);
+    tt_int_op(type, ==, QES_COMPRESSION_XZ);
+    type = qes_compress_detect((const unsigned char *)"\x28\xb5\x2f\xfd", 4);
+    tt_int_op(type, ==, QES_COMPRESSION_ZSTD);
+    type = qes_compress_detect((const unsigned char *)"\x5e\x2a\x4d\x18", 4);
+    tt_int_op(type, ==, QES_COMPRESSION_ZSTD);
+    type = qes_compress_detect((const unsigned char *)"\x1f\x8b", 2);
+    tt_int_op(type, ==, QES_COMPRESSION_GZIP);
+    type = qes_compress_detect((const unsigned char *)"@HWI", 4);
+    tt_int_op(type, ==, QES_COMPRESSION_GZIP);
+    type = qes_compress_detect(NULL, 0);
+    tt_int_op(type, ==, QES_COMPRESSION_GZIP);
+    for (iii = 0; iii < N_COMPRESSED_FILES; iii++) {
+        fname = find_data_file(compressed_files[iii].fname);
+        type = qes_compress_detect_path(fname);
+        tt_int_op(type, ==, compressed_files[iii].type);
+        free(fname);
+        fname = NULL;
+    }
+    /* Empty, missing and non-regular files go to zlib */
+    fname = find_data_file("empty.txt");
+    type = qes_compress_detect_path(fname);
+    tt_int_op(type, ==, QES_COMPRESSION_GZIP);
+    type = qes_compress_detect_path("/non/existent");
+    tt_int_op(type, ==, QES_COMPRESSION_GZIP);
+    type = qes_compress_detect_path("/dev/null");
+    tt_int_op(type, ==, QES_COMPRESSION_GZIP);
+    /* Backends */
+    tt_ptr_op(qes_compress_backend(QES_COMPRESSION_AUTO), ==, NULL);
+    tt_str_op(qes_compress_backend(QES_COMPRESSION_GZIP)->name, ==, "gzip");
+#ifdef LIBDEFLATE_FOUND
+    tt_str_op(qes_compress_backend(QES_COMPRESSION_BGZF)->name, ==, "bgzf");
+#else
+    tt_str_op(qes_compress_backend(QES_COMPRESSION_BGZF)->name, ==, "gzip");
+#endif
+end:
+    if (fname != NULL) free(fname);
+}
+
+static void
+test_qes_compress_read (void *ptr)
+{
+    struct qes_file *file = NULL;
+    struct qes_file_opts opts;
+    char *fname = NULL;
+    char *expect = NULL;
+    char *buf = NULL;
+    size_t expect_len = 0;
+    size_t bufsize = 1<<10;
+    size_t pos = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+    ssize_t res = 0;
+    struct stat st;
+    const off_t offsets[] = {100000, 1, 65000, 65536, 144229, 0, 80000};
+
+    (void) ptr;
+    fname = find_data_file("test.fastq");
+    expect = read_whole_file(fname, &expect_len);
+    tt_ptr_op(expect, !=, NULL);
+    free(fname);
+    fname = NULL;
+    buf = malloc(bufsize);
+    for (iii = 0; iii < N_COMPRESSED_FILES; iii++) {
+        fname = find_data_file(compressed_files[iii].fname);
+        if (qes_compress_backend(compressed_files[iii].type) == NULL) {
+            /* Not built in, so we must refuse rather than return garbage */
+            file = qes_file_open(fname, "r");
+            tt_ptr_op(file, ==, NULL);
+            free(fname);
+            fname = NULL;
+            continue;
+        }
+        /* Small buffers, so that we cross compressed block boundaries */
+        memset(&opts, 0, sizeof(opts));
+        opts.bufsize = 1000;
+        opts.zbufsize = 777;
+        file = qes_file_open_opts(fname, "r", &opts);
+        tt_ptr_op(file, !=, NULL);
+        tt_ptr_op(file->backend, ==,
+                  qes_compress_backend(compressed_files[iii].type));
+        /* Only zlib files have a gzFile */
+        tt_int_op(file->fp != NULL, ==,
+                  file->backend->type == QES_COMPRESSION_GZIP);
+        pos = 0;
+        while ((res = qes_file_readline_realloc(file, &buf, &bufsize)) > 0) {
+            tt_assert(pos + res <= expect_len);
+            tt_int_op(memcmp(buf, expect + pos, res), ==, 0);
+            pos += res;
+        }
+        tt_int_op(res, ==, EOF);
+        tt_int_op(pos, ==, expect_len);
+        tt_int_op(file->filepos, ==, expect_len);
+        tt_ptr_op(qes_file_error(file), !=, NULL);
+        /* Seeks, backwards and forwards, land on the right byte */
+        for (jjj = 0; jjj < sizeof(offsets) / sizeof(*offsets); jjj++) {
+            tt_int_op(qes_file_seek(file, offsets[jjj]), ==, 0);
+            tt_int_op(qes_file_peek(file), ==, expect[offsets[jjj]]);
+            res = qes_file_readline(file, buf, bufsize);
+            tt_int_op(res, >, 0);
+            tt_int_op(memcmp(buf, expect + offsets[jjj], res), ==, 0);
+        }
+        if (file->backend->type != QES_COMPRESSION_GZIP) {
+            /* zlib lets us seek past the end */
+            tt_int_op(qes_file_seek(file, expect_len + 10), ==, 1);
+        }
+        qes_file_rewind(file);
+        tt_int_op(qes_file_readline(file, buf, bufsize), >, 0);
+        tt_int_op(strncmp(buf, expect, strlen(buf)), ==, 0);
+        /* Forcing the format works too */
+        opts.compression = compressed_files[iii].type;
+        qes_file_close(file);
+        file = qes_file_open_opts(fname, "r", &opts);
+        tt_ptr_op(file, !=, NULL);
+        do {
+            res = qes_file_readline_realloc(file, &buf, &bufsize);
+        } while (res > 0);
+        tt_int_op(res, ==, EOF);
+        tt_int_op(file->filepos, ==, expect_len);
+#ifdef QES_STATS
+        {
+            struct qes_file_stats stats;
+            tt_int_op(stat(fname, &st), ==, 0);
+            tt_int_op(qes_file_stats(file, &stats), ==, 0);
+            tt_int_op(stats.bytes_uncompressed, ==, expect_len);
+            tt_int_op(stats.bytes_compressed, <=, st.st_size);
+            tt_int_op(stats.bytes_compressed, >, 0);
+        }
+#else
+        (void) st;
+#endif
+        qes_file_close(file);
+        free(fname);
+        fname = NULL;
+    }
+    /* Only zlib writes */
+    memset(&opts, 0, sizeof(opts));
+    opts.compression = QES_COMPRESSION_XZ;
+    fname = get_writable_file();
+    file = qes_file_open_opts(fname, "w", &opts);
+    tt_ptr_op(file, !=, NULL);
+    tt_ptr_op(file->backend, ==, qes_compress_backend(QES_COMPRESSION_GZIP));
+    qes_file_close(file);
+    clean_writable_file(fname);
+    fname = NULL;
+end:
+    qes_file_close(file);
+    if (fname != NULL) free(fname);
+    free(expect);
+    free(buf);
+}
+
+static void
+test_qes_compress_truncated (void *ptr)
+{
+    struct qes_file *file = NULL;
+    FILE *fp = NULL;
+    char *fname = NULL;
+    char *outname = NULL;
+    char *data = NULL;
+    char buf[1<<10];
+    struct qes_file_opts opts = {.bufsize = 1<<10};
+    size_t len = 0;
+    size_t iii = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    for (iii = 0; iii < N_COMPRESSED_FILES; iii++) {
+        /* zlib reads what it can of a truncated gzip file without error */
+        if (qes_compress_backend(compressed_files[iii].type) == NULL ||
+                qes_compress_backend(compressed_files[iii].type)->type ==
+                QES_COMPRESSION_GZIP) {
+            continue;
+        }
+        fname = find_data_file(compressed_files[iii].fname);
+        data = read_whole_file(fname, &len);
+        tt_ptr_op(data, !=, NULL);
+        outname = get_writable_file();
+        fp = fopen(outname, "wb");
+        tt_int_op(fwrite(data, 1, len * 3 / 4, fp), ==, len * 3 / 4);
+        fclose(fp);
+        fp = NULL;
+        /* Formats like bzip2 can't decompress anything until they have a
+         * whole block, in which case the error comes from the first read, in
+         * qes_file_open */
+        file = qes_file_open_opts(outname, "r", &opts);
+        if (file != NULL) {
+            do {
+                res = qes_file_readline(file, buf, sizeof(buf));
+            } while (res > 0);
+            tt_int_op(res, ==, -2);
+            tt_str_op(qes_file_error(file), !=, "");
+        }
+        qes_file_close(file);
+        clean_writable_file(outname);
+        outname = NULL;
+        free(data);
+        data = NULL;
+        free(fname);
+        fname = NULL;
+    }
+end:
+    qes_file_close(file);
+    if (fp != NULL) fclose(fp);
+    if (outname != NULL) clean_writable_file(outname);
+    if (fname != NULL) free(fname);
+    free(data);
+}
+
+static void
+test_qes_compress_bgzf_xlen (void *ptr)
+{
+    struct qes_file *file = NULL;
+    struct qes_file_opts opts = {.compression = QES_COMPRESSION_BGZF};
+    FILE *fp = NULL;
+    char *fname = get_writable_file();
+    char buf[1<<10];
+    /* A gzip header with FEXTRA, and the largest XLEN there is */
+    const unsigned char hdr[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff,
+                                 0xff, 0xff};
+    size_t iii = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    if (qes_compress_backend(QES_COMPRESSION_BGZF)->type !=
+            QES_COMPRESSION_BGZF) {
+        /* Without libdeflate, BGZF files are read as plain gzip */
+        goto end;
+    }
+    fp = fopen(fname, "wb");
+    tt_ptr_op(fp, !=, NULL);
+    tt_int_op(fwrite(hdr, 1, sizeof(hdr), fp), ==, sizeof(hdr));
+    for (iii = 0; iii < 0x10000; iii++) {
+        fputc(iii & 1 ? 'C' : 'B', fp);
+    }
+    fclose(fp);
+    fp = NULL;
+    /* Must be refused, not read into a block buffer it can't fit in */
+    file = qes_file_open_opts(fname, "r", &opts);
+    if (file != NULL) {
+        do {
+            res = qes_file_readline(file, buf, sizeof(buf));
+        } while (res > 0);
+        tt_int_op(res, ==, -2);
+        tt_str_op(qes_file_error(file), ==, "Not a BGZF block");
+    }
+end:
+    qes_file_close(file);
+    if (fp != NULL) fclose(fp);
+    clean_writable_file(fname);
+}
+
+static void
+test_qes_compress_pipe (void *ptr)
+{
+    struct qes_file *file = NULL;
+    struct qes_file_opts opts;
+    char *fname = NULL;
+    char *expect = NULL;
+    char *data = NULL;
+    char *buf = NULL;
+    size_t expect_len = 0;
+    size_t len = 0;
+    size_t bufsize = 1<<10;
+    size_t pos = 0;
+    size_t iii = 0;
+    ssize_t res = 0;
+    pid_t pid = -1;
+    int status = 0;
+    int fd = -1;
+
+    (void) ptr;
+    fname = find_data_file("test.fastq");
+    expect = read_whole_file(fname, &expect_len);
+    tt_ptr_op(expect, !=, NULL);
+    free(fname);
+    fname = NULL;
+    buf = malloc(bufsize);
+    for (iii = 0; iii < N_COMPRESSED_FILES; iii++) {
+        if (qes_compress_backend(compressed_files[iii].type) == NULL) {
+            continue;
+        }
+        fname = find_data_file(compressed_files[iii].fname);
+        data = read_whole_file(fname, &len);
+        tt_ptr_op(data, !=, NULL);
+        fd = feed_pipe(data, len, &pid);
+        tt_int_op(fd, >=, 0);
+        memset(&opts, 0, sizeof(opts));
+        opts.bufsize = 1000;
+#ifndef SPLICE_FOUND
+        /* We can only peek at a pipe's magic with tee */
+        opts.compression = compressed_files[iii].type;
+#endif
+        file = qes_file_dopen_opts(fd, "r", &opts);
+        fd = -1;
+        tt_ptr_op(file, !=, NULL);
+        tt_ptr_op(file->backend, ==,
+                  qes_compress_backend(compressed_files[iii].type));
+        tt_int_op(file->fd_start, ==, -1);
+        pos = 0;
+        while ((res = qes_file_readline_realloc(file, &buf, &bufsize)) > 0) {
+            tt_assert(pos + res <= expect_len);
+            tt_int_op(memcmp(buf, expect + pos, res), ==, 0);
+            pos += res;
+        }
+        tt_int_op(res, ==, EOF);
+        tt_int_op(pos, ==, expect_len);
+        /* There's no going back in a pipe */
+        tt_int_op(qes_file_seek(file, 0), ==, 1);
+        qes_file_close(file);
+        tt_int_op(waitpid(pid, &status, 0), ==, pid);
+        pid = -1;
+        tt_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        free(data);
+        data = NULL;
+        free(fname);
+        fname = NULL;
+    }
+end:
+    qes_file_close(file);
+    if (fd >= 0) close(fd);
+    if (pid > 0) waitpid(pid, &status, 0);
+    if (fname != NULL) free(fname);
+    free(expect);
+    free(data);
+    free(buf);
+}
+
+struct testcase_t qes_compress_tests[] = {
+    { "qes_compress_detect", test_qes_compress_detect, 0, NULL, NULL},
+    { "qes_compress_read", test_qes_compress_read, 0, NULL, NULL},
+    { "qes_compress_truncated", test_qes_compress_truncated, 0, NULL, NULL},
+    { "qes_compress_bgzf_xlen", test_qes_compress_bgzf_xlen, 0, NULL, NULL},
+    { "qes_compress_pipe", test_qes_compress_pipe, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
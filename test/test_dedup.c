@@ -0,0 +1,358 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_dedup.c
+ *
+ *    Description:  Tests for the qes_dedup module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 23:52:40
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_dedup.h>
+
+static void
+test_qes_hash128 (void *ptr)
+{
+    uint64_t out[2];
+    uint64_t other[2];
+
+    (void) ptr;
+    /* MurmurHash3_x64_128 reference values */
+    qes_hash128("hello", 5, 0, out);
+    tt_assert(out[0] == 0xcbd8a7b341bd9b02ULL);
+    tt_assert(out[1] == 0x5b1e906a48ae1d19ULL);
+    qes_hash128("", 0, 0, out);
+    tt_assert(out[0] == 0 && out[1] == 0);
+    /* Seed and every byte of the tail matter */
+    qes_hash128("hello", 5, 1, other);
+    tt_assert(other[0] != 0xcbd8a7b341bd9b02ULL);
+    qes_hash128("ACGTACGTACGTACGTACG", 19, 0, out);
+    qes_hash128("ACGTACGTACGTACGTACC", 19, 0, other);
+    tt_assert(out[0] != other[0] && out[1] != other[1]);
+end:
+    ;
+}
+
+/* Check test.fastq twice, once read-by-read and once in batches, paired
+ * against itself if ``paired`` */
+static int
+check_dedup (const struct qes_dedup_opts *opts, int paired)
+{
+    struct qes_dedup *dedup = qes_dedup_create(opts);
+    struct qes_dedup *batch_dedup = qes_dedup_create(opts);
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqbatch *batch = qes_seqbatch_create(64, 0);
+    struct qes_seq *seq = qes_seq_create();
+    char *fname = find_data_file("test.fastq");
+    int64_t *expect = NULL;
+    int64_t counts[64];
+    size_t n_seqs = 0;
+    size_t n_dups = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+    ssize_t res = 0;
+    int pass = 0;
+    int ret = 1;
+
+    expect = calloc(20000, sizeof(*expect));
+    if (dedup == NULL || batch_dedup == NULL || expect == NULL) goto end;
+    for (pass = 0; pass < 2; pass++) {
+        sf = qes_seqfile_create(fname, "r");
+        n_seqs = 0;
+        while (qes_seqfile_read(sf, seq) > 0 && n_seqs < 20000) {
+            if (paired) {
+                expect[n_seqs] = qes_dedup_check_pair(dedup, seq, seq);
+            } else {
+                expect[n_seqs] = qes_dedup_check(dedup, seq);
+            }
+            /* The second time round, everything is a duplicate */
+            if (expect[n_seqs] < pass) goto end;
+            n_dups += expect[n_seqs] > 0;
+            n_seqs++;
+        }
+        qes_seqfile_destroy(sf);
+        sf = qes_seqfile_create(fname, "r");
+        iii = 0;
+        while ((res = qes_seqfile_read_batch(sf, batch)) > 0) {
+            res = qes_dedup_check_batch(batch_dedup, batch,
+                                        paired ? batch : NULL, counts);
+            if (res < 0) goto end;
+            for (jjj = 0; jjj < batch->n_seqs; jjj++, iii++) {
+                if (counts[jjj] != expect[iii]) goto end;
+                res -= counts[jjj] > 0;
+            }
+            if (res != 0) goto end;
+        }
+        qes_seqfile_destroy(sf);
+        if (iii != n_seqs) goto end;
+    }
+    if (dedup->n_reads != n_seqs * 2 || dedup->n_dups != n_dups ||
+            batch_dedup->n_dups != n_dups || n_dups < n_seqs) {
+        goto end;
+    }
+    ret = 0;
+end:
+    qes_dedup_destroy(dedup);
+    qes_dedup_destroy(batch_dedup);
+    qes_seqfile_destroy(sf);
+    qes_seqbatch_destroy(batch);
+    qes_seq_destroy(seq);
+    free(expect);
+    free(fname);
+    return ret;
+}
+
+static void
+test_qes_dedup (void *ptr)
+{
+    struct qes_dedup_opts opts;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    tt_int_op(check_dedup(&opts, 0), ==, 0);
+    tt_int_op(check_dedup(&opts, 1), ==, 0);
+    opts.n_threads = 4;
+    tt_int_op(check_dedup(&opts, 1), ==, 0);
+    opts.mode = QES_DEDUP_BLOOM;
+    opts.max_mem = 1 << 20;
+    tt_int_op(check_dedup(&opts, 0), ==, 0);
+    tt_int_op(check_dedup(&opts, 1), ==, 0);
+    opts.mode = QES_DEDUP_NEAR;
+    opts.max_mem = 0;
+    tt_int_op(check_dedup(&opts, 0), ==, 0);
+    tt_int_op(check_dedup(&opts, 1), ==, 0);
+end:
+    ;
+}
+
+static void
+test_qes_dedup_counts (void *ptr)
+{
+    struct qes_dedup *dedup = NULL;
+    struct qes_dedup_opts opts;
+    struct qes_seq *seq1 = qes_seq_create();
+    struct qes_seq *seq2 = qes_seq_create();
+    char name[32];
+    uint32_t state = 42;
+    size_t iii = 0;
+    size_t jjj = 0;
+    int64_t res = 0;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    tt_int_op(qes_seq_fill(seq1, "r", "c", "ACGTACGTAC", "IIIIIIIIII"), ==, 0);
+    tt_int_op(qes_seq_fill(seq2, "r", "c", "TTTTGGGGCC", "IIIIIIIIII"), ==, 0);
+    for (opts.mode = QES_DEDUP_EXACT; opts.mode <= QES_DEDUP_NEAR;
+            opts.mode++) {
+        dedup = qes_dedup_create(&opts);
+        tt_ptr_op(dedup, !=, NULL);
+        for (iii = 0; iii < 300; iii++) {
+            res = qes_dedup_check(dedup, seq1);
+            /* Bloom counters saturate */
+            tt_int_op(res, ==, (opts.mode == QES_DEDUP_BLOOM && iii > 255 ?
+                               255 : iii));
+        }
+        tt_int_op(qes_dedup_check(dedup, seq2), ==, 0);
+        /* Pairs are ordered, and distinct from their mates alone */
+        tt_int_op(qes_dedup_check_pair(dedup, seq1, seq2), ==, 0);
+        tt_int_op(qes_dedup_check_pair(dedup, seq2, seq1), ==, 0);
+        tt_int_op(qes_dedup_check_pair(dedup, seq1, seq2), ==, 1);
+        tt_int_op(qes_dedup_check_pair(dedup, seq1, NULL), ==, -1);
+        tt_int_op(qes_dedup_check(dedup, NULL), ==, -1);
+        tt_int_op(qes_dedup_check_batch(dedup, NULL, NULL, NULL), ==, -1);
+        tt_int_op(dedup->n_reads, ==, 304);
+        tt_int_op(dedup->n_dups, ==, 300);
+        qes_dedup_destroy(dedup);
+        tt_ptr_op(dedup, ==, NULL);
+    }
+    tt_int_op(qes_dedup_check(NULL, seq1), ==, -1);
+    /* Running out of memory */
+    opts.mode = QES_DEDUP_EXACT;
+    opts.max_mem = 2048 * 20;
+    dedup = qes_dedup_create(&opts);
+    for (iii = 0; iii < 2000; iii++) {
+        snprintf(name, sizeof(name), "ACGT%zuACGT", iii);
+        qes_str_fill_charptr(&seq1->seq, name, 0);
+        res = qes_dedup_check(dedup, seq1);
+        if (res != 0) break;
+    }
+    tt_int_op(res, ==, -1);
+    tt_int_op(iii, ==, 1024);
+    tt_int_op(dedup->n_keys, ==, 1024);
+    qes_dedup_destroy(dedup);
+    opts.mode = QES_DEDUP_NEAR;
+    opts.max_mem = 1 << 20;
+    dedup = qes_dedup_create(&opts);
+    tt_ptr_op(dedup, !=, NULL);
+    for (iii = 0; iii < 100000; iii++) {
+        /* Random reads, which are nowhere near each other */
+        for (jjj = 0; jjj < 31; jjj++) {
+            state = state * 1103515245 + 12345;
+            name[jjj] = "ACGT"[(state >> 16) % 4];
+        }
+        name[31] = '\0';
+        qes_str_fill_charptr(&seq1->seq, name, 0);
+        res = qes_dedup_check(dedup, seq1);
+        if (res != 0) break;
+    }
+    tt_int_op(res, ==, -1);
+    tt_int_op(iii, >, 1000);
+    tt_int_op(iii, ==, dedup->n_distinct);
+    tt_int_op(dedup->arena_mem, ==, qes_arena_size(dedup->arena));
+    tt_int_op(dedup->arena_mem + dedup->reads_capacity *
+              sizeof(*dedup->reads) + dedup->n_seg_slots * 12, <=, 1 << 20);
+end:
+    qes_dedup_destroy(dedup);
+    qes_seq_destroy(seq1);
+    qes_seq_destroy(seq2);
+}
+
+#define NEAR_N_READS 3000
+#define NEAR_READ_LEN 40
+
+/* Is ``seq`` within ``max`` mismatches of any of ``kept``, by brute force */
+static int
+near_ref (char kept[][NEAR_READ_LEN + 1], size_t n_kept, const char *seq,
+          size_t len, unsigned max)
+{
+    size_t iii = 0;
+    size_t jjj = 0;
+    unsigned dist = 0;
+
+    for (iii = 0; iii < n_kept; iii++) {
+        if (strlen(kept[iii]) != len) continue;
+        for (jjj = 0, dist = 0; jjj < len; jjj++) {
+            dist += kept[iii][jjj] != seq[jjj];
+        }
+        if (dist <= max) return 1;
+    }
+    return 0;
+}
+
+static void
+test_qes_dedup_near (void *ptr)
+{
+    struct qes_dedup *dedup = NULL;
+    struct qes_dedup_opts opts;
+    struct qes_seq *seq1 = qes_seq_create();
+    struct qes_seq *seq2 = qes_seq_create();
+    char (*kept)[NEAR_READ_LEN + 1] = NULL;
+    char (*origs)[NEAR_READ_LEN + 1] = NULL;
+    char read[NEAR_READ_LEN + 1];
+    const char *bases = "ACGTN";
+    uint32_t state = 42;
+    size_t n_kept = 0;
+    size_t len = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+    unsigned max = 0;
+    int64_t res = 0;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    opts.mode = QES_DEDUP_NEAR;
+    /* Mismatches anywhere, up to max_mismatches */
+    dedup = qes_dedup_create(&opts);
+    tt_ptr_op(dedup, !=, NULL);
+    tt_int_op(dedup->opts.max_mismatches, ==, QES_DEDUP_MAX_MISMATCHES);
+    qes_seq_fill(seq1, "r", "c", "AAAAAAAAAACCCCCCCCCCGGGGGGGGGG", "");
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 0);
+    qes_str_fill_charptr(&seq1->seq, "TAAAAAAAATCCCCCCCCCCGGGGGGGGGG", 0);
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 1);
+    qes_str_fill_charptr(&seq1->seq, "AAAAAAAAAACCCCCCCCCNNGGGGGGGGG", 0);
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 2);
+    /* One too many, in every segment, is a new read */
+    qes_str_fill_charptr(&seq1->seq, "TAAAAAAAAACCCCCTCCCCGGGGGGGGGT", 0);
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 0);
+    /* Near-duplicates aren't kept, so can't be matched */
+    qes_str_fill_charptr(&seq1->seq, "TTTAAAAAATCCCCCCCCCCGGGGGGGGGG", 0);
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 0);
+    /* Lengths must match */
+    qes_str_fill_charptr(&seq1->seq, "AAAAAAAAAACCCCCCCCCCGGGGGGGGG", 0);
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 0);
+    tt_int_op(dedup->n_distinct, ==, 4);
+    /* Reads shorter than the number of segments, and empty ones */
+    qes_str_fill_charptr(&seq1->seq, "A", 0);
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 0);
+    qes_str_fill_charptr(&seq1->seq, "T", 0);
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 1);
+    seq1->seq.str[0] = '\0';
+    seq1->seq.len = 0;
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 0);
+    tt_int_op(qes_dedup_check(dedup, seq1), ==, 1);
+    /* Pairs are compared as a whole, and by each mate's length */
+    qes_str_fill_charptr(&seq1->seq, "ACGTACGTAC", 0);
+    qes_seq_fill(seq2, "r", "c", "GGGGCCCCTT", "");
+    tt_int_op(qes_dedup_check_pair(dedup, seq1, seq2), ==, 0);
+    qes_str_fill_charptr(&seq2->seq, "GGGGCCCCAA", 0);
+    tt_int_op(qes_dedup_check_pair(dedup, seq1, seq2), ==, 1);
+    qes_str_fill_charptr(&seq1->seq, "ACGTACGTACG", 0);
+    qes_str_fill_charptr(&seq2->seq, "GGGCCCCTT", 0);
+    tt_int_op(qes_dedup_check_pair(dedup, seq1, seq2), ==, 0);
+    qes_dedup_destroy(dedup);
+    /* Against brute force, with many near copies of a few reads */
+    kept = calloc(NEAR_N_READS, sizeof(*kept));
+    origs = calloc(NEAR_N_READS / 10, sizeof(*origs));
+    tt_ptr_op(kept, !=, NULL);
+    tt_ptr_op(origs, !=, NULL);
+    for (iii = 0; iii < NEAR_N_READS / 10; iii++) {
+        for (jjj = 0; jjj < NEAR_READ_LEN; jjj++) {
+            state = state * 1103515245 + 12345;
+            origs[iii][jjj] = bases[(state >> 16) % 4];
+        }
+    }
+    for (max = 1; max <= 5; max += 2) {
+        opts.max_mismatches = max;
+        dedup = qes_dedup_create(&opts);
+        tt_ptr_op(dedup, !=, NULL);
+        n_kept = 0;
+        for (iii = 0; iii < NEAR_N_READS; iii++) {
+            state = state * 1103515245 + 12345;
+            memcpy(read, origs[(state >> 16) % (NEAR_N_READS / 10)],
+                   sizeof(read));
+            state = state * 1103515245 + 12345;
+            /* Mostly full length, with a few mutations */
+            len = (state >> 16) % 8 == 0 ? NEAR_READ_LEN - 1 : NEAR_READ_LEN;
+            read[len] = '\0';
+            state = state * 1103515245 + 12345;
+            for (jjj = (state >> 16) % (max + 3); jjj > 0; jjj--) {
+                state = state * 1103515245 + 12345;
+                read[(state >> 16) % len] = bases[(state >> 8) % 5];
+            }
+            qes_str_fill_charptr(&seq1->seq, read, len);
+            res = qes_dedup_check(dedup, seq1);
+            tt_int_op(res, >=, 0);
+            tt_int_op(res > 0, ==, near_ref(kept, n_kept, read, len, max));
+            if (res == 0) memcpy(kept[n_kept++], read, sizeof(read));
+        }
+        tt_int_op(dedup->n_distinct, ==, n_kept);
+        tt_int_op(dedup->n_dups, ==, NEAR_N_READS - n_kept);
+        qes_dedup_destroy(dedup);
+    }
+    opts.max_mismatches = QES_DEDUP_MISMATCHES_LIMIT + 1;
+    tt_ptr_op(qes_dedup_create(&opts), ==, NULL);
+end:
+    qes_dedup_destroy(dedup);
+    qes_seq_destroy(seq1);
+    qes_seq_destroy(seq2);
+    free(kept);
+    free(origs);
+}
+
+struct testcase_t qes_dedup_tests[] = {
+    { "qes_hash128", test_qes_hash128, 0, NULL, NULL},
+    { "qes_dedup", test_qes_dedup, 0, NULL, NULL},
+    { "qes_dedup_counts", test_qes_dedup_counts, 0, NULL, NULL},
+    { "qes_dedup_near", test_qes_dedup_near, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
@@ -0,0 +1,266 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_demux.c
+ *
+ *    Description:  Tests for the qes_demux module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 23:11:52
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_demux.h>
+
+#define N_OUTPUTS 200
+
+/* Split test.fastq round-robin into ``n_outs`` outputs, then check each
+ * output has every ``n_outs``th record, in order */
+static int
+check_demux (const struct qes_demux_opts *opts, size_t n_outs)
+{
+    struct qes_demux_writer *writer = NULL;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqfile *out = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_seq *got = qes_seq_create();
+    char *fname = find_data_file("test.fastq");
+    char *paths[N_OUTPUTS];
+    size_t n_seqs = 0;
+    size_t iii = 0;
+    int ret = 1;
+
+    memset(paths, 0, sizeof(paths));
+    writer = qes_demux_writer_create(opts);
+    if (writer == NULL) goto end;
+    for (iii = 0; iii < n_outs; iii++) {
+        paths[iii] = get_writable_file();
+        if (qes_demux_writer_add(writer, paths[iii]) != (ssize_t)iii) goto end;
+    }
+    sf = qes_seqfile_create(fname, "r");
+    while (qes_seqfile_read(sf, seq) > 0) {
+        if (qes_demux_writer_write(writer, n_seqs++ % n_outs, seq) <= 0 ||
+                writer->n_open > writer->opts.max_open) {
+            goto end;
+        }
+    }
+    if (qes_demux_writer_flush(writer) != 0) goto end;
+    qes_demux_writer_destroy(writer);
+    qes_seqfile_destroy(sf);
+    sf = qes_seqfile_create(fname, "r");
+    for (iii = 0; iii < n_outs; iii++) {
+        out = qes_seqfile_create(paths[iii], "r");
+        if (out == NULL) goto end;
+        qes_seqfile_set_format(out, opts->format == FASTA_FMT ?
+                                    FASTA_FMT : FASTQ_FMT);
+        qes_seqfile_destroy(sf);
+        sf = qes_seqfile_create(fname, "r");
+        n_seqs = 0;
+        while (qes_seqfile_read(sf, seq) > 0) {
+            if (n_seqs++ % n_outs != iii) continue;
+            if (qes_seqfile_read(out, got) <= 0 ||
+                    strcmp(seq->name.str, got->name.str) != 0 ||
+                    strcmp(seq->seq.str, got->seq.str) != 0) {
+                goto end;
+            }
+        }
+        if (qes_seqfile_read(out, got) != EOF) goto end;
+        qes_seqfile_destroy(out);
+    }
+    ret = 0;
+end:
+    qes_demux_writer_destroy(writer);
+    qes_seqfile_destroy(sf);
+    qes_seqfile_destroy(out);
+    qes_seq_destroy(seq);
+    qes_seq_destroy(got);
+    for (iii = 0; iii < n_outs; iii++) {
+        clean_writable_file(paths[iii]);
+    }
+    free(fname);
+    return ret;
+}
+
+static void
+test_qes_demux_writer (void *ptr)
+{
+    struct qes_demux_opts opts;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    /* Defaults: everything is buffered until the flush */
+    tt_int_op(check_demux(&opts, 3), ==, 0);
+    /* Many more outputs than files open, and blocks written as we go */
+    opts.max_open = 16;
+    opts.mem_budget = 16 << 10;
+    opts.block_len = 2 << 10;
+    opts.n_threads = 4;
+    tt_int_op(check_demux(&opts, N_OUTPUTS), ==, 0);
+    /* Smaller budget than a block of each output */
+    opts.mem_budget = 1 << 10;
+    tt_int_op(check_demux(&opts, 10), ==, 0);
+    opts.uncompressed = 1;
+    opts.format = FASTA_FMT;
+    tt_int_op(check_demux(&opts, 50), ==, 0);
+end:
+    ;
+}
+
+static void
+test_qes_demux_writer_errors (void *ptr)
+{
+    struct qes_demux_writer *writer = qes_demux_writer_create(NULL);
+    struct qes_seq *seq = qes_seq_create();
+    char *path = get_writable_file();
+    char *buf = NULL;
+    size_t len = 0;
+
+    (void) ptr;
+    tt_ptr_op(writer, !=, NULL);
+    tt_int_op(writer->opts.format, ==, FASTQ_FMT);
+    tt_int_op(qes_seq_fill(seq, "r", "c", "ACGT", "IIII"), ==, 0);
+    tt_int_op(qes_demux_writer_write(writer, 0, seq), ==, -2);
+    tt_int_op(qes_demux_writer_add(writer, "/nonexistent/dir/x"), ==, -1);
+    tt_assert(strstr(qes_demux_writer_error(writer), "/nonexistent") != NULL);
+    tt_int_op(qes_demux_writer_add(writer, path), ==, 0);
+    tt_int_op(qes_demux_writer_write(writer, 0, seq), ==, 17);
+    tt_int_op(qes_demux_writer_write(writer, 1, seq), ==, -2);
+    tt_int_op(qes_demux_writer_write(writer, 0, NULL), ==, -2);
+    /* FASTQ records need a quality score per base */
+    seq->qual.len = 3;
+    tt_int_op(qes_demux_writer_write(writer, 0, seq), ==, -2);
+    tt_assert(strstr(qes_demux_writer_error(writer), "qualities") != NULL);
+    /* As read from FASTA */
+    seq->qual.str[0] = '\0';
+    seq->qual.len = 0;
+    tt_int_op(qes_demux_writer_write(writer, 0, seq), ==, -2);
+    tt_int_op(qes_seq_fill(seq, "r", "c", "ACGT", "IIII"), ==, 0);
+    tt_int_op(qes_demux_writer_add(NULL, path), ==, -1);
+    /* Written on destroy */
+    qes_demux_writer_destroy(writer);
+    tt_ptr_op(writer, ==, NULL);
+    writer = qes_demux_writer_create(NULL);
+    tt_int_op(qes_demux_writer_flush(NULL), ==, 1);
+    tt_str_op(qes_demux_writer_error(NULL), ==, "BAD FILE");
+    buf = read_whole_file(path, &len);
+    tt_ptr_op(buf, !=, NULL);
+    tt_int_op(len, >, 18);
+    tt_int_op((unsigned char)buf[0], ==, 0x1f);
+end:
+    qes_demux_writer_destroy(writer);
+    qes_seq_destroy(seq);
+    clean_writable_file(path);
+    free(buf);
+}
+
+static void
+test_qes_demux_writer_empty (void *ptr)
+{
+    struct qes_demux_opts opts = {.uncompressed = 1};
+    struct qes_demux_writer *writer = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *path = get_writable_file();
+    char *buf = NULL;
+    size_t len = 0;
+    size_t iii = 0;
+    const enum qes_seqfile_format formats[] = {FASTQ_FMT, FASTA_FMT};
+    const char *expect[] = {"@r c\n\n+\n\n@s d\nACGT\n+\nIIII\n",
+                            ">r c\n\n>s d\nACGT\n"};
+
+    (void) ptr;
+    for (iii = 0; iii < 2; iii++) {
+        opts.format = formats[iii];
+        writer = qes_demux_writer_create(&opts);
+        tt_ptr_op(writer, !=, NULL);
+        tt_int_op(qes_demux_writer_add(writer, path), ==, 0);
+        /* Empty reads, as left by trimming, keep the record type of the
+         * rest of the file */
+        tt_int_op(qes_seq_fill(seq, "r", "c", "A", "I"), ==, 0);
+        seq->seq.str[0] = '\0';
+        seq->seq.len = 0;
+        seq->qual.str[0] = '\0';
+        seq->qual.len = 0;
+        tt_int_op(qes_demux_writer_write(writer, 0, seq), ==,
+                  iii == 0 ? 9 : 6);
+        tt_int_op(qes_seq_fill(seq, "s", "d", "ACGT", "IIII"), ==, 0);
+        tt_int_op(qes_demux_writer_write(writer, 0, seq), >, 0);
+        qes_demux_writer_destroy(writer);
+        buf = read_whole_file(path, &len);
+        tt_ptr_op(buf, !=, NULL);
+        tt_int_op(len, ==, strlen(expect[iii]));
+        tt_assert(memcmp(buf, expect[iii], len) == 0);
+        free(buf);
+        buf = NULL;
+    }
+end:
+    qes_demux_writer_destroy(writer);
+    qes_seq_destroy(seq);
+    clean_writable_file(path);
+    free(buf);
+}
+
+static void
+test_qes_demux_writer_failing (void *ptr)
+{
+    struct qes_demux_opts opts;
+    struct qes_demux_writer *writer = NULL;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *path = get_writable_file();
+    size_t n_seqs = 0;
+    int uncompressed = 0;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    opts.block_len = 17;
+    tt_int_op(qes_seq_fill(seq, "r", "c", "ACGT", "IIII"), ==, 0);
+    for (uncompressed = 0; uncompressed < 2; uncompressed++) {
+        opts.uncompressed = uncompressed;
+        writer = qes_demux_writer_create(&opts);
+        tt_ptr_op(writer, !=, NULL);
+        tt_int_op(qes_demux_writer_add(writer, path), ==, 0);
+        tt_int_op(qes_demux_writer_add(writer, "/dev/full"), ==, 1);
+        tt_int_op(qes_demux_writer_write(writer, 0, seq), ==, 17);
+        tt_int_op(qes_demux_writer_write(writer, 0, seq), ==, 17);
+        tt_int_op(qes_demux_writer_write(writer, 1, seq), ==, 17);
+        /* Output 1 fails, but what was written of output 0 stays written,
+         * and isn't written again by later flushes */
+        tt_int_op(qes_demux_writer_flush(writer), ==, 1);
+        tt_assert(strstr(qes_demux_writer_error(writer),
+                         "/dev/full") != NULL);
+        tt_int_op(writer->dests[0].len, ==, 0);
+        tt_int_op(writer->dests[1].len, ==, 17);
+        tt_int_op(writer->buffered, ==, 17);
+        tt_int_op(qes_demux_writer_flush(writer), ==, 1);
+        qes_demux_writer_destroy(writer);
+        sf = qes_seqfile_create(path, "r");
+        tt_ptr_op(sf, !=, NULL);
+        n_seqs = 0;
+        while (qes_seqfile_read(sf, seq) > 0) n_seqs++;
+        tt_int_op(n_seqs, ==, 2);
+        qes_seqfile_destroy(sf);
+    }
+end:
+    qes_demux_writer_destroy(writer);
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+    clean_writable_file(path);
+}
+
+struct testcase_t qes_demux_tests[] = {
+    { "qes_demux_writer", test_qes_demux_writer, 0, NULL, NULL},
+    { "qes_demux_writer_errors", test_qes_demux_writer_errors, 0, NULL,
+      NULL},
+    { "qes_demux_writer_empty", test_qes_demux_writer_empty, 0, NULL, NULL},
+    { "qes_demux_writer_failing", test_qes_demux_writer_failing, 0, NULL,
+      NULL},
+    END_OF_TESTCASES
+};
@@ -18,6 +18,7 @@
 #include "tests.h"
 
 #include <qes_file.h>
+#include <fcntl.h>
 
 static void
 test_qes_file_open (void *ptr)
@@ -68,6 +69,83 @@ end:
     if (fname != NULL) free(fname);
 }
 
+static void
+test_qes_file_open_opts (void *ptr)
+{
+    struct qes_file *file = NULL;
+    struct qes_file *ref = NULL;
+    struct qes_file_opts opts;
+    char *fname = NULL;
+    char buf[1<<10];
+    char refbuf[1<<10];
+    const size_t bufsizes[] = {2, 3, 64, 0};
+    size_t iii = 0;
+    ssize_t res = 0;
+    ssize_t refres = 0;
+
+    (void) ptr;
+    fname = find_data_file("loremipsum.txt.gz");
+    tt_assert(fname != NULL);
+    /* Defaults */
+    file = qes_file_open_opts(fname, "r", NULL);
+    tt_ptr_op(file, !=, NULL);
+    tt_int_op(file->bufsize, ==, QES_FILEBUFFER_LEN);
+    tt_int_op(file->max_bufsize, ==, 0);
+    qes_file_close(file);
+    /* Every buffer size gives the same lines as the default */
+    for (iii = 0; iii < sizeof(bufsizes) / sizeof(*bufsizes); iii++) {
+        memset(&opts, 0, sizeof(opts));
+        opts.bufsize = bufsizes[iii];
+        ref = qes_file_open(fname, "r");
+        file = qes_file_open_opts(fname, "r", &opts);
+        tt_ptr_op(file, !=, NULL);
+        tt_int_op(file->bufsize, ==, bufsizes[iii] > 0 ? bufsizes[iii] :
+                                     QES_FILEBUFFER_LEN);
+        do {
+            refres = qes_file_readline(ref, refbuf, sizeof(refbuf));
+            res = qes_file_readline(file, buf, sizeof(buf));
+            tt_int_op(res, ==, refres);
+            if (res > 0) tt_str_op(buf, ==, refbuf);
+        } while (refres > 0);
+        tt_int_op(file->filepos, ==, ref->filepos);
+        qes_file_close(file);
+        qes_file_close(ref);
+    }
+    /* Adaptive buffers double each refill while IO dominates, up to the
+     * limit. Fake a slow refill to make that deterministic. */
+    memset(&opts, 0, sizeof(opts));
+    opts.bufsize = 64;
+    opts.adaptive = 1;
+    opts.max_bufsize = 300;
+    ref = qes_file_open(fname, "r");
+    file = qes_file_open_opts(fname, "r", &opts);
+    tt_ptr_op(file, !=, NULL);
+    tt_int_op(file->max_bufsize, ==, 300);
+    do {
+        file->fill_nsec = UINT64_MAX;
+        refres = qes_file_readline(ref, refbuf, sizeof(refbuf));
+        res = qes_file_readline(file, buf, sizeof(buf));
+        tt_int_op(res, ==, refres);
+        if (res > 0) tt_str_op(buf, ==, refbuf);
+    } while (refres > 0);
+    tt_int_op(file->bufsize, ==, 300);
+    qes_file_close(file);
+    qes_file_close(ref);
+    /* Default limit */
+    opts.max_bufsize = 0;
+    file = qes_file_open_opts(fname, "r", &opts);
+    tt_int_op(file->max_bufsize, ==, QES_FILEBUFFER_MAX_LEN);
+    qes_file_close(file);
+    /* A one byte buffer can't hold the terminating '\0' */
+    opts.bufsize = 1;
+    file = qes_file_open_opts_errnil(fname, "r", &opts);
+    tt_ptr_op(file, ==, NULL);
+end:
+    qes_file_close(file);
+    qes_file_close(ref);
+    if (fname != NULL) free(fname);
+}
+
 static void
 test_qes_file_close (void *ptr)
 {
@@ -100,6 +178,7 @@ test_qes_file_rewind (void *ptr)
     char buffer[bufsize];
     ssize_t res = 0;
     char *fname = NULL;
+    int fds[2] = {-1, -1};
 
     (void) ptr;
     /* Open file */
@@ -114,12 +193,27 @@ test_qes_file_rewind (void *ptr)
     tt_int_op(QES_ZTELL(file->fp), ==, loremipsum_fsize);
     tt_assert(file->eof);
     tt_assert(file->feof);
-    qes_file_rewind(file);
+    tt_int_op(qes_file_rewind(file), ==, 0);
     tt_int_op(file->filepos, ==, 0);
     tt_assert(!file->eof);
     tt_assert(!file->feof);
     tt_int_op(QES_ZTELL(file->fp), ==, 0);
+    qes_file_close(file);
+    /* Pipes can't be rewound, and say so */
+    tt_int_op(pipe(fds), ==, 0);
+    tt_int_op(write(fds[1], "a\nb\n", 4), ==, 4);
+    close(fds[1]);
+    fds[1] = -1;
+    file = qes_file_dopen(fds[0], "r");
+    fds[0] = -1;
+    tt_ptr_op(file, !=, NULL);
+    tt_int_op(qes_file_readline(file, buffer, bufsize), ==, 2);
+    tt_int_op(qes_file_readline(file, buffer, bufsize), ==, 2);
+    tt_int_op(qes_file_rewind(file), ==, 1);
+    tt_int_op(file->filepos, ==, 4);
 end:
+    if (fds[0] >= 0) close(fds[0]);
+    if (fds[1] >= 0) close(fds[1]);
     qes_file_close(file);
     free(fname);
 }
@@ -421,8 +515,123 @@ end:
 
 }
 
+static void
+test_qes_file_stats (void *ptr)
+{
+    struct qes_file *file = NULL;
+    struct qes_file_stats stats;
+    char *fname = NULL;
+    char *buf = NULL;
+    size_t bufsize = 4;
+    size_t total = 0;
+    ssize_t ret = 0;
+    struct stat st;
+
+    (void) ptr;
+    fname = find_data_file("loremipsum.txt.gz");
+    tt_assert(fname != NULL);
+    tt_int_op(stat(fname, &st), ==, 0);
+    file = qes_file_open(fname, "r");
+    tt_ptr_op(file, !=, NULL);
+    /* Start small so that lines force the buffer to grow */
+    buf = calloc(bufsize, 1);
+    while ((ret = qes_file_readline_realloc(file, &buf, &bufsize)) > 0) {
+        total += ret;
+    }
+#ifdef QES_STATS
+    tt_int_op(qes_file_stats(file, &stats), ==, 0);
+    tt_int_op(stats.bytes_uncompressed, ==, total);
+    tt_int_op(stats.bytes_compressed, ==, st.st_size);
+    tt_int_op(stats.n_fills, >, 0);
+    tt_int_op(stats.n_reallocs, >, 0);
+#else
+    tt_int_op(qes_file_stats(file, &stats), ==, 1);
+    tt_int_op(stats.n_fills, ==, 0);
+#endif
+    tt_int_op(qes_file_stats(file, NULL), ==, 1);
+end:
+    qes_file_close(file);
+    if (buf != NULL) free(buf);
+    if (fname != NULL) free(fname);
+}
+
+static void
+test_qes_file_dopen (void *ptr)
+{
+    struct qes_file *file = NULL;
+    char *fname = NULL;
+    char buf[1<<10];
+    char *crc = NULL;
+    int fd = -1;
+    ssize_t res = 0;
+
+    (void) ptr;
+    /* Reading starts wherever fd is, and rewinding goes back there */
+    fname = find_data_file("loremipsum.txt");
+    tt_assert(fname != NULL);
+    fd = open(fname, O_RDONLY);
+    tt_int_op(fd, >=, 0);
+    tt_int_op(lseek(fd, 6, SEEK_SET), ==, 6);
+    file = qes_file_dopen(fd, "r");
+    fd = -1;
+    tt_ptr_op(file, !=, NULL);
+    tt_int_op(file->fd_start, ==, 6);
+    tt_int_op(file->raw, ==, 1);
+    res = qes_file_readline(file, buf, sizeof(buf));
+    tt_int_op(res, >, 0);
+    tt_str_op(buf, ==, "ipsum dolor sit amet, consectetur adipiscing elit. "
+              "Donec ornare tortor et\n");
+    qes_file_rewind(file);
+    res = qes_file_readline(file, buf, sizeof(buf));
+    tt_str_op(buf, ==, "ipsum dolor sit amet, consectetur adipiscing elit. "
+              "Donec ornare tortor et\n");
+    qes_file_close(file);
+    free(fname);
+    /* Compressed too */
+    fname = find_data_file("loremipsum.txt.gz");
+    fd = open(fname, O_RDONLY);
+    file = qes_file_dopen(fd, "r");
+    fd = -1;
+    tt_ptr_op(file, !=, NULL);
+    tt_int_op(file->raw, ==, 0);
+    res = qes_file_readline(file, buf, sizeof(buf));
+    tt_str_op(buf, ==, "Lorem ipsum dolor sit amet, "
+              "consectetur adipiscing elit. Donec ornare tortor et\n");
+    qes_file_close(file);
+    free(fname);
+    /* Writing, uncompressed with "wT" */
+    fname = get_writable_file();
+    fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    tt_int_op(fd, >=, 0);
+    file = qes_file_dopen(fd, "wT");
+    fd = -1;
+    tt_ptr_op(file, !=, NULL);
+    tt_int_op(file->mode, ==, QES_READ_MODE_WRITE);
+    tt_int_op(file->raw, ==, 1);
+    tt_int_op(qes_file_puts(file, "ACGT\n"), ==, 5);
+    qes_file_close(file);
+    crc = crc32_file(fname);
+    tt_str_op(crc, ==, "61c79b3c");
+    clean_writable_file(fname);
+    fname = NULL;
+    /* On error, fd is closed */
+    fd = open("/dev/null", O_RDONLY);
+    file = qes_file_dopen(fd, "q");
+    tt_ptr_op(file, ==, NULL);
+    tt_int_op(fcntl(fd, F_GETFD), ==, -1);
+    fd = -1;
+    file = qes_file_dopen(-1, "r");
+    tt_ptr_op(file, ==, NULL);
+end:
+    qes_file_close(file);
+    if (fd >= 0) close(fd);
+    if (fname != NULL) free(fname);
+    if (crc != NULL) free(crc);
+}
+
 struct testcase_t qes_file_tests[] = {
     { "qes_file_open", test_qes_file_open, 0, NULL, NULL},
+    { "qes_file_open_opts", test_qes_file_open_opts, 0, NULL, NULL},
     { "qes_file_peek", test_qes_file_peek, 0, NULL, NULL},
     { "qes_file_readline", test_qes_file_readline, 0, NULL, NULL},
     { "qes_file_readline_realloc", test_qes_file_readline_realloc, 0, NULL, NULL},
@@ -431,5 +640,7 @@ struct testcase_t qes_file_tests[] = {
     { "qes_file_rewind", test_qes_file_rewind, 0, NULL, NULL},
     { "qes_file_getuntil", test_qes_file_getuntil, 0, NULL, NULL},
     { "qes_file_ok", test_qes_file_ok, 0, NULL, NULL},
+    { "qes_file_stats", test_qes_file_stats, 0, NULL, NULL},
+    { "qes_file_dopen", test_qes_file_dopen, 0, NULL, NULL},
     END_OF_TESTCASES
 };
@@ -0,0 +1,197 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_illumina.c
+ *
+ *    Description:  Tests for the qes_illumina module
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 04:40:02
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_illumina.h>
+#include <qes_seqfile.h>
+
+/* Parse a header line, split as qes_seq_fill_header would */
+static int
+parse_line (const char *line, struct qes_illumina_header *hdr)
+{
+    const char *space = strchr(line, ' ');
+
+    if (space == NULL) {
+        return qes_illumina_parse(line, strlen(line), NULL, 0, hdr);
+    }
+    return qes_illumina_parse(line, space - line, space + 1,
+                              strlen(space + 1), hdr);
+}
+
+#define slice_eq(str, len, expect)                                          \
+    ((len) == strlen(expect) && memcmp((str), (expect), (len)) == 0)
+
+static void
+test_qes_illumina_parse (void *ptr)
+{
+    struct qes_illumina_header hdr;
+    const char *bad[] = {
+        "", "read1", "a:1:2:3", "a:1:2:3:4:5", "a:1:2:3:4:5:6:7:8",
+        "M:1:FC:1:2:3:4:", "M:1:FC:1:2:3::ACGT", "M:1:FC:1:2:3:4:ACGT/",
+        "a:1:2:x:4", "a:1:2:3:", "a:1:2:3:4/", "a:1:2:3:4#ACGT/x",
+        "a:1:2:3:99999999999", "a:1:2:3:-4",
+        "M:1:FC:1:2:3:4 x:N:0:ACGT", "M:1:FC:1:2:3:4 1:X:0:ACGT",
+        "M:1:FC:1:2:3:4 1:N:ACGT", "M:1:FC:1:2:3:4 1:N",
+        "M:run:FC:1:2:3:4 1:N:0:ACGT",
+    };
+    size_t iii = 0;
+
+    (void) ptr;
+    /* CASAVA 1.8, as in test.fastq */
+    tt_int_op(parse_line("HWI-ST960:105:D10GVACXX:2:1101:1151:2158 "
+                         "1:N:0: bcd:RPI9 seq:CACGATCAGATC", &hdr), ==, 0);
+    tt_int_op(hdr.format, ==, QES_ILLUMINA_CASAVA18);
+    tt_assert(slice_eq(hdr.instrument, hdr.instrument_len, "HWI-ST960"));
+    tt_int_op(hdr.run, ==, 105);
+    tt_assert(slice_eq(hdr.flowcell, hdr.flowcell_len, "D10GVACXX"));
+    tt_int_op(hdr.lane, ==, 2);
+    tt_int_op(hdr.tile, ==, 1101);
+    tt_int_op(hdr.x, ==, 1151);
+    tt_int_op(hdr.y, ==, 2158);
+    tt_int_op(hdr.read, ==, 1);
+    tt_int_op(hdr.filtered, ==, 0);
+    tt_int_op(hdr.control, ==, 0);
+    tt_int_op(hdr.index_len, ==, 0);
+    /* Dual indices, filtered */
+    tt_int_op(parse_line("A00123:8:H5KJ2DSXX:4:2678:31385:1000 "
+                         "2:Y:18:ATCACG+GTACGT", &hdr), ==, 0);
+    tt_int_op(hdr.read, ==, 2);
+    tt_int_op(hdr.filtered, ==, 1);
+    tt_int_op(hdr.control, ==, 18);
+    tt_assert(slice_eq(hdr.index, hdr.index_len, "ATCACG+GTACGT"));
+    tt_int_op(hdr.y, ==, 1000);
+    /* No comment, or one from SRA with the read number in the name */
+    tt_int_op(parse_line("M1:1:FC:1:2:3:4294967295", &hdr), ==, 0);
+    tt_int_op(hdr.y, ==, 4294967295u);
+    tt_int_op(hdr.read, ==, 0);
+    tt_int_op(hdr.filtered, ==, -1);
+    tt_int_op(parse_line("M1:1:FC:1:2:3:4/2", &hdr), ==, 0);
+    tt_int_op(hdr.y, ==, 4);
+    tt_int_op(hdr.read, ==, 2);
+    tt_ptr_op(hdr.umi, ==, NULL);
+    /* UMIs, single or dual, in an eighth field */
+    tt_int_op(parse_line("A00123:8:H5KJ2DSXX:4:2678:31385:1000:ACGTACGT "
+                         "1:N:0:ATCACG", &hdr), ==, 0);
+    tt_int_op(hdr.format, ==, QES_ILLUMINA_CASAVA18);
+    tt_int_op(hdr.x, ==, 31385);
+    tt_int_op(hdr.y, ==, 1000);
+    tt_assert(slice_eq(hdr.umi, hdr.umi_len, "ACGTACGT"));
+    tt_assert(slice_eq(hdr.index, hdr.index_len, "ATCACG"));
+    tt_int_op(hdr.read, ==, 1);
+    tt_int_op(parse_line("M1:1:FC:1:2:3:4:ACGT+TTGA/2", &hdr), ==, 0);
+    tt_int_op(hdr.y, ==, 4);
+    tt_assert(slice_eq(hdr.umi, hdr.umi_len, "ACGT+TTGA"));
+    tt_int_op(hdr.read, ==, 2);
+    /* Before CASAVA 1.8 */
+    tt_int_op(parse_line("HWUSI-EAS100R:6:73:941:1973#ATCACG/1", &hdr), ==,
+              0);
+    tt_int_op(hdr.format, ==, QES_ILLUMINA_OLD);
+    tt_assert(slice_eq(hdr.instrument, hdr.instrument_len,
+                       "HWUSI-EAS100R"));
+    tt_int_op(hdr.run, ==, 0);
+    tt_int_op(hdr.flowcell_len, ==, 0);
+    tt_int_op(hdr.lane, ==, 6);
+    tt_int_op(hdr.tile, ==, 73);
+    tt_int_op(hdr.x, ==, 941);
+    tt_int_op(hdr.y, ==, 1973);
+    tt_assert(slice_eq(hdr.index, hdr.index_len, "ATCACG"));
+    tt_int_op(hdr.read, ==, 1);
+    tt_int_op(hdr.filtered, ==, -1);
+    tt_int_op(parse_line("HWUSI-EAS100R:6:73:941:1973#0", &hdr), ==, 0);
+    tt_assert(slice_eq(hdr.index, hdr.index_len, "0"));
+    tt_int_op(hdr.read, ==, 0);
+    tt_int_op(parse_line("HWUSI-EAS100R:6:73:941:1973/2", &hdr), ==, 0);
+    tt_int_op(hdr.index_len, ==, 0);
+    tt_int_op(hdr.read, ==, 2);
+    /* Not Illumina */
+    for (iii = 0; iii < sizeof(bad) / sizeof(*bad); iii++) {
+        tt_int_op(parse_line(bad[iii], &hdr), ==, 1);
+        tt_int_op(hdr.format, ==, QES_ILLUMINA_UNKNOWN);
+    }
+    tt_int_op(qes_illumina_parse(NULL, 0, NULL, 0, &hdr), ==, 1);
+    tt_int_op(qes_illumina_parse("a", 1, NULL, 0, NULL), ==, 1);
+end:
+    ;
+}
+
+static void
+test_qes_illumina_parse_batch (void *ptr)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqfile *lazy = NULL;
+    struct qes_seqbatch *batch = qes_seqbatch_create(100, 0);
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_illumina_header hdrs[100];
+    struct qes_illumina_header hdr;
+    char *fname = find_data_file("test.fastq");
+    ssize_t n_seqs = 0;
+    ssize_t iii = 0;
+
+    (void) ptr;
+    sf = qes_seqfile_create(fname, "r");
+    lazy = qes_seqfile_create(fname, "r");
+    qes_seqfile_set_header(lazy, QES_HEADER_LAZY);
+    while ((n_seqs = qes_seqfile_read_batch(sf, batch)) > 0) {
+        tt_int_op(qes_illumina_parse_batch(batch, hdrs), ==, n_seqs);
+        for (iii = 0; iii < n_seqs; iii++) {
+            /* A lazy header parses the same */
+            tt_int_op(qes_seqfile_read(lazy, seq), >, 0);
+            tt_int_op(seq->raw_header, ==, 1);
+            tt_int_op(qes_illumina_parse_seq(seq, &hdr), ==, 0);
+            tt_int_op(hdr.format, ==, QES_ILLUMINA_CASAVA18);
+            tt_int_op(hdr.format, ==, hdrs[iii].format);
+            tt_int_op(hdr.tile, ==, hdrs[iii].tile);
+            tt_int_op(hdr.x, ==, hdrs[iii].x);
+            tt_int_op(hdr.y, ==, hdrs[iii].y);
+            tt_int_op(hdr.read, ==, hdrs[iii].read);
+            tt_int_op(hdr.filtered, ==, hdrs[iii].filtered);
+            tt_int_op(hdr.flowcell_len, ==, hdrs[iii].flowcell_len);
+            tt_assert(memcmp(hdr.flowcell, hdrs[iii].flowcell,
+                             hdr.flowcell_len) == 0);
+        }
+    }
+    tt_int_op(n_seqs, ==, EOF);
+    tt_int_op(qes_seqfile_read(lazy, seq), ==, EOF);
+    /* Bad headers are marked, not errors */
+    qes_seqbatch_clear(batch);
+    tt_int_op(qes_seq_fill(seq, "read1", "c", "ACGT", "IIII"), ==, 0);
+    tt_int_op(qes_seqbatch_add(batch, seq), ==, 0);
+    tt_int_op(qes_seq_fill(seq, "M:1:FC:1:2:3:4", "1:N:0:ACGT", "ACGT",
+                           "IIII"), ==, 0);
+    tt_int_op(qes_seqbatch_add(batch, seq), ==, 0);
+    tt_int_op(qes_illumina_parse_batch(batch, hdrs), ==, 1);
+    tt_int_op(hdrs[0].format, ==, QES_ILLUMINA_UNKNOWN);
+    tt_int_op(hdrs[1].format, ==, QES_ILLUMINA_CASAVA18);
+    tt_assert(slice_eq(hdrs[1].index, hdrs[1].index_len, "ACGT"));
+    tt_int_op(qes_illumina_parse_batch(NULL, hdrs), ==, -1);
+    tt_int_op(qes_illumina_parse_seq(NULL, &hdr), ==, 1);
+end:
+    qes_seqfile_destroy(sf);
+    qes_seqfile_destroy(lazy);
+    qes_seqbatch_destroy(batch);
+    qes_seq_destroy(seq);
+    free(fname);
+}
+
+struct testcase_t qes_illumina_tests[] = {
+    { "qes_illumina_parse", test_qes_illumina_parse, 0, NULL, NULL},
+    { "qes_illumina_parse_batch", test_qes_illumina_parse_batch, 0, NULL,
+      NULL},
+    END_OF_TESTCASES
+};
@@ -89,8 +89,73 @@ end:
     ;
 }
 
+static void
+test_qes_hamming_long (void *p)
+{
+    char seq1[1000];
+    char seq2[1000];
+    size_t iii = 0;
+
+    (void) (p);
+    /* Longer than the vectorised block size, and not a multiple of it */
+    memset(seq1, 'A', sizeof(seq1) - 1);
+    seq1[sizeof(seq1) - 1] = '\0';
+    memcpy(seq2, seq1, sizeof(seq1));
+    tt_int_op(qes_match_hamming(seq1, seq2, 0), ==, 0);
+    for (iii = 0; iii < sizeof(seq2) - 1; iii += 7) {
+        seq2[iii] = 'T';
+    }
+    tt_int_op(qes_match_hamming(seq1, seq2, 0), ==, 143);
+    tt_int_op(qes_match_hamming(seq1, seq2, 999), ==, 143);
+    tt_int_op(qes_match_hamming(seq1, seq2, 70), ==, 10);
+    tt_int_op(qes_match_hamming_max(seq1, seq2, 0, INT_MAX), ==, 143);
+    tt_int_op(qes_match_hamming_max(seq1, seq2, 0, 143), ==, 143);
+    tt_int_op(qes_match_hamming_max(seq1, seq2, 0, 142), ==, 143);
+    tt_int_op(qes_match_hamming_max(seq1, seq2, 0, 5), ==, 6);
+    tt_int_op(qes_match_hamming_max(seq1, seq2, 0, 0), ==, 1);
+end:
+    ;
+}
+
+static void
+test_qes_hamming_revcomp_max (void *p)
+{
+    char seq[1000];
+    char *rc = NULL;
+    size_t len = sizeof(seq) - 1;
+    size_t iii = 0;
+
+    (void) (p);
+    tt_int_op(qes_match_hamming_revcomp_max("ACGTT", "AACGT", 5, 5), ==, 0);
+    tt_int_op(qes_match_hamming_revcomp_max("acgtt", "AACGT", 5, 5), ==, 0);
+    tt_int_op(qes_match_hamming_revcomp_max("ACGTT", "AACGA", 5, 5), ==, 1);
+    /* Only the first ``len`` chars of each are compared */
+    tt_int_op(qes_match_hamming_revcomp_max("ACGTT", "CGTAA", 3, 5), ==, 0);
+    /* Ns never match */
+    tt_int_op(qes_match_hamming_revcomp_max("ACNTT", "AANGT", 5, 5), ==, 1);
+    tt_int_op(qes_match_hamming_revcomp_max("ACGTT", "TTTTT", 5, 1), ==, 2);
+    tt_int_op(qes_match_hamming_revcomp_max(NULL, "ACGTT", 5, 1), ==, -1);
+    /* Over many blocks */
+    for (iii = 0; iii < len; iii++) {
+        seq[iii] = "ACGT"[(iii * 7 + iii / 3) % 4];
+    }
+    seq[len] = '\0';
+    rc = qes_sequtil_revcomp(seq, len);
+    tt_ptr_op(rc, !=, NULL);
+    tt_int_op(qes_match_hamming_revcomp_max(seq, rc, len, 0), ==, 0);
+    rc[0] = rc[0] == 'A' ? 'C' : 'A';
+    rc[len - 1] = rc[len - 1] == 'A' ? 'C' : 'A';
+    tt_int_op(qes_match_hamming_revcomp_max(seq, rc, len, 10), ==, 2);
+    tt_int_op(qes_match_hamming_revcomp_max(seq, rc, len, 1), ==, 2);
+end:
+    free(rc);
+}
+
 struct testcase_t qes_match_tests[] = {
     { "qes_match_hamming", test_qes_hamming, 0, NULL, NULL},
     { "qes_match_hamming_max", test_qes_hamming_max, 0, NULL, NULL},
+    { "qes_match_hamming_long", test_qes_hamming_long, 0, NULL, NULL},
+    { "qes_match_hamming_revcomp_max", test_qes_hamming_revcomp_max, 0, NULL,
+      NULL},
     END_OF_TESTCASES
 };
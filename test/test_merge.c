@@ -0,0 +1,319 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_merge.c
+ *
+ *    Description:  Tests for the qes_merge module
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 08:41:05
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_merge.h>
+#include <qes_pairedfile.h>
+
+#define READ_LEN 100
+static const char *adapter = "AGATCGGAAGAGCACACGTCTGAACTCCAGTCACATCTCGTATG"
+                             "CCGTCTTCTGCTTGAGATCGGAAGAGCGTCGTGTAGGGAAAGAG"
+                             "TGTAGATC";
+
+/* A made up insert of ``len`` bases */
+static void
+make_insert (char *insert, size_t len, uint32_t seed)
+{
+    size_t iii = 0;
+
+    for (iii = 0; iii < len; iii++) {
+        seed = seed * 1103515245 + 12345;
+        insert[iii] = "ACGT"[(seed >> 16) & 3];
+    }
+    insert[len] = '\0';
+}
+
+/* Mates of ``READ_LEN`` bases read from either end of ``insert``, reading
+ * on into the adapter if it's shorter */
+static void
+make_mates (const char *insert, size_t len, char *seq1, char *seq2)
+{
+    size_t keep = len < READ_LEN ? len : READ_LEN;
+
+    memcpy(seq1, insert, keep);
+    memcpy(seq1 + keep, adapter, READ_LEN - keep);
+    seq1[READ_LEN] = '\0';
+    memcpy(seq2, insert + len - keep, keep);
+    qes_sequtil_revcomp_inplace(seq2, keep);
+    memcpy(seq2 + keep, adapter, READ_LEN - keep);
+    seq2[READ_LEN] = '\0';
+}
+
+static void
+test_qes_merge_find_insert (void *ptr)
+{
+    struct qes_merge_opts opts;
+    struct qes_merge *merge = qes_merge_create(NULL);
+    char insert[700];
+    char other[700];
+    char seq1[READ_LEN + 1];
+    char seq2[READ_LEN + 1];
+    const size_t lens[] = {20, 60, 99, 100, 101, 150, 185};
+    size_t iii = 0;
+
+    (void) ptr;
+    tt_ptr_op(merge, !=, NULL);
+    make_insert(insert, 200, 1);
+    for (iii = 0; iii < 7; iii++) {
+        make_mates(insert, lens[iii], seq1, seq2);
+        tt_int_op(qes_merge_find_insert(merge, seq1, READ_LEN, seq2,
+                                        READ_LEN), ==, lens[iii]);
+        /* Case and a sequencing error don't matter */
+        seq1[READ_LEN - 1] = seq1[READ_LEN - 1] | 0x20;
+        seq2[READ_LEN - 5] = seq2[READ_LEN - 5] == 'A' ? 'C' : 'A';
+        tt_int_op(qes_merge_find_insert(merge, seq1, READ_LEN, seq2,
+                                        READ_LEN), ==, lens[iii]);
+    }
+    /* Mates of different lengths */
+    make_mates(insert, 150, seq1, seq2);
+    tt_int_op(qes_merge_find_insert(merge, seq1, 80, seq2, READ_LEN), ==,
+              150);
+    tt_int_op(qes_merge_find_insert(merge, seq1, READ_LEN, seq2, 70), ==,
+              150);
+    /* Too little overlap */
+    make_mates(insert, 195, seq1, seq2);
+    tt_int_op(qes_merge_find_insert(merge, seq1, READ_LEN, seq2, READ_LEN),
+              ==, 0);
+    /* Unless allowed */
+    memset(&opts, 0, sizeof(opts));
+    opts.min_overlap = 5;
+    qes_merge_destroy(merge);
+    merge = qes_merge_create(&opts);
+    tt_int_op(qes_merge_find_insert(merge, seq1, READ_LEN, seq2, READ_LEN),
+              ==, 195);
+    /* Unrelated mates, and Ns, which never match */
+    make_insert(other, 200, 2);
+    tt_int_op(qes_merge_find_insert(merge, insert, READ_LEN, other,
+                                    READ_LEN), ==, 0);
+    memset(seq1, 'N', READ_LEN);
+    tt_int_op(qes_merge_find_insert(merge, seq1, READ_LEN, seq1, READ_LEN),
+              ==, 0);
+    /* Mates longer than fit on the stack */
+    make_insert(insert, 600, 3);
+    tt_int_op(qes_merge_find_insert(merge, insert, 600, insert, 0), ==, 0);
+    memcpy(other, insert, 601);
+    qes_sequtil_revcomp_inplace(other, 600);
+    tt_int_op(qes_merge_find_insert(merge, insert, 600, other, 600), ==,
+              600);
+    tt_int_op(qes_merge_find_insert(NULL, insert, 600, other, 600), ==,
+              SIZE_MAX);
+    tt_int_op(qes_merge_find_insert(merge, NULL, 0, other, 600), ==,
+              SIZE_MAX);
+end:
+    qes_merge_destroy(merge);
+}
+
+static void
+test_qes_merge_pairs (void *ptr)
+{
+    struct qes_merge *merge = qes_merge_create(NULL);
+    struct qes_seq *seq1 = qes_seq_create();
+    struct qes_seq *seq2 = qes_seq_create();
+    struct qes_seq *merged = qes_seq_create();
+    char insert[400];
+    char mate1[READ_LEN + 1];
+    char mate2[READ_LEN + 1];
+    char qual[READ_LEN + 1];
+    char expect[400];
+    size_t iii = 0;
+
+    (void) ptr;
+    tt_ptr_op(merge, !=, NULL);
+    make_insert(insert, 150, 4);
+    make_mates(insert, 150, mate1, mate2);
+    memset(qual, 'I', READ_LEN);
+    qual[READ_LEN] = '\0';
+    tt_int_op(qes_seq_fill(seq1, "pair/1", "c1", mate1, qual), ==, 0);
+    tt_int_op(qes_seq_fill(seq2, "pair/2", "c2", mate2, qual), ==, 0);
+    tt_int_op(qes_merge_pairs(merge, seq1, seq2, merged), ==, 150);
+    tt_str_op(merged->seq.str, ==, insert);
+    tt_str_op(merged->name.str, ==, "pair/1");
+    tt_str_op(merged->comment.str, ==, "c1");
+    /* Q40 agreeing with Q40 is capped at Q41 */
+    tt_int_op(merged->qual.len, ==, 150);
+    for (iii = 0; iii < 150; iii++) {
+        expect[iii] = iii < 50 || iii >= 100 ? 'I' : 'J';
+    }
+    expect[150] = '\0';
+    tt_str_op(merged->qual.str, ==, expect);
+    /* Where they disagree, the better base wins, with a quality of about
+     * the difference of theirs. Base 60 of the insert is base 89 of
+     * read 2. */
+    seq1->seq.str[60] = seq1->seq.str[60] == 'A' ? 'C' : 'A';
+    seq1->qual.str[60] = '5';
+    seq2->qual.str[89] = '+';
+    tt_int_op(qes_merge_pairs(merge, seq1, seq2, merged), ==, 150);
+    tt_int_op(merged->seq.str[60], ==, seq1->seq.str[60]);
+    tt_int_op(merged->qual.str[60], ==, ',');
+    seq2->qual.str[89] = 'I';
+    tt_int_op(qes_merge_pairs(merge, seq1, seq2, merged), ==, 150);
+    tt_str_op(merged->seq.str, ==, insert);
+    tt_int_op(merged->qual.str[60], ==, '5');
+    /* An N takes the other mate's base and quality */
+    seq1->seq.str[60] = 'N';
+    tt_int_op(qes_merge_pairs(merge, seq1, seq2, merged), ==, 150);
+    tt_str_op(merged->seq.str, ==, insert);
+    tt_int_op(merged->qual.str[60], ==, 'I');
+    /* A short insert drops the adapter */
+    make_mates(insert, 70, mate1, mate2);
+    tt_int_op(qes_seq_fill(seq1, "short", "c", mate1, qual), ==, 0);
+    tt_int_op(qes_seq_fill(seq2, "short", "c", mate2, qual), ==, 0);
+    tt_int_op(qes_merge_pairs(merge, seq1, seq2, merged), ==, 70);
+    tt_int_op(strncmp(merged->seq.str, insert, 70), ==, 0);
+    tt_int_op(merged->qual.len, ==, 70);
+    /* Without qualities */
+    seq1->qual.len = 0;
+    tt_int_op(qes_merge_pairs(merge, seq1, seq2, merged), ==, 70);
+    tt_int_op(merged->qual.len, ==, 0);
+    tt_int_op(merge->n_pairs, ==, 6);
+    tt_int_op(merge->n_merged, ==, 6);
+    /* Mates which don't overlap leave ``merged`` be */
+    make_insert(insert, 300, 5);
+    make_mates(insert, 300, mate1, mate2);
+    tt_int_op(qes_seq_fill(seq1, "far", "c", mate1, qual), ==, 0);
+    tt_int_op(qes_seq_fill(seq2, "far", "c", mate2, qual), ==, 0);
+    tt_int_op(qes_merge_pairs(merge, seq1, seq2, merged), ==, 0);
+    tt_str_op(merged->name.str, ==, "short");
+    tt_int_op(merge->n_pairs, ==, 7);
+    tt_int_op(merge->n_merged, ==, 6);
+    /* Errors */
+    tt_int_op(qes_merge_pairs(merge, seq1, seq2, seq1), ==, -1);
+    tt_int_op(qes_merge_pairs(NULL, seq1, seq2, merged), ==, -1);
+    seq1->qual.len = 10;
+    tt_int_op(qes_merge_pairs(merge, seq1, seq2, merged), ==, -1);
+end:
+    qes_merge_destroy(merge);
+    qes_seq_destroy(seq1);
+    qes_seq_destroy(seq2);
+    qes_seq_destroy(merged);
+}
+
+/* Write ``n`` pairs to ``path1`` and ``path2``, with inserts of 20 to 219
+ * bases, as many of which overlap as don't */
+static int
+write_pairs (const char *path1, const char *path2, size_t n)
+{
+    FILE *fp1 = fopen(path1, "w");
+    FILE *fp2 = fopen(path2, "w");
+    char insert[400];
+    char mate1[READ_LEN + 1];
+    char mate2[READ_LEN + 1];
+    char qual[READ_LEN + 1];
+    size_t iii = 0;
+
+    if (fp1 == NULL || fp2 == NULL) return 1;
+    memset(qual, 'A', READ_LEN);
+    qual[READ_LEN] = '\0';
+    for (iii = 0; iii < n; iii++) {
+        make_insert(insert, 20 + iii % 200, iii + 10);
+        make_mates(insert, 20 + iii % 200, mate1, mate2);
+        fprintf(fp1, "@pair%zu/1\n%s\n+\n%s\n", iii, mate1, qual);
+        fprintf(fp2, "@pair%zu/2\n%s\n+\n%s\n", iii, mate2, qual);
+    }
+    fclose(fp1);
+    fclose(fp2);
+    return 0;
+}
+
+static void
+test_qes_merge_batch (void *ptr)
+{
+    struct qes_merge_opts opts;
+    struct qes_merge *merge = NULL;
+    struct qes_pairedfile *pf = NULL;
+    struct qes_seqbatch *batch1 = qes_seqbatch_create(64, 0);
+    struct qes_seqbatch *batch2 = qes_seqbatch_create(64, 0);
+    struct qes_seqbatch *merged = NULL;
+    struct qes_seq *seq1 = qes_seq_create();
+    struct qes_seq *seq2 = qes_seq_create();
+    struct qes_seq *expect = qes_seq_create();
+    struct qes_seq *got = qes_seq_create();
+    char *r1 = get_writable_file();
+    char *r2 = get_writable_file();
+    const size_t strides[] = {0, 256};
+    size_t inserts[64];
+    size_t n_merged = 0;
+    size_t jjj = 0;
+    size_t kkk = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    tt_int_op(write_pairs(r1, r2, 1000), ==, 0);
+    memset(&opts, 0, sizeof(opts));
+    opts.n_threads = 4;
+    merge = qes_merge_create(&opts);
+    tt_ptr_op(merge, !=, NULL);
+    for (jjj = 0; jjj < 2; jjj++) {
+        merged = qes_seqbatch_create(64, strides[jjj]);
+        pf = qes_pairedfile_create(r1, r2, NULL);
+        tt_ptr_op(pf, !=, NULL);
+        n_merged = 0;
+        while ((res = qes_pairedfile_read_batch(pf, batch1, batch2)) > 0) {
+            tt_int_op(qes_merge_batch(merge, batch1, batch2, merged,
+                                      jjj == 0 ? inserts : NULL), ==,
+                      merged->n_seqs);
+            /* The same as merging each pair */
+            res = 0;
+            for (kkk = 0; kkk < batch1->n_seqs; kkk++) {
+                tt_int_op(qes_seqbatch_get(batch1, kkk, seq1), ==, 0);
+                tt_int_op(qes_seqbatch_get(batch2, kkk, seq2), ==, 0);
+                if (qes_merge_pairs(merge, seq1, seq2, expect) == 0) {
+                    if (jjj == 0) tt_int_op(inserts[kkk], ==, 0);
+                    continue;
+                }
+                if (jjj == 0) tt_int_op(inserts[kkk], ==, expect->seq.len);
+                tt_int_op(qes_seqbatch_get(merged, res++, got), ==, 0);
+                tt_str_op(got->name.str, ==, expect->name.str);
+                tt_str_op(got->seq.str, ==, expect->seq.str);
+                tt_str_op(got->qual.str, ==, expect->qual.str);
+            }
+            tt_int_op(res, ==, merged->n_seqs);
+            n_merged += merged->n_seqs;
+        }
+        tt_int_op(res, ==, EOF);
+        /* Inserts of 20 to 190 bases overlap by at least 10 */
+        tt_int_op(n_merged, ==, 1000 / 200 * 171);
+        qes_pairedfile_destroy(pf);
+        qes_seqbatch_destroy(merged);
+    }
+    tt_int_op(merge->n_pairs, ==, 4000);
+    /* Too small a batch to merge into */
+    merged = qes_seqbatch_create(10, 0);
+    tt_int_op(qes_merge_batch(merge, batch1, batch2, merged, NULL), ==, -1);
+    tt_int_op(qes_merge_batch(merge, batch1, NULL, merged, NULL), ==, -1);
+end:
+    qes_merge_destroy(merge);
+    qes_pairedfile_destroy(pf);
+    qes_seqbatch_destroy(batch1);
+    qes_seqbatch_destroy(batch2);
+    qes_seqbatch_destroy(merged);
+    qes_seq_destroy(seq1);
+    qes_seq_destroy(seq2);
+    qes_seq_destroy(expect);
+    qes_seq_destroy(got);
+    clean_writable_file(r1);
+    clean_writable_file(r2);
+}
+
+struct testcase_t qes_merge_tests[] = {
+    { "qes_merge_find_insert", test_qes_merge_find_insert, 0, NULL, NULL},
+    { "qes_merge_pairs", test_qes_merge_pairs, 0, NULL, NULL},
+    { "qes_merge_batch", test_qes_merge_batch, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
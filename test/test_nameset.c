@@ -0,0 +1,181 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_nameset.c
+ *
+ *    Description:  Tests for the qes_nameset module
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 02:58:40
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_nameset.h>
+
+static void
+test_qes_nameset (void *ptr)
+{
+    struct qes_nameset *set = qes_nameset_create();
+    char name[32];
+    size_t iii = 0;
+
+    (void) ptr;
+    tt_ptr_op(set, !=, NULL);
+    tt_int_op(qes_nameset_add(set, "read1", 0), ==, 0);
+    tt_int_op(qes_nameset_add(set, "read1", 0), ==, 0);
+    tt_int_op(set->n_names, ==, 1);
+    tt_int_op(qes_nameset_contains(set, "read1", 0), ==, 1);
+    /* Prefixes and extensions of a name aren't it */
+    tt_int_op(qes_nameset_contains(set, "read", 0), ==, 0);
+    tt_int_op(qes_nameset_contains(set, "read10", 0), ==, 0);
+    tt_int_op(qes_nameset_contains(set, "read10", 5), ==, 1);
+    /* Enough names to grow a few times */
+    for (iii = 0; iii < 10000; iii++) {
+        snprintf(name, sizeof(name), "HWI:%zu:%zu", iii % 7, iii);
+        tt_int_op(qes_nameset_add(set, name, 0), ==, 0);
+    }
+    tt_int_op(set->n_names, ==, 10001);
+    tt_int_op(set->n_slots, >=, 2 * set->n_names);
+    for (iii = 0; iii < 10000; iii++) {
+        snprintf(name, sizeof(name), "HWI:%zu:%zu", iii % 7, iii);
+        tt_int_op(qes_nameset_contains(set, name, 0), ==, 1);
+        snprintf(name, sizeof(name), "HWI:%zu:%zu", iii % 7 + 1, iii);
+        tt_int_op(qes_nameset_contains(set, name, 0), ==, 0);
+    }
+    tt_int_op(qes_nameset_contains(set, "read1", 0), ==, 1);
+    tt_int_op(qes_nameset_add(NULL, "read1", 0), ==, 1);
+    tt_int_op(qes_nameset_contains(NULL, "read1", 0), ==, 0);
+end:
+    qes_nameset_destroy(set);
+}
+
+/* Check reading ``fname`` filtered by ``set`` gives the records whose name
+ * is in it (or not), in order. Returns the number read, or -1 on error. */
+static ssize_t
+check_filter (const struct qes_nameset *set, const char *fname, int exclude,
+              size_t bufsize)
+{
+    struct qes_file_opts opts;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqfile *all = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_seq *expect = qes_seq_create();
+    ssize_t n_read = 0;
+    ssize_t res = 0;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.bufsize = bufsize;
+    sf = qes_seqfile_create_opts(fname, "r", &opts);
+    all = qes_seqfile_create(fname, "r");
+    while ((res = qes_nameset_read(set, sf, seq, exclude)) > 0) {
+        do {
+            if (qes_seqfile_read(all, expect) <= 0) goto error;
+        } while (qes_nameset_contains(set, expect->name.str, 0) == exclude);
+        if (strcmp(seq->name.str, expect->name.str) != 0 ||
+                strcmp(seq->comment.str, expect->comment.str) != 0 ||
+                strcmp(seq->seq.str, expect->seq.str) != 0 ||
+                strcmp(seq->qual.str, expect->qual.str) != 0) {
+            goto error;
+        }
+        n_read++;
+    }
+    if (res != EOF) goto error;
+    /* Nothing else was to be kept */
+    while (qes_seqfile_read(all, expect) > 0) {
+        if (qes_nameset_contains(set, expect->name.str, 0) != exclude) {
+            goto error;
+        }
+    }
+    if (sf->n_records != all->n_records) goto error;
+    goto end;
+error:
+    n_read = -1;
+end:
+    qes_seqfile_destroy(sf);
+    qes_seqfile_destroy(all);
+    qes_seq_destroy(seq);
+    qes_seq_destroy(expect);
+    return n_read;
+}
+
+static void
+test_qes_nameset_read (void *ptr)
+{
+    struct qes_nameset *set = NULL;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *path = get_writable_file();
+    char *fname = NULL;
+    FILE *fp = NULL;
+    const char *files[] = {"test.fastq", "test.fastq.gz", "test.fasta"};
+    const size_t n_seqs[] = {1000, 1000, 813};
+    size_t n_listed = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+
+    (void) ptr;
+    for (iii = 0; iii < 3; iii++) {
+        fname = find_data_file(files[iii]);
+        /* List every seventh name, in each style we accept */
+        fp = fopen(path, "w");
+        tt_ptr_op(fp, !=, NULL);
+        sf = qes_seqfile_create(fname, "r");
+        n_listed = 0;
+        for (jjj = 0; qes_seqfile_read(sf, seq) > 0; jjj++) {
+            if (jjj % 7 != 0) continue;
+            if (jjj % 3 == 0) {
+                fprintf(fp, "%s\n", seq->name.str);
+            } else if (jjj % 3 == 1) {
+                fprintf(fp, "@%s %s\n", seq->name.str, seq->comment.str);
+            } else {
+                fprintf(fp, ">%s\t\n\n", seq->name.str);
+            }
+            n_listed++;
+        }
+        fprintf(fp, "not_a_read");
+        fclose(fp);
+        fp = NULL;
+        qes_seqfile_destroy(sf);
+        set = qes_nameset_create();
+        tt_int_op(qes_nameset_load(set, path), ==, n_listed + 1);
+        tt_int_op(check_filter(set, fname, 0, 0), ==, n_listed);
+        tt_int_op(check_filter(set, fname, 1, 0), ==,
+                  n_seqs[iii] - n_listed);
+        /* Headers straddling a tiny buffer are read in full */
+        tt_int_op(check_filter(set, fname, 0, 17), ==, n_listed);
+        tt_int_op(check_filter(set, fname, 1, 17), ==,
+                  n_seqs[iii] - n_listed);
+        qes_nameset_destroy(set);
+        free(fname);
+        fname = NULL;
+    }
+    /* Errors */
+    set = qes_nameset_create();
+    tt_int_op(qes_nameset_load(set, "/nonexistent"), ==, -1);
+    fname = find_data_file("bad_nohdr.fastq");
+    sf = qes_seqfile_create(fname, "r");
+    qes_seqfile_set_format(sf, FASTQ_FMT);
+    tt_int_op(qes_nameset_read(set, sf, seq, 1), <, -1);
+    tt_int_op(qes_nameset_read(NULL, sf, seq, 1), ==, -2);
+end:
+    if (fp != NULL) fclose(fp);
+    qes_nameset_destroy(set);
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+    clean_writable_file(path);
+    free(fname);
+}
+
+struct testcase_t qes_nameset_tests[] = {
+    { "qes_nameset", test_qes_nameset, 0, NULL, NULL},
+    { "qes_nameset_read", test_qes_nameset_read, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
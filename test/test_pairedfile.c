@@ -0,0 +1,212 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_pairedfile.c
+ *
+ *    Description:  Tests for the qes_pairedfile module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 20:31:47
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_pairedfile.h>
+
+/* Write the reads of test.fastq to ``fp``, skipping the first ``skip``, with
+ * ``suffix`` appended to each name. If ``fp2`` isn't NULL, each read is also
+ * written there with ``suffix2``. */
+static int
+write_mates (FILE *fp, const char *suffix, FILE *fp2, const char *suffix2,
+             size_t skip)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *fname = find_data_file("test.fastq");
+    size_t n = 0;
+
+    sf = qes_seqfile_create(fname, "r");
+    free(fname);
+    if (sf == NULL) return 1;
+    while (qes_seqfile_read(sf, seq) > 0) {
+        if (n++ < skip) continue;
+        fprintf(fp, "@%s%s\n%s\n+\n%s\n", seq->name.str, suffix,
+                seq->seq.str, seq->qual.str);
+        if (fp2 != NULL) {
+            fprintf(fp2, "@%s%s\n%s\n+\n%s\n", seq->name.str, suffix2,
+                    seq->seq.str, seq->qual.str);
+        }
+    }
+    qes_seq_destroy(seq);
+    qes_seqfile_destroy(sf);
+    return 0;
+}
+
+static void
+test_qes_pairedfile_mates_match (void *ptr)
+{
+    (void) ptr;
+    tt_assert(qes_pairedfile_mates_match("read", 4, "read", 4));
+    tt_assert(qes_pairedfile_mates_match("read/1", 6, "read/2", 6));
+    tt_assert(qes_pairedfile_mates_match("/1", 2, "/2", 2));
+    tt_assert(qes_pairedfile_mates_match("", 0, "", 0));
+    tt_assert(!qes_pairedfile_mates_match("read/1", 6, "reed/2", 6));
+    tt_assert(!qes_pairedfile_mates_match("read", 4, "read/2", 6));
+    tt_assert(!qes_pairedfile_mates_match("read_1", 6, "read_2", 6));
+    tt_assert(!qes_pairedfile_mates_match("read/a", 6, "read/b", 6));
+end:
+    ;
+}
+
+static void
+test_qes_pairedfile_read (void *ptr)
+{
+    struct qes_pairedfile *pf = NULL;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq *seq1 = qes_seq_create();
+    struct qes_seq *seq2 = qes_seq_create();
+    struct qes_seq *expect = qes_seq_create();
+    char *fname = NULL;
+    size_t n_pairs = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    fname = find_data_file("test.fastq");
+    /* A file paired with itself has matching names */
+    pf = qes_pairedfile_create(fname, fname, NULL);
+    tt_ptr_op(pf, !=, NULL);
+    tt_int_op(pf->check_names, ==, 1);
+    sf = qes_seqfile_create(fname, "r");
+    tt_ptr_op(sf, !=, NULL);
+    while ((res = qes_pairedfile_read(pf, seq1, seq2)) > 0) {
+        tt_int_op(qes_seqfile_read(sf, expect), >, 0);
+        tt_str_op(seq1->name.str, ==, expect->name.str);
+        tt_str_op(seq2->seq.str, ==, expect->seq.str);
+        n_pairs++;
+    }
+    tt_int_op(res, ==, EOF);
+    tt_int_op(n_pairs, ==, 1000);
+    tt_int_op(pf->n_pairs, ==, 1000);
+    qes_pairedfile_destroy(pf);
+    /* Read interleaved, consecutive reads aren't mates */
+    pf = qes_pairedfile_create(fname, NULL, NULL);
+    tt_ptr_op(pf, !=, NULL);
+    tt_ptr_op(pf->r2, ==, NULL);
+    tt_int_op(qes_pairedfile_read(pf, seq1, seq2), ==, -2);
+    tt_str_op(qes_pairedfile_error(pf), ==, "Names of pair 1 don't match");
+    pf->check_names = 0;
+    n_pairs = 1;
+    while ((res = qes_pairedfile_read(pf, seq1, seq2)) > 0) {
+        n_pairs++;
+    }
+    tt_int_op(res, ==, EOF);
+    tt_int_op(n_pairs, ==, 500);
+    /* Bad arguments */
+    tt_int_op(qes_pairedfile_read(pf, NULL, seq2), ==, -2);
+    tt_int_op(qes_pairedfile_read(NULL, seq1, seq2), ==, -2);
+    tt_ptr_op(qes_pairedfile_create(NULL, fname, NULL), ==, NULL);
+    tt_str_op(qes_pairedfile_error(NULL), ==, "BAD FILE");
+end:
+    qes_pairedfile_destroy(pf);
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq1);
+    qes_seq_destroy(seq2);
+    qes_seq_destroy(expect);
+    free(fname);
+}
+
+static void
+test_qes_pairedfile_read_batch (void *ptr)
+{
+    struct qes_pairedfile *pf = NULL;
+    struct qes_seqbatch *batch1 = qes_seqbatch_create(64, 0);
+    struct qes_seqbatch *batch2 = qes_seqbatch_create(64, 0);
+    struct qes_seqbatch *small = qes_seqbatch_create(10, 0);
+    FILE *fp1 = NULL;
+    FILE *fp2 = NULL;
+    char *r1 = get_writable_file();
+    char *r2 = get_writable_file();
+    char *il = get_writable_file();
+    size_t n_pairs = 0;
+    size_t iii = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    /* Old-style /1 and /2 names, in two files and interleaved */
+    fp1 = fopen(r1, "w");
+    fp2 = fopen(r2, "w");
+    tt_int_op(write_mates(fp1, "/1", fp2, "/2", 0), ==, 0);
+    fclose(fp1);
+    fclose(fp2);
+    fp1 = fopen(il, "w");
+    tt_int_op(write_mates(fp1, "/1", fp1, "/2", 0), ==, 0);
+    fclose(fp1);
+    fp1 = fp2 = NULL;
+    for (iii = 0; iii < 2; iii++) {
+        pf = iii == 0 ? qes_pairedfile_create(r1, r2, NULL) :
+                        qes_pairedfile_create(il, NULL, NULL);
+        tt_ptr_op(pf, !=, NULL);
+        n_pairs = 0;
+        while ((res = qes_pairedfile_read_batch(pf, batch1, batch2)) > 0) {
+            tt_int_op(batch1->n_seqs, ==, res);
+            tt_int_op(batch2->n_seqs, ==, res);
+            tt_int_op(qes_seqbatch_len(batch1, name, 0), >, 2);
+            tt_str_op(qes_seqbatch_str(batch1, seq, res - 1), ==,
+                      qes_seqbatch_str(batch2, seq, res - 1));
+            n_pairs += res;
+        }
+        tt_int_op(res, ==, EOF);
+        tt_int_op(n_pairs, ==, 1000);
+        tt_int_op(pf->n_pairs, ==, 1000);
+        /* Batches must be the same size */
+        tt_int_op(qes_pairedfile_read_batch(pf, batch1, small), ==, -2);
+        qes_pairedfile_destroy(pf);
+    }
+    /* Mates out of step */
+    fp2 = fopen(r2, "w");
+    tt_int_op(write_mates(fp2, "/2", NULL, NULL, 1), ==, 0);
+    fclose(fp2);
+    fp2 = NULL;
+    pf = qes_pairedfile_create(r1, r2, NULL);
+    tt_ptr_op(pf, !=, NULL);
+    tt_int_op(qes_pairedfile_read_batch(pf, batch1, batch2), ==, -2);
+    tt_str_op(qes_pairedfile_error(pf), ==, "Names of pair 1 don't match");
+    /* Without checking names, the second file runs out first. The first
+     * batch was read, so we start from the second. */
+    pf->check_names = 0;
+    n_pairs = 0;
+    while ((res = qes_pairedfile_read_batch(pf, batch1, batch2)) > 0) {
+        n_pairs += res;
+    }
+    tt_int_op(res, ==, -2);
+    tt_int_op(n_pairs, ==, 1000 / 64 * 64 - 64);
+    tt_int_op(pf->n_pairs, ==, n_pairs);
+    tt_str_op(qes_pairedfile_error(pf), ==,
+              "Files have different numbers of reads");
+end:
+    if (fp1 != NULL) fclose(fp1);
+    if (fp2 != NULL) fclose(fp2);
+    qes_pairedfile_destroy(pf);
+    qes_seqbatch_destroy(batch1);
+    qes_seqbatch_destroy(batch2);
+    qes_seqbatch_destroy(small);
+    clean_writable_file(r1);
+    clean_writable_file(r2);
+    clean_writable_file(il);
+}
+
+struct testcase_t qes_pairedfile_tests[] = {
+    { "qes_pairedfile_mates_match", test_qes_pairedfile_mates_match, 0, NULL,
+      NULL},
+    { "qes_pairedfile_read", test_qes_pairedfile_read, 0, NULL, NULL},
+    { "qes_pairedfile_read_batch", test_qes_pairedfile_read_batch, 0, NULL,
+      NULL},
+    END_OF_TESTCASES
+};
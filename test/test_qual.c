@@ -0,0 +1,277 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_qual.c
+ *
+ *    Description:  Tests for the qes_qual module
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 06:12:40
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <zlib.h>
+#include <qes_qual.h>
+
+/* Illumina's binning, one score at a time */
+static char
+ref_bin (char qual)
+{
+    int phred = (unsigned char)qual - 33;
+
+    if (phred < 2) return qual;
+    if (phred < 10) return 33 + 6;
+    if (phred < 20) return 33 + 15;
+    if (phred < 25) return 33 + 22;
+    if (phred < 30) return 33 + 27;
+    if (phred < 35) return 33 + 33;
+    if (phred < 40) return 33 + 37;
+    return 33 + 40;
+}
+
+/* Qualities of every record of test.fastq, back to back */
+static char *
+load_quals (size_t *len, size_t **lens, size_t *n_reads)
+{
+    char *fname = find_data_file("test.fastq");
+    struct qes_seqfile *sf = qes_seqfile_create(fname, "r");
+    struct qes_seq *seq = qes_seq_create();
+    char *quals = NULL;
+
+    *len = 0;
+    *n_reads = 0;
+    *lens = NULL;
+    while (qes_seqfile_read(sf, seq) > 0) {
+        quals = realloc(quals, *len + seq->qual.len + 1);
+        *lens = realloc(*lens, (*n_reads + 1) * sizeof(**lens));
+        memcpy(quals + *len, seq->qual.str, seq->qual.len);
+        *len += seq->qual.len;
+        (*lens)[(*n_reads)++] = seq->qual.len;
+    }
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+    free(fname);
+    return quals;
+}
+
+static void
+test_qes_qual_bin (void *ptr)
+{
+    struct qes_qual_bins bins;
+    struct qes_seqbatch *batch = NULL;
+    struct qes_seqfile *sf = NULL;
+    char *fname = NULL;
+    char buf[1000];
+    char expect[1000];
+    const int lows[] = {0, 20, 30};
+    const int values[] = {10, 25, 35};
+    const int bad_lows[] = {0, 20, 20};
+    const int bad_values[] = {10, 250, 35};
+    const size_t strides[] = {0, 128};
+    size_t iii = 0;
+    size_t jjj = 0;
+
+    (void) ptr;
+    qes_qual_bins_illumina(&bins);
+    tt_int_op(bins.n_bins, ==, 7);
+    /* Every byte, at lengths around the chunk size */
+    for (iii = 0; iii < sizeof(buf); iii++) {
+        buf[iii] = iii % 255 + 1;
+        expect[iii] = ref_bin(buf[iii]);
+    }
+    qes_qual_bin(&bins, buf, 255);
+    tt_assert(memcmp(buf, expect, 255) == 0);
+    qes_qual_bin(&bins, buf + 255, sizeof(buf) - 255);
+    tt_assert(memcmp(buf, expect, sizeof(buf)) == 0);
+    /* Custom bins */
+    tt_int_op(qes_qual_bins_init(&bins, lows, values, 3), ==, 0);
+    memcpy(buf, " !+5?IK", 8);
+    qes_qual_bin(&bins, buf, 7);
+    tt_str_op(buf, ==, " ++:DDD");
+    tt_int_op(qes_qual_bins_init(&bins, bad_lows, values, 3), ==, 1);
+    tt_int_op(qes_qual_bins_init(&bins, lows, bad_values, 3), ==, 1);
+    tt_int_op(qes_qual_bins_init(&bins, lows, values, 0), ==, 1);
+    tt_int_op(qes_qual_bins_init(&bins, lows, values, 17), ==, 1);
+    tt_int_op(qes_qual_bins_init(NULL, lows, values, 3), ==, 1);
+    /* Whole batches at once, packed or strided */
+    qes_qual_bins_illumina(&bins);
+    fname = find_data_file("test.fastq");
+    for (iii = 0; iii < 2; iii++) {
+        batch = qes_seqbatch_create(100, strides[iii]);
+        sf = qes_seqfile_create(fname, "r");
+        tt_int_op(qes_seqfile_read_batch(sf, batch), ==, 100);
+        memcpy(buf, qes_seqbatch_str(batch, qual, 99),
+               qes_seqbatch_len(batch, qual, 99));
+        qes_qual_bin_batch(&bins, batch);
+        for (jjj = 0; jjj < qes_seqbatch_len(batch, qual, 99); jjj++) {
+            tt_int_op(qes_seqbatch_str(batch, qual, 99)[jjj], ==,
+                      ref_bin(buf[jjj]));
+        }
+        tt_int_op(strlen(qes_seqbatch_str(batch, qual, 99)), ==,
+                  qes_seqbatch_len(batch, qual, 99));
+        qes_seqfile_destroy(sf);
+        qes_seqbatch_destroy(batch);
+    }
+end:
+    qes_seqfile_destroy(sf);
+    qes_seqbatch_destroy(batch);
+    free(fname);
+}
+
+static void
+test_qes_qual_codec (void *ptr)
+{
+    struct qes_qual_codec *codec = NULL;
+    struct qes_qual_bins bins;
+    char *quals = NULL;
+    char *decoded = NULL;
+    size_t *lens = NULL;
+    uint8_t *out = NULL;
+    size_t len = 0;
+    size_t n_reads = 0;
+    size_t bound = 0;
+    ssize_t coded = 0;
+    ssize_t coded_raw = 0;
+    uLongf gz_len = 0;
+    int order = 0;
+    uint8_t one = 0;
+
+    (void) ptr;
+    quals = load_quals(&len, &lens, &n_reads);
+    tt_int_op(n_reads, ==, 1000);
+    bound = qes_qual_encode_bound(len);
+    out = malloc(bound);
+    decoded = malloc(len);
+    /* gzip's default level, for comparison */
+    gz_len = bound;
+    tt_int_op(compress2(out, &gz_len, (uint8_t *)quals, len, 6), ==, Z_OK);
+    for (order = 1; order <= 2; order++) {
+        codec = qes_qual_codec_create(order);
+        tt_ptr_op(codec, !=, NULL);
+        coded_raw = qes_qual_encode(codec, quals, len, lens, n_reads, out,
+                                    bound);
+        tt_int_op(coded_raw, >, 0);
+        tt_int_op(coded_raw, <, gz_len);
+        memset(decoded, 0, len);
+        tt_int_op(qes_qual_decode(codec, out, coded_raw, decoded, len, lens,
+                                  n_reads), ==, 0);
+        tt_assert(memcmp(decoded, quals, len) == 0);
+        /* The same, as one long read */
+        coded = qes_qual_encode(codec, quals, len, NULL, 0, out, bound);
+        tt_int_op(coded, >, 0);
+        tt_int_op(qes_qual_decode(codec, out, coded, decoded, len, NULL, 0),
+                  ==, 0);
+        tt_assert(memcmp(decoded, quals, len) == 0);
+        /* Too little room */
+        tt_int_op(qes_qual_encode(codec, quals, len, lens, n_reads, out,
+                                  coded_raw - 1), ==, -1);
+        qes_qual_codec_destroy(codec);
+    }
+    /* Binned scores code far smaller */
+    qes_qual_bins_illumina(&bins);
+    qes_qual_bin(&bins, quals, len);
+    codec = qes_qual_codec_create(2);
+    coded = qes_qual_encode(codec, quals, len, lens, n_reads, out, bound);
+    tt_int_op(coded, >, 0);
+    tt_int_op(coded * 2, <, coded_raw);
+    tt_int_op(qes_qual_decode(codec, out, coded, decoded, len, lens,
+                              n_reads), ==, 0);
+    tt_assert(memcmp(decoded, quals, len) == 0);
+    /* Lengths must add up */
+    lens[0]++;
+    tt_int_op(qes_qual_encode(codec, quals, len, lens, n_reads, out, bound),
+              ==, -1);
+    tt_int_op(qes_qual_decode(codec, out, coded, decoded, len, lens,
+                              n_reads), ==, 1);
+    lens[0]--;
+    /* A bad header */
+    out[0] = 3;
+    tt_int_op(qes_qual_decode(codec, out, coded, decoded, len, lens,
+                              n_reads), ==, 1);
+    tt_int_op(qes_qual_decode(codec, out, 2, decoded, len, lens, n_reads),
+              ==, 1);
+    /* Nothing to code, and a single symbol */
+    coded = qes_qual_encode(codec, NULL, 0, NULL, 0, out, bound);
+    tt_int_op(coded, ==, 5);
+    tt_int_op(qes_qual_decode(codec, out, coded, NULL, 0, NULL, 0), ==, 0);
+    memset(quals, 'I', len);
+    coded = qes_qual_encode(codec, quals, len, lens, n_reads, out, bound);
+    tt_int_op(coded, <, 32);
+    tt_int_op(qes_qual_decode(codec, out, coded, decoded, len, lens,
+                              n_reads), ==, 0);
+    tt_assert(memcmp(decoded, quals, len) == 0);
+    tt_int_op(qes_qual_encode(NULL, quals, len, NULL, 0, out, bound), ==,
+              -1);
+    tt_int_op(qes_qual_decode(codec, &one, 1, decoded, 1, NULL, 0), ==, 1);
+    tt_ptr_op(qes_qual_codec_create(3), ==, NULL);
+end:
+    qes_qual_codec_destroy(codec);
+    free(quals);
+    free(decoded);
+    free(lens);
+    free(out);
+}
+
+static void
+test_qes_qual_codec_batch (void *ptr)
+{
+    struct qes_qual_codec *codec = qes_qual_codec_create(2);
+    struct qes_seqbatch *batch = NULL;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_seq *expect = qes_seq_create();
+    char *fname = find_data_file("test.fastq");
+    uint8_t *out = malloc(qes_qual_encode_bound(100 * 128));
+    const size_t strides[] = {0, 128};
+    ssize_t coded = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+
+    (void) ptr;
+    for (iii = 0; iii < 2; iii++) {
+        batch = qes_seqbatch_create(100, strides[iii]);
+        sf = qes_seqfile_create(fname, "r");
+        tt_int_op(qes_seqfile_read_batch(sf, batch), ==, 100);
+        coded = qes_qual_encode_batch(codec, batch, out,
+                                      qes_qual_encode_bound(100 * 128));
+        tt_int_op(coded, >, 0);
+        /* Wipe the qualities, then get them back */
+        memset(batch->qual.data, 0, batch->qual.len);
+        batch->qual.len = 0;
+        tt_int_op(qes_qual_decode_batch(codec, out, coded, batch), ==, 0);
+        qes_seqfile_destroy(sf);
+        sf = qes_seqfile_create(fname, "r");
+        for (jjj = 0; jjj < 100; jjj++) {
+            tt_int_op(qes_seqfile_read(sf, expect), >, 0);
+            tt_int_op(qes_seqbatch_get(batch, jjj, seq), ==, 0);
+            tt_str_op(seq->qual.str, ==, expect->qual.str);
+        }
+        qes_seqfile_destroy(sf);
+        qes_seqbatch_destroy(batch);
+    }
+    tt_int_op(qes_qual_encode_batch(codec, NULL, out, 1), ==, -1);
+    tt_int_op(qes_qual_decode_batch(codec, out, coded, NULL), ==, 1);
+end:
+    qes_qual_codec_destroy(codec);
+    qes_seqfile_destroy(sf);
+    qes_seqbatch_destroy(batch);
+    qes_seq_destroy(seq);
+    qes_seq_destroy(expect);
+    free(fname);
+    free(out);
+}
+
+struct testcase_t qes_qual_tests[] = {
+    { "qes_qual_bin", test_qes_qual_bin, 0, NULL, NULL},
+    { "qes_qual_codec", test_qes_qual_codec, 0, NULL, NULL},
+    { "qes_qual_codec_batch", test_qes_qual_codec_batch, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
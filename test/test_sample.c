@@ -0,0 +1,148 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_sample.c
+ *
+ *    Description:  Tests for the qes_sample module
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 01:47:15
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_sample.h>
+
+#define N_RECORDS 1000
+
+/* Sample test.fastq, checking the sample is in file order. Returns the
+ * number of records sampled, or -1 on error. ``first`` is set to the index
+ * of the first record sampled. */
+static ssize_t
+check_sample (double fraction, size_t count, uint64_t seed, size_t *first)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqfile *all = NULL;
+    struct qes_sampler *sampler = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_seq *expect = qes_seq_create();
+    char *fname = find_data_file("test.fastq");
+    size_t idx = 0;
+    ssize_t n_sampled = 0;
+    ssize_t res = 0;
+
+    sf = qes_seqfile_create(fname, "r");
+    all = qes_seqfile_create(fname, "r");
+    if (fraction >= 0.0) {
+        sampler = qes_sampler_create_fraction(sf, fraction, seed);
+    } else {
+        sampler = qes_sampler_create_count(sf, count, seed);
+    }
+    if (sampler == NULL) goto error;
+    while ((res = qes_sampler_read(sampler, seq)) > 0) {
+        /* Each record sampled is a later record of the file */
+        do {
+            if (qes_seqfile_read(all, expect) <= 0) goto error;
+            idx++;
+        } while (strcmp(seq->name.str, expect->name.str) != 0);
+        if (strcmp(seq->seq.str, expect->seq.str) != 0) goto error;
+        if (n_sampled++ == 0) *first = idx - 1;
+    }
+    if (res != EOF) goto error;
+    goto end;
+error:
+    n_sampled = -1;
+end:
+    qes_sampler_destroy(sampler);
+    qes_seqfile_destroy(sf);
+    qes_seqfile_destroy(all);
+    qes_seq_destroy(seq);
+    qes_seq_destroy(expect);
+    free(fname);
+    return n_sampled;
+}
+
+static void
+test_qes_sampler_fraction (void *ptr)
+{
+    size_t first = 0;
+    ssize_t total = 0;
+    ssize_t res = 0;
+    uint64_t seed = 0;
+
+    (void) ptr;
+    tt_int_op(check_sample(0.0, 0, 1, &first), ==, 0);
+    tt_int_op(check_sample(1.0, 0, 1, &first), ==, N_RECORDS);
+    tt_int_op(first, ==, 0);
+    /* About a tenth, on average */
+    for (seed = 0; seed < 20; seed++) {
+        res = check_sample(0.1, 0, seed, &first);
+        tt_int_op(res, >, 50);
+        tt_int_op(res, <, 150);
+        total += res;
+    }
+    tt_int_op(total, >, 1800);
+    tt_int_op(total, <, 2200);
+    /* The same seed gives the same sample */
+    tt_int_op(check_sample(0.01, 0, 42, &first), ==,
+              check_sample(0.01, 0, 42, &first));
+    tt_ptr_op(qes_sampler_create_fraction(NULL, 0.5, 1), ==, NULL);
+end:
+    ;
+}
+
+static void
+test_qes_sampler_count (void *ptr)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_sampler *sampler = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *fname = find_data_file("test.fastq");
+    size_t first = 0;
+    size_t first_sum = 0;
+    uint64_t seed = 0;
+
+    (void) ptr;
+    tt_int_op(check_sample(-1.0, 0, 1, &first), ==, 0);
+    tt_int_op(check_sample(-1.0, 10, 1, &first), ==, 10);
+    tt_int_op(check_sample(-1.0, 999, 1, &first), ==, 999);
+    tt_int_op(check_sample(-1.0, 5000, 1, &first), ==, N_RECORDS);
+    tt_int_op(first, ==, 0);
+    /* Single records are uniform, so average the middle record */
+    for (seed = 0; seed < 400; seed++) {
+        tt_int_op(check_sample(-1.0, 1, seed, &first), ==, 1);
+        first_sum += first;
+    }
+    tt_int_op(first_sum / 400, >, 400);
+    tt_int_op(first_sum / 400, <, 600);
+    /* The file is read from where it was, and left where it was */
+    sf = qes_seqfile_create(fname, "r");
+    tt_int_op(qes_seqfile_skip(sf, 990), ==, 990);
+    sampler = qes_sampler_create_count(sf, 100, 1);
+    tt_ptr_op(sampler, !=, NULL);
+    tt_int_op(sampler->n_keep, ==, 10);
+    tt_int_op(sf->n_records, ==, 990);
+    for (first = 0; first < 10; first++) {
+        tt_int_op(qes_sampler_read(sampler, seq), >, 0);
+    }
+    tt_int_op(qes_sampler_read(sampler, seq), ==, EOF);
+    tt_int_op(qes_sampler_read(NULL, seq), ==, -2);
+end:
+    qes_sampler_destroy(sampler);
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+    free(fname);
+}
+
+struct testcase_t qes_sample_tests[] = {
+    { "qes_sampler_fraction", test_qes_sampler_fraction, 0, NULL, NULL},
+    { "qes_sampler_count", test_qes_sampler_count, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
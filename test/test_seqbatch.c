@@ -0,0 +1,117 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_seqbatch.c
+ *
+ *    Description:  Tests for the qes_seqbatch module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 15:37:02
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_seqbatch.h>
+
+
+static void
+test_qes_seqfile_read_batch (void *ptr)
+{
+    struct qes_seqbatch *batch = NULL;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqfile *batchsf = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_seq *got = qes_seq_create();
+    char *fname = NULL;
+    const char *files[] = {"test.fastq", "test.fasta"};
+    const size_t strides[] = {0, 64};
+    size_t n_recs = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+    size_t kkk = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    for (jjj = 0; jjj < sizeof(files) / sizeof(*files); jjj++) {
+    for (kkk = 0; kkk < sizeof(strides) / sizeof(*strides); kkk++) {
+        fname = find_data_file(files[jjj]);
+        tt_assert(fname != NULL);
+        sf = qes_seqfile_create(fname, "r");
+        batchsf = qes_seqfile_create(fname, "r");
+        batch = qes_seqbatch_create(100, strides[kkk]);
+        tt_ptr_op(batch, !=, NULL);
+        n_recs = 0;
+        while ((res = qes_seqfile_read_batch(batchsf, batch)) > 0) {
+            tt_int_op(res, ==, batch->n_seqs);
+            for (iii = 0; iii < batch->n_seqs; iii++) {
+                tt_int_op(qes_seqfile_read(sf, seq), >, 0);
+                tt_str_op(qes_seqbatch_str(batch, name, iii), ==,
+                          seq->name.str);
+                tt_int_op(qes_seqbatch_len(batch, name, iii), ==,
+                          seq->name.len);
+                tt_str_op(qes_seqbatch_str(batch, comment, iii), ==,
+                          seq->comment.str);
+                tt_str_op(qes_seqbatch_str(batch, seq, iii), ==,
+                          seq->seq.str);
+                tt_int_op(qes_seqbatch_len(batch, seq, iii), ==,
+                          seq->seq.len);
+                tt_str_op(qes_seqbatch_str(batch, qual, iii), ==,
+                          seq->qual.str);
+                if (strides[kkk] > 0) {
+                    tt_ptr_op(qes_seqbatch_str(batch, seq, iii), ==,
+                              batch->seq.data + iii * strides[kkk]);
+                }
+                tt_int_op(qes_seqbatch_get(batch, iii, got), ==, 0);
+                tt_str_op(got->name.str, ==, seq->name.str);
+                tt_str_op(got->seq.str, ==, seq->seq.str);
+                tt_int_op(got->qual.len, ==, seq->qual.len);
+                n_recs++;
+            }
+        }
+        tt_int_op(res, ==, EOF);
+        tt_int_op(n_recs, ==, sf->n_records);
+        tt_int_op(qes_seqfile_read(sf, seq), ==, EOF);
+        qes_seqfile_destroy(sf);
+        qes_seqfile_destroy(batchsf);
+        qes_seqbatch_destroy(batch);
+        free(fname);
+        fname = NULL;
+    }
+    }
+    /* Reads must fit in the stride */
+    batch = qes_seqbatch_create(2, 4);
+    tt_int_op(qes_seq_fill(seq, "r", "c", "ACG", "III"), ==, 0);
+    tt_int_op(qes_seqbatch_add(batch, seq), ==, 0);
+    tt_int_op(qes_seq_fill(seq, "r", "c", "ACGT", "IIII"), ==, 0);
+    tt_int_op(qes_seqbatch_add(batch, seq), ==, 1);
+    tt_int_op(batch->n_seqs, ==, 1);
+    /* Full batches can't be added to */
+    tt_int_op(qes_seq_fill(seq, "r", "c", "A", "I"), ==, 0);
+    tt_int_op(qes_seqbatch_add(batch, seq), ==, 0);
+    tt_int_op(qes_seqbatch_add(batch, seq), ==, 1);
+    /* Bad arguments */
+    tt_int_op(qes_seqbatch_get(batch, 2, got), ==, 1);
+    tt_int_op(qes_seqbatch_add(NULL, seq), ==, 1);
+    tt_int_op(qes_seqfile_read_batch(NULL, batch), ==, -2);
+    tt_ptr_op(qes_seqbatch_create(0, 0), ==, NULL);
+end:
+    qes_seqfile_destroy(sf);
+    qes_seqfile_destroy(batchsf);
+    qes_seqbatch_destroy(batch);
+    qes_seq_destroy(seq);
+    qes_seq_destroy(got);
+    if (fname != NULL) free(fname);
+}
+
+
+struct testcase_t qes_seqbatch_tests[] = {
+    { "qes_seqfile_read_batch", test_qes_seqfile_read_batch, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
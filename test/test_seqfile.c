@@ -19,6 +19,8 @@
 #include "tests.h"
 
 #include <qes_seqfile.h>
+#include <qes_seqbatch.h>
+#include <fcntl.h>
 
 #include "kseq.h"
 KSEQ_INIT(gzFile, gzread)
@@ -369,6 +371,426 @@ end:
     if (crc != NULL) free(crc);
 }
 
+static void
+test_qes_seqfile_create_opts (void *ptr)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_file_opts opts = {.bufsize = 16, .adaptive = 1,
+                                 .max_bufsize = 1<<12};
+    char *fname = NULL;
+    const char *files[] = {"test.fastq", "test.fastq.gz", "test.fasta"};
+    const size_t n_records[] = {1000, 1000, 813};
+    size_t iii = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    /* A small adaptive buffer reads the same records as the default */
+    for (iii = 0; iii < sizeof(files) / sizeof(*files); iii++) {
+        fname = find_data_file(files[iii]);
+        sf = qes_seqfile_create_opts(fname, "r", &opts);
+        tt_ptr_op(sf, !=, NULL);
+        tt_int_op(sf->qf->bufsize, >=, 16);
+        while ((res = qes_seqfile_read(sf, seq)) > 0) {
+            tt_int_op(seq->seq.len, ==, res);
+        }
+        tt_int_op(res, ==, EOF);
+        tt_int_op(sf->n_records, ==, n_records[iii]);
+        tt_int_op(sf->qf->bufsize, <=, 1<<12);
+        qes_seqfile_destroy(sf);
+        free(fname);
+        fname = NULL;
+    }
+end:
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+    if (fname != NULL) free(fname);
+}
+
+static void
+test_qes_seqfile_counters (void *ptr)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_seqfile_counters counters;
+    struct qes_file_stats stats;
+    char *fname = NULL;
+    ssize_t res = 0;
+
+    (void) ptr;
+    fname = find_data_file("test.fastq");
+    sf = qes_seqfile_create(fname, "r");
+    tt_ptr_op(sf, !=, NULL);
+    while ((res = qes_seqfile_read(sf, seq)) > 0);
+    res = qes_seqfile_read(sf, seq);
+    tt_int_op(res, ==, EOF);
+    res = qes_seqfile_read(sf, NULL);
+    tt_int_op(res, ==, -2);
+#ifdef QES_STATS
+    tt_int_op(qes_seqfile_counters(sf, &counters, &stats), ==, 0);
+    tt_int_op(counters.n_results[0], ==, 1000);
+    tt_int_op(counters.n_results[-EOF], ==, 2);
+    tt_int_op(counters.n_results[2], ==, 1);
+    tt_int_op(stats.n_fills, >, 0);
+    qes_seqfile_destroy(sf);
+    free(fname);
+    fname = find_data_file("bad_diff_lens.fastq");
+    sf = qes_seqfile_create(fname, "r");
+    tt_int_op(qes_seqfile_read(sf, seq), ==, -7);
+    tt_int_op(qes_seqfile_counters(sf, &counters, NULL), ==, 0);
+    tt_int_op(counters.n_results[7], ==, 1);
+#else
+    tt_int_op(qes_seqfile_counters(sf, &counters, &stats), ==, 1);
+    tt_int_op(counters.n_results[0], ==, 0);
+#endif
+    tt_int_op(qes_seqfile_counters(sf, NULL, NULL), ==, 1);
+end:
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+    if (fname != NULL) free(fname);
+}
+
+static void
+test_qes_seqfile_write_passthrough (void *ptr)
+{
+    struct qes_seqfile *in = NULL;
+    struct qes_seqfile *out = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *fname = NULL;
+    char *outname = NULL;
+    char *crc = NULL;
+    char *expect_crc = NULL;
+    char *got = NULL;
+    char *expect = NULL;
+    const char *files[] = {"test.fastq", "test.fastq.gz"};
+    size_t total = 0;
+    size_t iii = 0;
+    ssize_t res = 0;
+    int pfd[2] = {-1, -1};
+    FILE *fp = NULL;
+
+    (void) ptr;
+    fname = find_data_file("test.fastq");
+    expect_crc = crc32_file(fname);
+    free(fname);
+    fname = NULL;
+    /* Passing every record through gives back the input exactly, whether
+     * it's copied from the buffer, re-read, or reformatted */
+    for (iii = 0; iii < sizeof(files) / sizeof(*files); iii++) {
+        fname = find_data_file(files[iii]);
+        outname = get_writable_file();
+        in = qes_seqfile_create_opts(fname, "r",
+                                     &(struct qes_file_opts){.bufsize = 500});
+        out = qes_seqfile_create(outname, "wT");
+        tt_ptr_op(in, !=, NULL);
+        tt_ptr_op(out, !=, NULL);
+        qes_seqfile_set_format(out, FASTQ_FMT);
+        while ((res = qes_seqfile_read(in, seq)) > 0) {
+            res = qes_seqfile_write_passthrough(out, in, seq);
+            tt_int_op(res, >, 0);
+        }
+        tt_int_op(res, ==, EOF);
+        qes_seqfile_destroy(out);
+        crc = crc32_file(outname);
+        tt_str_op(crc, ==, expect_crc);
+        free(crc);
+        crc = NULL;
+        qes_seqfile_destroy(in);
+        clean_writable_file(outname);
+        outname = NULL;
+        free(fname);
+        fname = NULL;
+    }
+    /* Into a pipe */
+    fname = find_data_file("test.fastq");
+    in = qes_seqfile_create(fname, "r");
+    tt_ptr_op(in, !=, NULL);
+    tt_int_op(pipe(pfd), ==, 0);
+    out = qes_seqfile_dopen(pfd[1], "wT", NULL);
+    pfd[1] = -1;
+    tt_ptr_op(out, !=, NULL);
+    qes_seqfile_set_format(out, FASTQ_FMT);
+    /* Stay well within the pipe's buffer, so we don't block */
+    for (iii = 0; iii < 50; iii++) {
+        tt_int_op(qes_seqfile_read(in, seq), >, 0);
+        tt_int_op(in->rec_len, >, 0);
+        res = qes_seqfile_write_passthrough(out, in, seq);
+        tt_int_op(res, ==, in->rec_len);
+        total += res;
+    }
+    /* A long run of records is spliced */
+    res = qes_file_passthrough(out->qf, in->qf, total, 40000);
+    tt_int_op(res, ==, 40000);
+    total += res;
+    qes_seqfile_destroy(out);
+    got = calloc(total + 1, 1);
+    fp = fdopen(pfd[0], "rb");
+    pfd[0] = -1;
+    tt_int_op(fread(got, 1, total + 1, fp), ==, total);
+    fclose(fp);
+    fp = fopen(fname, "rb");
+    expect = calloc(total + 1, 1);
+    tt_int_op(fread(expect, 1, total, fp), ==, total);
+    tt_str_op(got, ==, expect);
+    fclose(fp);
+    fp = NULL;
+    qes_seqfile_destroy(in);
+    free(fname);
+    fname = NULL;
+    /* Line-wrapped FASTA keeps its wrapping, which writing would lose */
+    fname = find_data_file("test.fasta");
+    outname = get_writable_file();
+    in = qes_seqfile_create(fname, "r");
+    out = qes_seqfile_create(outname, "wT");
+    qes_seqfile_set_format(out, FASTA_FMT);
+    while ((res = qes_seqfile_read(in, seq)) > 0) {
+        tt_int_op(qes_seqfile_write_passthrough(out, in, seq), >, 0);
+    }
+    qes_seqfile_destroy(out);
+    free(expect_crc);
+    expect_crc = crc32_file(fname);
+    crc = crc32_file(outname);
+    tt_str_op(crc, ==, expect_crc);
+    /* Formats must match, or we just write the record */
+    out = qes_seqfile_create(outname, "wT");
+    qes_seqfile_set_format(out, FASTQ_FMT);
+    res = qes_seqfile_write_passthrough(out, in, seq);
+    tt_int_op(res, ==, 1 + seq->name.len + 1 + seq->comment.len + 1 +
+                       seq->seq.len + 1);
+    tt_int_op(qes_seqfile_write_passthrough(NULL, in, seq), ==, -2);
+end:
+    qes_seqfile_destroy(in);
+    qes_seqfile_destroy(out);
+    qes_seq_destroy(seq);
+    if (outname != NULL) clean_writable_file(outname);
+    if (fname != NULL) free(fname);
+    if (fp != NULL) fclose(fp);
+    if (pfd[0] >= 0) close(pfd[0]);
+    if (pfd[1] >= 0) close(pfd[1]);
+    free(crc);
+    free(expect_crc);
+    free(got);
+    free(expect);
+}
+
+static void
+test_qes_seqfile_skip (void *ptr)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqfile *all = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_seq *expect = qes_seq_create();
+    struct qes_file_opts opts;
+    const char *files[] = {"test.fastq", "test.fastq.gz", "test.fasta",
+                           "test.fasta"};
+    const ssize_t n_seqs[] = {1000, 1000, 813, 813};
+    const size_t skips[] = {0, 1, 7, 150, 300};
+    char *fname = NULL;
+    size_t iii = 0;
+    size_t jjj = 0;
+    size_t kkk = 0;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    for (iii = 0; iii < 4; iii++) {
+        fname = find_data_file(files[iii]);
+        /* The last time, records straddle many buffers */
+        opts.bufsize = iii == 3 ? 17 : 0;
+        sf = qes_seqfile_create_opts(fname, "r", &opts);
+        tt_int_op(qes_seqfile_skip(sf, SIZE_MAX), ==, n_seqs[iii]);
+        tt_int_op(sf->n_records, ==, n_seqs[iii]);
+        tt_int_op(qes_seqfile_skip(sf, 10), ==, 0);
+        tt_int_op(qes_seqfile_read(sf, seq), ==, EOF);
+        qes_seqfile_destroy(sf);
+        /* Skipping then reading gets the same records as reading alone */
+        sf = qes_seqfile_create_opts(fname, "r", &opts);
+        all = qes_seqfile_create(fname, "r");
+        for (jjj = 0; jjj < 5; jjj++) {
+            tt_int_op(qes_seqfile_skip(sf, skips[jjj]), ==, skips[jjj]);
+            for (; kkk <= skips[jjj]; kkk++) {
+                tt_int_op(qes_seqfile_read(all, expect), >, 0);
+            }
+            tt_int_op(qes_seqfile_read(sf, seq), >, 0);
+            tt_str_op(seq->name.str, ==, expect->name.str);
+            tt_str_op(seq->seq.str, ==, expect->seq.str);
+            kkk = 0;
+        }
+        tt_int_op(qes_seqfile_skip(sf, SIZE_MAX), ==, n_seqs[iii] - 463);
+        qes_seqfile_destroy(sf);
+        qes_seqfile_destroy(all);
+        free(fname);
+        fname = NULL;
+    }
+    fname = find_data_file("bad_nohdr.fastq");
+    sf = qes_seqfile_create(fname, "r");
+    qes_seqfile_set_format(sf, FASTQ_FMT);
+    tt_int_op(qes_seqfile_skip(sf, 10), ==, -2);
+    tt_int_op(qes_seqfile_skip(NULL, 10), ==, -2);
+end:
+    qes_seqfile_destroy(sf);
+    qes_seqfile_destroy(all);
+    qes_seq_destroy(seq);
+    qes_seq_destroy(expect);
+    free(fname);
+}
+
+static void
+test_qes_seqfile_header (void *ptr)
+{
+    struct qes_seqfile *split = NULL;
+    struct qes_seqfile *lazy = NULL;
+    struct qes_seqfile *skip = NULL;
+    struct qes_seqfile *out = NULL;
+    struct qes_seqbatch *batch = qes_seqbatch_create(64, 0);
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_seq *expect = qes_seq_create();
+    struct qes_seq *copy = qes_seq_create();
+    const struct qes_str *str = NULL;
+    struct qes_str name;
+    struct qes_str comment;
+    const char *files[] = {"test.fastq", "test.fasta"};
+    char *fname = NULL;
+    char *path = get_writable_file();
+    char *expect_buf = NULL;
+    char *got_buf = NULL;
+    size_t expect_len = 0;
+    size_t got_len = 0;
+    size_t n_comments = 0;
+    ssize_t res = 0;
+    size_t iii = 0;
+    size_t jjj = 0;
+
+    (void) ptr;
+    for (iii = 0; iii < 2; iii++) {
+        fname = find_data_file(files[iii]);
+        split = qes_seqfile_create(fname, "r");
+        lazy = qes_seqfile_create(fname, "r");
+        skip = qes_seqfile_create(fname, "r");
+        tt_int_op(qes_seqfile_set_header(lazy, QES_HEADER_LAZY), ==, 0);
+        tt_int_op(qes_seqfile_set_header(skip, QES_HEADER_SKIP), ==, 0);
+        out = qes_seqfile_create(path, "wT");
+        qes_seqfile_set_format(out, split->format);
+        while ((res = qes_seqfile_read(split, expect)) > 0) {
+            /* Lazy headers are whole until split, and written as read */
+            tt_int_op(qes_seqfile_read(lazy, seq), ==, res);
+            tt_int_op(seq->raw_header, ==, 1);
+            tt_int_op(seq->comment.len, ==, 0);
+            tt_int_op(qes_seqfile_write(out, seq), >, 0);
+            qes_seq_peek_header(seq, &name, &comment);
+            tt_int_op(name.len, ==, expect->name.len);
+            tt_int_op(comment.len, ==, expect->comment.len);
+            tt_assert(memcmp(name.str, expect->name.str, name.len) == 0);
+            tt_assert(memcmp(comment.str, expect->comment.str,
+                             comment.len) == 0);
+            tt_int_op(qes_seq_copy(copy, seq), ==, 0);
+            tt_int_op(copy->raw_header, ==, 1);
+            str = qes_seq_name(seq);
+            tt_ptr_op(str, !=, NULL);
+            tt_int_op(seq->raw_header, ==, 0);
+            tt_str_op(str->str, ==, expect->name.str);
+            str = qes_seq_comment(seq);
+            tt_str_op(str->str, ==, expect->comment.str);
+            tt_int_op(qes_seq_split_header(copy), ==, 0);
+            tt_str_op(copy->name.str, ==, expect->name.str);
+            tt_str_op(copy->comment.str, ==, expect->comment.str);
+            n_comments += expect->comment.len > 0;
+            /* Skipped headers are never stored */
+            tt_int_op(qes_seqfile_read(skip, seq), ==, res);
+            tt_int_op(seq->name.len, ==, 0);
+            tt_int_op(seq->comment.len, ==, 0);
+            tt_int_op(seq->raw_header, ==, 0);
+            tt_str_op(seq->seq.str, ==, expect->seq.str);
+            tt_str_op(seq->qual.str, ==, expect->qual.str);
+        }
+        tt_int_op(res, ==, EOF);
+        tt_int_op(qes_seqfile_read(lazy, seq), ==, EOF);
+        tt_int_op(qes_seqfile_read(skip, seq), ==, EOF);
+        tt_int_op(skip->n_records, ==, split->n_records);
+        qes_seqfile_destroy(out);
+        got_buf = read_whole_file(path, &got_len);
+        expect_buf = read_whole_file(fname, &expect_len);
+        tt_ptr_op(got_buf, !=, NULL);
+        /* test.fasta's sequences span many lines, so check FASTQ only */
+        if (iii == 0) {
+            tt_int_op(got_len, ==, expect_len);
+            tt_assert(memcmp(got_buf, expect_buf, got_len) == 0);
+        }
+        free(got_buf);
+        got_buf = NULL;
+        free(expect_buf);
+        expect_buf = NULL;
+        /* Batches split lazy headers */
+        qes_seqfile_destroy(split);
+        qes_seqfile_destroy(lazy);
+        split = qes_seqfile_create(fname, "r");
+        lazy = qes_seqfile_create(fname, "r");
+        qes_seqfile_set_header(lazy, QES_HEADER_LAZY);
+        tt_int_op(qes_seqfile_read_batch(lazy, batch), ==, 64);
+        for (jjj = 0; jjj < 64; jjj++) {
+            tt_int_op(qes_seqfile_read(split, expect), >, 0);
+            tt_int_op(qes_seqbatch_get(batch, jjj, seq), ==, 0);
+            tt_str_op(seq->name.str, ==, expect->name.str);
+            tt_str_op(seq->comment.str, ==, expect->comment.str);
+        }
+        qes_seqfile_destroy(split);
+        qes_seqfile_destroy(lazy);
+        qes_seqfile_destroy(skip);
+        free(fname);
+        fname = NULL;
+    }
+    tt_int_op(n_comments, >, 0);
+    /* Names starting with a delimiter lose it, whether split or peeked */
+    for (iii = 0; iii < 2; iii++) {
+        fname = get_writable_file();
+        out = qes_seqfile_create(fname, "wT");
+        qes_seqfile_set_format(out, iii == 0 ? FASTQ_FMT : FASTA_FMT);
+        tt_int_op(qes_seq_fill(expect, iii == 0 ? "@odd" : ">odd", "c",
+                               "ACGT", "IIII"), ==, 0);
+        tt_int_op(qes_seqfile_write(out, expect), >, 0);
+        tt_int_op(qes_seq_fill(expect, iii == 0 ? ">x" : "@x", "c", "ACGT",
+                               "IIII"), ==, 0);
+        tt_int_op(qes_seqfile_write(out, expect), >, 0);
+        qes_seqfile_destroy(out);
+        split = qes_seqfile_create(fname, "r");
+        lazy = qes_seqfile_create(fname, "r");
+        qes_seqfile_set_header(lazy, QES_HEADER_LAZY);
+        qes_seqbatch_clear(batch);
+        for (jjj = 0; jjj < 2; jjj++) {
+            tt_int_op(qes_seqfile_read(split, expect), >, 0);
+            tt_str_op(expect->name.str, ==, jjj == 0 ? "odd" : "x");
+            tt_int_op(qes_seqfile_read(lazy, seq), >, 0);
+            qes_seq_peek_header(seq, &name, &comment);
+            tt_int_op(name.len, ==, expect->name.len);
+            tt_assert(memcmp(name.str, expect->name.str, name.len) == 0);
+            tt_int_op(comment.len, ==, 1);
+            tt_int_op(qes_seqbatch_add(batch, seq), ==, 0);
+            tt_int_op(qes_seq_split_header(seq), ==, 0);
+            tt_str_op(seq->name.str, ==, expect->name.str);
+            tt_int_op(qes_seqbatch_get(batch, batch->n_seqs - 1, copy), ==,
+                      0);
+            tt_str_op(copy->name.str, ==, expect->name.str);
+        }
+        qes_seqfile_destroy(split);
+        qes_seqfile_destroy(lazy);
+        clean_writable_file(fname);
+        fname = NULL;
+    }
+    tt_int_op(qes_seqfile_set_header(NULL, QES_HEADER_LAZY), ==, 1);
+end:
+    qes_seqfile_destroy(split);
+    qes_seqfile_destroy(lazy);
+    qes_seqfile_destroy(skip);
+    qes_seqfile_destroy(out);
+    qes_seqbatch_destroy(batch);
+    qes_seq_destroy(seq);
+    qes_seq_destroy(expect);
+    qes_seq_destroy(copy);
+    clean_writable_file(path);
+    free(fname);
+    free(got_buf);
+    free(expect_buf);
+}
+
 struct testcase_t qes_seqfile_tests[] = {
     { "qes_seqfile_create", test_qes_seqfile_create, 0, NULL, NULL},
     { "qes_seqfile_guess_format", test_qes_seqfile_guess_format, 0, NULL, NULL},
@@ -376,5 +798,10 @@ struct testcase_t qes_seqfile_tests[] = {
     { "qes_seqfile_read_vs_kseq", test_qes_seqfile_read_vs_kseq, 0, NULL, NULL},
     { "qes_seqfile_read", test_qes_seqfile_read, 0, NULL, NULL},
     { "qes_seqfile_write", test_qes_seqfile_write, 0, NULL, NULL},
+    { "qes_seqfile_create_opts", test_qes_seqfile_create_opts, 0, NULL, NULL},
+    { "qes_seqfile_counters", test_qes_seqfile_counters, 0, NULL, NULL},
+    { "qes_seqfile_write_passthrough", test_qes_seqfile_write_passthrough, 0, NULL, NULL},
+    { "qes_seqfile_skip", test_qes_seqfile_skip, 0, NULL, NULL},
+    { "qes_seqfile_header", test_qes_seqfile_header, 0, NULL, NULL},
     END_OF_TESTCASES
 };
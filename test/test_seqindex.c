@@ -0,0 +1,257 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_seqindex.c
+ *
+ *    Description:  Tests for the qes_seqindex module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 11:32:05
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_seqindex.h>
+
+
+static void
+test_qes_seqindex_build (void *ptr)
+{
+    struct qes_seqindex *idx = NULL;
+    char name[64];
+    size_t iii = 0;
+    const size_t n_names = 10000;
+
+    (void) ptr;
+    idx = qes_seqindex_create();
+    tt_ptr_op(idx, !=, NULL);
+    for (iii = 0; iii < n_names; iii++) {
+        snprintf(name, sizeof(name), "read_%zu", iii);
+        tt_int_op(qes_seqindex_add(idx, name, strlen(name), iii * 100), ==, 0);
+    }
+    /* A duplicate name is only reachable by number */
+    tt_int_op(qes_seqindex_add(idx, "read_0", 6, 42), ==, 0);
+    tt_int_op(idx->n_records, ==, n_names + 1);
+    tt_int_op(qes_seqindex_lookup(idx, "read_0", 6), ==, -1);
+    tt_int_op(qes_seqindex_build(idx), ==, 0);
+    for (iii = 0; iii < n_names; iii++) {
+        snprintf(name, sizeof(name), "read_%zu", iii);
+        tt_int_op(qes_seqindex_lookup(idx, name, strlen(name)), ==, iii);
+    }
+    tt_int_op(qes_seqindex_lookup(idx, "not_a_read", 10), ==, -1);
+    /* Adding a record invalidates the hash */
+    tt_int_op(qes_seqindex_add(idx, "extra", 5, 1), ==, 0);
+    tt_int_op(qes_seqindex_lookup(idx, "extra", 5), ==, -1);
+    tt_int_op(qes_seqindex_build(idx), ==, 0);
+    tt_int_op(qes_seqindex_lookup(idx, "extra", 5), ==, n_names + 1);
+    /* More records of one name than a bucket could hold, if duplicates
+     * counted towards its size */
+    for (iii = 0; iii < 1000; iii++) {
+        tt_int_op(qes_seqindex_add(idx, "dup", 3, iii), ==, 0);
+    }
+    tt_int_op(qes_seqindex_build(idx), ==, 0);
+    tt_int_op(qes_seqindex_lookup(idx, "dup", 3), ==, n_names + 2);
+    tt_int_op(qes_seqindex_lookup(idx, "read_0", 6), ==, 0);
+    tt_int_op(qes_seqindex_lookup(idx, "extra", 5), ==, n_names + 1);
+    /* Bad arguments */
+    tt_int_op(qes_seqindex_add(NULL, "x", 1, 0), ==, 1);
+    tt_int_op(qes_seqindex_add(idx, NULL, 1, 0), ==, 1);
+    tt_int_op(qes_seqindex_lookup(NULL, "x", 1), ==, -1);
+    tt_int_op(qes_seqindex_build(NULL), ==, 1);
+end:
+    qes_seqindex_destroy(idx);
+}
+
+static void
+test_qes_seqfile_fetch (void *ptr)
+{
+    struct qes_seqindex *idx = NULL;
+    struct qes_seqindex *loaded = NULL;
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqfile *fetchsf = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_seq *fetched = qes_seq_create();
+    char *fname = NULL;
+    char *idxname = NULL;
+    char first_name[64] = "";
+    const char *files[] = {"test.fastq", "test.fastq.gz", "test.fasta"};
+    const size_t n_records[] = {1000, 1000, 813};
+    size_t iii = 0;
+    size_t jjj = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    for (jjj = 0; jjj < sizeof(files) / sizeof(*files); jjj++) {
+        /* Index during a normal read pass */
+        fname = find_data_file(files[jjj]);
+        tt_assert(fname != NULL);
+        sf = qes_seqfile_create(fname, "r");
+        idx = qes_seqindex_create();
+        qes_seqfile_set_index(sf, idx);
+        do {
+            res = qes_seqfile_read(sf, seq);
+        } while (res > 0);
+        tt_int_op(res, ==, EOF);
+        tt_int_op(idx->n_records, ==, sf->n_records);
+        tt_int_op(idx->n_records, ==, n_records[jjj]);
+        idxname = get_writable_file();
+        tt_int_op(qes_seqindex_save(idx, idxname), ==, 0);
+        loaded = qes_seqindex_load(idxname);
+        tt_ptr_op(loaded, !=, NULL);
+        tt_int_op(loaded->n_records, ==, idx->n_records);
+        /* Check each record, by number and by name, against a sequential
+         * read of the file */
+        qes_seqfile_destroy(sf);
+        sf = qes_seqfile_create(fname, "r");
+        fetchsf = qes_seqfile_create(fname, "r");
+        iii = 0;
+        while ((res = qes_seqfile_read(sf, seq)) > 0) {
+            tt_int_op(qes_seqfile_fetch(fetchsf, loaded, iii, fetched), ==, res);
+            tt_str_op(fetched->name.str, ==, seq->name.str);
+            tt_str_op(fetched->seq.str, ==, seq->seq.str);
+            tt_int_op(qes_seqindex_lookup(loaded, seq->name.str, seq->name.len),
+                      ==, iii);
+            if (iii == 0) {
+                strncpy(first_name, seq->name.str, sizeof(first_name) - 1);
+            }
+            iii++;
+        }
+        tt_int_op(iii, ==, n_records[jjj]);
+        /* Backwards, by name */
+        tt_int_op(qes_seqfile_fetch_name(fetchsf, loaded, first_name, fetched),
+                  ==, 33);
+        tt_str_op(fetched->name.str, ==, first_name);
+        /* Sequential reads continue after the fetched record */
+        tt_int_op(qes_seqfile_fetch(fetchsf, loaded, iii - 2, fetched), >, 0);
+        tt_int_op(qes_seqfile_read(fetchsf, fetched), >, 0);
+        tt_int_op(qes_seqfile_read(fetchsf, fetched), ==, EOF);
+        /* Missing records */
+        tt_int_op(qes_seqfile_fetch(fetchsf, loaded, iii, fetched), ==, EOF);
+        tt_int_op(qes_seqfile_fetch_name(fetchsf, loaded, "nope", fetched),
+                  ==, EOF);
+        tt_int_op(qes_seqfile_fetch(NULL, loaded, 0, fetched), ==, -2);
+        tt_int_op(qes_seqfile_fetch(fetchsf, NULL, 0, fetched), ==, -2);
+        /* Loaded indices can't be added to */
+        tt_int_op(qes_seqindex_add(loaded, "x", 1, 0), ==, 1);
+        qes_seqfile_destroy(sf);
+        qes_seqfile_destroy(fetchsf);
+        qes_seqindex_destroy(idx);
+        qes_seqindex_destroy(loaded);
+        clean_writable_file(idxname);
+        idxname = NULL;
+        free(fname);
+        fname = NULL;
+    }
+    /* Not an index */
+    fname = find_data_file("test.fastq");
+    tt_ptr_op(qes_seqindex_load(fname), ==, NULL);
+    tt_ptr_op(qes_seqindex_load(NULL), ==, NULL);
+end:
+    qes_seqfile_destroy(sf);
+    qes_seqfile_destroy(fetchsf);
+    qes_seqindex_destroy(idx);
+    qes_seqindex_destroy(loaded);
+    qes_seq_destroy(seq);
+    qes_seq_destroy(fetched);
+    if (idxname != NULL) clean_writable_file(idxname);
+    if (fname != NULL) free(fname);
+}
+
+/* Write ``len`` bytes of ``buf`` over the file ``path`` */
+static int
+write_bytes (const char *path, const uint8_t *buf, size_t len)
+{
+    FILE *fp = fopen(path, "wb");
+    int ret = 0;
+
+    if (fp == NULL) return 1;
+    if (fwrite(buf, 1, len, fp) != len) ret = 1;
+    if (fclose(fp) != 0) ret = 1;
+    return ret;
+}
+
+static void
+test_qes_seqindex_load (void *ptr)
+{
+    struct qes_seqindex *idx = qes_seqindex_create();
+    struct qes_seqindex *loaded = NULL;
+    char *idxname = get_writable_file();
+    uint8_t *buf = NULL;
+    uint64_t value = 0;
+    size_t len = 0;
+    size_t slots_start = 0;
+    size_t iii = 0;
+    char name[64];
+    FILE *fp = NULL;
+
+    (void) ptr;
+    for (iii = 0; iii < 100; iii++) {
+        snprintf(name, sizeof(name), "read_%zu", iii);
+        tt_int_op(qes_seqindex_add(idx, name, strlen(name), iii * 100), ==, 0);
+    }
+    tt_int_op(qes_seqindex_save(idx, idxname), ==, 0);
+    fp = fopen(idxname, "rb");
+    tt_ptr_op(fp, !=, NULL);
+    buf = malloc(1 << 16);
+    len = fread(buf, 1, 1 << 16, fp);
+    fclose(fp);
+    /* Magic, header, offsets, displacements, slots then fingerprints */
+    tt_int_op(len, ==, 32 + 100 * 8 + idx->n_buckets * 4 +
+              idx->n_slots * 12);
+    slots_start = 32 + 100 * 8 + idx->n_buckets * 4;
+    loaded = qes_seqindex_load(idxname);
+    tt_ptr_op(loaded, !=, NULL);
+    qes_seqindex_destroy(loaded);
+    /* Truncated, or with trailing junk */
+    tt_int_op(write_bytes(idxname, buf, len - 1), ==, 0);
+    tt_ptr_op(qes_seqindex_load(idxname), ==, NULL);
+    tt_int_op(write_bytes(idxname, buf, 20), ==, 0);
+    tt_ptr_op(qes_seqindex_load(idxname), ==, NULL);
+    buf[len] = 0;
+    tt_int_op(write_bytes(idxname, buf, len + 1), ==, 0);
+    tt_ptr_op(qes_seqindex_load(idxname), ==, NULL);
+    /* Counts that would overflow, or don't match the file */
+    value = UINT64_MAX;
+    memcpy(buf + 8, &value, sizeof(value));
+    tt_int_op(write_bytes(idxname, buf, len), ==, 0);
+    tt_ptr_op(qes_seqindex_load(idxname), ==, NULL);
+    value = UINT64_MAX / 8 + 2;
+    memcpy(buf + 8, &value, sizeof(value));
+    tt_int_op(write_bytes(idxname, buf, len), ==, 0);
+    tt_ptr_op(qes_seqindex_load(idxname), ==, NULL);
+    value = 99;
+    memcpy(buf + 8, &value, sizeof(value));
+    tt_int_op(write_bytes(idxname, buf, len), ==, 0);
+    tt_ptr_op(qes_seqindex_load(idxname), ==, NULL);
+    value = 100;
+    memcpy(buf + 8, &value, sizeof(value));
+    /* A slot past the last record */
+    memcpy(buf + slots_start, &value, sizeof(value));
+    tt_int_op(write_bytes(idxname, buf, len), ==, 0);
+    tt_ptr_op(qes_seqindex_load(idxname), ==, NULL);
+    value = 99;
+    memcpy(buf + slots_start, &value, sizeof(value));
+    tt_int_op(write_bytes(idxname, buf, len), ==, 0);
+    loaded = qes_seqindex_load(idxname);
+    tt_ptr_op(loaded, !=, NULL);
+end:
+    qes_seqindex_destroy(idx);
+    qes_seqindex_destroy(loaded);
+    clean_writable_file(idxname);
+    free(buf);
+}
+
+
+struct testcase_t qes_seqindex_tests[] = {
+    { "qes_seqindex_build", test_qes_seqindex_build, 0, NULL, NULL},
+    { "qes_seqfile_fetch", test_qes_seqfile_fetch, 0, NULL, NULL},
+    { "qes_seqindex_load", test_qes_seqindex_load, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
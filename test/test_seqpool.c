@@ -0,0 +1,151 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_seqpool.c
+ *
+ *    Description:  Tests for the qes_seqpool module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 14:31:48
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_seqpool.h>
+#ifdef OPENMP_FOUND
+#   include <omp.h>
+#endif
+
+
+static void
+test_qes_seqpool_get_put (void *ptr)
+{
+    struct qes_seqpool *pool = NULL;
+    struct qes_seqpool_cache *cache = NULL;
+    struct qes_seqpool_cache *other = NULL;
+    struct qes_seq *seq = NULL;
+    struct qes_seq *seqs[3 * QES_SEQPOOL_CACHE_LEN];
+    size_t capacity = 0;
+    size_t iii = 0;
+    const size_t n_seqs = sizeof(seqs) / sizeof(*seqs);
+
+    (void) ptr;
+    pool = qes_seqpool_create();
+    tt_ptr_op(pool, !=, NULL);
+    cache = qes_seqpool_cache_create(pool);
+    tt_ptr_op(cache, !=, NULL);
+    /* A returned seq is reused, empty but with its capacity */
+    seq = qes_seqpool_get(cache);
+    tt_assert(qes_seq_ok(seq));
+    tt_int_op(qes_seq_fill(seq, "name", "comment", "ACGT", "IIII"), ==, 0);
+    tt_int_op(qes_str_reserve(&seq->seq, 1000), ==, 0);
+    capacity = seq->seq.capacity;
+    tt_int_op(qes_seqpool_put(cache, seq), ==, 0);
+    tt_ptr_op(qes_seqpool_get(cache), ==, seq);
+    tt_int_op(seq->seq.capacity, ==, capacity);
+    tt_int_op(seq->seq.len, ==, 0);
+    tt_int_op(seq->name.len, ==, 0);
+    tt_int_op(pool->n_created, ==, 1);
+    tt_int_op(qes_seqpool_put(cache, seq), ==, 0);
+    /* An overfull cache gives seqs back to the pool, where another cache
+     * can get them */
+    for (iii = 0; iii < n_seqs; iii++) {
+        seqs[iii] = qes_seqpool_get(cache);
+        tt_assert(qes_seq_ok(seqs[iii]));
+    }
+    tt_int_op(pool->n_created, ==, n_seqs);
+    tt_int_op(cache->len, ==, 0);
+    for (iii = 0; iii < n_seqs; iii++) {
+        tt_int_op(qes_seqpool_put(cache, seqs[iii]), ==, 0);
+        tt_int_op(cache->len, <=, 2 * QES_SEQPOOL_CACHE_LEN);
+    }
+    tt_ptr_op(pool->slots[cache->slot], !=, NULL);
+    other = qes_seqpool_cache_create(pool);
+    seq = qes_seqpool_get(other);
+    tt_ptr_op(seq, !=, NULL);
+    tt_int_op(cache->len + other->len + 1, ==, n_seqs);
+    tt_int_op(pool->n_created, ==, n_seqs);
+    /* Bad arguments */
+    tt_int_op(qes_seqpool_put(NULL, seqs[0]), ==, 1);
+    tt_int_op(qes_seqpool_put(cache, NULL), ==, 1);
+    tt_ptr_op(qes_seqpool_get(NULL), ==, NULL);
+    tt_ptr_op(qes_seqpool_cache_create(NULL), ==, NULL);
+    /* Seqs still out aren't the pool's to free */
+    qes_seq_destroy(seq);
+end:
+    qes_seqpool_cache_destroy(cache);
+    qes_seqpool_cache_destroy(other);
+    qes_seqpool_destroy(pool);
+}
+
+#ifdef OPENMP_FOUND
+static void
+test_qes_seqpool_threads (void *ptr)
+{
+    struct qes_seqpool *pool = NULL;
+    struct qes_seq **seqs = NULL;
+    const int n_threads = 4;
+    const size_t n_each = 1000;
+    const size_t n_rounds = 20;
+    size_t n_bad = 0;
+
+    (void) ptr;
+    pool = qes_seqpool_create();
+    seqs = calloc(n_threads * n_each, sizeof(*seqs));
+    tt_ptr_op(seqs, !=, NULL);
+    /* Each thread gets seqs, and returns those another thread got */
+    #pragma omp parallel num_threads(n_threads) reduction(+:n_bad)
+    {
+        struct qes_seqpool_cache *cache = qes_seqpool_cache_create(pool);
+        int tid = omp_get_thread_num();
+        int nthr = omp_get_num_threads();
+        size_t round = 0;
+        size_t iii = 0;
+        struct qes_seq **mine = NULL;
+
+        for (round = 0; round < n_rounds; round++) {
+            mine = seqs + tid * n_each;
+            for (iii = 0; iii < n_each; iii++) {
+                mine[iii] = qes_seqpool_get(cache);
+                if (!qes_seq_ok(mine[iii]) || mine[iii]->seq.len != 0) {
+                    n_bad++;
+                    continue;
+                }
+                qes_seq_fill_seq(mine[iii], "ACGTACGT", 8);
+            }
+            #pragma omp barrier
+            mine = seqs + ((tid + 1) % nthr) * n_each;
+            for (iii = 0; iii < n_each; iii++) {
+                if (strcmp(mine[iii]->seq.str, "ACGTACGT") != 0) n_bad++;
+                if (qes_seqpool_put(cache, mine[iii]) != 0) n_bad++;
+            }
+            #pragma omp barrier
+        }
+        qes_seqpool_cache_destroy(cache);
+    }
+    tt_int_op(n_bad, ==, 0);
+    /* Steady state does no allocation: only the first round's seqs, plus
+     * those held in other threads' caches, were ever created */
+    tt_int_op(pool->n_created, <=,
+              n_threads * (n_each + 2 * QES_SEQPOOL_CACHE_LEN));
+end:
+    free(seqs);
+    qes_seqpool_destroy(pool);
+}
+#endif
+
+
+struct testcase_t qes_seqpool_tests[] = {
+    { "qes_seqpool_get_put", test_qes_seqpool_get_put, 0, NULL, NULL},
+#ifdef OPENMP_FOUND
+    { "qes_seqpool_threads", test_qes_seqpool_threads, 0, NULL, NULL},
+#endif
+    END_OF_TESTCASES
+};
@@ -0,0 +1,203 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_seqstats.c
+ *
+ *    Description:  Tests for the qes_seqstats module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 21:24:10
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_seqstats.h>
+
+/* Work out the stats of ``fname`` the slow way, reading each record */
+static int
+slow_stats (const char *fname, struct qes_seqstats *stats, size_t copies)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    size_t iii = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->min_len = UINT64_MAX;
+    sf = qes_seqfile_create(fname, "r");
+    if (sf == NULL) return 1;
+    while (qes_seqfile_read(sf, seq) > 0) {
+        stats->n_records += copies;
+        stats->n_bases += seq->seq.len * copies;
+        if (seq->seq.len < stats->min_len) stats->min_len = seq->seq.len;
+        if (seq->seq.len > stats->max_len) stats->max_len = seq->seq.len;
+        for (iii = 0; iii < seq->seq.len; iii++) {
+            stats->n_gc += copies * (toupper(seq->seq.str[iii]) == 'G' ||
+                                     toupper(seq->seq.str[iii]) == 'C');
+        }
+        for (iii = 0; iii < seq->qual.len; iii++) {
+            stats->n_q20 += copies * (seq->qual.str[iii] >= 33 + 20);
+            stats->n_q30 += copies * (seq->qual.str[iii] >= 33 + 30);
+        }
+    }
+    qes_seq_destroy(seq);
+    qes_seqfile_destroy(sf);
+    return 0;
+}
+
+#define check_stats(got, expect)                                            \
+    do {                                                                    \
+        tt_int_op((got)->n_records, ==, (expect)->n_records);               \
+        tt_int_op((got)->n_bases, ==, (expect)->n_bases);                   \
+        tt_int_op((got)->min_len, ==, (expect)->min_len);                   \
+        tt_int_op((got)->max_len, ==, (expect)->max_len);                   \
+        tt_int_op((got)->n_gc, ==, (expect)->n_gc);                         \
+        tt_int_op((got)->n_q20, ==, (expect)->n_q20);                       \
+        tt_int_op((got)->n_q30, ==, (expect)->n_q30);                       \
+    } while (0)
+
+static void
+test_qes_seqfile_stats (void *ptr)
+{
+    struct qes_seqstats *stats = NULL;
+    struct qes_seqstats expect;
+    struct qes_seqstats_opts opts;
+    char *fname = NULL;
+    uint64_t sum = 0;
+    size_t iii = 0;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    fname = find_data_file("test.fastq");
+    tt_int_op(slow_stats(fname, &expect, 1), ==, 0);
+    stats = qes_seqfile_stats(fname, NULL);
+    tt_ptr_op(stats, !=, NULL);
+    tt_int_op(stats->format, ==, FASTQ_FMT);
+    tt_int_op(stats->n_records, ==, 1000);
+    check_stats(stats, &expect);
+    tt_int_op(stats->n50, >=, stats->min_len);
+    tt_int_op(stats->n50, <=, stats->max_len);
+    tt_ptr_op(stats->qual_hist, ==, NULL);
+    qes_seqstats_destroy(stats);
+    /* Quality histogram: every read has a base at position 0 */
+    opts.max_positions = 10;
+    stats = qes_seqfile_stats(fname, &opts);
+    tt_ptr_op(stats, !=, NULL);
+    tt_int_op(stats->n_positions, >=, 10);
+    for (iii = 0; iii < QES_SEQSTATS_N_QUALS; iii++) {
+        sum += stats->qual_hist[iii];
+    }
+    tt_int_op(sum, ==, 1000);
+    sum = 0;
+    for (iii = 10 * QES_SEQSTATS_N_QUALS;
+            iii < stats->n_positions * QES_SEQSTATS_N_QUALS; iii++) {
+        sum += stats->qual_hist[iii];
+    }
+    tt_int_op(sum, ==, 0);
+    qes_seqstats_destroy(stats);
+    free(fname);
+    /* Compressed */
+    fname = find_data_file("test.fastq.gz");
+    opts.n_threads = 4;
+    stats = qes_seqfile_stats(fname, &opts);
+    tt_ptr_op(stats, !=, NULL);
+    check_stats(stats, &expect);
+    qes_seqstats_destroy(stats);
+    free(fname);
+    /* FASTA, with sequence over many lines */
+    fname = find_data_file("test.fasta");
+    tt_int_op(slow_stats(fname, &expect, 1), ==, 0);
+    stats = qes_seqfile_stats(fname, NULL);
+    tt_ptr_op(stats, !=, NULL);
+    tt_int_op(stats->format, ==, FASTA_FMT);
+    check_stats(stats, &expect);
+    tt_int_op(stats->n_q20, ==, 0);
+    qes_seqstats_destroy(stats);
+    free(fname);
+    /* Empty file */
+    fname = find_data_file("empty.txt");
+    stats = qes_seqfile_stats(fname, NULL);
+    tt_ptr_op(stats, !=, NULL);
+    tt_int_op(stats->n_records, ==, 0);
+    tt_int_op(stats->min_len, ==, 0);
+    qes_seqstats_destroy(stats);
+    free(fname);
+    /* Bad files */
+    fname = find_data_file("empty.fastq");
+    tt_ptr_op(qes_seqfile_stats(fname, NULL), ==, NULL);
+    free(fname);
+    fname = find_data_file("bad_diff_lens.fastq");
+    tt_ptr_op(qes_seqfile_stats(fname, NULL), ==, NULL);
+    free(fname);
+    fname = find_data_file("loremipsum.txt");
+    tt_ptr_op(qes_seqfile_stats(fname, NULL), ==, NULL);
+    tt_ptr_op(qes_seqfile_stats(NULL, NULL), ==, NULL);
+end:
+    qes_seqstats_destroy(stats);
+    free(fname);
+}
+
+static void
+test_qes_seqfile_stats_parallel (void *ptr)
+{
+    struct qes_seqstats *stats = NULL;
+    struct qes_seqstats *serial = NULL;
+    struct qes_seqstats expect;
+    struct qes_seqstats_opts opts;
+    char *fname = find_data_file("test.fastq");
+    char *big = get_writable_file();
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp = NULL;
+    size_t iii = 0;
+    unsigned n_threads = 0;
+
+    (void) ptr;
+    /* Big enough to be split into chunks */
+    memset(&opts, 0, sizeof(opts));
+    tt_int_op(slow_stats(fname, &expect, 20), ==, 0);
+    buf = read_whole_file(fname, &len);
+    tt_ptr_op(buf, !=, NULL);
+    fp = fopen(big, "w");
+    for (iii = 0; iii < 20; iii++) {
+        tt_int_op(fwrite(buf, 1, len, fp), ==, len);
+    }
+    fclose(fp);
+    fp = NULL;
+    opts.max_positions = 1000;
+    serial = qes_seqfile_stats(big, &opts);
+    tt_ptr_op(serial, !=, NULL);
+    check_stats(serial, &expect);
+    for (n_threads = 2; n_threads <= 16; n_threads += 7) {
+        opts.n_threads = n_threads;
+        stats = qes_seqfile_stats(big, &opts);
+        tt_ptr_op(stats, !=, NULL);
+        check_stats(stats, &expect);
+        tt_int_op(stats->n50, ==, serial->n50);
+        tt_int_op(stats->n_positions, ==, serial->n_positions);
+        tt_int_op(memcmp(stats->qual_hist, serial->qual_hist,
+                         serial->n_positions * QES_SEQSTATS_N_QUALS *
+                         sizeof(*serial->qual_hist)), ==, 0);
+        qes_seqstats_destroy(stats);
+    }
+end:
+    if (fp != NULL) fclose(fp);
+    qes_seqstats_destroy(stats);
+    qes_seqstats_destroy(serial);
+    clean_writable_file(big);
+    free(buf);
+    free(fname);
+}
+
+struct testcase_t qes_seqstats_tests[] = {
+    { "qes_seqfile_stats", test_qes_seqfile_stats, 0, NULL, NULL},
+    { "qes_seqfile_stats_parallel", test_qes_seqfile_stats_parallel, 0, NULL,
+      NULL},
+    END_OF_TESTCASES
+};
@@ -50,7 +50,41 @@ end:
     if (cdn != NULL) free(cdn);
 }
 
+static void
+test_qes_sequtil_revcomp (void *ptr)
+{
+    char *rc = NULL;
+    char buf[16] = "";
+
+    (void) ptr;
+    rc = qes_sequtil_revcomp("AACGTTTC", 0);
+    tt_str_op(rc, ==, "GAAACGTT");
+    free(rc);
+    /* Odd lengths, case, non-bases and trailing whitespace */
+    rc = qes_sequtil_revcomp("acgXt\n", 0);
+    tt_str_op(rc, ==, "ANCGT");
+    free(rc);
+    /* Only the first len chars */
+    rc = qes_sequtil_revcomp("AAAACCCC", 4);
+    tt_str_op(rc, ==, "TTTT");
+    free(rc);
+    rc = qes_sequtil_revcomp("", 0);
+    tt_str_op(rc, ==, "");
+    free(rc);
+    rc = NULL;
+    tt_ptr_op(qes_sequtil_revcomp(NULL, 0), ==, NULL);
+    /* In place, twice is a no-op */
+    strcpy(buf, "GATTACA");
+    qes_sequtil_revcomp_inplace(buf, strlen(buf));
+    tt_str_op(buf, ==, "TGTAATC");
+    qes_sequtil_revcomp_inplace(buf, sizeof(buf));
+    tt_str_op(buf, ==, "GATTACA");
+end:
+    if (rc != NULL) free(rc);
+}
+
 struct testcase_t qes_sequtil_tests[] = {
     { "qes_sequtil_translate_codon", test_qes_sequtil_translate_codon, 0, NULL, NULL},
+    { "qes_sequtil_revcomp", test_qes_sequtil_revcomp, 0, NULL, NULL},
     END_OF_TESTCASES
 };
@@ -0,0 +1,226 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_sort.c
+ *
+ *    Description:  Tests for the qes_sort module
+ *
+ *        Version:  1.0
+ *        Created:  20/10/26 00:51:09
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_sort.h>
+
+/* Sort ``fname`` to a new file, and return its contents */
+static char *
+sort_to_buf (const char *fname, const struct qes_sort_opts *opts,
+             size_t *len)
+{
+    struct qes_seqfile *in = qes_seqfile_create(fname, "r");
+    struct qes_seqfile *out = NULL;
+    char *path = get_writable_file();
+    char *buf = NULL;
+    int res = 0;
+
+    out = qes_seqfile_create(path, "wT");
+    res = qes_sort_file(in, out, opts);
+    qes_seqfile_destroy(in);
+    qes_seqfile_destroy(out);
+    if (res == 0) buf = read_whole_file(path, len);
+    clean_writable_file(path);
+    return buf;
+}
+
+/* Compare keys up to the end of their word */
+static int
+key_cmp (const char *key1, const char *key2)
+{
+    size_t len1 = strcspn(key1, " \n");
+    size_t len2 = strcspn(key2, " \n");
+    int res = memcmp(key1, key2, len1 < len2 ? len1 : len2);
+
+    if (res != 0) return res;
+    return (len1 > len2) - (len1 < len2);
+}
+
+/* Check records of ``buf`` are in order, and as many as in ``fname`` */
+static int
+check_sorted (const char *buf, size_t len, const char *fname,
+              enum qes_sort_key key)
+{
+    struct qes_seqfile *sf = qes_seqfile_create(fname, "r");
+    struct qes_seq *seq = qes_seq_create();
+    const char *iter = buf;
+    const char *prev = NULL;
+    const char *cur = NULL;
+    size_t n_seqs = 0;
+    size_t n_lines = 0;
+    size_t lines_per_rec = sf->format == FASTQ_FMT ? 4 : 2;
+    size_t line = key == QES_SORT_NAME ? 0 : 1;
+    int ret = 1;
+
+    while (qes_seqfile_read(sf, seq) > 0) n_seqs++;
+    for (iter = buf; iter < buf + len; iter = strchr(iter, '\n') + 1) {
+        if (n_lines++ % lines_per_rec != line) continue;
+        cur = iter + (line == 0);
+        if (prev != NULL && key != QES_SORT_MINIMIZER &&
+                key_cmp(prev, cur) > 0) {
+            goto end;
+        }
+        prev = cur;
+    }
+    if (n_lines != n_seqs * lines_per_rec) goto end;
+    ret = 0;
+end:
+    qes_seqfile_destroy(sf);
+    qes_seq_destroy(seq);
+    return ret;
+}
+
+static void
+test_qes_sort_file (void *ptr)
+{
+    struct qes_sort_opts opts;
+    char *fname = NULL;
+    char *expect = NULL;
+    char *got = NULL;
+    size_t expect_len = 0;
+    size_t got_len = 0;
+    const char *files[] = {"test.fastq", "test.fasta"};
+    size_t iii = 0;
+
+    (void) ptr;
+    for (iii = 0; iii < 2; iii++) {
+        fname = find_data_file(files[iii]);
+        memset(&opts, 0, sizeof(opts));
+        for (opts.key = QES_SORT_NAME; opts.key <= QES_SORT_MINIMIZER;
+                opts.key++) {
+            /* All in memory */
+            opts.mem_budget = 0;
+            opts.n_threads = 1;
+            opts.max_fanin = 0;
+            opts.level = 0;
+            expect = sort_to_buf(fname, &opts, &expect_len);
+            tt_ptr_op(expect, !=, NULL);
+            tt_int_op(check_sorted(expect, expect_len, fname, opts.key), ==,
+                      0);
+            /* Many runs, merged in many passes, is the same sort */
+            opts.mem_budget = 16 << 10;
+            opts.n_threads = 3;
+            opts.max_fanin = 3;
+            got = sort_to_buf(fname, &opts, &got_len);
+            tt_ptr_op(got, !=, NULL);
+            tt_int_op(got_len, ==, expect_len);
+            tt_assert(memcmp(got, expect, got_len) == 0);
+            free(got);
+            /* With uncompressed runs, merged in one pass */
+            opts.max_fanin = 1000;
+            opts.level = -1;
+            got = sort_to_buf(fname, &opts, &got_len);
+            tt_ptr_op(got, !=, NULL);
+            tt_int_op(got_len, ==, expect_len);
+            tt_assert(memcmp(got, expect, got_len) == 0);
+            free(got);
+            got = NULL;
+            free(expect);
+            expect = NULL;
+        }
+        free(fname);
+        fname = NULL;
+    }
+end:
+    free(fname);
+    free(expect);
+    free(got);
+}
+
+static void
+test_qes_sorter (void *ptr)
+{
+    struct qes_sorter *sorter = NULL;
+    struct qes_sort_opts opts;
+    struct qes_seqfile *out = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    char *path = get_writable_file();
+    char *buf = NULL;
+    size_t len = 0;
+    size_t iii = 0;
+    const char *seqs[] = {"TTTT", "AAAA", "ACGT", "AAAA", "AAA"};
+    const char *quals[] = {"IIII", "IIII", "IIII", "IIII", "III"};
+    const char *expect = "@r4\nAAA\n+\nIII\n@r1\nAAAA\n+\nIIII\n"
+                         "@r3 c\nAAAA\n+\nIIII\n@r2\nACGT\n+\nIIII\n"
+                         "@r0\nTTTT\n+\nIIII\n";
+    char name[4];
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    opts.key = QES_SORT_SEQ;
+    opts.mem_budget = 64;
+    sorter = qes_sorter_create(&opts);
+    tt_ptr_op(sorter, !=, NULL);
+    /* Stable, even when every record is its own run */
+    for (iii = 0; iii < 5; iii++) {
+        memcpy(name, "r0", 3);
+        name[1] += iii;
+        tt_int_op(qes_seq_fill(seq, name, "c", seqs[iii], quals[iii]), ==,
+                  0);
+        if (iii != 3) qes_str_nullify(&seq->comment);
+        tt_int_op(qes_sorter_add(sorter, seq), ==, 0);
+    }
+    tt_int_op(sorter->n_runs, ==, 5);
+    out = qes_seqfile_create(path, "wT");
+    tt_int_op(qes_sorter_finish(sorter, out), ==, 0);
+    tt_int_op(out->format, ==, FASTQ_FMT);
+    qes_seqfile_destroy(out);
+    buf = read_whole_file(path, &len);
+    tt_str_op(buf, ==, expect);
+    /* Nothing is left, so the sorter is reusable */
+    tt_int_op(sorter->n_runs, ==, 0);
+    free(buf);
+    buf = NULL;
+    out = qes_seqfile_create(path, "wT");
+    tt_int_op(qes_sorter_add(sorter, seq), ==, 0);
+    tt_int_op(qes_sorter_finish(sorter, out), ==, 0);
+    qes_seqfile_destroy(out);
+    buf = read_whole_file(path, &len);
+    tt_str_op(buf, ==, "@r4\nAAA\n+\nIII\n");
+    /* FASTQ records need qualities */
+    qes_str_nullify(&seq->qual);
+    tt_int_op(qes_sorter_add(sorter, seq), ==, 1);
+    tt_assert(strstr(qes_sorter_error(sorter), "qualities") != NULL);
+    qes_sorter_destroy(sorter);
+    tt_ptr_op(sorter, ==, NULL);
+    /* Spilling somewhere we can't */
+    opts.tmp_dir = "/nonexistent/dir";
+    sorter = qes_sorter_create(&opts);
+    tt_int_op(qes_seq_fill(seq, "r", "c", "ACGT", "IIII"), ==, 0);
+    tt_int_op(qes_sorter_add(sorter, seq), ==, 1);
+    tt_assert(strstr(qes_sorter_error(sorter), "/nonexistent") != NULL);
+    qes_sorter_destroy(sorter);
+    opts.minimizer_k = 33;
+    tt_ptr_op(qes_sorter_create(&opts), ==, NULL);
+    tt_int_op(qes_sorter_add(NULL, seq), ==, 1);
+    tt_int_op(qes_sort_file(NULL, NULL, NULL), ==, 1);
+    tt_str_op(qes_sorter_error(NULL), ==, "BAD FILE");
+end:
+    qes_sorter_destroy(sorter);
+    qes_seqfile_destroy(out);
+    qes_seq_destroy(seq);
+    clean_writable_file(path);
+    free(buf);
+}
+
+struct testcase_t qes_sort_tests[] = {
+    { "qes_sort_file", test_qes_sort_file, 0, NULL, NULL},
+    { "qes_sorter", test_qes_sorter, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
@@ -0,0 +1,247 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  test_trim.c
+ *
+ *    Description:  Tests for the qes_trim module
+ *
+ *        Version:  1.0
+ *        Created:  19/10/26 22:14:40
+ *       Revision:  none
+ *        License:  GPLv3+
+ *       Compiler:  gcc, clang
+ *
+ *         Author:  Kevin Murray, spam@kdmurray.id.au
+ *
+ * ============================================================================
+ */
+
+#include "tests.h"
+
+#include <qes_trim.h>
+
+static void
+test_qes_trim_kernels (void *ptr)
+{
+    (void) ptr;
+    /* 'I' is Q40, '#' is Q2, '5' is Q20 */
+    tt_int_op(qes_trim_qual_mott("IIIII##", 7, 20), ==, 5);
+    tt_int_op(qes_trim_qual_mott("IIIII", 5, 20), ==, 5);
+    tt_int_op(qes_trim_qual_mott("#####", 5, 20), ==, 0);
+    /* One good base doesn't outweigh the bad ones around it */
+    tt_int_op(qes_trim_qual_mott("IIII##I##", 9, 20), ==, 4);
+    tt_int_op(qes_trim_qual_mott("IIII#I##", 8, 20), ==, 6);
+    /* But a good run after a bad base is kept */
+    tt_int_op(qes_trim_qual_mott("II#IIIII", 8, 20), ==, 8);
+    tt_int_op(qes_trim_qual_mott("", 0, 20), ==, 0);
+    tt_int_op(qes_trim_qual_mott(NULL, 4, 20), ==, 4);
+    tt_int_op(qes_trim_qual_window("IIIII##", 7, 2, 20), ==, 5);
+    tt_int_op(qes_trim_qual_window("I#I#I#I", 7, 2, 20), ==, 7);
+    tt_int_op(qes_trim_qual_window("I#I#I#I", 7, 1, 20), ==, 1);
+    tt_int_op(qes_trim_qual_window("55555", 5, 4, 20), ==, 5);
+    tt_int_op(qes_trim_qual_window("5555#", 5, 4, 20), ==, 1);
+    /* Shorter than the window */
+    tt_int_op(qes_trim_qual_window("I#", 2, 10, 20), ==, 2);
+    tt_int_op(qes_trim_qual_window("##", 2, 10, 20), ==, 0);
+    tt_int_op(qes_trim_qual_window("##", 2, 0, 20), ==, 2);
+    tt_int_op(qes_trim_ns("ACGTNNn", 7), ==, 4);
+    tt_int_op(qes_trim_ns("NACGT", 5), ==, 5);
+    tt_int_op(qes_trim_ns("NNN", 3), ==, 0);
+end:
+    ;
+}
+
+static void
+test_qes_trim_seq (void *ptr)
+{
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_trim_opts opts;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    tt_int_op(qes_seq_fill(seq, "r", "c", "ACGTACGNN", "IIIIIII##"), ==, 0);
+    /* Nothing to do */
+    tt_int_op(qes_trim_seq(seq, &opts), ==, 0);
+    tt_int_op(seq->seq.len, ==, 9);
+    opts.trim_ns = 1;
+    tt_int_op(qes_trim_seq(seq, &opts), ==, 2);
+    tt_str_op(seq->seq.str, ==, "ACGTACG");
+    tt_str_op(seq->qual.str, ==, "IIIIIII");
+    tt_int_op(seq->qual.len, ==, 7);
+    tt_int_op(qes_seq_fill(seq, "r", "c", "ACGTACGTA", "IIIII5#5#"), ==, 0);
+    opts.mott_cutoff = 20;
+    tt_int_op(qes_trim_seq(seq, &opts), ==, 3);
+    tt_str_op(seq->seq.str, ==, "ACGTAC");
+    tt_str_op(seq->qual.str, ==, "IIIII5");
+    /* No qualities, so only Ns are trimmed */
+    tt_int_op(qes_seq_fill_seq(seq, "ACGTNN", 6), ==, 0);
+    tt_int_op(qes_str_nullify(&seq->qual), ==, 0);
+    tt_int_op(qes_trim_seq(seq, &opts), ==, 2);
+    tt_str_op(seq->seq.str, ==, "ACGT");
+    /* Mismatched lengths */
+    tt_int_op(qes_seq_fill_qual(seq, "II", 2), ==, 0);
+    tt_int_op(qes_trim_seq(seq, &opts), ==, -1);
+    tt_int_op(qes_trim_seq(NULL, &opts), ==, -1);
+    tt_int_op(qes_trim_seq(seq, NULL), ==, -1);
+end:
+    qes_seq_destroy(seq);
+}
+
+static void
+test_qes_trim_adapter (void *ptr)
+{
+    const char *adapter = "AGATCGGAAGAGC";
+    struct qes_trim_opts opts;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    tt_int_op(qes_trim_adapter("ACGTACGTACAGATCGGAAGAGCTTT", 26, adapter, 13,
+                               &opts), ==, 10);
+    /* Partial adapters, at the end of the read only */
+    tt_int_op(qes_trim_adapter("ACGTACGTACAGATC", 15, adapter, 13, &opts),
+              ==, 10);
+    tt_int_op(qes_trim_adapter("AGATCACGTACGTAC", 15, adapter, 13, &opts),
+              ==, 15);
+    tt_int_op(qes_trim_adapter("ACGTACGTACAGA", 13, adapter, 13, &opts),
+              ==, 10);
+    tt_int_op(qes_trim_adapter("ACGTACGTACAG", 12, adapter, 13, &opts),
+              ==, 12);
+    opts.min_overlap = 2;
+    tt_int_op(qes_trim_adapter("ACGTACGTACAG", 12, adapter, 13, &opts),
+              ==, 10);
+    /* Mismatches */
+    tt_int_op(qes_trim_adapter("ACGTACGTACAGATCGGTAGAGC", 23, adapter, 13,
+                               &opts), ==, 23);
+    opts.max_mismatch_rate = 0.1;
+    tt_int_op(qes_trim_adapter("ACGTACGTACAGATCGGTAGAGC", 23, adapter, 13,
+                               &opts), ==, 10);
+    tt_int_op(qes_trim_adapter("ACGTACGTACAGTTCGGTAGAGC", 23, adapter, 13,
+                               &opts), ==, 23);
+    /* The whole read */
+    tt_int_op(qes_trim_adapter("AGATCGGAAGAGC", 13, adapter, 13, &opts),
+              ==, 0);
+    tt_int_op(qes_trim_adapter("ACGT", 4, NULL, 13, &opts), ==, 4);
+end:
+    ;
+}
+
+static void
+test_qes_trim_pair (void *ptr)
+{
+    const char *insert = "ACGTTGCAAGGCTTACGATCG";
+    const char *adapter1 = "AGATCGGAAGAGCACACGTCTGAACTCCAGTCA";
+    const char *adapter2 = "AGATCGGAAGAGCGTCGTGTAGGGAAAGAGTGT";
+    struct qes_seq *seq1 = qes_seq_create();
+    struct qes_seq *seq2 = qes_seq_create();
+    struct qes_trim_opts opts;
+    char read1[31];
+    char read2[31];
+    char *rc = qes_sequtil_revcomp(insert, 0);
+    char qual[31];
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    memset(qual, 'I', 30);
+    qual[30] = '\0';
+    /* A 21 base insert, read through into 9 bases of adapter */
+    tt_ptr_op(rc, !=, NULL);
+    memcpy(read1, insert, 21);
+    memcpy(read1 + 21, adapter1, 9);
+    memcpy(read2, rc, 21);
+    memcpy(read2 + 21, adapter2, 9);
+    read1[30] = read2[30] = '\0';
+    tt_int_op(qes_trim_mate_overlap(read1, 30, read2, 30, &opts), ==, 21);
+    tt_int_op(qes_trim_mate_overlap(read1, 30, read1, 30, &opts), ==, 0);
+    tt_int_op(qes_seq_fill(seq1, "r", "c", read1, qual), ==, 0);
+    tt_int_op(qes_seq_fill(seq2, "r", "c", read2, qual), ==, 0);
+    tt_int_op(qes_trim_pair(seq1, seq2, &opts), ==, 18);
+    tt_str_op(seq1->seq.str, ==, insert);
+    tt_str_op(seq2->seq.str, ==, rc);
+    tt_int_op(seq2->qual.len, ==, 21);
+    /* A mismatch in the overlap */
+    read2[3] = read2[3] == 'A' ? 'C' : 'A';
+    tt_int_op(qes_trim_mate_overlap(read1, 30, read2, 30, &opts), ==, 0);
+    opts.max_mismatch_rate = 0.1;
+    tt_int_op(qes_trim_mate_overlap(read1, 30, read2, 30, &opts), ==, 21);
+    /* Too short an overlap to be sure of, but the adapters are found */
+    opts.min_mate_overlap = 25;
+    opts.adapter = adapter1;
+    opts.adapter2 = adapter2;
+    tt_int_op(qes_seq_fill(seq1, "r", "c", read1, qual), ==, 0);
+    tt_int_op(qes_seq_fill(seq2, "r", "c", read2, qual), ==, 0);
+    tt_int_op(qes_trim_pair(seq1, seq2, &opts), ==, 18);
+    tt_str_op(seq1->seq.str, ==, insert);
+    tt_int_op(seq2->seq.len, ==, 21);
+    tt_int_op(qes_trim_pair(seq1, NULL, &opts), ==, -1);
+end:
+    qes_seq_destroy(seq1);
+    qes_seq_destroy(seq2);
+    free(rc);
+}
+
+static void
+test_qes_trim_batch (void *ptr)
+{
+    struct qes_seqfile *sf = NULL;
+    struct qes_seqbatch *batch = NULL;
+    struct qes_seq *seq = qes_seq_create();
+    struct qes_trim_opts opts;
+    char *fname = find_data_file("test.fastq");
+    size_t stride = 0;
+    size_t iii = 0;
+    ssize_t trimmed = 0;
+    ssize_t expect = 0;
+    ssize_t res = 0;
+
+    (void) ptr;
+    memset(&opts, 0, sizeof(opts));
+    opts.mott_cutoff = 25;
+    opts.window_len = 4;
+    opts.window_cutoff = 15;
+    opts.trim_ns = 1;
+    /* Packed, and with a fixed stride */
+    for (stride = 0; stride <= 512; stride += 512) {
+        batch = qes_seqbatch_create(100, stride);
+        sf = qes_seqfile_create(fname, "r");
+        tt_ptr_op(sf, !=, NULL);
+        trimmed = expect = 0;
+        while ((res = qes_seqfile_read_batch(sf, batch)) > 0) {
+            res = qes_trim_batch(batch, &opts);
+            tt_int_op(res, >=, 0);
+            trimmed += res;
+            /* Each record was trimmed as qes_trim_seq would */
+            for (iii = 0; iii < batch->n_seqs; iii++) {
+                tt_int_op(qes_seqbatch_get(batch, iii, seq), ==, 0);
+                tt_int_op(seq->seq.len, ==, strlen(seq->seq.str));
+                tt_int_op(seq->qual.len, ==, seq->seq.len);
+                tt_int_op(qes_trim_seq(seq, &opts), ==, 0);
+            }
+        }
+        tt_int_op(res, ==, EOF);
+        qes_seqfile_destroy(sf);
+        /* And the total is the same */
+        sf = qes_seqfile_create(fname, "r");
+        while (qes_seqfile_read(sf, seq) > 0) {
+            expect += qes_trim_seq(seq, &opts);
+        }
+        tt_int_op(trimmed, ==, expect);
+        tt_int_op(trimmed, >, 0);
+        qes_seqfile_destroy(sf);
+        qes_seqbatch_destroy(batch);
+    }
+    tt_int_op(qes_trim_batch(NULL, &opts), ==, -1);
+end:
+    qes_seqfile_destroy(sf);
+    qes_seqbatch_destroy(batch);
+    qes_seq_destroy(seq);
+    free(fname);
+}
+
+struct testcase_t qes_trim_tests[] = {
+    { "qes_trim_kernels", test_qes_trim_kernels, 0, NULL, NULL},
+    { "qes_trim_seq", test_qes_trim_seq, 0, NULL, NULL},
+    { "qes_trim_adapter", test_qes_trim_adapter, 0, NULL, NULL},
+    { "qes_trim_pair", test_qes_trim_pair, 0, NULL, NULL},
+    { "qes_trim_batch", test_qes_trim_batch, 0, NULL, NULL},
+    END_OF_TESTCASES
+};
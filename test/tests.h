@@ -58,5 +58,41 @@ extern struct testcase_t qes_seqfile_tests[];
 extern struct testcase_t qes_seq_tests[];
 /* test_sequtil tests */
 extern struct testcase_t qes_sequtil_tests[];
+/* test_seqindex tests */
+extern struct testcase_t qes_seqindex_tests[];
+/* test_arena tests */
+extern struct testcase_t qes_arena_tests[];
+/* test_seqpool tests */
+extern struct testcase_t qes_seqpool_tests[];
+/* test_seqbatch tests */
+extern struct testcase_t qes_seqbatch_tests[];
+/* test_compress tests */
+extern struct testcase_t qes_compress_tests[];
+/* test_aio tests */
+extern struct testcase_t qes_aio_tests[];
+/* test_pairedfile tests */
+extern struct testcase_t qes_pairedfile_tests[];
+/* test_seqstats tests */
+extern struct testcase_t qes_seqstats_tests[];
+/* test_trim tests */
+extern struct testcase_t qes_trim_tests[];
+/* test_demux tests */
+extern struct testcase_t qes_demux_tests[];
+/* test_dedup tests */
+extern struct testcase_t qes_dedup_tests[];
+/* test_sort tests */
+extern struct testcase_t qes_sort_tests[];
+/* test_sample tests */
+extern struct testcase_t qes_sample_tests[];
+/* test_nameset tests */
+extern struct testcase_t qes_nameset_tests[];
+/* test_illumina tests */
+extern struct testcase_t qes_illumina_tests[];
+/* test_binseq tests */
+extern struct testcase_t qes_binseq_tests[];
+/* test_qual tests */
+extern struct testcase_t qes_qual_tests[];
+/* test_merge tests */
+extern struct testcase_t qes_merge_tests[];
 
 #endif /* TESTS_H */